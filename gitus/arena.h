@@ -0,0 +1,191 @@
+#ifndef GITUS_ARENA_H
+#define GITUS_ARENA_H
+
+#include <vector>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+
+
+// Monotonic memory for the short lived buffers of a command
+//
+// Every thread has its own arena. An 'ArenaScope' is opened at command and task boundaries
+// ('main', 'BatchCommand', 'GitusDaemon::Serve', 'ThreadPool' workers): allocations only bump
+// a pointer, and everything allocated inside the scope is released at once when it ends.
+// The chunks are kept for the next scope, so warm commands do not reach the global allocator
+// for their scratch buffers.
+//
+// Only function local 'ScratchData' may use the arena, nothing allocated from it may outlive
+// the scope it was allocated in.
+class Arena {
+
+public:
+	// Larger buffers go to the global allocator, so that a thread does not keep them forever
+	static const size_t MaxAllocation = 4 * 1024 * 1024;
+
+	struct Mark
+	{
+		size_t chunk;
+		size_t offset;
+	};
+
+private:
+	static const size_t MinChunkSize = 64 * 1024;
+
+	struct Chunk
+	{
+		char* data;
+		size_t size;
+	};
+
+	std::vector<Chunk> _chunks;
+	size_t _chunk = 0;
+	size_t _offset = 0;
+	int _depth = 0;
+
+	static Arena& Local()
+	{
+		thread_local Arena arena;
+		return arena;
+	}
+
+	friend class ArenaScope;
+
+public:
+
+	Arena() = default;
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	~Arena()
+	{
+		for (auto& chunk : _chunks)
+			::operator delete(chunk.data);
+	}
+
+	// The arena of the thread, nullptr outside of a scope
+	static Arena* Current()
+	{
+		auto& arena = Local();
+		return arena._depth > 0 ? &arena : nullptr;
+	}
+
+	void* Allocate(size_t size, size_t alignment)
+	{
+		while (true)
+		{
+			if (_chunk < _chunks.size())
+			{
+				auto& chunk = _chunks[_chunk];
+				auto offset = (_offset + alignment - 1) & ~(alignment - 1);
+				if (offset + size <= chunk.size)
+				{
+					_offset = offset + size;
+					return chunk.data + offset;
+				}
+
+				// Chunks left by a previous scope are reused when they are large enough
+				if (_chunk + 1 < _chunks.size() && _chunks[_chunk + 1].size >= size + alignment)
+				{
+					_chunk++;
+					_offset = 0;
+					continue;
+				}
+			}
+
+			auto previousSize = _chunks.empty() ? 0 : _chunks.back().size;
+			auto chunkSize = std::max(std::max(MinChunkSize, previousSize * 2), size + alignment);
+			Chunk chunk = { static_cast<char*>(::operator new(chunkSize)), chunkSize };
+
+			auto position = _chunks.empty() ? 0 : _chunk + 1;
+			_chunks.insert(_chunks.begin() + position, chunk);
+			_chunk = position;
+			_offset = 0;
+		}
+	}
+
+	Mark Position() const
+	{
+		return Mark{ _chunk, _offset };
+	}
+
+	void Rewind(const Mark& mark)
+	{
+		_chunk = mark.chunk;
+		_offset = mark.offset;
+	}
+};
+
+// Everything allocated from the arena of the thread while the scope is alive is released with it
+class ArenaScope {
+
+private:
+	Arena& _arena;
+	Arena::Mark _mark;
+
+public:
+	ArenaScope() : _arena(Arena::Local())
+	{
+		_mark = _arena.Position();
+		_arena._depth++;
+	}
+
+	~ArenaScope()
+	{
+		_arena._depth--;
+		_arena.Rewind(_mark);
+	}
+
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope& operator=(const ArenaScope&) = delete;
+};
+
+// Allocates from the arena current when the container was created, or from the heap outside of a scope
+template <typename T>
+struct ArenaAllocator
+{
+	typedef T value_type;
+
+	Arena* arena;
+
+	ArenaAllocator() : arena(Arena::Current()) {}
+
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t n)
+	{
+		auto size = n * sizeof(T);
+		if (arena != nullptr && size <= Arena::MaxAllocation)
+			return static_cast<T*>(arena->Allocate(size, alignof(T)));
+
+		return static_cast<T*>(::operator new(size));
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		// Arena memory is only released with its scope
+		if (arena != nullptr && n * sizeof(T) <= Arena::MaxAllocation)
+			return;
+
+		::operator delete(p);
+	}
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const
+	{
+		return arena == other.arena;
+	}
+
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const
+	{
+		return arena != other.arena;
+	}
+};
+
+// For buffers which do not leave the function creating them
+typedef std::vector<unsigned char, ArenaAllocator<unsigned char>> ScratchData;
+
+
+#endif
@@ -0,0 +1,41 @@
+#include <cstdlib>
+#include <new>
+
+#include "allocations.h"
+
+std::atomic<size_t> Allocations::Count(0);
+std::atomic<size_t> Allocations::Bytes(0);
+
+void* operator new(size_t size)
+{
+	Allocations::Count.fetch_add(1, std::memory_order_relaxed);
+	Allocations::Bytes.fetch_add(size, std::memory_order_relaxed);
+	if (void* p = std::malloc(size == 0 ? 1 : size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	std::free(p);
+}
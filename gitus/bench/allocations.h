@@ -0,0 +1,15 @@
+#ifndef GITUS_BENCH_ALLOCATIONS_H
+#define GITUS_BENCH_ALLOCATIONS_H
+
+#include <atomic>
+#include <cstddef>
+
+// Heap allocations of the benchmark process, counted by the global 'operator new' of 'allocations.cpp'.
+// The replacement lives in its own translation unit: inlined into the benchmarks, the 'free' of
+// 'operator delete' meets the 'operator new' of the caller and gcc reports a mismatched deallocation.
+namespace Allocations {
+	extern std::atomic<size_t> Count;
+	extern std::atomic<size_t> Bytes;
+}
+
+#endif
@@ -0,0 +1,778 @@
+// Benchmarks of the hot paths of gitus
+//
+// usage: gitus_bench [--entries 1000,100000,1000000] [--filter <substring>] [--json <file>] [--min-time <seconds>] [--no-arena]
+//
+// Every case reports throughput, latency percentiles and heap allocations per operation.
+// With '--json' the results are also written in a machine readable format to track regressions.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+#include <memory>
+#include <set>
+#include <ctime>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "../commands.h"
+#include "../arena.h"
+#include "../chunker.h"
+#include "../gitus_service.h"
+#include "../io_engine.h"
+#include "../pack.h"
+#include "../repack.h"
+#include "../thread_pool.h"
+#include "../walker.h"
+#include "../utils.h"
+#include "allocations.h"
+
+
+//--- Measurement
+
+struct BenchResult
+{
+	std::string name;
+	size_t iterations = 0;
+	size_t bytesPerOp = 0;
+	double opsPerSecond = 0;
+	double megabytesPerSecond = 0;
+	double p50 = 0;
+	double p90 = 0;
+	double p99 = 0;
+	double max = 0;
+	double allocationsPerOp = 0;
+	double allocatedBytesPerOp = 0;
+};
+
+class Bench {
+
+private:
+	std::vector<BenchResult> _results;
+	std::string _filter;
+	double _minTime;
+	// Every operation runs in its own arena scope, like a command
+	bool _useArena;
+
+	static double Percentile(const std::vector<double>& sorted, double p)
+	{
+		auto index = static_cast<size_t>(p * (sorted.size() - 1));
+		return sorted[index];
+	}
+
+public:
+
+	Bench(const std::string& filter, double minTime, bool useArena)
+	{
+		_useArena = useArena;
+		_filter = filter;
+		_minTime = minTime;
+	}
+
+	bool Selected(const std::string& name)
+	{
+		return _filter.empty() || name.find(_filter) != std::string::npos;
+	}
+
+	// Runs 'operation' until 'minTime' elapsed (at least 'minIterations', at most 'maxIterations' times),
+	// 'setup' runs before every iteration and is excluded from the measurement
+	void Run(const std::string& name, size_t bytesPerOp, std::function<void()> operation,
+		std::function<void()> setup = nullptr, size_t minIterations = 3, size_t maxIterations = 100000)
+	{
+		using namespace std::chrono;
+
+		if (!Selected(name))
+			return;
+
+		std::vector<double> latencies;
+		size_t allocations = 0;
+		size_t allocatedBytes = 0;
+		double elapsed = 0;
+
+		while (latencies.size() < maxIterations && (latencies.size() < minIterations || elapsed < _minTime))
+		{
+			if (setup)
+				setup();
+
+			auto allocationsBefore = Allocations::Count.load();
+			auto bytesBefore = Allocations::Bytes.load();
+			auto start = steady_clock::now();
+
+			if (_useArena)
+			{
+				ArenaScope arena;
+				operation();
+			}
+			else
+			{
+				operation();
+			}
+
+			auto seconds = duration<double>(steady_clock::now() - start).count();
+			allocations += Allocations::Count.load() - allocationsBefore;
+			allocatedBytes += Allocations::Bytes.load() - bytesBefore;
+
+			latencies.push_back(seconds);
+			elapsed += seconds;
+		}
+
+		std::sort(latencies.begin(), latencies.end());
+
+		BenchResult result;
+		result.name = name;
+		result.iterations = latencies.size();
+		result.bytesPerOp = bytesPerOp;
+		result.opsPerSecond = latencies.size() / elapsed;
+		result.megabytesPerSecond = bytesPerOp * result.opsPerSecond / (1024.0 * 1024.0);
+		result.p50 = Percentile(latencies, 0.50);
+		result.p90 = Percentile(latencies, 0.90);
+		result.p99 = Percentile(latencies, 0.99);
+		result.max = latencies.back();
+		result.allocationsPerOp = static_cast<double>(allocations) / latencies.size();
+		result.allocatedBytesPerOp = static_cast<double>(allocatedBytes) / latencies.size();
+		_results.push_back(result);
+
+		std::cout << std::left << std::setw(36) << name << std::right << std::fixed
+			<< std::setw(10) << result.iterations
+			<< std::setw(14) << std::setprecision(1) << result.opsPerSecond
+			<< std::setw(12) << std::setprecision(2) << result.megabytesPerSecond
+			<< std::setw(12) << std::setprecision(1) << result.p50 * 1e6
+			<< std::setw(12) << result.p90 * 1e6
+			<< std::setw(12) << result.p99 * 1e6
+			<< std::setw(12) << result.allocationsPerOp << std::endl;
+	}
+
+	static void PrintHeader()
+	{
+		std::cout << std::left << std::setw(36) << "case" << std::right
+			<< std::setw(10) << "iters" << std::setw(14) << "ops/s" << std::setw(12) << "MiB/s"
+			<< std::setw(12) << "p50 (us)" << std::setw(12) << "p90 (us)" << std::setw(12) << "p99 (us)"
+			<< std::setw(12) << "allocs/op" << std::endl;
+	}
+
+	void WriteJson(std::ostream& out)
+	{
+		out << "{\n  \"benchmark\": \"gitus_bench\",\n  \"results\": [";
+		for (size_t i = 0; i < _results.size(); i++)
+		{
+			auto& r = _results[i];
+			out << (i == 0 ? "\n" : ",\n") << std::setprecision(9)
+				<< "    {\"name\": \"" << r.name << "\""
+				<< ", \"iterations\": " << r.iterations
+				<< ", \"bytes_per_op\": " << r.bytesPerOp
+				<< ", \"ops_per_second\": " << r.opsPerSecond
+				<< ", \"mib_per_second\": " << r.megabytesPerSecond
+				<< ", \"p50_seconds\": " << r.p50
+				<< ", \"p90_seconds\": " << r.p90
+				<< ", \"p99_seconds\": " << r.p99
+				<< ", \"max_seconds\": " << r.max
+				<< ", \"allocations_per_op\": " << r.allocationsPerOp
+				<< ", \"allocated_bytes_per_op\": " << r.allocatedBytesPerOp << "}";
+		}
+		out << "\n  ]\n}" << std::endl;
+	}
+};
+
+
+//--- Fixtures
+
+// Deterministic, moderately compressible content
+RawData GenerateContent(size_t size, unsigned seed)
+{
+	static const char* words[] = { "gitus ", "object ", "index ", "tree ", "commit ", "blob ", "sha1 ", "\n" };
+
+	std::mt19937 random(seed);
+	RawData content;
+	content.reserve(size);
+	while (content.size() < size)
+	{
+		auto word = words[random() % 8];
+		for (auto c = word; *c != 0 && content.size() < size; c++)
+			content.push_back(*c);
+	}
+
+	return content;
+}
+
+std::map<std::string, IndexEntry> GenerateIndexEntries(size_t count)
+{
+	std::map<std::string, IndexEntry> entries;
+	for (size_t i = 0; i < count; i++)
+	{
+		IndexEntry entry;
+		std::stringstream path;
+		path << "dir" << (i % 97) << "/sub" << (i % 13) << "/file" << i << ".txt";
+		entry.path = path.str();
+
+		auto content = GenerateContent(16, static_cast<unsigned>(i));
+		Utils::Sha1(GitusService::CreateContentData(content, GitusService::Blob), entry.sha1);
+		entries.insert(std::make_pair(entry.path, entry));
+	}
+
+	return entries;
+}
+
+std::string SizeName(size_t size)
+{
+	if (size >= 1024 * 1024)
+		return std::to_string(size / (1024 * 1024)) + "MiB";
+	if (size >= 1024)
+		return std::to_string(size / 1024) + "KiB";
+	return std::to_string(size) + "B";
+}
+
+
+//--- Cases
+
+void BenchObjects(Bench& bench, GitusService& gitus)
+{
+	for (size_t size : { size_t(64), size_t(4 * 1024), size_t(256 * 1024), size_t(4 * 1024 * 1024) })
+	{
+		auto content = GenerateContent(size, 1);
+		auto compressed = Utils::Compress(content);
+		RawData compressedData(compressed.begin(), compressed.end());
+
+		bench.Run("HashObject/" + SizeName(size), size, [&]() {
+			RawData sha1;
+			gitus.HashObject(content, GitusService::Blob, false, sha1);
+		});
+
+		bench.Run("Compress/" + SizeName(size), size, [&]() {
+			Utils::Compress(content);
+		});
+
+		bench.Run("Decompress/" + SizeName(size), size, [&]() {
+			Utils::Decompress(compressedData);
+		});
+	}
+}
+
+// Fresh objects every iteration, an object already stored is not written again
+void BenchObjectWrites(Bench& bench, const boost::filesystem::path& root)
+{
+	using namespace boost;
+
+	if (!bench.Selected("WriteObjects"))
+		return;
+
+	const size_t count = 256;
+	auto gitusDirectory = root / "objects" / ".git";
+	filesystem::create_directories(gitusDirectory);
+	GitusService gitus;
+	gitus.SetGitusDirectory(gitusDirectory);
+
+	unsigned batch = 0;
+	std::vector<RawData> objects;
+	auto generate = [&]() {
+		objects.clear();
+		batch++;
+		for (size_t i = 0; i < count; i++)
+		{
+			auto object = GenerateContent(4 * 1024, static_cast<unsigned>(i));
+			std::copy(reinterpret_cast<char*>(&batch), reinterpret_cast<char*>(&batch) + sizeof(batch), object.begin());
+			objects.push_back(object);
+		}
+	};
+
+	bench.Run("WriteObjects/blocking/256x4KiB", count * 4 * 1024, [&]() {
+		for (auto& object : objects)
+		{
+			RawData sha1;
+			gitus.HashObject(object, GitusService::Blob, true, sha1);
+		}
+	}, generate, 3, 200);
+
+	bench.Run("WriteObjects/" + IoEngine::Backend() + "/256x4KiB", count * 4 * 1024, [&]() {
+		std::vector<RawData> sha1s;
+		gitus.HashObjects(objects, GitusService::Blob, true, sha1s);
+	}, generate, 3, 200);
+}
+
+// A large file re-added after small edits, only the chunks around the edit are written again
+void BenchChunking(Bench& bench, const boost::filesystem::path& root)
+{
+	using namespace boost;
+
+	if (!bench.Selected("Chunk/") && !bench.Selected("AddChunked/"))
+		return;
+
+	const size_t size = 32 * 1024 * 1024;
+	auto content = GenerateContent(size, 3);
+
+	bench.Run("Chunk/" + SizeName(size), size, [&]() {
+		ByteView remaining(content);
+		while (!remaining.empty())
+		{
+			auto length = Chunker::NextChunk(remaining);
+			remaining = remaining.Sub(length, remaining.size() - length);
+		}
+	});
+
+	auto gitusDirectory = root / "chunks" / ".git";
+	filesystem::create_directories(gitusDirectory);
+	GitusService gitus;
+	gitus.SetGitusDirectory(gitusDirectory);
+	gitus.SetChunkThreshold(1024 * 1024);
+
+	auto fileName = root / "chunks" / "large.bin";
+	unsigned edit = 0;
+	auto write = [&]() {
+		content[(edit++ * 7919 * 4099) % size] ^= 0x5a;
+		filesystem::ofstream ofs{ fileName, std::ios_base::binary };
+		ofs.write(reinterpret_cast<const char*>(content.data()), content.size());
+	};
+
+	write();
+	RawData sha1;
+	gitus.HashBlobFile(fileName, true, sha1);
+
+	bench.Run("AddChunked/edited/" + SizeName(size), size, [&]() {
+		RawData sha1;
+		gitus.HashBlobFile(fileName, true, sha1);
+	}, write, 3, 20);
+}
+
+void BenchIndex(Bench& bench, const boost::filesystem::path& gitusDirectory, size_t count)
+{
+	auto suffix = "/" + std::to_string(count);
+	if (!bench.Selected("Index") && !bench.Selected("HashCommitTree"))
+		return;
+
+	auto entries = GenerateIndexEntries(count);
+	auto indexSize = [&]() { return static_cast<size_t>(boost::filesystem::file_size(gitusDirectory / "index")); };
+
+	GitusService gitus;
+	gitus.SetGitusDirectory(gitusDirectory);
+	gitus.WriteIndex(entries);
+
+	bench.Run("WriteIndex" + suffix, indexSize(), [&]() {
+		gitus.WriteIndex(entries);
+	}, nullptr, 3, 1000);
+
+	// A new service every time, otherwise the cached index is returned
+	bench.Run("ReadIndex" + suffix, indexSize(), [&]() {
+		GitusService cold;
+		cold.SetGitusDirectory(gitusDirectory);
+		std::map<std::string, IndexEntry> read;
+		cold.ReadIndex(read);
+	}, nullptr, 3, 1000);
+
+	// Measures building the tree from an already parsed index
+	std::map<std::string, IndexEntry> warm;
+	gitus.ReadIndex(warm);
+	bench.Run("HashCommitTree" + suffix, 0, [&]() {
+		gitus.HashCommitTree();
+	}, nullptr, 3, 1000);
+}
+
+void BenchEndToEnd(Bench& bench, const boost::filesystem::path& root)
+{
+	using namespace boost;
+
+	if (!bench.Selected("EndToEnd"))
+		return;
+
+	// Command outputs are not part of the results
+	std::stringstream discarded;
+	auto* coutBuffer = std::cout.rdbuf();
+
+	auto gitus = std::make_shared<GitusService>();
+	auto repository = root / "e2e";
+	filesystem::create_directories(repository);
+	filesystem::current_path(repository);
+	std::cout.rdbuf(discarded.rdbuf());
+	InitCommand(gitus).Execute();
+	std::cout.rdbuf(coutBuffer);
+
+	size_t fileCount = 0;
+	std::string fileName;
+	auto content = GenerateContent(4 * 1024, 7);
+
+	bench.Run("EndToEnd/add/4KiB", content.size(), [&]() {
+		std::cout.rdbuf(discarded.rdbuf());
+		AddCommand(gitus, fileName).Execute();
+		std::cout.rdbuf(coutBuffer);
+	}, [&]() {
+		fileName = "file" + std::to_string(fileCount++) + ".txt";
+		content[0] = static_cast<unsigned char>('a' + fileCount % 26);
+		filesystem::ofstream ofs{ fileName, std::ios_base::binary };
+		ofs.write(reinterpret_cast<const char*>(content.data()), content.size());
+	}, 3, 2000);
+
+	bench.Run("EndToEnd/commit", 0, [&]() {
+		std::cout.rdbuf(discarded.rdbuf());
+		CommitCommand(gitus, "benchmark", "bench", "bench@gitus").Execute();
+		std::cout.rdbuf(coutBuffer);
+	}, [&]() {
+		// Every commit needs a change to the index
+		fileName = "commit" + std::to_string(fileCount++) + ".txt";
+		filesystem::ofstream{ fileName } << fileName;
+		std::cout.rdbuf(discarded.rdbuf());
+		AddCommand(gitus, fileName).Execute();
+		std::cout.rdbuf(coutBuffer);
+	}, 3, 500);
+
+	filesystem::current_path(root);
+}
+
+
+// Ids of unchanged files, queried by a fresh process each time as a build system would
+void BenchHashCache(Bench& bench, const boost::filesystem::path& root)
+{
+	using namespace boost;
+
+	if (!bench.Selected("HashFiles/"))
+		return;
+
+	const size_t count = 256;
+	const size_t size = 64 * 1024;
+	auto workTree = root / "hashcache";
+	auto gitusDirectory = workTree / ".git";
+	filesystem::create_directories(gitusDirectory);
+
+	std::vector<filesystem::path> fileNames;
+	for (size_t i = 0; i < count; i++)
+	{
+		auto content = GenerateContent(size, static_cast<unsigned>(i));
+		fileNames.push_back(workTree / ("file" + std::to_string(i) + ".bin"));
+		filesystem::ofstream ofs{ fileNames.back(), std::ios_base::binary };
+		ofs.write(reinterpret_cast<const char*>(content.data()), content.size());
+		ofs.close();
+		// Files modified within the last second are not cached
+		filesystem::last_write_time(fileNames.back(), std::time(nullptr) - 60);
+	}
+
+	std::unique_ptr<GitusService> gitus;
+	auto open = [&]() {
+		gitus.reset(new GitusService);
+		gitus->SetGitusDirectory(gitusDirectory);
+	};
+	auto hashFiles = [&]() {
+		for (auto& fileName : fileNames)
+		{
+			RawData sha1;
+			gitus->HashBlobFile(fileName, false, sha1);
+		}
+		gitus->FlushHashCache();
+	};
+
+	open();
+	auto cacheFile = gitus->HashCacheFile();
+	bench.Run("HashFiles/uncached/256x64KiB", count * size, hashFiles, [&]() {
+		gitus.reset();
+		filesystem::remove(cacheFile);
+		open();
+	}, 3, 200);
+
+	bench.Run("HashFiles/cached/256x64KiB", count * size, hashFiles, open, 3, 200);
+	gitus.reset();
+}
+
+// Looking every object up in 128 packs, searching each pack index in turn or the multi-pack index
+void BenchPackLookup(Bench& bench, const boost::filesystem::path& root)
+{
+	using namespace boost;
+
+	if (!bench.Selected("PackLookup/"))
+		return;
+
+	const size_t packCount = 128;
+	const size_t objectsPerPack = 64;
+	auto gitusDirectory = root / "packlookup" / ".git";
+	filesystem::create_directories(gitusDirectory);
+	GitusService gitus;
+	gitus.SetGitusDirectory(gitusDirectory);
+
+	std::vector<RawData> sha1s;
+	for (size_t p = 0; p < packCount; p++)
+	{
+		PackWriter writer(gitus.PacksDirectory());
+		for (size_t i = 0; i < objectsPerPack; i++)
+		{
+			auto text = "object " + std::to_string(sha1s.size());
+			auto content = GitusService::CreateContentData(RawData(text.begin(), text.end()), GitusService::Blob);
+			std::string sha1String;
+			RawData sha1;
+			Utils::Sha1String(content, sha1String);
+			Utils::StringToSha1(sha1String, sha1);
+			DeflateContext deflate;
+			deflate.Update(content);
+			writer.Add(sha1, deflate.Finish());
+			sha1s.push_back(sha1);
+		}
+
+		filesystem::path packPath;
+		writer.Finish(packPath);
+	}
+
+	size_t packs, objects;
+	gitus.WriteMultiPackIndex(packs, objects);
+	auto packIndexes = gitus.Packs();
+	auto multiPackIndex = MultiPackIndex::Open(gitus.MultiPackIndexFile());
+
+	size_t found = 0;
+	bench.Run("PackLookup/perpack/128packs", 0, [&]() {
+		for (auto& sha1 : sha1s)
+		{
+			uint64_t offset;
+			uint32_t length;
+			for (auto& pack : packIndexes)
+			{
+				if (pack->Find(sha1, offset, length))
+				{
+					found++;
+					break;
+				}
+			}
+		}
+	}, nullptr, 3, 200);
+
+	bench.Run("PackLookup/midx/128packs", 0, [&]() {
+		for (auto& sha1 : sha1s)
+		{
+			size_t pack;
+			uint64_t offset;
+			uint32_t length;
+			if (multiPackIndex->Find(sha1, pack, offset, length))
+				found++;
+		}
+	}, nullptr, 3, 200);
+}
+
+// Versions of many files in one pack without deltas, repacked with one thread and with one per core
+void BenchRepack(Bench& bench, const boost::filesystem::path& root)
+{
+	using namespace boost;
+
+	if (!bench.Selected("Repack/"))
+		return;
+
+	const size_t fileCount = 200;
+	const size_t versionCount = 5;
+	auto gitusDirectory = root / "repack" / ".git";
+	auto pristineDirectory = root / "repack-pristine";
+	filesystem::create_directories(gitusDirectory);
+	filesystem::create_directories(pristineDirectory);
+
+	// Files of distinct sizes, so that the versions of a file are next to each other once sorted
+	{
+		GitusService gitus;
+		gitus.SetGitusDirectory(gitusDirectory);
+		PackWriter writer(gitus.PacksDirectory());
+		std::mt19937 random(42);
+		for (size_t f = 0; f < fileCount; f++)
+		{
+			std::string text;
+			while (text.size() < 4000 + f * 50)
+				text += "line " + std::to_string(random()) + "\n";
+
+			for (size_t v = 0; v < versionCount; v++)
+			{
+				text.insert(random() % text.size(), "change " + std::to_string(v) + "\n");
+				auto content = GitusService::CreateContentData(RawData(text.begin(), text.end()), GitusService::Blob);
+				std::string sha1String;
+				RawData sha1;
+				Utils::Sha1String(content, sha1String);
+				Utils::StringToSha1(sha1String, sha1);
+				DeflateContext deflate;
+				deflate.Update(content);
+				writer.Add(sha1, deflate.Finish());
+			}
+		}
+
+		filesystem::path packPath;
+		writer.Finish(packPath);
+		filesystem::rename(packPath, pristineDirectory / packPath.filename());
+		filesystem::rename(filesystem::path(packPath).replace_extension(".idx"),
+			pristineDirectory / filesystem::path(packPath).replace_extension(".idx").filename());
+	}
+
+	std::shared_ptr<GitusService> gitus;
+	auto setup = [&]() {
+		gitus = std::make_shared<GitusService>();
+		gitus->SetGitusDirectory(gitusDirectory);
+		filesystem::remove_all(gitus->PacksDirectory());
+		filesystem::create_directories(gitus->PacksDirectory());
+		for (filesystem::directory_iterator it(pristineDirectory), end; it != end; it++)
+			filesystem::copy_file(it->path(), gitus->PacksDirectory() / it->path().filename());
+	};
+
+	std::set<size_t> threadCounts = { 1, ThreadPool::DefaultThreadCount() };
+	for (auto threadCount : threadCounts)
+	{
+		Repacker::Options options;
+		options.threads = threadCount;
+		bench.Run("Repack/" + std::to_string(fileCount * versionCount) + "objects/" + std::to_string(threadCount) + "threads", 0, [&]() {
+			size_t objects, deltas;
+			filesystem::path packPath;
+			if (!Repacker::Repack(*gitus, options, objects, deltas, packPath) || deltas == 0)
+				std::cout << "repack failed" << std::endl;
+		}, setup, 3, 20);
+	}
+}
+
+// Resolving branches among few and many, loose then packed
+void BenchRefs(Bench& bench, const boost::filesystem::path& root)
+{
+	using namespace boost;
+
+	if (!bench.Selected("Refs/"))
+		return;
+
+	const size_t lookups = 1000;
+	for (size_t branchCount : { 100, 10000 })
+	{
+		auto gitusDirectory = root / ("refs" + std::to_string(branchCount)) / ".git";
+		filesystem::create_directories(gitusDirectory);
+		GitusService gitus;
+		gitus.SetGitusDirectory(gitusDirectory);
+
+		RawData commit(20, 0x5a);
+		for (size_t i = 0; i < branchCount; i++)
+			gitus.UpdateReference("refs/heads/topic/" + std::to_string(i), commit);
+
+		std::mt19937 random(42);
+		std::vector<std::string> names;
+		for (size_t i = 0; i < lookups; i++)
+			names.push_back("refs/heads/topic/" + std::to_string(random() % branchCount));
+
+		auto resolve = [&]() {
+			RawData sha1;
+			for (auto& name : names)
+			{
+				if (!gitus.ResolveReference(name, sha1) || sha1 != commit)
+					std::cout << "unresolved " << name << std::endl;
+			}
+		};
+
+		bench.Run("Refs/resolve/loose/" + std::to_string(branchCount) + "refs", 0, resolve);
+
+		size_t packed;
+		gitus.PackReferences(packed);
+		bench.Run("Refs/resolve/packed/" + std::to_string(branchCount) + "refs", 0, resolve);
+	}
+}
+
+// A tree where most files are build outputs, the ignored directories are not entered
+void BenchWalk(Bench& bench, const boost::filesystem::path& root)
+{
+	using namespace boost;
+
+	if (!bench.Selected("Walk/"))
+		return;
+
+	const size_t modules = 100;
+	auto workTree = root / "walk";
+	auto gitusDirectory = workTree / ".git";
+	filesystem::create_directories(gitusDirectory);
+	{
+		filesystem::ofstream ofs{ workTree / ".gitignore" };
+		ofs << "build/\n*.o\n*.tmp\ncmake-build-*\n!keep.o\n";
+	}
+
+	size_t files = 0;
+	for (size_t i = 0; i < modules; i++)
+	{
+		auto module = workTree / ("module" + std::to_string(i));
+		filesystem::create_directories(module / "src");
+		filesystem::create_directories(module / "build");
+		for (size_t j = 0; j < 10; j++)
+		{
+			filesystem::ofstream(module / "src" / ("file" + std::to_string(j) + ".cpp")) << j;
+			filesystem::ofstream(module / "src" / ("file" + std::to_string(j) + ".o")) << j;
+			files++;
+		}
+		for (size_t j = 0; j < 200; j++)
+			filesystem::ofstream(module / "build" / ("object" + std::to_string(j) + ".o")) << j;
+	}
+
+	GitusService gitus;
+	gitus.SetGitusDirectory(gitusDirectory);
+	bench.Run("Walk/ignored/" + std::to_string(modules * 220) + "files", 0, [&]() {
+		std::vector<std::string> listed;
+		gitus.ListWorkTreeFiles(workTree, listed);
+		if (listed.size() != files + 1)
+			std::cout << "unexpected file count " << listed.size() << std::endl;
+	});
+
+	// One walker against one per core
+	IgnoreMatcher matcher(workTree, gitusDirectory);
+	std::set<size_t> threadCounts = { 1, ThreadPool::DefaultThreadCount() };
+	for (auto threadCount : threadCounts)
+	{
+		bench.Run("Walk/ignored/" + std::to_string(threadCount) + "threads", 0, [&]() {
+			std::vector<std::string> listed;
+			TreeWalker::Walk(workTree, matcher, nullptr, "", listed, threadCount);
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	namespace po = boost::program_options;
+	using namespace boost;
+
+	po::options_description desc("gitus_bench options");
+	desc.add_options()
+		("help", "Display this help message")
+		("entries", po::value<std::string>()->default_value("1000,100000,1000000"), "Comma separated index sizes")
+		("filter", po::value<std::string>()->default_value(""), "Only run the cases containing this substring")
+		("json", po::value<std::string>(), "Also write the results as json to this file")
+		("min-time", po::value<double>()->default_value(0.5), "Minimum measured time per case, in seconds")
+		("no-arena", "Allocate the scratch buffers from the heap, to compare with the arena");
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	if (vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 0;
+	}
+
+	Bench bench(vm["filter"].as<std::string>(), vm["min-time"].as<double>(), vm.count("no-arena") == 0);
+
+	auto initialDirectory = filesystem::current_path();
+	auto root = filesystem::temp_directory_path() / filesystem::unique_path("gitus-bench-%%%%-%%%%");
+	auto gitusDirectory = root / "index" / ".git";
+	filesystem::create_directories(gitusDirectory);
+
+	Bench::PrintHeader();
+
+	GitusService gitus;
+	gitus.SetGitusDirectory(gitusDirectory);
+	BenchObjects(bench, gitus);
+	BenchObjectWrites(bench, root);
+	BenchChunking(bench, root);
+	BenchHashCache(bench, root);
+	BenchWalk(bench, root);
+	BenchPackLookup(bench, root);
+	BenchRepack(bench, root);
+	BenchRefs(bench, root);
+
+	std::stringstream counts(vm["entries"].as<std::string>());
+	std::string count;
+	while (std::getline(counts, count, ','))
+	{
+		BenchIndex(bench, gitusDirectory, std::stoul(count));
+	}
+
+	BenchEndToEnd(bench, root);
+
+	filesystem::current_path(initialDirectory);
+	filesystem::remove_all(root);
+
+	if (vm.count("json"))
+	{
+		std::ofstream ofs(vm["json"].as<std::string>());
+		bench.WriteJson(ofs);
+	}
+
+	return 0;
+}
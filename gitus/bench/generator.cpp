@@ -0,0 +1,265 @@
+// Generates synthetic repositories for load testing
+//
+// usage: gitus_gen --output <dir> [--seed 1] [--files 10000] [--depth 4] [--fanout 8]
+//                  [--min-size 64] [--max-size 65536] [--binary-ratio 0.1]
+//                  [--commits 10] [--changes-per-commit 10] [--threads 0] [--pack]
+//
+// The repository is created by driving 'GitusService' directly rather than the command line.
+// The same options and seed always produce the same files, objects and commits.
+// File sizes follow a log-uniform distribution between '--min-size' and '--max-size',
+// binary files are random bytes and text files are made of words.
+// With '--pack' the initial import is written as one pack (see 'GitusService::BeginBulkCheckin'),
+// the order of the objects in the pack then depends on the scheduling of the threads.
+
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "../commands.h"
+#include "../gitus_service.h"
+#include "../thread_pool.h"
+#include "../utils.h"
+
+
+struct GeneratorOptions
+{
+	unsigned seed;
+	size_t files;
+	size_t depth;
+	size_t fanout;
+	size_t minSize;
+	size_t maxSize;
+	double binaryRatio;
+	size_t commits;
+	size_t changesPerCommit;
+	size_t threads;
+	bool pack;
+};
+
+class RepositoryGenerator {
+
+private:
+	GeneratorOptions _options;
+	std::shared_ptr<GitusService> _gitus;
+	std::vector<std::string> _paths;
+
+	// Every file and revision has its own random stream so that generation can run in parallel
+	std::mt19937_64 Random(size_t file, size_t revision)
+	{
+		std::seed_seq seed{ static_cast<size_t>(_options.seed), file, revision };
+		return std::mt19937_64(seed);
+	}
+
+	std::string GeneratePath(size_t file)
+	{
+		auto random = Random(file, static_cast<size_t>(-1));
+		size_t depth = _options.depth == 0 ? 0 : random() % (_options.depth + 1);
+
+		std::stringstream path;
+		for (size_t level = 0; level < depth; level++)
+			path << "dir" << random() % std::max<size_t>(_options.fanout, 1) << "/";
+		path << "file" << file << ".txt";
+		return path.str();
+	}
+
+	RawData GenerateContent(size_t file, size_t revision)
+	{
+		static const char* words[] = { "gitus ", "object ", "index ", "tree ", "commit ", "blob ", "sha1 ", "\n" };
+
+		auto random = Random(file, revision);
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+		// Log-uniform sizes: many small files and a few large ones
+		auto logMin = std::log(static_cast<double>(std::max<size_t>(_options.minSize, 1)));
+		auto logMax = std::log(static_cast<double>(std::max(_options.maxSize, _options.minSize) + 1));
+		auto size = static_cast<size_t>(std::exp(logMin + uniform(random) * (logMax - logMin)));
+		auto binary = uniform(random) < _options.binaryRatio;
+
+		RawData content;
+		content.reserve(size);
+		while (content.size() < size)
+		{
+			if (binary)
+			{
+				content.push_back(static_cast<unsigned char>(random()));
+			}
+			else
+			{
+				for (auto c = words[random() % 8]; *c != 0 && content.size() < size; c++)
+					content.push_back(*c);
+			}
+		}
+
+		return content;
+	}
+
+	// Writes the files to the working tree and their blobs to the object store
+	void WriteFiles(const std::vector<size_t>& files, size_t revision, std::map<std::string, IndexEntry>& entries)
+	{
+		using namespace boost;
+
+		std::mutex entriesMutex;
+		ThreadPool pool(_options.threads);
+
+		for (auto file : files)
+		{
+			pool.Enqueue([&, file]() {
+				auto content = GenerateContent(file, revision);
+				auto& path = _paths[file];
+				auto fullPath = _gitus->RepoDirectory() / path;
+
+				system::error_code ec;
+				filesystem::create_directories(fullPath.parent_path(), ec);
+				{
+					filesystem::ofstream ofs{ fullPath, std::ios_base::binary };
+					ofs.write(reinterpret_cast<const char*>(content.data()), content.size());
+				}
+
+				IndexEntry entry;
+				entry.path = path;
+				_gitus->HashObject(content, GitusService::Blob, true, entry.sha1);
+
+				std::lock_guard<std::mutex> lock(entriesMutex);
+				entries[path] = entry;
+			});
+		}
+
+		pool.Wait();
+	}
+
+	bool Commit(size_t revision)
+	{
+		auto tree = _gitus->HashCommitTree();
+		if (tree.empty())
+			return false;
+
+		RawData treeHash;
+		_gitus->HashObject(tree, GitusService::Tree, true, treeHash);
+
+		// Fixed timestamps keep commit ids reproducible
+		RawData commitHash;
+		std::time_t time = 1500000000 + static_cast<std::time_t>(revision) * 60;
+		return _gitus->WriteCommit(treeHash, "Generated revision " + std::to_string(revision), "gitus_gen", "gen@gitus", time, commitHash);
+	}
+
+public:
+
+	RepositoryGenerator(const GeneratorOptions& options, const std::shared_ptr<GitusService>& gitus)
+	{
+		_options = options;
+		_gitus = gitus;
+	}
+
+	bool Generate()
+	{
+		using namespace std;
+		using namespace std::chrono;
+
+		auto start = steady_clock::now();
+		auto elapsed = [&]() { return duration<double>(steady_clock::now() - start).count(); };
+
+		for (size_t file = 0; file < _options.files; file++)
+			_paths.push_back(GeneratePath(file));
+
+		// The index is only written once, at the end
+		_gitus->SetDeferIndexWrites(true);
+
+		std::map<std::string, IndexEntry> entries;
+		_gitus->ReadIndex(entries);
+
+		vector<size_t> allFiles;
+		for (size_t file = 0; file < _options.files; file++)
+			allFiles.push_back(file);
+
+		if (_options.pack)
+			_gitus->BeginBulkCheckin();
+
+		WriteFiles(allFiles, 0, entries);
+		if (_options.pack && !_gitus->EndBulkCheckin())
+			return false;
+
+		_gitus->WriteIndex(entries);
+		if (_options.commits > 0 && !Commit(0))
+			return false;
+
+		cout << "Generated " << _options.files << " files in " << elapsed() << "s" << endl;
+
+		for (size_t revision = 1; revision < _options.commits; revision++)
+		{
+			auto random = Random(static_cast<size_t>(-1), revision);
+			vector<size_t> changed;
+			for (size_t change = 0; change < _options.changesPerCommit && _options.files > 0; change++)
+				changed.push_back(random() % _options.files);
+
+			WriteFiles(changed, revision, entries);
+			_gitus->WriteIndex(entries);
+			Commit(revision);
+
+			if (revision % 1000 == 0)
+				cout << "Generated " << revision << " commits in " << elapsed() << "s" << endl;
+		}
+
+		_gitus->SetDeferIndexWrites(false);
+		cout << "Generated " << _options.files << " files and " << _options.commits << " commits in "
+			<< _gitus->RepoDirectory().string() << " (" << elapsed() << "s)" << endl;
+		return true;
+	}
+};
+
+
+int main(int argc, char** argv)
+{
+	namespace po = boost::program_options;
+	using namespace boost;
+
+	GeneratorOptions options;
+	po::options_description desc("gitus_gen options");
+	desc.add_options()
+		("help", "Display this help message")
+		("output", po::value<std::string>(), "Directory of the repository to create")
+		("seed", po::value<unsigned>(&options.seed)->default_value(1), "Seed of the generator")
+		("files", po::value<size_t>(&options.files)->default_value(10000), "Number of files")
+		("depth", po::value<size_t>(&options.depth)->default_value(4), "Maximum directory depth")
+		("fanout", po::value<size_t>(&options.fanout)->default_value(8), "Subdirectories per directory")
+		("min-size", po::value<size_t>(&options.minSize)->default_value(64), "Minimum file size in bytes")
+		("max-size", po::value<size_t>(&options.maxSize)->default_value(65536), "Maximum file size in bytes")
+		("binary-ratio", po::value<double>(&options.binaryRatio)->default_value(0.1), "Fraction of binary files")
+		("commits", po::value<size_t>(&options.commits)->default_value(10), "Length of the history")
+		("changes-per-commit", po::value<size_t>(&options.changesPerCommit)->default_value(10), "Files modified by every commit after the first")
+		("threads", po::value<size_t>(&options.threads)->default_value(0), "Worker threads, 0 for one per core")
+		("pack", "Write the objects of the initial import to a pack instead of loose objects");
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+	options.pack = vm.count("pack") != 0;
+
+	if (vm.count("help") || !vm.count("output"))
+	{
+		std::cout << desc << std::endl;
+		return vm.count("help") ? 0 : 1;
+	}
+
+	auto output = filesystem::absolute(vm["output"].as<std::string>());
+	if (filesystem::exists(output / ".git"))
+	{
+		std::cout << "fatal: '" << output.string() << "' already contains a repository" << std::endl;
+		return 1;
+	}
+
+	filesystem::create_directories(output);
+	filesystem::current_path(output);
+
+	auto gitus = std::make_shared<GitusService>();
+	InitCommand(gitus).Execute();
+
+	RepositoryGenerator generator(options, gitus);
+	return generator.Generate() ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#include "chunker.h"
+
+
+// Boundaries test the high bits of the hash, which depend on the last 64 bytes only
+// 18 bits before the average size and 14 bits after it, 'AverageSize' being 2^16
+static const uint64_t MaskStrict = ~uint64_t(0) << (64 - 18);
+static const uint64_t MaskLoose = ~uint64_t(0) << (64 - 14);
+
+const uint64_t* Chunker::GearTable()
+{
+	// Fixed seed: the boundaries, hence the ids of the chunks, must never change between versions
+	struct Table
+	{
+		uint64_t values[256];
+
+		Table()
+		{
+			// splitmix64
+			uint64_t state = 0x6769747573636463ULL;
+			for (auto& value : values)
+			{
+				state += 0x9e3779b97f4a7c15ULL;
+				uint64_t z = state;
+				z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+				z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+				value = z ^ (z >> 31);
+			}
+		}
+	};
+
+	static const Table table;
+	return table.values;
+}
+
+size_t Chunker::NextChunk(ByteView data)
+{
+	auto gear = GearTable();
+	auto size = data.size();
+	if (size <= MinSize)
+		return size;
+
+	auto normalSize = std::min(size, AverageSize);
+	auto maxSize = std::min(size, MaxSize);
+
+	// Nothing can be cut before 'MinSize', those bytes are not even hashed
+	uint64_t hash = 0;
+	size_t i = MinSize;
+	for (; i < normalSize; i++)
+	{
+		hash = (hash << 1) + gear[data[i]];
+		if ((hash & MaskStrict) == 0)
+			return i + 1;
+	}
+
+	for (; i < maxSize; i++)
+	{
+		hash = (hash << 1) + gear[data[i]];
+		if ((hash & MaskLoose) == 0)
+			return i + 1;
+	}
+
+	return maxSize;
+}
@@ -0,0 +1,33 @@
+#ifndef GITUS_CHUNKER_H
+#define GITUS_CHUNKER_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "utils.h"
+
+
+// Content-defined chunking of large blobs (FastCDC)
+//
+// Boundaries are chosen where a rolling gear hash of the last bytes matches a mask, so they only
+// depend on the surrounding content: an edit only changes the chunks it touches, the chunks before
+// and after it are found again and deduplicated against the previous version of the file.
+// Normalized chunking (a stricter mask before the average size, a looser one after it) keeps the
+// chunk sizes close to 'AverageSize'.
+class Chunker {
+
+public:
+	static const size_t MinSize = 16 * 1024;
+	static const size_t AverageSize = 64 * 1024;
+	static const size_t MaxSize = 256 * 1024;
+
+	// Length of the chunk starting at the beginning of 'data'
+	// 'data' must hold at least 'MaxSize' bytes unless it ends the file.
+	static size_t NextChunk(ByteView data);
+
+private:
+	static const uint64_t* GearTable();
+};
+
+
+#endif
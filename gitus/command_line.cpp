@@ -0,0 +1,691 @@
+#include <memory>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+#include "boost/filesystem.hpp"
+
+#include "command_line.h"
+#include "stats.h"
+#include "trace.h"
+
+
+std::shared_ptr<BaseCommand> CreateCommand(const std::shared_ptr<GitusService>& gitus, const std::vector<std::string>& args)
+{
+	namespace po = boost::program_options;
+	using namespace std;
+
+	// Cmd line params (e.g single dash --help vs -help
+	po::command_line_style::style_t style = po::command_line_style::style_t(
+		po::command_line_style::unix_style |
+		po::command_line_style::case_insensitive |
+		po::command_line_style::allow_long_disguise |
+		po::command_line_style::allow_dash_for_short);
+
+	po::options_description global("Global options");
+
+	global.add_options()
+		// global help
+		("help,help", "Display this help message")
+		("batch", "Execute the commands read from the standard input, one per line")
+		("timings", "Print the time spent in each phase of the command")
+		("trace-output", po::value<string>(), "Write the phases of the command as Chrome trace events to a '.json' file")
+		("stats", "Print the I/O counters of the command as JSON on exit")
+		// positional arguments need to be added
+		("command", po::value<string>(), "command to execute")
+		("subargs", po::value<vector<string>>(), "Arguments for command");
+
+	po::positional_options_description pos;
+	pos.add("command", 1).
+		add("subargs", -1);
+
+	po::variables_map vm;
+
+	po::parsed_options parsed = po::command_line_parser(args).
+		options(global)
+		.style(style)
+		.positional(pos)
+		.allow_unregistered()
+		.run();
+
+	po::store(parsed, vm);
+
+	if (vm.count("trace-output"))
+	{
+		Trace::Enable(vm["trace-output"].as<string>());
+	}
+	else if (vm.count("timings"))
+	{
+		Trace::Enable("");
+	}
+
+	if (vm.count("stats"))
+	{
+		Stats::Enable("");
+	}
+
+	if (vm.count("batch"))
+	{
+		CommandFactory createCommand = [gitus](const vector<string>& commandArgs) {
+			return CreateCommand(gitus, commandArgs);
+		};
+		return shared_ptr<BaseCommand>(new BatchCommand(gitus, createCommand));
+	}
+
+	if (vm.count("command") == 0)
+	{
+		return shared_ptr<BaseCommand>(new HelpCommand(gitus));
+	}
+
+	string cmdName = vm["command"].as<string>();
+
+	std::shared_ptr<BaseCommand> cmd;
+	// Subprograms
+	if (cmdName == "help")
+	{
+		return shared_ptr<BaseCommand>(new HelpCommand(gitus));
+	}
+	else if (cmdName == "init")
+	{
+		po::options_description desc("init options");
+		desc.add_options()("help", "");
+
+		// Collects 'init args
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new InitCommandHelp(gitus));
+
+		// Check if too many arguments
+		if (opts.size() > 1)
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.run(), vm);
+
+		// Check if help argument
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else if (opts.size() != 0)
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+		else
+		{
+			return shared_ptr<BaseCommand>(new InitCommand(gitus));
+		}
+	}
+	else if (cmdName == "add")
+	{
+		po::options_description desc("init options");
+		desc.add_options()
+			("help", "")
+			("pathspec", po::value<vector<string>>(), "");
+
+		// Collects 'init args
+		std::vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+		
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new AddCommandHelp(gitus));
+
+		po::positional_options_description pos;
+		pos.add("pathspec", -1);
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.positional(pos)
+			.run(), vm);
+
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else if (opts.empty())
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd; // return the help command
+		}
+		else
+		{
+			return shared_ptr<BaseCommand>(new AddCommand(gitus, vm["pathspec"].as<vector<string>>()));
+		}
+	}
+	else if (cmdName == "commit")
+	{
+		po::options_description desc("init options");
+		desc.add_options()
+			("help", "")
+			("msg", "")
+			("author", "")
+			("email", "");
+
+		po::positional_options_description pos;
+		pos.add("msg", 1)
+			.add("author", 1)
+			.add("email", 1);
+		
+		// Collects 'init args
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new CommitCommandHelp(gitus));
+
+		// Check if too many arguments
+		if (opts.size() > 3)
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.positional(pos)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else if (opts.size() != 3)
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+		else
+		{
+			return shared_ptr<BaseCommand>(new CommitCommand(
+				gitus,
+				vm["msg"].as<string>(),
+				vm["author"].as<string>(),
+				vm["email"].as<string>()
+			));
+		}
+	}
+	else if (cmdName == "checkout")
+	{
+		po::options_description desc("checkout options");
+		desc.add_options()
+			("help", "")
+			("pathspec", po::value<vector<string>>(), "");
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new CheckoutCommandHelp(gitus));
+
+		po::positional_options_description pos;
+		pos.add("pathspec", -1);
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.positional(pos)
+			.run(), vm);
+
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else
+		{
+			vector<string> pathspecs;
+			if (vm.count("pathspec"))
+				pathspecs = vm["pathspec"].as<vector<string>>();
+
+			return shared_ptr<BaseCommand>(new CheckoutCommand(gitus, pathspecs));
+		}
+	}
+	else if (cmdName == "branch")
+	{
+		po::options_description desc("branch options");
+		desc.add_options()
+			("help", "")
+			("delete,d", "")
+			("name", po::value<string>(), "")
+			("start-point", po::value<string>(), "");
+
+		po::positional_options_description pos;
+		pos.add("name", 1)
+			.add("start-point", 1);
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new BranchCommandHelp(gitus));
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.positional(pos)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+			return cmd;
+
+		auto name = vm.count("name") ? vm["name"].as<string>() : "";
+		auto startPoint = vm.count("start-point") ? vm["start-point"].as<string>() : "";
+		if (vm.count("delete") && (name.empty() || !startPoint.empty()))
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+
+		return shared_ptr<BaseCommand>(new BranchCommand(gitus, name, startPoint, vm.count("delete") != 0));
+	}
+	else if (cmdName == "pack-refs")
+	{
+		po::options_description desc("pack-refs options");
+		desc.add_options()("help", "");
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new PackRefsCommandHelp(gitus));
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+			return cmd;
+
+		return shared_ptr<BaseCommand>(new PackRefsCommand(gitus));
+	}
+	else if (cmdName == "clone")
+	{
+		po::options_description desc("clone options");
+		desc.add_options()
+			("help", "")
+			("bare", "")
+			("repository", po::value<string>(), "")
+			("directory", po::value<string>(), "");
+
+		po::positional_options_description pos;
+		pos.add("repository", 1)
+			.add("directory", 1);
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new CloneCommandHelp(gitus));
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.positional(pos)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else if (vm.count("repository") == 0 || vm.count("directory") == 0)
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+		else
+		{
+			return shared_ptr<BaseCommand>(new CloneCommand(gitus, vm["repository"].as<string>(), vm["directory"].as<string>(), vm.count("bare") != 0));
+		}
+	}
+	else if (cmdName == "fetch" || cmdName == "push")
+	{
+		po::options_description desc(cmdName + " options");
+		desc.add_options()
+			("help", "")
+			("repository", po::value<string>(), "");
+
+		po::positional_options_description pos;
+		pos.add("repository", 1);
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		if (cmdName == "fetch")
+			cmd = shared_ptr<BaseCommand>(new FetchCommandHelp(gitus));
+		else
+			cmd = shared_ptr<BaseCommand>(new PushCommandHelp(gitus));
+
+		if (opts.size() > 1)
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.positional(pos)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+			return cmd;
+
+		auto remote = vm.count("repository") ? vm["repository"].as<string>() : string("origin");
+		if (cmdName == "fetch")
+			return shared_ptr<BaseCommand>(new FetchCommand(gitus, remote));
+		else
+			return shared_ptr<BaseCommand>(new PushCommand(gitus, remote));
+	}
+	else if (cmdName == "sparse-checkout")
+	{
+		po::options_description desc("sparse-checkout options");
+		desc.add_options()
+			("help", "")
+			("action", po::value<string>(), "")
+			("directory", po::value<vector<string>>(), "");
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new SparseCheckoutCommandHelp(gitus));
+
+		po::positional_options_description pos;
+		pos.add("action", 1)
+			.add("directory", -1);
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.positional(pos)
+			.run(), vm);
+
+		if (vm.count("help") || vm.count("action") == 0)
+		{
+			return cmd;
+		}
+
+		auto action = vm["action"].as<string>();
+		vector<string> directories;
+		if (vm.count("directory"))
+			directories = vm["directory"].as<vector<string>>();
+
+		if ((action == "set" && directories.empty()) || ((action == "list" || action == "disable") && !directories.empty()))
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+		else if (action != "set" && action != "list" && action != "disable")
+		{
+			cout << "Unknown sparse-checkout action '" << action << "'." << endl;
+			return cmd;
+		}
+		else
+		{
+			return shared_ptr<BaseCommand>(new SparseCheckoutCommand(gitus, action, directories));
+		}
+	}
+	else if (cmdName == "status")
+	{
+		po::options_description desc("status options");
+		desc.add_options()("help", "");
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new StatusCommandHelp(gitus));
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else if (opts.size() != 0)
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+		else
+		{
+			return shared_ptr<BaseCommand>(new StatusCommand(gitus));
+		}
+	}
+	else if (cmdName == "hash-object")
+	{
+		po::options_description desc("hash-object options");
+		desc.add_options()
+			("help", "")
+			("w", "")
+			("file", po::value<vector<string>>(), "");
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new HashObjectCommandHelp(gitus));
+
+		po::positional_options_description pos;
+		pos.add("file", -1);
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.positional(pos)
+			.run(), vm);
+
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else if (vm.count("file") == 0)
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+		else
+		{
+			return shared_ptr<BaseCommand>(new HashObjectCommand(gitus, vm["file"].as<vector<string>>(), vm.count("w") != 0));
+		}
+	}
+	else if (cmdName == "multi-pack-index")
+	{
+		po::options_description desc("multi-pack-index options");
+		desc.add_options()
+			("help", "")
+			("action", po::value<string>(), "");
+
+		po::positional_options_description pos;
+		pos.add("action", 1);
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new MultiPackIndexCommandHelp(gitus));
+
+		if (opts.size() != 1)
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.positional(pos)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+			return cmd;
+
+		return shared_ptr<BaseCommand>(new MultiPackIndexCommand(gitus, vm["action"].as<string>()));
+	}
+	else if (cmdName == "repack")
+	{
+		Repacker::Options options;
+		po::options_description desc("repack options");
+		desc.add_options()
+			("help", "")
+			("window", po::value<size_t>(&options.window), "")
+			("depth", po::value<size_t>(&options.depth), "")
+			("window-memory", po::value<size_t>(&options.windowMemory), "")
+			("threads", po::value<size_t>(&options.threads), "");
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new RepackCommandHelp(gitus));
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.run(), vm);
+		po::notify(vm);
+
+		if (vm.count("help"))
+			return cmd;
+
+		return shared_ptr<BaseCommand>(new RepackCommand(gitus, options));
+	}
+	else if (cmdName == "fsck")
+	{
+		po::options_description desc("fsck options");
+		desc.add_options()("help", "");
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new FsckCommandHelp(gitus));
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else if (opts.size() != 0)
+		{
+			cout << "Wrong number of positional arguments." << endl;
+			return cmd;
+		}
+		else
+		{
+			return shared_ptr<BaseCommand>(new FsckCommand(gitus));
+		}
+	}
+	else if (cmdName == "cat-file")
+	{
+		po::options_description desc("cat-file options");
+		desc.add_options()
+			("help", "")
+			("batch", "")
+			("batch-check", "")
+			("buffer", "");
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new CatFileCommandHelp(gitus));
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else if (vm.count("batch") + vm.count("batch-check") != 1)
+		{
+			cout << "Exactly one of --batch or --batch-check is required." << endl;
+			return cmd;
+		}
+		else
+		{
+			return shared_ptr<BaseCommand>(new CatFileCommand(gitus, vm.count("batch-check") != 0, vm.count("buffer") != 0));
+		}
+	}
+	else if (cmdName == "daemon")
+	{
+		po::options_description desc("daemon options");
+		desc.add_options()
+			("help", "")
+			("stop", "");
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new DaemonCommandHelp(gitus));
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else
+		{
+			CommandFactory createCommand = [gitus](const vector<string>& commandArgs) {
+				return CreateCommand(gitus, commandArgs);
+			};
+			return shared_ptr<BaseCommand>(new DaemonCommand(gitus, createCommand, vm.count("stop") != 0));
+		}
+	}
+
+	else if (cmdName == "stats")
+	{
+		po::options_description desc("stats options");
+		desc.add_options()
+			("help", "")
+			("reset", "");
+
+		vector<string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+		opts.erase(opts.begin());
+
+		// Create help command
+		cmd = shared_ptr<BaseCommand>(new StatsCommandHelp(gitus));
+
+		po::store(po::command_line_parser(opts)
+			.options(desc)
+			.style(style)
+			.run(), vm);
+
+		if (vm.count("help"))
+		{
+			return cmd;
+		}
+		else
+		{
+			return shared_ptr<BaseCommand>(new StatsCommand(gitus, vm.count("reset") != 0));
+		}
+	}
+
+	cout << "gitus: '" << cmdName << "' is not a gitus command. See 'gitus help'." << endl;
+	return nullptr;
+}
@@ -0,0 +1,17 @@
+#ifndef GITUS_COMMAND_LINE_H
+#define GITUS_COMMAND_LINE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "commands.h"
+#include "gitus_service.h"
+
+
+// Parses the arguments of a command line, excluding the program name
+// Returns the help of the command when the arguments are invalid, nullptr for an unknown command.
+std::shared_ptr<BaseCommand> CreateCommand(const std::shared_ptr<GitusService>& gitus, const std::vector<std::string>& args);
+
+
+#endif
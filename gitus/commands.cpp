@@ -1,56 +1,60 @@
 
 #include <memory>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <algorithm>
+#include <cstring>
 
 #include <boost/filesystem.hpp>
 #include "boost/date_time/posix_time/posix_time.hpp"
 #include "boost/date_time/posix_time/conversion.hpp"
 
 #include "commands.h"
+#include "arena.h"
+#include "daemon.h"
+#include "io_engine.h"
+#include "pack.h"
+#include "refs.h"
+#include "hash_cache.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "transport.h"
 #include "utils.h"
 
 
 //-- Init
 
-bool InitCommand::Init()
-{
-	boost::filesystem::create_directory(GitusService::NewGitusDirectory());
-	_gitus->CacheCurrentGitusDirectory();
-
-	boost::filesystem::create_directory(_gitus->ObjectsDirectory());
-	boost::filesystem::create_directory(_gitus->RefsDirectory());
-	boost::filesystem::create_directory(_gitus->HeadsDirectory());
-	
-	auto masterFilePath = _gitus->MasterFile().string();
-	boost::filesystem::ofstream{ masterFilePath};
-	boost::filesystem::ofstream headFile{ _gitus->HeadFile().string()};
-	headFile << "ref: refs / heads / master";
-
-	return true;
-}
-
 bool InitCommand::Execute() {
 
 	using namespace std;
 	using namespace boost;
 
 	string msg;
+	auto gitusDirectory = GitusService::NewGitusDirectory();
+	auto reinitialize = filesystem::exists(gitusDirectory);
+
+	filesystem::create_directories(gitusDirectory);
+	_gitus->SetGitusDirectory(gitusDirectory);
+
 	// Reinitialize the repository
-	if (filesystem::exists(GitusService::NewGitusDirectory()))
+	if (reinitialize)
 	{
-		boost::filesystem::remove(_gitus->IndexFile());
-		boost::filesystem::remove(_gitus->ObjectsDirectory());
-		Init();
+		system::error_code ec;
+		boost::filesystem::remove(_gitus->IndexFile(), ec);
+		// Only removed when empty, existing objects are kept
+		boost::filesystem::remove(_gitus->ObjectsDirectory(), ec);
+		_gitus->CreateLayout();
 		msg = "Reinitialized existing Git repository in ";
 	}
 	// Create new repository
 	else
 	{
-		Init();
+		_gitus->CreateLayout();
 		msg = "Initialized empty Git repository in ";
 	}
 
-	_gitus->CacheCurrentGitusDirectory();
 	msg += _gitus->RepoDirectory().string();
 
 	cout << msg << endl;
@@ -68,12 +72,87 @@ bool AddCommand::Execute() {
 	if (!BaseCommand::Execute())
 		return false;
 
-	auto fullPath = _gitus->RepoDirectory() / _pathspec;
+	// A directory stands for the files below it which are not ignored, unlike a file named explicitly
+	vector<string> pathspecs;
+	vector<bool> named;
+	auto currentDirectory = filesystem::current_path();
+	for (auto& pathspec : _pathspecs)
+	{
+		auto fullPath = filesystem::absolute(pathspec).lexically_normal();
+		Stats::Add(Stats::StatCalls);
+		if (!filesystem::is_directory(fullPath))
+		{
+			pathspecs.push_back(pathspec);
+			named.push_back(true);
+			continue;
+		}
+
+		vector<string> directoryFiles;
+		if (!_gitus->ListWorkTreeFiles(fullPath, directoryFiles))
+		{
+			cout << "fatal: pathspec '" << pathspec << "' is outside repository" << endl;
+			return false;
+		}
+
+		for (auto& file : directoryFiles)
+		{
+			pathspecs.push_back((_gitus->RepoDirectory() / file).lexically_relative(currentDirectory).generic_string());
+			named.push_back(false);
+		}
+	}
 
-	if (!filesystem::exists(fullPath))
+	// Nothing is added unless every pathspec is valid
+	// Files above the chunk or large file threshold are streamed one by one, the others are read in a batch
+	// unless the hash cache has the id of the unchanged file
+	auto hashCache = _gitus->FileHashCache();
+	vector<RawData> sha1s(pathspecs.size());
+	vector<HashCache::FileStamp> stamps(pathspecs.size());
+	vector<IoEngine::ReadRequest> files;
+	vector<size_t> batched;
+	vector<size_t> streamed;
+	vector<filesystem::path> fullPaths;
+	vector<string> indexPaths;
+	for (size_t i = 0; i < pathspecs.size(); i++)
 	{
-		cout << "fatal: pathspec '" << _pathspec <<"' did not match any files" << endl;
-		return false;
+		auto& pathspec = pathspecs[i];
+		// The pathspec is relative to the current directory, which may be a subdirectory of the repository
+		auto fullPath = filesystem::absolute(pathspec).lexically_normal();
+		auto indexPath = fullPath.lexically_relative(_gitus->RepoDirectory()).generic_string();
+
+		Stats::Add(Stats::StatCalls);
+		if (!filesystem::exists(fullPath))
+		{
+			cout << "fatal: pathspec '" << pathspec <<"' did not match any files" << endl;
+			return false;
+		}
+
+		if (indexPath.empty() || indexPath.compare(0, 2, "..") == 0)
+		{
+			cout << "fatal: pathspec '" << pathspec << "' is outside repository" << endl;
+			return false;
+		}
+
+		fullPaths.push_back(fullPath);
+		indexPaths.push_back(indexPath);
+
+		auto stamped = HashCache::Stat(fullPath, stamps[i]);
+		if (stamped && _gitus->IsStreamed(stamps[i].size))
+		{
+			streamed.push_back(i);
+			continue;
+		}
+
+		string cachedString;
+		if (stamped && hashCache->Lookup(stamps[i], sha1s[i])
+			&& Utils::Sha1ToString(sha1s[i], cachedString) && _gitus->ObjectExists(cachedString))
+			continue;
+
+		sha1s[i].clear();
+
+		IoEngine::ReadRequest file;
+		file.path = fullPath;
+		files.push_back(file);
+		batched.push_back(i);
 	}
 
 	auto entries = map<string, IndexEntry>();
@@ -83,27 +162,106 @@ bool AddCommand::Execute() {
 		return false;
 	}
 
-	IndexEntry entry;
+	if (!IoEngine::ReadFiles(files))
+	{
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			if (!files[i].done)
+				cout << "fatal: unable to read '" << pathspecs[batched[i]] << "'" << endl;
+		}
+		return false;
+	}
+
+	vector<RawData> contents;
+	for (auto& file : files)
+		contents.push_back(move(file.data));
 
-	_gitus->HashObject(Utils::ReadBytes(fullPath.string()), GitusService::Blob, true, entry.sha1);
+	// Large imports go to a single pack, a few files are still written as loose objects
+	auto bulkCheckin = batched.size() >= GitusService::BulkCheckinMinObjects
+		|| (!streamed.empty() && _gitus->ChunkThreshold() != 0);
+	if (bulkCheckin)
+		_gitus->BeginBulkCheckin();
 
-	entry.path = _pathspec;
+	vector<RawData> batchedSha1s;
+	if (!_gitus->HashObjects(contents, GitusService::Blob, true, batchedSha1s))
+	{
+		cout << "fatal: unable to write the new objects" << endl;
+		if (bulkCheckin)
+			_gitus->AbortBulkCheckin();
+		return false;
+	}
 
-	if (entries.count(_pathspec) != 0) {
+	for (size_t i = 0; i < batched.size(); i++)
+		sha1s[batched[i]] = move(batchedSha1s[i]);
 
-		auto indexedEntry = entries.at(_pathspec);
-		if (indexedEntry.sha1 == entry.sha1) {
-			cout << "The file '" << _pathspec << "' is arleady inside the index." << endl;
+	for (auto i : streamed)
+	{
+		if (!_gitus->HashBlobFile(fullPaths[i], true, sha1s[i]))
+		{
+			cout << "fatal: unable to read '" << pathspecs[i] << "'" << endl;
+			if (bulkCheckin)
+				_gitus->AbortBulkCheckin();
 			return false;
 		}
 	}
 
-	entries.insert(make_pair(entry.path, entry));
+	// The objects must be readable before the index references them
+	if (bulkCheckin && !_gitus->EndBulkCheckin())
+	{
+		cout << "fatal: unable to write the pack of the new objects" << endl;
+		return false;
+	}
+
+	// Cached once stored, a cached id is trusted by the next add without writing its object again
+	for (auto* list : { &batched, &streamed })
+	{
+		for (auto i : *list)
+			hashCache->Insert(fullPaths[i], stamps[i], sha1s[i]);
+	}
 
-	_gitus->WriteIndex(entries);
+	bool success = true;
+	bool modified = false;
+	for (size_t i = 0; i < pathspecs.size(); i++)
+	{
+		IndexEntry entry;
+		entry.sha1 = sha1s[i];
+		entry.path = indexPaths[i];
 
-	cout << "File '" << _pathspec << "' added to the index." << std::endl;
-	return true;
+		// A file below a directory collapsed by sparse checkout needs the entries of the directory
+		size_t expanded = 0;
+		if (!_gitus->ExpandIndex(entries, entry.path, expanded))
+		{
+			cout << "fatal: unable to expand the sparse directory above '" << pathspecs[i] << "'" << endl;
+			return false;
+		}
+		modified |= expanded != 0;
+
+		if (entries.count(entry.path) != 0) {
+
+			auto indexedEntry = entries.at(entry.path);
+			if (indexedEntry.sha1 == entry.sha1) {
+				// Unchanged files of a directory are not worth a message
+				if (!named[i])
+					continue;
+
+				cout << "The file '" << pathspecs[i] << "' is arleady inside the index." << endl;
+				success = false;
+				continue;
+			}
+		}
+
+		// Replaces the entry of a modified file
+		entries[entry.path] = entry;
+		modified = true;
+
+		cout << "File '" << pathspecs[i] << "' added to the index." << std::endl;
+	}
+
+	if (modified)
+		_gitus->WriteIndex(entries);
+
+	_gitus->FlushHashCache();
+	return success;
 }
 
 
@@ -116,7 +274,16 @@ bool CommitCommand::Execute() {
 
 	if (!BaseCommand::Execute())
 		return false;
-	
+
+	auto entries = map<string, IndexEntry>();
+	if (!_gitus->ReadIndex(entries))
+		return false;
+
+	if (entries.empty())
+	{
+		std::cout << "Your branch is up to date with 'origin/master'" << std::endl;
+		return false;
+	}
 	
 	auto currentTree = _gitus->HashCommitTree();
 	if (currentTree.empty())
@@ -125,75 +292,1454 @@ bool CommitCommand::Execute() {
 		return false;
 	}
 
-	//Check to see if parent hash obj is same as current index
-	auto treeContent = _gitus->CreateContentData(currentTree, GitusService::Tree);
-	string treeStringHash;
-	Utils::Sha1String(treeContent, treeStringHash);
-	if(_gitus->ObjectExists(treeStringHash)) 
+	// Hashed once: when the tree of the index is already stored, nothing changed since a commit
+	RawData directoryTreeObject;
+	bool treeExisted = false;
+	if (!_gitus->HashObject(currentTree, GitusService::Tree, true, directoryTreeObject, treeExisted))
+	{
+		cout << "fatal: unable to write the tree of the index" << endl;
+		return false;
+	}
+
+	if (treeExisted)
 	{
 		std::cout << "nothing to commit, working tree clean" << std::endl;
 		return false;
 	}
 
-	RawData directoryTreeObject;
-	_gitus->HashObject(currentTree, GitusService::Tree, true, directoryTreeObject);
+	time_t utcTime = to_time_t(second_clock::universal_time());
+	RawData commitHash;
+	if (!_gitus->WriteCommit(directoryTreeObject, _msg, _author, _email, utcTime, commitHash))
+	{
+		cout << "fatal: unable to write the commit" << endl;
+		return false;
+	}
+
+	// The branch HEAD points to, which 'WriteCommit' moved
+	string branch;
+	_gitus->HeadBranch(branch);
+
+	string commitHexString;
+	Utils::Sha1ToString(commitHash, commitHexString);
+	std::cout << "committed to branch " + branch + " with commit " + commitHexString.substr(0, 7) << std::endl;
+	return true;
+}
+
+
+
+//--- Branch
+
+bool BranchCommand::Execute() {
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	if (_delete)
+		return Delete();
+
+	return _name.empty() ? List() : Create();
+}
+
+bool BranchCommand::List()
+{
+	using namespace std;
+
+	static const string prefix = "refs/heads/";
+
+	string current;
+	map<string, RawData> branches;
+	if (!_gitus->HeadBranch(current) || !_gitus->ListReferences(prefix, branches))
+	{
+		cout << "fatal: unable to read the branches" << endl;
+		return false;
+	}
+
+	for (auto& branch : branches)
+	{
+		auto name = branch.first.substr(prefix.size());
+		cout << (name == current ? "* " : "  ") << name << endl;
+	}
+
+	return true;
+}
+
+bool BranchCommand::Create()
+{
+	using namespace std;
+	using namespace boost;
+
+	if (!GitusService::IsValidBranchName(_name))
+	{
+		cout << "fatal: '" << _name << "' is not a valid branch name" << endl;
+		return false;
+	}
+
+	RawData existing;
+	if (!_gitus->ResolveReference("refs/heads/" + _name, existing))
+		return false;
+
+	if (!existing.empty())
+	{
+		cout << "fatal: a branch named '" << _name << "' already exists" << endl;
+		return false;
+	}
+
+	// "a" and "a/b" cannot both exist, the loose file of one would be the directory of the other
+	string conflict;
+	for (auto slash = _name.find('/'); conflict.empty() && slash != string::npos; slash = _name.find('/', slash + 1))
+	{
+		auto parent = _name.substr(0, slash);
+		RawData commit;
+		Stats::Add(Stats::StatCalls);
+		if (filesystem::is_regular_file(_gitus->HeadsDirectory() / parent)
+			|| (_gitus->ResolveReference("refs/heads/" + parent, commit) && !commit.empty()))
+			conflict = parent;
+	}
+
+	map<string, RawData> children;
+	Stats::Add(Stats::StatCalls);
+	if (conflict.empty() && (!_gitus->ListReferences("refs/heads/" + _name + "/", children) || !children.empty()
+		|| filesystem::is_directory(_gitus->HeadsDirectory() / _name)))
+		conflict = children.empty() ? _name + "/" : children.begin()->first.substr(strlen("refs/heads/"));
+
+	if (!conflict.empty())
+	{
+		cout << "fatal: cannot create branch '" << _name << "': '" << conflict << "' exists" << endl;
+		return false;
+	}
+
+	// The HEAD commit, else a branch, else a commit id
+	RawData commit;
+	string startPoint = _startPoint;
+	if (startPoint.empty())
+	{
+		_gitus->HeadBranch(startPoint);
+		_gitus->LocalMasterHash(commit);
+	}
+	else if (!GitusService::IsValidBranchName(startPoint) || !_gitus->ResolveReference("refs/heads/" + startPoint, commit)
+		|| commit.empty())
+	{
+		GitusService::ObjectHashType type;
+		size_t size;
+		if (!Utils::StringToSha1(startPoint, commit) || !_gitus->ReadObjectHeader(startPoint, type, size) || type != GitusService::Commit)
+			commit.clear();
+	}
+
+	if (commit.empty())
+	{
+		cout << "fatal: not a valid object name: '" << startPoint << "'" << endl;
+		return false;
+	}
+
+	if (!_gitus->UpdateReference("refs/heads/" + _name, commit))
+	{
+		cout << "fatal: unable to write the branch '" << _name << "'" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool BranchCommand::Delete()
+{
+	using namespace std;
+
+	string current;
+	if (_gitus->HeadBranch(current) && current == _name)
+	{
+		cout << "error: cannot delete branch '" << _name << "' checked out" << endl;
+		return false;
+	}
+
+	RawData commit;
+	if (!GitusService::IsValidBranchName(_name) || !_gitus->ResolveReference("refs/heads/" + _name, commit) || commit.empty())
+	{
+		cout << "error: branch '" << _name << "' not found." << endl;
+		return false;
+	}
+
+	if (!_gitus->DeleteReference("refs/heads/" + _name))
+	{
+		cout << "error: unable to delete branch '" << _name << "'" << endl;
+		return false;
+	}
+
+	string sha1String;
+	Utils::Sha1ToString(commit, sha1String);
+	cout << "Deleted branch " << _name << " (was " << sha1String.substr(0, 7) << ")." << endl;
+	return true;
+}
+
+
+//--- Checkout
+
+bool CheckoutCommand::Execute() {
+
+	using namespace std;
+	using namespace boost;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	auto entries = map<string, IndexEntry>();
+	if (!_gitus->ReadIndex(entries))
+		return false;
+
+	// A pathspec names a file or a directory, relative to the current directory
+	vector<const IndexEntry*> selected;
+	if (_pathspecs.empty())
+	{
+		for (auto& entry : entries)
+			selected.push_back(&entry.second);
+	}
 
-	stringstream content;
-	// Add tree information
-	content << "tree ";
-	content.write(
-		reinterpret_cast<char*>(directoryTreeObject.data()),
-		directoryTreeObject.size() * sizeof(unsigned char));
+	for (auto& pathspec : _pathspecs)
+	{
+		auto fullPath = filesystem::absolute(pathspec).lexically_normal();
+		auto indexPath = fullPath.lexically_relative(_gitus->RepoDirectory()).generic_string();
+		// "dir/" normalizes to "dir/."
+		if (indexPath.size() >= 2 && indexPath.compare(indexPath.size() - 2, 2, "/.") == 0)
+			indexPath.resize(indexPath.size() - 2);
+
+		if (indexPath == ".")
+			indexPath.clear();
+		else if (indexPath.empty() || indexPath.compare(0, 2, "..") == 0)
+		{
+			cout << "fatal: pathspec '" << pathspec << "' is outside repository" << endl;
+			return false;
+		}
 
-	// Add parent commit object information
-	// If has local master and local master is not empty
-	if (_gitus->HasParentTree()) {
-		RawData localMaster;
-		_gitus->LocalMasterHash(localMaster);
+		auto prefix = indexPath + "/";
+		bool matched = false;
+		for (auto& entry : entries)
+		{
+			if (indexPath.empty() || entry.first == indexPath || entry.first.compare(0, prefix.size(), prefix) == 0)
+			{
+				selected.push_back(&entry.second);
+				matched = true;
+			}
+		}
 
-		if (localMaster.size() > 0)
+		if (!matched)
 		{
-			content << '\n';
-			content << "parent ";
-			content.write(
-				reinterpret_cast<char*>(localMaster.data()),
-				directoryTreeObject.size() * sizeof(unsigned char));
+			cout << "error: pathspec '" << pathspec << "' did not match any file(s) known to gitus" << endl;
+			return false;
 		}
 	}
 
-	// Add author information
-	content << '\n';
-	time_t utcTime = to_time_t(second_clock::universal_time());
-	string timezone = "+0000";	
-	content << "author " << _author << utcTime << timezone;
+	// The directories outside of the sparse checkout cone are skipped
+	size_t updated = 0;
+	string failed;
+	if (!_gitus->CheckoutEntries(selected, updated, failed))
+	{
+		cout << "fatal: unable to checkout '" << failed << "'" << endl;
+		return false;
+	}
 
-	// Add commiter information (Simplified: same as author)
-	content << '\n';
-	content << "author " << _author << _email << utcTime << timezone;
+	cout << "Updated " << updated << " path" << (updated == 1 ? "" : "s") << " from the index" << endl;
+	return true;
+}
 
-	// Add linebreak as per the specification
-	content << '\n';
 
-	// Add the message
-	content << '\n';
-	content << _msg;
+//--- Clone
 
-	RawData commitObject(
-		(std::istreambuf_iterator<char>(content)),
-		(std::istreambuf_iterator<char>()));
+bool CloneCommand::Execute() {
 
-	// Get hash representation
-	RawData commitHash;
-	_gitus->HashObject(commitObject, GitusService::Commit, true, commitHash);
-	commitHash.push_back('\n');
+	using namespace std;
+	using namespace boost;
 
-	// Write commit representation to master file
-	boost::filesystem::ofstream ofs{ _gitus->MasterFile() };
-	ofs.write(reinterpret_cast<char*>(commitHash.data()), commitHash.size()*sizeof(unsigned char));
-	
-	string commitHexString;
-	Utils::Sha1String(commitObject, commitHexString);
-	std::cout << "committed to branch master with commit " + commitHexString.substr(0, 7) << std::endl;
+	filesystem::path sourceGitusDirectory;
+	bool sourceBare;
+	if (!GitusService::FindRepository(_source, sourceGitusDirectory, sourceBare))
+	{
+		cout << "fatal: repository '" << _source << "' does not exist" << endl;
+		return false;
+	}
+
+	auto destination = filesystem::absolute(_destination).lexically_normal();
+	Stats::Add(Stats::StatCalls);
+	if (filesystem::exists(destination) && !filesystem::is_empty(destination))
+	{
+		cout << "fatal: destination path '" << _destination << "' already exists and is not an empty directory." << endl;
+		return false;
+	}
+
+	// A bare repository has no work tree, the destination is its '.git' directory
+	auto gitusDirectory = _bare ? destination : destination / ".git";
+	cout << "Cloning into " << (_bare ? "bare repository " : "") << "'" << _destination << "'..." << endl;
+	filesystem::create_directories(gitusDirectory);
+	// The service of this command keeps its repository, e.g for the next commands of a daemon or a batch
+	GitusService clone;
+	clone.SetGitusDirectory(gitusDirectory);
+	clone.CreateLayout();
+
+	// Objects never change once written, they are shared with the source rather than rewritten
+	size_t linked = 0;
+	if (!clone.LinkObjects(sourceGitusDirectory, linked))
+	{
+		cout << "fatal: unable to link the objects of '" << _source << "'" << endl;
+		return false;
+	}
+
+	// Branches change, they are copied in a single 'packed-refs' whatever their number
+	GitusService source;
+	source.SetGitusDirectory(sourceGitusDirectory);
+	map<string, RawData> branches;
+	if (!source.ListReferences("refs/heads/", branches) || !PackedRefs::Write(clone.PackedRefsFile(), branches))
+	{
+		cout << "fatal: unable to copy the branches of '" << _source << "'" << endl;
+		return false;
+	}
+
+	system::error_code ec;
+	filesystem::copy_file(sourceGitusDirectory / "HEAD", clone.HeadFile(), filesystem::copy_option::overwrite_if_exists, ec);
+
+	// The source is the 'origin' remote of fetch and push, tracked for the branch checked out
+	string branch;
+	RawData tip;
+	if (!clone.WriteRemote("origin", sourceBare ? sourceGitusDirectory : sourceGitusDirectory.parent_path())
+		|| !clone.HeadBranch(branch) || !clone.ResolveReference("refs/heads/" + branch, tip)
+		|| (!tip.empty() && !clone.UpdateReference(GitusService::RemoteTrackingReference("origin", branch), tip)))
+	{
+		cout << "fatal: unable to record the remote '" << _source << "'" << endl;
+		return false;
+	}
+
+	if (_bare)
+	{
+		cout << "done, " << linked << " object files linked." << endl;
+		return true;
+	}
+
+	map<string, RawData> head;
+	if (!clone.ReadHeadTree(head))
+	{
+		cout << "fatal: unable to read the last commit of '" << _source << "'" << endl;
+		return false;
+	}
+
+	if (head.empty())
+	{
+		cout << "warning: You appear to have cloned an empty repository." << endl;
+		return true;
+	}
+
+	// The directories collapsed by a sparse checkout of the source are expanded
+	auto entries = map<string, IndexEntry>();
+	for (auto& file : head)
+	{
+		IndexEntry entry;
+		entry.path = file.first;
+		entry.sha1 = file.second;
+		if (file.first.back() == '/')
+			entry.fields[6].n = IndexEntry::SparseDirectoryMode;
+		entries[entry.path] = entry;
+	}
+
+	size_t expanded = 0;
+	do
+	{
+		if (!clone.ExpandIndex(entries, "", expanded))
+		{
+			cout << "fatal: unable to read the trees of '" << _source << "'" << endl;
+			return false;
+		}
+	} while (expanded != 0);
+
+	vector<const IndexEntry*> selected;
+	for (auto& entry : entries)
+		selected.push_back(&entry.second);
+
+	size_t updated = 0;
+	string failed;
+	if (!clone.CheckoutEntries(selected, updated, failed))
+	{
+		cout << "fatal: unable to checkout '" << failed << "'" << endl;
+		return false;
+	}
+
+	if (!clone.WriteIndex(entries))
+		return false;
+
+	cout << "done, " << linked << " object files linked, " << updated << " files checked out." << endl;
 	return true;
 }
 
+
+//--- Fetch
+
+namespace {
+
+	// "   1234567..89abcde  master -> origin/master" and the like, as printed by fetch and push
+	std::string ReferenceUpdateLine(const RawData& previous, const RawData& current, const std::string& source, const std::string& destination)
+	{
+		using namespace std;
+
+		string previousString, currentString;
+		Utils::Sha1ToString(current, currentString);
+		if (previous.empty())
+			return " * [new branch]      " + source + " -> " + destination;
+
+		Utils::Sha1ToString(previous, previousString);
+		return "   " + previousString.substr(0, 7) + ".." + currentString.substr(0, 7) + "  " + source + " -> " + destination;
+	}
+}
+
+bool FetchCommand::Execute() {
+
+	using namespace std;
+	using namespace boost;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	filesystem::path repository;
+	filesystem::path remoteGitusDirectory;
+	bool bare;
+	if (!_gitus->RemoteRepository(_remote, repository) || !GitusService::FindRepository(repository, remoteGitusDirectory, bare))
+	{
+		cout << "fatal: '" << _remote << "' does not appear to be a gitus repository" << endl;
+		return false;
+	}
+
+	// The remote side of the transfer, the local repository only learns its references
+	GitusService remote;
+	remote.SetGitusDirectory(remoteGitusDirectory);
+	UploadPack upload(remote);
+	map<string, RawData> references;
+	if (!upload.Advertise(references))
+	{
+		cout << "fatal: unable to read the references of '" << _remote << "'" << endl;
+		return false;
+	}
+
+	// The remote branch of the same name as the branch checked out
+	string branch;
+	if (!_gitus->HeadBranch(branch))
+	{
+		cout << "fatal: invalid HEAD" << endl;
+		return false;
+	}
+
+	auto tip = references.find("refs/heads/" + branch);
+	if (tip == references.end())
+	{
+		cout << "warning: the remote repository '" << _remote << "' has no branch " << branch << endl;
+		return true;
+	}
+
+	// A remote named by its path has no tracking branch, its commit is recorded in FETCH_HEAD
+	Stats::Add(Stats::StatCalls);
+	auto named = filesystem::exists(_gitus->RemoteFile(_remote));
+	auto tracking = GitusService::RemoteTrackingReference(_remote, branch);
+	RawData previous;
+	RawData local;
+	if (!(named ? _gitus->ResolveReference(tracking, previous) : GitusService::ReadReference(_gitus->FetchHeadFile(), previous))
+		|| !_gitus->ResolveReference("refs/heads/" + branch, local))
+		return false;
+
+	string tipString;
+	Utils::Sha1ToString(tip->second, tipString);
+	if (!_gitus->ObjectExists(tipString))
+	{
+		vector<RawData> common;
+		size_t rounds, sent, reused;
+		if (!Transport::Negotiate(*_gitus, { local, previous }, upload, common, rounds)
+			|| !upload.SendPack({ tip->second }, common, *_gitus, sent, reused) || !_gitus->ObjectExists(tipString))
+		{
+			cout << "fatal: unable to fetch the objects of '" << _remote << "'" << endl;
+			return false;
+		}
+
+		cout << "Received " << sent + reused << " object" << (sent + reused == 1 ? "" : "s") << " (" << reused
+			<< " from existing packs) after " << rounds << " negotiation round" << (rounds == 1 ? "" : "s") << endl;
+	}
+
+	if (previous == tip->second)
+		return true;
+
+	if (!(named ? _gitus->UpdateReference(tracking, tip->second) : GitusService::WriteReference(_gitus->FetchHeadFile(), tip->second)))
+		return false;
+
+	cout << "From " << repository.string() << endl;
+	cout << ReferenceUpdateLine(previous, tip->second, branch, named ? _remote + "/" + branch : "FETCH_HEAD") << endl;
+	return true;
+}
+
+
+//--- Push
+
+bool PushCommand::Execute() {
+
+	using namespace std;
+	using namespace boost;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	filesystem::path repository;
+	filesystem::path remoteGitusDirectory;
+	bool bare;
+	if (!_gitus->RemoteRepository(_remote, repository) || !GitusService::FindRepository(repository, remoteGitusDirectory, bare))
+	{
+		cout << "fatal: '" << _remote << "' does not appear to be a gitus repository" << endl;
+		return false;
+	}
+
+	// The branch checked out, to the remote branch of the same name
+	string branch;
+	if (!_gitus->HeadBranch(branch))
+	{
+		cout << "fatal: invalid HEAD" << endl;
+		return false;
+	}
+	auto reference = "refs/heads/" + branch;
+
+	// Its index and files would no longer match its branch
+	if (!bare)
+	{
+		cout << "error: refusing to update checked out branch: " << reference << " of '" << _remote << "'" << endl;
+		cout << "hint: push to a bare repository (see 'gitus clone --bare')" << endl;
+		return false;
+	}
+
+	RawData local;
+	if (!_gitus->ResolveReference(reference, local) || local.empty())
+	{
+		cout << "error: src refspec " << branch << " does not match any" << endl;
+		return false;
+	}
+
+	GitusService remote;
+	remote.SetGitusDirectory(remoteGitusDirectory);
+	RawData remoteTip;
+	if (!remote.ResolveReference(reference, remoteTip))
+		return false;
+
+	if (remoteTip == local)
+	{
+		cout << "Everything up-to-date" << endl;
+		return true;
+	}
+
+	// The remote commit is the common one, the local repository has it unless the histories diverged
+	if (!remoteTip.empty() && !Transport::IsAncestor(*_gitus, remoteTip, local))
+	{
+		cout << "To " << repository.string() << endl;
+		cout << " ! [rejected]        " << branch << " -> " << branch << " (non-fast-forward)" << endl;
+		cout << "error: failed to push some refs to '" << repository.string() << "'" << endl;
+		return false;
+	}
+
+	UploadPack upload(*_gitus);
+	vector<RawData> common;
+	if (!remoteTip.empty())
+		common.push_back(remoteTip);
+
+	size_t sent, reused;
+	if (!upload.SendPack({ local }, common, remote, sent, reused))
+	{
+		cout << "fatal: unable to send the objects to '" << _remote << "'" << endl;
+		return false;
+	}
+
+	// Another push may have moved the branch meanwhile
+	RawData current;
+	if (!remote.ResolveReference(reference, current) || current != remoteTip
+		|| !remote.UpdateReference(reference, local))
+	{
+		cout << "error: failed to update ref " << branch << " of '" << repository.string() << "'" << endl;
+		return false;
+	}
+
+	Stats::Add(Stats::StatCalls);
+	if (filesystem::exists(_gitus->RemoteFile(_remote)))
+		_gitus->UpdateReference(GitusService::RemoteTrackingReference(_remote, branch), local);
+
+	cout << "Sent " << sent + reused << " object" << (sent + reused == 1 ? "" : "s") << " (" << reused << " from existing packs)" << endl;
+	cout << "To " << repository.string() << endl;
+	cout << ReferenceUpdateLine(remoteTip, local, branch, branch) << endl;
+	return true;
+}
+
+
+//--- Sparse-checkout
+
+bool SparseCheckoutCommand::UpdateWorkTree(const std::map<std::string, IndexEntry>& entries, const std::vector<std::string>& directories)
+{
+	using namespace std;
+	using namespace boost;
+
+	auto workTree = _gitus->RepoDirectory();
+	for (auto& entry : entries)
+	{
+		auto path = workTree / entry.first;
+		auto inCone = directories.empty() || GitusService::InSparseCone(directories, entry.first);
+
+		Stats::Add(Stats::StatCalls);
+		auto exists = filesystem::is_regular_file(path);
+		if (inCone && !exists && !_gitus->CheckoutBlob(entry.second.sha1, path))
+		{
+			cout << "fatal: unable to checkout '" << entry.first << "'" << endl;
+			return false;
+		}
+
+		if (inCone || !exists)
+			continue;
+
+		// Local changes are never lost
+		RawData sha1;
+		if (!_gitus->HashBlobFile(path, false, sha1) || sha1 != entry.second.sha1)
+		{
+			cout << "warning: '" << entry.first << "' has local changes, it is not removed" << endl;
+			continue;
+		}
+
+		system::error_code ec;
+		filesystem::remove(path, ec);
+
+		// Up to the first directory which is not empty
+		for (auto directory = path.parent_path(); directory != workTree && filesystem::is_empty(directory, ec) && !ec;
+			directory = directory.parent_path())
+		{
+			filesystem::remove(directory, ec);
+		}
+	}
+
+	return true;
+}
+
+bool SparseCheckoutCommand::Execute() {
+
+	using namespace std;
+	using namespace boost;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	vector<string> directories;
+	auto enabled = _gitus->SparseCone(directories);
+	if (_action == "list")
+	{
+		if (!enabled)
+		{
+			cout << "fatal: this worktree is not sparse" << endl;
+			return false;
+		}
+
+		for (auto& directory : directories)
+			cout << directory << endl;
+		return true;
+	}
+
+	// The directories are relative to the work tree, as in '.git/info/sparse-checkout'
+	directories.clear();
+	for (auto& directory : _directories)
+	{
+		// "dir/" normalizes to "dir/."
+		auto normalized = filesystem::path(directory).lexically_normal().generic_string();
+		if (normalized.size() >= 2 && normalized.compare(normalized.size() - 2, 2, "/.") == 0)
+			normalized.resize(normalized.size() - 2);
+		if (normalized == ".")
+			normalized.clear();
+
+		if (normalized.empty() || normalized.compare(0, 2, "..") == 0 || filesystem::path(normalized).is_absolute())
+		{
+			cout << "fatal: '" << directory << "' is not a directory of the work tree" << endl;
+			return false;
+		}
+
+		directories.push_back(normalized);
+	}
+
+	auto entries = map<string, IndexEntry>();
+	size_t expanded = 0;
+	if (!_gitus->ReadIndex(entries) || !_gitus->ExpandIndex(entries, "", expanded))
+	{
+		cout << "fatal: unable to read the index" << endl;
+		return false;
+	}
+
+	if (!UpdateWorkTree(entries, directories))
+		return false;
+
+	if (!directories.empty() && !_gitus->CollapseIndex(entries, directories))
+	{
+		cout << "fatal: unable to write the trees of the sparse directories" << endl;
+		return false;
+	}
+
+	if (!_gitus->WriteIndex(entries) || !_gitus->WriteSparseCone(directories))
+	{
+		cout << "fatal: unable to write the sparse checkout" << endl;
+		return false;
+	}
+
+	_gitus->FlushHashCache();
+	return true;
+}
+
+
+//--- Status
+
+bool StatusCommand::Execute() {
+
+	using namespace std;
+	using namespace boost;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	auto& out = *_out;
+	auto entries = map<string, IndexEntry>();
+	if (!_gitus->ReadIndex(entries))
+		return false;
+
+	map<string, RawData> head;
+	if (!_gitus->ReadHeadTree(head))
+	{
+		cout << "fatal: unable to read the last commit" << endl;
+		return false;
+	}
+
+	// The last commit and the index may not collapse the same directories (sparse checkout)
+	// A directory expanded in the index is expanded in the commit, and a directory collapsed in the
+	// index is hashed from the files of the commit below it
+	vector<string> sparseDirectories;
+	for (auto& entry : entries)
+	{
+		if (entry.second.IsSparseDirectory())
+			sparseDirectories.push_back(entry.first);
+	}
+
+	for (auto committed = head.begin(); committed != head.end();)
+	{
+		if (committed->first.back() != '/' || entries.count(committed->first) != 0)
+		{
+			committed++;
+			continue;
+		}
+
+		vector<TreeEntry> treeEntries;
+		if (!_gitus->ReadTree(committed->second, committed->first, treeEntries))
+		{
+			cout << "fatal: unable to read the tree of '" << committed->first << "'" << endl;
+			return false;
+		}
+
+		committed = head.erase(committed);
+		for (auto& treeEntry : treeEntries)
+			head[treeEntry.path] = treeEntry.sha1;
+	}
+
+	for (auto& directory : sparseDirectories)
+	{
+		if (head.count(directory) != 0)
+			continue;
+
+		vector<TreeEntry> treeEntries;
+		auto end = head.lower_bound(directory.substr(0, directory.size() - 1) + char('/' + 1));
+		for (auto committed = head.lower_bound(directory); committed != end;)
+		{
+			TreeEntry treeEntry;
+			treeEntry.mode.n = committed->first.back() == '/' ? IndexEntry::SparseDirectoryMode : 0;
+			treeEntry.path = committed->first.substr(directory.size(), committed->first.size() - directory.size() - (treeEntry.mode.n != 0 ? 1 : 0));
+			treeEntry.sha1 = committed->second;
+			treeEntries.push_back(treeEntry);
+			committed = head.erase(committed);
+		}
+
+		if (!treeEntries.empty())
+			_gitus->HashObject(GitusService::CreateTreeData(treeEntries), GitusService::Tree, false, head[directory]);
+	}
+
+	// Paths are shown relative to the current directory, as given to add
+	auto currentDirectory = filesystem::current_path();
+	auto display = [&](const string& path) {
+		return (_gitus->RepoDirectory() / path).lexically_relative(currentDirectory).generic_string();
+	};
+
+	// The index against the last commit
+	map<string, string> staged;
+	for (auto& entry : entries)
+	{
+		auto committed = head.find(entry.first);
+		if (committed == head.end())
+			staged[entry.first] = "new file:   ";
+		else if (committed->second != entry.second.sha1)
+			staged[entry.first] = "modified:   ";
+	}
+
+	for (auto& committed : head)
+	{
+		if (entries.count(committed.first) == 0)
+			staged[committed.first] = "deleted:    ";
+	}
+
+	// The working tree against the index
+	vector<pair<string, string>> unstaged;
+	for (auto& entry : entries)
+	{
+		// Not checked out
+		if (entry.second.IsSparseDirectory())
+			continue;
+
+		RawData sha1;
+		if (!_gitus->HashBlobFile(_gitus->RepoDirectory() / entry.first, false, sha1))
+			unstaged.push_back(make_pair(entry.first, "deleted:    "));
+		else if (sha1 != entry.second.sha1)
+			unstaged.push_back(make_pair(entry.first, "modified:   "));
+	}
+
+	vector<string> files;
+	_gitus->ListWorkTreeFiles(_gitus->RepoDirectory(), files);
+	_gitus->FlushHashCache();
+
+	string branch;
+	if (!_gitus->HeadBranch(branch))
+	{
+		cout << "fatal: invalid HEAD" << endl;
+		return false;
+	}
+
+	out << "On branch " << branch << endl;
+	if (!staged.empty())
+	{
+		out << "Changes to be committed:" << endl;
+		for (auto& change : staged)
+			out << "\t" << change.second << display(change.first) << endl;
+		out << endl;
+	}
+
+	if (!unstaged.empty())
+	{
+		out << "Changes not staged for commit:" << endl;
+		for (auto& change : unstaged)
+			out << "\t" << change.second << display(change.first) << endl;
+		out << endl;
+	}
+
+	auto untracked = false;
+	for (auto& file : files)
+	{
+		auto sparse = any_of(sparseDirectories.begin(), sparseDirectories.end(), [&](const string& directory) {
+			return file.compare(0, directory.size(), directory) == 0;
+		});
+		if (sparse || entries.count(file) != 0)
+			continue;
+
+		if (!untracked)
+			out << "Untracked files:" << endl;
+		untracked = true;
+		out << "\t" << display(file) << endl;
+	}
+
+	if (untracked)
+		out << endl;
+
+	if (staged.empty() && unstaged.empty())
+		out << (untracked ? "nothing added to commit but untracked files present" : "nothing to commit, working tree clean") << endl;
+
+	return true;
+}
+
+
+//--- Hash-object
+
+bool HashObjectCommand::Execute() {
+
+	using namespace std;
+	using namespace boost;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	for (auto& file : _files)
+	{
+		RawData sha1;
+		string sha1String;
+		auto fullPath = filesystem::absolute(file).lexically_normal();
+		if (!filesystem::is_regular_file(fullPath) || !_gitus->HashBlobFile(fullPath, _write, sha1)
+			|| !Utils::Sha1ToString(sha1, sha1String))
+		{
+			cout << "fatal: unable to hash '" << file << "'" << endl;
+			return false;
+		}
+
+		cout << sha1String << endl;
+	}
+
+	_gitus->FlushHashCache();
+	return true;
+}
+
+
+//--- Multi-pack-index
+
+bool MultiPackIndexCommand::Execute() {
+
+	using namespace std;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	if (_action != "write")
+	{
+		cout << "error: unrecognized subcommand: " << _action << endl;
+		return false;
+	}
+
+	size_t packs, objects;
+	if (!_gitus->WriteMultiPackIndex(packs, objects))
+	{
+		cout << "fatal: unable to write the multi-pack index" << endl;
+		return false;
+	}
+
+	cout << "Indexed " << objects << " object" << (objects == 1 ? "" : "s") << " of " << packs << " pack" << (packs == 1 ? "" : "s") << endl;
+	return true;
+}
+
+
+//--- Repack
+
+bool RepackCommand::Execute() {
+
+	using namespace std;
+	using namespace boost;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	if (_options.depth > GitusService::MaxDeltaDepth)
+	{
+		cout << "fatal: the depth cannot be above " << GitusService::MaxDeltaDepth << endl;
+		return false;
+	}
+
+	auto threads = _options.threads == 0 ? ThreadPool::DefaultThreadCount() : _options.threads;
+	cout << "Delta compression using up to " << threads << " thread" << (threads == 1 ? "" : "s") << endl;
+
+	size_t objects, deltas;
+	filesystem::path packPath;
+	if (!Repacker::Repack(*_gitus, _options, objects, deltas, packPath))
+	{
+		cout << "fatal: unable to repack the objects" << endl;
+		return false;
+	}
+
+	if (packPath.empty())
+	{
+		cout << "Nothing new to pack." << endl;
+		return true;
+	}
+
+	cout << "Wrote " << objects << " object" << (objects == 1 ? "" : "s") << " (" << deltas << " delta" << (deltas == 1 ? "" : "s")
+		<< ") to " << packPath.filename().string() << endl;
+	return true;
+}
+
+
+//--- Pack-refs
+
+bool PackRefsCommand::Execute() {
+
+	using namespace std;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	size_t packed;
+	if (!_gitus->PackReferences(packed))
+	{
+		cout << "fatal: unable to pack the references" << endl;
+		return false;
+	}
+
+	cout << "Packed " << packed << " reference" << (packed == 1 ? "" : "s") << endl;
+	return true;
+}
+
+
+//--- Fsck
+
+namespace {
+
+	struct FsckReference
+	{
+		std::string sha1String;
+		GitusService::ObjectHashType expectedType;
+	};
+
+	// Re-hashes and parses the inflated content of a single object, collecting the objects it references
+	bool FsckContent(const std::string& sha1String, const std::string& content, GitusService::ObjectHashType& type, std::vector<FsckReference>& references, std::string& error)
+	{
+		using namespace std;
+
+		string contentHash;
+		Utils::Sha1String(content, contentHash);
+		if (contentHash != sha1String)
+		{
+			error = "hash mismatch (content hashes to " + contentHash + ")";
+			return false;
+		}
+
+		RawData object;
+		if (!GitusService::ParseContentData(content, type, object))
+		{
+			error = "invalid object header";
+			return false;
+		}
+
+		string refString;
+		if (type == GitusService::Tree)
+		{
+			vector<TreeEntry> entries;
+			if (!GitusService::ParseTree(object, entries))
+			{
+				error = "malformed tree";
+				return false;
+			}
+
+			for (auto& entry : entries)
+			{
+				// The directories collapsed by a sparse index are trees
+				auto subtree = entry.mode.n == IndexEntry::SparseDirectoryMode;
+				Utils::Sha1ToString(entry.sha1, refString);
+				references.push_back({ refString, subtree ? GitusService::Tree : GitusService::Blob });
+			}
+		}
+		else if (type == GitusService::Commit)
+		{
+			RawData tree;
+			vector<RawData> parents;
+			if (!GitusService::ParseCommit(object, tree, parents))
+			{
+				error = "malformed commit";
+				return false;
+			}
+
+			Utils::Sha1ToString(tree, refString);
+			references.push_back({ refString, GitusService::Tree });
+
+			for (auto& parent : parents)
+			{
+				Utils::Sha1ToString(parent, refString);
+				references.push_back({ refString, GitusService::Commit });
+			}
+		}
+		else if (type == GitusService::Chunks)
+		{
+			vector<ChunkEntry> chunks;
+			if (!GitusService::ParseChunks(object, chunks))
+			{
+				error = "malformed chunk list";
+				return false;
+			}
+
+			for (auto& chunk : chunks)
+			{
+				Utils::Sha1ToString(chunk.sha1, refString);
+				references.push_back({ refString, GitusService::Blob });
+			}
+		}
+
+		return true;
+	}
+
+	// Checks the i-th object of 'pack', or the object 'sha1String' as read from its loose file first when
+	// 'pack' is nullptr. A packed copy is read from its own pack, a loose copy does not hide it.
+	bool FsckObject(GitusService& gitus, const PackIndex* pack, size_t i, const std::string& sha1String, GitusService::ObjectHashType& type, std::vector<FsckReference>& references, std::string& error)
+	{
+		using namespace std;
+
+		try
+		{
+			string content;
+			if (pack != nullptr ? !gitus.ReadPackedContent(*pack, i, content) : !gitus.ReadObjectContent(sha1String, content))
+			{
+				error = "unreadable object";
+				return false;
+			}
+
+			return FsckContent(sha1String, content, type, references, error);
+		}
+		catch (const std::exception& e)
+		{
+			error = string("unreadable object: ") + e.what();
+			return false;
+		}
+	}
+}
+
+bool FsckCommand::Execute() {
+
+	using namespace std;
+	using namespace boost;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	// Work is distributed by fanout directory ('objects/xx/')
+	vector<filesystem::path> fanoutDirectories;
+	if (filesystem::exists(_gitus->ObjectsDirectory()))
+	{
+		Stats::Add(Stats::ReaddirCalls);
+		for (filesystem::directory_iterator it(_gitus->ObjectsDirectory()); it != filesystem::directory_iterator(); it++)
+		{
+			auto name = it->path().filename().string();
+			if (filesystem::is_directory(it->path()) && name.size() == 2
+				&& name.find_first_not_of("0123456789abcdef") == string::npos)
+			{
+				fanoutDirectories.push_back(it->path());
+			}
+		}
+	}
+
+	// and by pack
+	auto packs = _gitus->Packs();
+
+	mutex resultsMutex;
+	map<string, GitusService::ObjectHashType> objects;
+	vector<FsckReference> references;
+	vector<string> errors;
+
+	atomic<size_t> checkedObjects(0);
+	atomic<size_t> checkedDirectories(0);
+
+	auto printProgress = [&]() {
+		cerr << "Checking object directories: " << checkedDirectories.load() << "/" << fanoutDirectories.size() + packs.size()
+			<< " (" << checkedObjects.load() << " objects)\r" << flush;
+	};
+
+	{
+		ThreadPool pool;
+		for (auto& directory : fanoutDirectories)
+		{
+			pool.Enqueue([&, directory]() {
+				GITUS_TRACE_SCOPE("FsckCommand::CheckDirectory");
+				map<string, GitusService::ObjectHashType> localObjects;
+				vector<FsckReference> localReferences;
+				vector<string> localErrors;
+
+				try
+				{
+					auto prefix = directory.filename().string();
+					Stats::Add(Stats::ReaddirCalls);
+					for (filesystem::directory_iterator it(directory); it != filesystem::directory_iterator(); it++)
+					{
+						// Object being written, or left behind by an interrupted write (see 'HashObject')
+						if (it->path().extension() == ".tmp")
+							continue;
+
+						auto sha1String = prefix + it->path().filename().string();
+						if (sha1String.size() != 40 || sha1String.find_first_not_of("0123456789abcdef") != string::npos)
+						{
+							localErrors.push_back("error: " + it->path().string() + ": invalid object name");
+							continue;
+						}
+
+						GitusService::ObjectHashType type;
+						string error;
+						if (FsckObject(*_gitus, nullptr, 0, sha1String, type, localReferences, error))
+							localObjects[sha1String] = type;
+						else
+							localErrors.push_back("error: " + sha1String + ": " + error);
+
+						checkedObjects++;
+					}
+				}
+				catch (const std::exception& e)
+				{
+					localErrors.push_back("error: " + directory.string() + ": " + e.what());
+				}
+
+				lock_guard<mutex> lock(resultsMutex);
+				objects.insert(localObjects.begin(), localObjects.end());
+				references.insert(references.end(), localReferences.begin(), localReferences.end());
+				errors.insert(errors.end(), localErrors.begin(), localErrors.end());
+				checkedDirectories++;
+			});
+		}
+
+		for (auto& pack : packs)
+		{
+			pool.Enqueue([&, pack]() {
+				GITUS_TRACE_SCOPE("FsckCommand::CheckPack");
+				map<string, GitusService::ObjectHashType> localObjects;
+				vector<FsckReference> localReferences;
+				vector<string> localErrors;
+
+				string sha1String;
+				for (size_t i = 0; i < pack->Count(); i++)
+				{
+					Utils::Sha1ToString(pack->Sha1(i), sha1String);
+
+					GitusService::ObjectHashType type;
+					string error;
+					if (FsckObject(*_gitus, pack.get(), i, sha1String, type, localReferences, error))
+						localObjects[sha1String] = type;
+					else
+						localErrors.push_back("error: " + sha1String + ": " + error);
+
+					checkedObjects++;
+				}
+
+				lock_guard<mutex> lock(resultsMutex);
+				objects.insert(localObjects.begin(), localObjects.end());
+				references.insert(references.end(), localReferences.begin(), localReferences.end());
+				errors.insert(errors.end(), localErrors.begin(), localErrors.end());
+				checkedDirectories++;
+			});
+		}
+
+		while (!pool.WaitFor(chrono::milliseconds(200)))
+			printProgress();
+	}
+
+	printProgress();
+	cerr << endl;
+
+	// The branches, the commits fetched from the remotes and the index entries are the roots of the object graph
+	vector<FsckReference> roots;
+	string rootString;
+	map<string, RawData> branches;
+	if (!_gitus->ListReferences("refs/", branches))
+		errors.push_back("error: unable to read the references");
+
+	for (auto& branch : branches)
+	{
+		Utils::Sha1ToString(branch.second, rootString);
+		roots.push_back({ rootString, GitusService::Commit });
+	}
+
+	auto entries = map<string, IndexEntry>();
+	_gitus->ReadIndex(entries);
+	for (auto& entry : entries)
+	{
+		Utils::Sha1ToString(entry.second.sha1, rootString);
+		roots.push_back({ rootString, entry.second.IsSparseDirectory() ? GitusService::Tree : GitusService::Blob });
+	}
+
+	set<string> referenced;
+	set<string> missing;
+	for (auto* list : { &references, &roots })
+	{
+		for (auto& reference : *list)
+		{
+			referenced.insert(reference.sha1String);
+
+			auto object = objects.find(reference.sha1String);
+			if (object == objects.end())
+			{
+				if (missing.insert(reference.sha1String).second)
+					errors.push_back("missing " + GitusService::TypeName(reference.expectedType) + " " + reference.sha1String);
+			}
+			else if (object->second != reference.expectedType && reference.expectedType != GitusService::Blob)
+			{
+				errors.push_back("error: " + reference.sha1String + ": expected " + GitusService::TypeName(reference.expectedType)
+					+ ", found " + GitusService::TypeName(object->second));
+			}
+		}
+	}
+
+	for (auto& error : errors)
+		cout << error << endl;
+
+	for (auto& object : objects)
+	{
+		if (referenced.count(object.first) == 0)
+			cout << "dangling " << GitusService::TypeName(object.second) << " " << object.first << endl;
+	}
+
+	return errors.empty();
+}
+
+
+//--- Cat-file
+
+bool CatFileCommand::Execute() {
+
+	using namespace std;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	// Reading the next id must not flush the records written so far
+	auto* tied = _in->tie(nullptr);
+
+	// Records are '<id> <type> <size>' followed by the content when not in check mode
+	string sha1String;
+	RawData object;
+	while (getline(*_in, sha1String))
+	{
+		if (!sha1String.empty() && sha1String.back() == '\r')
+			sha1String.pop_back();
+
+		GitusService::ObjectHashType type;
+		size_t size = 0;
+		bool found;
+		try
+		{
+			if (_checkOnly)
+			{
+				found = _gitus->ReadObjectHeader(sha1String, type, size);
+			}
+			else
+			{
+				found = _gitus->ReadObject(sha1String, type, object);
+				size = object.size();
+			}
+		}
+		catch (const std::exception&)
+		{
+			found = false;
+		}
+
+		if (!found)
+		{
+			*_out << sha1String << " missing\n";
+		}
+		else
+		{
+			*_out << sha1String << ' ' << GitusService::TypeName(type) << ' ' << size << '\n';
+			if (!_checkOnly)
+			{
+				_out->write(reinterpret_cast<const char*>(object.data()), object.size());
+				*_out << '\n';
+			}
+		}
+
+		if (!_buffer)
+			_out->flush();
+	}
+
+	_out->flush();
+	_in->tie(tied);
+	return true;
+}
+
+
+//--- Daemon
+
+bool DaemonCommand::Execute() {
+
+	using namespace std;
+
+	if (!BaseCommand::Execute())
+		return false;
+
+	// A running daemon handles '--stop' itself, see 'GitusDaemon::Forward'
+	if (_stop)
+	{
+		cout << "No gitus daemon is serving " << _gitus->RepoDirectory().string() << endl;
+		return false;
+	}
+
+	GitusDaemon daemon(_gitus, _createCommand);
+	return daemon.Run();
+}
+
+
+//--- Batch
+
+std::vector<std::string> BatchCommand::SplitCommandLine(const std::string& line)
+{
+	using namespace std;
+
+	vector<string> args;
+	string current;
+	bool inArgument = false;
+	char quote = 0;
+
+	for (size_t i = 0; i < line.size(); i++)
+	{
+		char c = line[i];
+		if (c == '\\' && i + 1 < line.size() && quote != '\'')
+		{
+			current += line[++i];
+			inArgument = true;
+		}
+		else if (quote != 0)
+		{
+			if (c == quote)
+				quote = 0;
+			else
+				current += c;
+		}
+		else if (c == '"' || c == '\'')
+		{
+			quote = c;
+			inArgument = true;
+		}
+		else if (isspace(static_cast<unsigned char>(c)))
+		{
+			if (inArgument)
+				args.push_back(current);
+			current.clear();
+			inArgument = false;
+		}
+		else
+		{
+			current += c;
+			inArgument = true;
+		}
+	}
+
+	if (inArgument)
+		args.push_back(current);
+
+	return args;
+}
+
+bool StatsCommand::Execute() {
+
+	// Does not need a repository, the counters belong to the process
+	Stats::WriteJson(*_out);
+
+	if (_reset)
+		Stats::Reset();
+
+	return true;
+}
+
+bool BatchCommand::Execute() {
+
+	using namespace std;
+
+	// The index is kept in memory between commands and written once at the end
+	_gitus->SetDeferIndexWrites(true);
+
+	bool success = true;
+	string line;
+	while (getline(*_in, line))
+	{
+		auto args = SplitCommandLine(line);
+		if (args.empty() || args[0][0] == '#')
+			continue;
+
+		// These would compete with the batch for the standard input
+		if (args[0] == "--batch" || args[0] == "cat-file" || args[0] == "daemon")
+		{
+			cout << "gitus: '" << args[0] << "' is not supported in batch mode" << endl;
+			success = false;
+			continue;
+		}
+
+		try
+		{
+			// Scratch memory is released after every command rather than at the end of the batch
+			ArenaScope arena;
+			auto cmd = _createCommand(args);
+			success = cmd && cmd->Execute() && success;
+		}
+		catch (const std::exception& e)
+		{
+			cout << "fatal: " << e.what() << endl;
+			success = false;
+		}
+	}
+
+	_gitus->SetDeferIndexWrites(false);
+	return success;
+}
@@ -4,9 +4,13 @@
 #include <iostream>
 #include <ctime>
 #include <memory>
+#include <functional>
+#include <string>
+#include <vector>
 
 
 #include "gitus_service.h"
+#include "repack.h"
 
 class BaseCommand {
 
@@ -32,6 +36,9 @@ public:
 	}
 };
 
+// Creates a command from its arguments (excluding the program name)
+typedef std::function<std::shared_ptr<BaseCommand>(const std::vector<std::string>&)> CommandFactory;
+
 //--- Help
 
 class HelpCommand : public BaseCommand {
@@ -63,10 +70,6 @@ public:
 };
 
 class InitCommand : public BaseCommand {
-private:
-
-	bool Init();
-	
 public:
 	InitCommand(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
 
@@ -81,20 +84,27 @@ public:
 
 	virtual bool Execute() override
 	{
-		std::cout<< "usage: gitus add <pathspec>" << std::endl;
+		std::cout<< "usage: gitus add <pathspec>..." << std::endl;
 		return true;
 	};
 };
 
+// The files are read and their objects written in batches (see 'IoEngine')
+// A directory adds the files below it, except the ones excluded by '.gitignore' files
 class AddCommand : public BaseCommand {
 private:
-	std::string _pathspec;
+	std::vector<std::string> _pathspecs;
 
 public:
 
 	AddCommand(const std::shared_ptr<GitusService>& gitus, std::string pathspec) : BaseCommand(gitus)
 	{
-		_pathspec = pathspec;
+		_pathspecs.push_back(pathspec);
+	};
+
+	AddCommand(const std::shared_ptr<GitusService>& gitus, const std::vector<std::string>& pathspecs) : BaseCommand(gitus)
+	{
+		_pathspecs = pathspecs;
 	};
 
 	virtual bool Execute() override;
@@ -147,4 +157,471 @@ public:
 
 };
 
+
+//--- Branch
+
+class BranchCommandHelp : public BaseCommand {
+public:
+	BranchCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus branch" << std::endl;
+		std::cout << "   or: gitus branch <branchname> [<start-point>]" << std::endl;
+		std::cout << "   or: gitus branch -d <branchname>" << std::endl;
+		return true;
+	};
+};
+
+// Lists the branches, creates one at the HEAD commit or at 'startPoint' (a branch or a commit id),
+// or deletes one. Deleting does not check that the branch was merged.
+class BranchCommand : public BaseCommand {
+private:
+	std::string _name;
+	std::string _startPoint;
+	bool _delete;
+
+	bool List();
+	bool Create();
+	bool Delete();
+
+public:
+	BranchCommand(const std::shared_ptr<GitusService>& gitus, const std::string& name = "", const std::string& startPoint = "", bool remove = false) : BaseCommand(gitus)
+	{
+		_name = name;
+		_startPoint = startPoint;
+		_delete = remove;
+	};
+
+	virtual bool Execute() override;
+};
+
+
+//--- Checkout
+
+class CheckoutCommandHelp : public BaseCommand {
+public:
+	CheckoutCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus checkout [<pathspec>...]" << std::endl;
+		return true;
+	};
+};
+
+// Restores files of the working tree from the index, every indexed file when no pathspec is given
+// The content of large files is fetched from the large file remote when missing locally.
+class CheckoutCommand : public BaseCommand {
+private:
+	std::vector<std::string> _pathspecs;
+
+public:
+	CheckoutCommand(const std::shared_ptr<GitusService>& gitus, const std::vector<std::string>& pathspecs) : BaseCommand(gitus)
+	{
+		_pathspecs = pathspecs;
+	};
+
+	virtual bool Execute() override;
+};
+
+
+//--- Clone
+
+class CloneCommandHelp : public BaseCommand {
+public:
+	CloneCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus clone [--bare] <repository> <directory>" << std::endl;
+		return true;
+	};
+};
+
+// Clones a local repository: the object files are hard linked (or copied when the source is on
+// another file system), the references copied, and the files of the last commit checked out in parallel
+// The source becomes the 'origin' remote. A bare clone has no work tree, it is a target for push.
+class CloneCommand : public BaseCommand {
+private:
+	std::string _source;
+	std::string _destination;
+	bool _bare;
+
+public:
+	CloneCommand(const std::shared_ptr<GitusService>& gitus, const std::string& source, const std::string& destination, bool bare = false) : BaseCommand(gitus)
+	{
+		_source = source;
+		_destination = destination;
+		_bare = bare;
+	};
+
+	virtual bool Execute() override;
+};
+
+
+//--- Fetch
+
+class FetchCommandHelp : public BaseCommand {
+public:
+	FetchCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus fetch [<repository>]" << std::endl;
+		return true;
+	};
+};
+
+// Receives the commits of the master branch of a local repository (a remote name, 'origin' by
+// default, or a path) missing from this one, as a single pack (see 'UploadPack')
+class FetchCommand : public BaseCommand {
+private:
+	std::string _remote;
+
+public:
+	FetchCommand(const std::shared_ptr<GitusService>& gitus, const std::string& remote) : BaseCommand(gitus)
+	{
+		_remote = remote;
+	};
+
+	virtual bool Execute() override;
+};
+
+
+//--- Push
+
+class PushCommandHelp : public BaseCommand {
+public:
+	PushCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus push [<repository>]" << std::endl;
+		return true;
+	};
+};
+
+// Sends the master branch to a bare local repository, when it is a fast-forward of the remote one
+class PushCommand : public BaseCommand {
+private:
+	std::string _remote;
+
+public:
+	PushCommand(const std::shared_ptr<GitusService>& gitus, const std::string& remote) : BaseCommand(gitus)
+	{
+		_remote = remote;
+	};
+
+	virtual bool Execute() override;
+};
+
+
+//--- Sparse-checkout
+
+class SparseCheckoutCommandHelp : public BaseCommand {
+public:
+	SparseCheckoutCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus sparse-checkout (set <directory>... | list | disable)" << std::endl;
+		return true;
+	};
+};
+
+// Restricts the working tree to the cone of some directories (see 'GitusService::SparseCone')
+// 'set' removes the unmodified files which leave the cone, checks out the files which enter it and
+// collapses the index outside of the cone, 'disable' checks out every file again.
+class SparseCheckoutCommand : public BaseCommand {
+private:
+	std::string _action;
+	std::vector<std::string> _directories;
+
+	bool UpdateWorkTree(const std::map<std::string, IndexEntry>& entries, const std::vector<std::string>& directories);
+
+public:
+	SparseCheckoutCommand(const std::shared_ptr<GitusService>& gitus, const std::string& action, const std::vector<std::string>& directories) : BaseCommand(gitus)
+	{
+		_action = action;
+		_directories = directories;
+	};
+
+	virtual bool Execute() override;
+};
+
+
+//--- Status
+
+class StatusCommandHelp : public BaseCommand {
+public:
+	StatusCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus status" << std::endl;
+		return true;
+	};
+};
+
+// Compares the index with the last commit and the working tree with the index, and lists the
+// untracked files which are not ignored
+// Unchanged files are recognized from the hash cache, they are neither read nor hashed.
+class StatusCommand : public BaseCommand {
+private:
+	std::ostream* _out;
+
+public:
+	StatusCommand(const std::shared_ptr<GitusService>& gitus, std::ostream& out = std::cout) : BaseCommand(gitus)
+	{
+		_out = &out;
+	};
+
+	virtual bool Execute() override;
+};
+
+
+//--- Hash-object
+
+class HashObjectCommandHelp : public BaseCommand {
+public:
+	HashObjectCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus hash-object [-w] <file>..." << std::endl;
+		return true;
+	};
+};
+
+// Prints the blob id of files, and writes the blobs with '-w'
+// The id of a file unchanged since it was last hashed comes from the hash cache.
+class HashObjectCommand : public BaseCommand {
+private:
+	std::vector<std::string> _files;
+	bool _write;
+
+public:
+	HashObjectCommand(const std::shared_ptr<GitusService>& gitus, const std::vector<std::string>& files, bool write) : BaseCommand(gitus)
+	{
+		_files = files;
+		_write = write;
+	};
+
+	virtual bool Execute() override;
+};
+
+
+//--- Multi-pack-index
+
+class MultiPackIndexCommandHelp : public BaseCommand {
+public:
+	MultiPackIndexCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus multi-pack-index write" << std::endl;
+		return true;
+	};
+};
+
+// Indexes the objects of all the packs in one file, so that looking an object up no longer
+// searches the index of every pack
+class MultiPackIndexCommand : public BaseCommand {
+private:
+	std::string _action;
+
+public:
+	MultiPackIndexCommand(const std::shared_ptr<GitusService>& gitus, const std::string& action) : BaseCommand(gitus)
+	{
+		_action = action;
+	};
+
+	virtual bool Execute() override;
+};
+
+
+//--- Repack
+
+class RepackCommandHelp : public BaseCommand {
+public:
+	RepackCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus repack [--window=<n>] [--depth=<n>] [--window-memory=<bytes>] [--threads=<n>]" << std::endl;
+		return true;
+	};
+};
+
+// Packs all the objects in a single pack, storing similar objects as deltas (see 'Repacker')
+class RepackCommand : public BaseCommand {
+private:
+	Repacker::Options _options;
+
+public:
+	RepackCommand(const std::shared_ptr<GitusService>& gitus, const Repacker::Options& options) : BaseCommand(gitus)
+	{
+		_options = options;
+	};
+
+	virtual bool Execute() override;
+};
+
+
+//--- Pack-refs
+
+class PackRefsCommandHelp : public BaseCommand {
+public:
+	PackRefsCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus pack-refs" << std::endl;
+		return true;
+	};
+};
+
+// Moves the loose references to 'packed-refs', where a reference is found by a binary search rather
+// than by opening its own file
+class PackRefsCommand : public BaseCommand {
+public:
+	PackRefsCommand(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override;
+};
+
+
+//--- Fsck
+
+class FsckCommandHelp : public BaseCommand {
+public:
+	FsckCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus fsck" << std::endl;
+		return true;
+	};
+};
+
+class FsckCommand : public BaseCommand {
+public:
+	FsckCommand(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override;
+};
+
+//--- Cat-file
+
+class CatFileCommandHelp : public BaseCommand {
+public:
+	CatFileCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus cat-file (--batch | --batch-check) [--buffer]" << std::endl;
+		return true;
+	};
+};
+
+class CatFileCommand : public BaseCommand {
+private:
+	// With 'checkOnly' the content of the objects is not printed
+	bool _checkOnly;
+	// With 'buffer' the output is only flushed once the input is exhausted
+	bool _buffer;
+
+	std::istream* _in;
+	std::ostream* _out;
+
+public:
+	CatFileCommand(const std::shared_ptr<GitusService>& gitus, bool checkOnly, bool buffer, std::istream& in = std::cin, std::ostream& out = std::cout) : BaseCommand(gitus)
+	{
+		_checkOnly = checkOnly;
+		_buffer = buffer;
+		_in = &in;
+		_out = &out;
+	};
+
+	virtual bool Execute() override;
+};
+
+//--- Daemon
+
+class DaemonCommandHelp : public BaseCommand {
+public:
+	DaemonCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus daemon [--stop]" << std::endl;
+		return true;
+	};
+};
+
+class DaemonCommand : public BaseCommand {
+private:
+	CommandFactory _createCommand;
+	bool _stop;
+
+public:
+	DaemonCommand(const std::shared_ptr<GitusService>& gitus, CommandFactory createCommand, bool stop) : BaseCommand(gitus)
+	{
+		_createCommand = createCommand;
+		_stop = stop;
+	};
+
+	virtual bool Execute() override;
+};
+
+//--- Stats
+
+class StatsCommandHelp : public BaseCommand {
+public:
+	StatsCommandHelp(const std::shared_ptr<GitusService>& gitus) : BaseCommand(gitus) {}
+
+	virtual bool Execute() override
+	{
+		std::cout << "usage: gitus stats [--reset]" << std::endl;
+		return true;
+	};
+};
+
+// Prints the counters of the process executing it, which is the daemon when one serves the repository
+class StatsCommand : public BaseCommand {
+private:
+	bool _reset;
+	std::ostream* _out;
+
+public:
+	StatsCommand(const std::shared_ptr<GitusService>& gitus, bool reset, std::ostream& out = std::cout) : BaseCommand(gitus)
+	{
+		_reset = reset;
+		_out = &out;
+	};
+
+	virtual bool Execute() override;
+};
+
+//--- Batch
+
+class BatchCommand : public BaseCommand {
+private:
+	CommandFactory _createCommand;
+	std::istream* _in;
+
+public:
+	BatchCommand(const std::shared_ptr<GitusService>& gitus, CommandFactory createCommand, std::istream& in = std::cin) : BaseCommand(gitus)
+	{
+		_createCommand = createCommand;
+		_in = &in;
+	};
+
+	// Splits a line into arguments, honouring quotes and backslash escapes
+	static std::vector<std::string> SplitCommandLine(const std::string& line);
+
+	virtual bool Execute() override;
+};
+
 #endif
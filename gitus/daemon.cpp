@@ -0,0 +1,335 @@
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+
+#include <boost/filesystem.hpp>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+#include "arena.h"
+#include "daemon.h"
+
+namespace {
+
+	volatile std::sig_atomic_t TerminationRequested = 0;
+
+	void RequestTermination(int)
+	{
+		TerminationRequested = 1;
+	}
+
+	// Commands which need the terminal of the client or must not reach a daemon
+	bool RunsLocally(const std::vector<std::string>& args)
+	{
+		if (args.empty())
+			return true;
+
+		// Counters and traces are per process, they must be those of this command
+		for (auto& arg : args)
+		{
+			if (arg == "--stats" || arg == "--timings" || arg.compare(0, 14, "--trace-output") == 0)
+				return true;
+		}
+
+		for (auto variable : { "GITUS_STATS", "GITUS_TRACE" })
+		{
+			auto value = std::getenv(variable);
+			if (value != nullptr && *value != 0 && std::string(value) != "0")
+				return true;
+		}
+
+		auto& name = args[0];
+		if (name == "daemon")
+			return args.size() < 2 || args[1] != "--stop";
+
+		return name == "init" || name == "help" || name == "cat-file" || name == "--batch";
+	}
+
+#ifndef _WIN32
+	bool WriteAll(int fd, const char* data, size_t size)
+	{
+		while (size > 0)
+		{
+			auto written = ::write(fd, data, size);
+			if (written <= 0)
+				return false;
+
+			data += written;
+			size -= written;
+		}
+
+		return true;
+	}
+
+	bool ReadAll(int fd, char* data, size_t size)
+	{
+		while (size > 0)
+		{
+			auto received = ::read(fd, data, size);
+			if (received <= 0)
+				return false;
+
+			data += received;
+			size -= received;
+		}
+
+		return true;
+	}
+
+	bool SocketAddress(const boost::filesystem::path& socketFile, sockaddr_un& address)
+	{
+		auto path = socketFile.string();
+		std::memset(&address, 0, sizeof(address));
+		if (path.size() >= sizeof(address.sun_path))
+			return false;
+
+		address.sun_family = AF_UNIX;
+		std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+		return true;
+	}
+
+	int Connect(const boost::filesystem::path& socketFile)
+	{
+		sockaddr_un address;
+		if (!SocketAddress(socketFile, address))
+			return -1;
+
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+
+		if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+
+		return fd;
+	}
+#endif
+}
+
+bool GitusDaemon::WriteMessage(int fd, const std::vector<std::string>& fields)
+{
+#ifndef _WIN32
+	std::string message;
+	uint32_t count = fields.size();
+	message.append(reinterpret_cast<char*>(&count), sizeof(count));
+	for (auto& field : fields)
+	{
+		uint32_t size = field.size();
+		message.append(reinterpret_cast<char*>(&size), sizeof(size));
+		message.append(field);
+	}
+
+	return WriteAll(fd, message.data(), message.size());
+#else
+	return false;
+#endif
+}
+
+bool GitusDaemon::ReadMessage(int fd, std::vector<std::string>& fields)
+{
+#ifndef _WIN32
+	uint32_t count;
+	if (!ReadAll(fd, reinterpret_cast<char*>(&count), sizeof(count)))
+		return false;
+
+	fields.clear();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t size;
+		if (!ReadAll(fd, reinterpret_cast<char*>(&size), sizeof(size)))
+			return false;
+
+		std::string field(size, '\0');
+		if (size > 0 && !ReadAll(fd, &field[0], size))
+			return false;
+
+		fields.push_back(field);
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool GitusDaemon::Run()
+{
+	using namespace std;
+	using namespace boost;
+
+#ifdef _WIN32
+	cout << "fatal: gitus daemon is not supported on this platform" << endl;
+	return false;
+#else
+	auto socketFile = _gitus->DaemonSocketFile();
+	sockaddr_un address;
+	if (!SocketAddress(socketFile, address))
+	{
+		cout << "fatal: socket path '" << socketFile.string() << "' is too long" << endl;
+		return false;
+	}
+
+	if (filesystem::exists(socketFile))
+	{
+		int running = Connect(socketFile);
+		if (running >= 0)
+		{
+			close(running);
+			cout << "fatal: a gitus daemon is already serving " << _gitus->RepoDirectory().string() << endl;
+			return false;
+		}
+
+		// Left behind by a daemon which did not exit cleanly
+		filesystem::remove(socketFile);
+	}
+
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0
+		|| ::bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+		|| listen(server, 16) != 0)
+	{
+		cout << "fatal: unable to listen on '" << socketFile.string() << "': " << strerror(errno) << endl;
+		if (server >= 0)
+			close(server);
+		return false;
+	}
+
+	signal(SIGINT, RequestTermination);
+	signal(SIGTERM, RequestTermination);
+	// A client going away must not kill the daemon
+	signal(SIGPIPE, SIG_IGN);
+
+	cout << "Serving " << _gitus->RepoDirectory().string() << " on " << socketFile.string() << endl;
+
+	bool stop = false;
+	while (!stop && !TerminationRequested)
+	{
+		// Wake up regularly to check for termination signals
+		pollfd pending = { server, POLLIN, 0 };
+		if (poll(&pending, 1, 500) <= 0)
+			continue;
+
+		int client = accept(server, nullptr, nullptr);
+		if (client < 0)
+			continue;
+
+		Serve(client, stop);
+		close(client);
+	}
+
+	close(server);
+	filesystem::remove(socketFile);
+
+	cout << "Stopped serving " << _gitus->RepoDirectory().string() << endl;
+	return true;
+#endif
+}
+
+bool GitusDaemon::Serve(int client, bool& stop)
+{
+	using namespace std;
+	using namespace boost;
+
+	GITUS_TRACE_SCOPE("GitusDaemon::Serve");
+	ArenaScope arena;
+
+	vector<string> request;
+	if (!ReadMessage(client, request) || request.empty())
+		return false;
+
+	vector<string> args(request.begin() + 1, request.end());
+	auto daemonDirectory = filesystem::current_path();
+
+	// Relative paths given to the command are relative to the client
+	system::error_code ec;
+	filesystem::current_path(request[0], ec);
+
+	stringstream out;
+	stringstream err;
+	auto* coutBuffer = cout.rdbuf(out.rdbuf());
+	auto* cerrBuffer = cerr.rdbuf(err.rdbuf());
+
+	int exitCode = 1;
+	try
+	{
+		if (args.size() == 2 && args[0] == "daemon" && args[1] == "--stop")
+		{
+			cout << "Stopping gitus daemon" << endl;
+			stop = true;
+			exitCode = 0;
+		}
+		else
+		{
+			auto cmd = _createCommand(args);
+			exitCode = cmd && cmd->Execute() ? 0 : 1;
+		}
+	}
+	catch (const std::exception& e)
+	{
+		cout << "fatal: " << e.what() << endl;
+	}
+
+	cout.rdbuf(coutBuffer);
+	cerr.rdbuf(cerrBuffer);
+	filesystem::current_path(daemonDirectory, ec);
+
+	return WriteMessage(client, { to_string(exitCode), out.str(), err.str() });
+}
+
+bool GitusDaemon::Forward(const std::shared_ptr<GitusService>& gitus, const std::vector<std::string>& args, int& exitCode)
+{
+	using namespace std;
+	using namespace boost;
+
+#ifdef _WIN32
+	return false;
+#else
+	if (getenv("GITUS_NO_DAEMON") != nullptr || RunsLocally(args))
+		return false;
+
+	if (!gitus->CacheCurrentGitusDirectory() || !filesystem::exists(gitus->DaemonSocketFile()))
+		return false;
+
+	int fd = Connect(gitus->DaemonSocketFile());
+	if (fd < 0)
+		return false;
+
+	vector<string> request;
+	request.push_back(filesystem::current_path().string());
+	request.insert(request.end(), args.begin(), args.end());
+
+	vector<string> response;
+	bool sent = WriteMessage(fd, request);
+	bool answered = sent && ReadMessage(fd, response) && response.size() == 3;
+	close(fd);
+
+	if (!sent)
+		return false;
+
+	// The command may have run, so it is not retried locally
+	if (!answered)
+	{
+		cout << "fatal: lost connection to the gitus daemon" << endl;
+		exitCode = 1;
+		return true;
+	}
+
+	cout << response[1] << flush;
+	cerr << response[2] << flush;
+	exitCode = stoi(response[0]);
+	return true;
+#endif
+}
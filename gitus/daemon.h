@@ -0,0 +1,48 @@
+#ifndef GITUS_DAEMON_H
+#define GITUS_DAEMON_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "commands.h"
+#include "gitus_service.h"
+
+
+// Resident server executing commands against a single long lived 'GitusService',
+// so that the parsed index and the object caches stay warm between commands.
+//
+// Clients connect to the unix socket '.git/gitus.sock', one command per connection.
+// A message is a list of fields, each prefixed by its 4 bytes size, and the list by its count.
+//		request: current directory of the client, command arguments
+//		response: exit code, standard output, standard error
+class GitusDaemon {
+
+private:
+	std::shared_ptr<GitusService> _gitus;
+	CommandFactory _createCommand;
+
+	bool Serve(int client, bool& stop);
+
+public:
+
+	GitusDaemon(const std::shared_ptr<GitusService>& gitus, CommandFactory createCommand)
+	{
+		_gitus = gitus;
+		_createCommand = createCommand;
+	}
+
+	// Serves commands until 'gitus daemon --stop' or a termination signal
+	bool Run();
+
+	// Executes the command on the daemon of the current repository,
+	// returns false when there is no daemon and the command must run locally.
+	// Set GITUS_NO_DAEMON to always run locally.
+	static bool Forward(const std::shared_ptr<GitusService>& gitus, const std::vector<std::string>& args, int& exitCode);
+
+	static bool WriteMessage(int fd, const std::vector<std::string>& fields);
+	static bool ReadMessage(int fd, std::vector<std::string>& fields);
+};
+
+
+#endif
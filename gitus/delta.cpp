@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cstring>
+
+#include "delta.h"
+
+
+namespace {
+
+	// Polynomial hash of a block, rolled one byte at a time over the target
+	const uint32_t HashMultiplier = 0x01000193;
+
+	uint32_t BlockHash(const unsigned char* block)
+	{
+		uint32_t hash = 0;
+		for (size_t i = 0; i < DeltaIndex::BlockSize; i++)
+			hash = hash * HashMultiplier + block[i];
+		return hash;
+	}
+
+	// Multiplier of the byte leaving the block
+	uint32_t OutgoingMultiplier()
+	{
+		uint32_t multiplier = 1;
+		for (size_t i = 1; i < DeltaIndex::BlockSize; i++)
+			multiplier *= HashMultiplier;
+		return multiplier;
+	}
+
+	uint32_t RollHash(uint32_t hash, unsigned char outgoing, unsigned char incoming)
+	{
+		static const uint32_t outgoingMultiplier = OutgoingMultiplier();
+		return (hash - outgoing * outgoingMultiplier) * HashMultiplier + incoming;
+	}
+
+	void AppendSize(std::string& delta, size_t size)
+	{
+		while (size >= 0x80)
+		{
+			delta.push_back(static_cast<char>(0x80 | (size & 0x7f)));
+			size >>= 7;
+		}
+		delta.push_back(static_cast<char>(size));
+	}
+
+	bool ReadSize(ByteView delta, size_t& pos, size_t& size)
+	{
+		size = 0;
+		for (unsigned shift = 0; pos < delta.size() && shift < 64; shift += 7)
+		{
+			auto byte = delta[pos++];
+			size |= static_cast<size_t>(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	void AppendInsert(std::string& delta, ByteView data)
+	{
+		for (size_t pos = 0; pos < data.size(); pos += 0x7f)
+		{
+			auto length = std::min<size_t>(0x7f, data.size() - pos);
+			delta.push_back(static_cast<char>(length));
+			delta.append(reinterpret_cast<const char*>(data.data() + pos), length);
+		}
+	}
+
+	void AppendCopy(std::string& delta, size_t offset, size_t size)
+	{
+		auto opPos = delta.size();
+		unsigned char op = 0x80;
+		delta.push_back(0);
+
+		for (unsigned i = 0; i < 4; i++)
+		{
+			auto byte = static_cast<unsigned char>(offset >> (8 * i));
+			if (byte == 0)
+				continue;
+			op |= 1 << i;
+			delta.push_back(static_cast<char>(byte));
+		}
+
+		// A size of 0x10000 is written without any byte
+		for (unsigned i = 0; size != 0x10000 && i < 3; i++)
+		{
+			auto byte = static_cast<unsigned char>(size >> (8 * i));
+			if (byte == 0)
+				continue;
+			op |= 1 << (4 + i);
+			delta.push_back(static_cast<char>(byte));
+		}
+
+		delta[opPos] = static_cast<char>(op);
+	}
+}
+
+
+DeltaIndex::DeltaIndex(ByteView base) : _base(base)
+{
+	auto blocks = base.size() / BlockSize;
+	if (blocks == 0)
+		return;
+
+	// Twice as many slots as blocks, the first block of a hash is kept
+	size_t slots = 16;
+	_shift = 28;
+	while (slots < 2 * blocks)
+	{
+		slots *= 2;
+		_shift--;
+	}
+
+	_table.assign(slots, 0);
+	for (size_t i = 0; i < blocks; i++)
+	{
+		auto slot = (BlockHash(base.data() + i * BlockSize) * 0x9e3779b1u) >> _shift;
+		if (_table[slot] == 0)
+			_table[slot] = static_cast<uint32_t>(i * BlockSize + 1);
+	}
+}
+
+bool DeltaIndex::Create(ByteView target, size_t maxSize, std::string& delta) const
+{
+	delta.clear();
+	AppendSize(delta, _base.size());
+	AppendSize(delta, target.size());
+
+	// Bytes from 'literal' to 'i' are inserted as is unless a copy extends back over them
+	size_t literal = 0;
+	size_t i = 0;
+	uint32_t hash = 0;
+	bool hashed = false;
+	while (!_table.empty() && i + BlockSize <= target.size())
+	{
+		if (!hashed)
+		{
+			hash = BlockHash(target.data() + i);
+			hashed = true;
+		}
+
+		auto candidate = _table[(hash * 0x9e3779b1u) >> _shift];
+		size_t offset = candidate - 1;
+		if (candidate != 0 && memcmp(_base.data() + offset, target.data() + i, BlockSize) == 0)
+		{
+			auto length = BlockSize;
+			while (offset + length < _base.size() && i + length < target.size() && length < MaxCopySize
+				&& _base[offset + length] == target[i + length])
+				length++;
+
+			while (i > literal && offset > 0 && length < MaxCopySize && _base[offset - 1] == target[i - 1])
+			{
+				i--;
+				offset--;
+				length++;
+			}
+
+			AppendInsert(delta, target.Sub(literal, i - literal));
+			AppendCopy(delta, offset, length);
+			if (delta.size() > maxSize)
+				return false;
+
+			i += length;
+			literal = i;
+			hashed = false;
+			continue;
+		}
+
+		if (i + BlockSize < target.size())
+			hash = RollHash(hash, target[i], target[i + BlockSize]);
+		i++;
+
+		// The pending literal bytes alone make it too large
+		if (delta.size() + i - literal > maxSize)
+			return false;
+	}
+
+	AppendInsert(delta, target.Sub(literal, target.size() - literal));
+	return delta.size() <= maxSize;
+}
+
+bool DeltaIndex::ReadSizes(ByteView delta, size_t& baseSize, size_t& resultSize)
+{
+	size_t pos = 0;
+	return ReadSize(delta, pos, baseSize) && ReadSize(delta, pos, resultSize);
+}
+
+bool DeltaIndex::Apply(ByteView base, ByteView delta, std::string& result)
+{
+	size_t pos = 0;
+	size_t baseSize;
+	size_t resultSize;
+	if (!ReadSize(delta, pos, baseSize) || !ReadSize(delta, pos, resultSize) || baseSize != base.size())
+		return false;
+
+	result.clear();
+	result.reserve(resultSize);
+	while (pos < delta.size())
+	{
+		auto op = delta[pos++];
+		if (op & 0x80)
+		{
+			size_t offset = 0;
+			size_t size = 0;
+			for (unsigned i = 0; i < 4; i++)
+			{
+				if ((op & (1 << i)) == 0)
+					continue;
+				if (pos == delta.size())
+					return false;
+				offset |= static_cast<size_t>(delta[pos++]) << (8 * i);
+			}
+			for (unsigned i = 0; i < 3; i++)
+			{
+				if ((op & (1 << (4 + i))) == 0)
+					continue;
+				if (pos == delta.size())
+					return false;
+				size |= static_cast<size_t>(delta[pos++]) << (8 * i);
+			}
+			if (size == 0)
+				size = 0x10000;
+
+			if (offset + size > base.size() || result.size() + size > resultSize)
+				return false;
+			result.append(reinterpret_cast<const char*>(base.data() + offset), size);
+		}
+		else
+		{
+			// 0 is reserved
+			if (op == 0 || pos + op > delta.size() || result.size() + op > resultSize)
+				return false;
+			result.append(reinterpret_cast<const char*>(delta.data() + pos), op);
+			pos += op;
+		}
+	}
+
+	return result.size() == resultSize;
+}
@@ -0,0 +1,61 @@
+#ifndef GITUS_DELTA_H
+#define GITUS_DELTA_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+
+// Binary delta of an object against a similar one, its base, in the format of git
+//
+//		size of the base, size of the result: 7 bits per byte, low bits first, the high bit set on all but the last byte
+//		instructions up to the end of the delta:
+//			1xxxxxxx: copy from the base, bits 0-3 tell which offset bytes follow, bits 4-6 which size
+//				bytes follow, low bytes first, missing bytes are 0 and a size of 0 is 0x10000
+//			0nnnnnnn: insert the n (1 to 127) bytes which follow
+//
+// In a pack, a delta entry is deflated after its own header: "delta", the size (4 bytes) of what
+// follows, the binary sha1 of the base and the delta itself. Base and result are whole object
+// contents, header included, so the base may be of any type and the result keeps its own.
+class DeltaIndex {
+
+private:
+	ByteView _base;
+	// Offset + 1 of the first block of the base with a given hash, 0 for none
+	std::vector<uint32_t> _table;
+	uint32_t _shift = 32;
+
+public:
+	// Matches are found on blocks of this many bytes
+	static const size_t BlockSize = 16;
+	// Largest copy of a single instruction
+	static const size_t MaxCopySize = 0xffffff;
+
+	// Indexes the blocks of 'base', which must outlive the index
+	explicit DeltaIndex(ByteView base);
+
+	ByteView Base() const
+	{
+		return _base;
+	}
+
+	// Memory used by the index itself, not counting the base
+	size_t MemoryUsage() const
+	{
+		return _table.size() * sizeof(uint32_t);
+	}
+
+	// Builds the delta turning the base into 'target', returns false when it would be larger than 'maxSize'
+	bool Create(ByteView target, size_t maxSize, std::string& delta) const;
+
+	// Rebuilds the result of 'delta' from 'base', returns false when the delta does not apply to it
+	static bool Apply(ByteView base, ByteView delta, std::string& result);
+
+	// The sizes at the start of 'delta', which may be cut right after them
+	static bool ReadSizes(ByteView delta, size_t& baseSize, size_t& resultSize);
+};
+
+
+#endif
@@ -1,10 +0,0 @@
-file(REMOVE_RECURSE
-  "CMakeFiles/git.dir/dummy.cpp.o"
-  "libgit.pdb"
-  "libgit.a"
-)
-
-# Per-language clean rules from dependency scanning.
-foreach(lang CXX)
-  include(CMakeFiles/git.dir/cmake_clean_${lang}.cmake OPTIONAL)
-endforeach()
@@ -1,6 +0,0 @@
-# CMake generated Testfile for 
-# Source directory: /home/operrault/repos/igl601-tp1/gitus/git
-# Build directory: /home/operrault/repos/igl601-tp1/gitus/git
-# 
-# This file includes the relevant testing commands required for 
-# testing this directory and lists subdirectories to be tested as well.
@@ -1,6 +0,0 @@
-#include "dummy.h"
-
-int GetAnswerToLifeUniverseAndEverything()
-{
-    return 42;
-}
@@ -1,3 +0,0 @@
-#pragma once
-
-int GetAnswerToLifeUniverseAndEverything();
\ No newline at end of file
@@ -4,6 +4,20 @@
 #include <bitset>
 #include <memory>
 #include <vector>
+#include <set>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <atomic>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/detail/sha1.hpp>
@@ -15,6 +29,15 @@
 #include <boost/iostreams/copy.hpp>
 
 #include "gitus_service.h"
+#include "chunker.h"
+#include "pack.h"
+#include "refs.h"
+#include "delta.h"
+#include "hash_cache.h"
+#include "ignore.h"
+#include "walker.h"
+#include "io_engine.h"
+#include "thread_pool.h"
 #include "utils.h"
 
 static const char* DirCacheSignature = "DIRC";
@@ -24,286 +47,2604 @@ static const size_t HeaderLength = 12;
 static const size_t EntryHeaderLength = 40;
 static const size_t Sha1Size = 20;
 static const size_t FlagsLength = 2;
-// total
-static const size_t BaseEntryLength = 52;
+// total: header, sha1 and flags
+static const size_t BaseEntryLength = EntryHeaderLength + Sha1Size + FlagsLength;
+
+
+
+namespace {
+
+	// Header of 'CreateHeaderData' on the stack, the object itself is never concatenated to it
+	struct ObjectHeader
+	{
+		unsigned char data[16];
+		size_t size = 0;
+
+		ObjectHeader(GitusService::ObjectHashType type, size_t objectSize)
+		{
+			auto name = GitusService::TypeName(type);
+			Word2 length; length.n = objectSize;
 
+			std::copy(name.begin(), name.end(), data);
+			std::copy(&length.c[0], &length.c[4], data + name.size());
+			size = name.size() + 4;
+		}
 
+		ByteView View() const
+		{
+			return ByteView(data, size);
+		}
+	};
+}
 
-bool GitusService::HashObject(const RawData& object, ObjectHashType type, bool write, RawData& sha1)
+bool GitusService::CacheCurrentGitusDirectory()
 {
-	using namespace std;
 	using namespace boost;
-	namespace ios = iostreams;
+	GITUS_TRACE_SCOPE("GitusService::CacheCurrentGitusDirectory");
 
-	RawData content = CreateContentData(object, type);
+	if (_resolved)
+		return true;
 
-	// sha1 string hex used for object path
-	// 20 bytes returned as 40 hex characters
-	string sha1String;
-	Utils::Sha1String(content, sha1String);
-	if (write)
+	auto gitusDir = std::getenv("GITUS_DIR");
+	if (gitusDir != nullptr && *gitusDir != 0)
 	{
-		std::string first = sha1String.substr(0, 2);
-		std::string last = sha1String.substr(2, string::npos);
+		Stats::Add(Stats::StatCalls);
+		if (!filesystem::is_directory(gitusDir))
+			return false;
+
+		SetGitusDirectory(filesystem::absolute(gitusDir));
+		return true;
+	}
 
-		auto filePath = ObjectsDirectory()
-			/ first;
+	return DiscoverGitusDirectory(filesystem::current_path());
+}
 
-		if (!filesystem::exists(filePath / last)) {
-			if (!filesystem::exists(filePath)) {
-				filesystem::create_directories(filePath);
-			}
+bool GitusService::DiscoverGitusDirectory(const boost::filesystem::path& start)
+{
+	using namespace boost;
 
-			filesystem::ofstream ofs{ filePath / last };
-			ofs << Utils::Compress(content);
+	// Only one check per level, so the cost does not depend on the size of the working tree
+	filesystem::path dir = start;
+	while (!dir.empty())
+	{
+		Stats::Add(Stats::StatCalls);
+		if (filesystem::is_directory(dir / ".git"))
+		{
+			SetGitusDirectory(dir / ".git");
+			return true;
 		}
+
+		auto parent = dir.parent_path();
+		if (parent == dir || IsCeilingDirectory(parent))
+			break;
+
+		dir = parent;
 	}
 
-	// populate full sha binary
-	Utils::Sha1(content, sha1);
-	return true;
+	return false;
+}
+
+bool GitusService::CreateLayout()
+{
+	using namespace boost;
+
+	filesystem::create_directory(ObjectsDirectory());
+	filesystem::create_directory(RefsDirectory());
+	filesystem::create_directory(HeadsDirectory());
+
+	// The branch has no commit yet
+	filesystem::ofstream{ MasterFile() };
+	return WriteHead("master");
 }
 
+void GitusService::SetGitusDirectory(const boost::filesystem::path& gitusDirectory)
+{
+	using namespace boost;
 
-RawData GitusService::CreateContentData(const RawData& object, ObjectHashType type) {
-	auto header = CreateHeaderData(type, object);
-	RawData content;
-	std::copy(header.begin(), header.end(), std::back_inserter(content));
-	std::copy(object.begin(), object.end(), std::back_inserter(content));
-	return content;
+	ClearCaches();
+
+	_currentGitusDirectory = gitusDirectory;
+	// Drop the trailing separator so that 'parent_path' is the working tree
+	if (_currentGitusDirectory.filename() == ".")
+		_currentGitusDirectory = _currentGitusDirectory.parent_path();
+
+	auto workTree = std::getenv("GITUS_WORK_TREE");
+	if (workTree != nullptr && *workTree != 0)
+		_workTree = filesystem::absolute(workTree);
+	else
+		_workTree = _currentGitusDirectory.parent_path();
+
+	_resolved = true;
 }
 
-RawData GitusService::CreateHeaderData(GitusService::ObjectHashType type, const RawData & object)
+bool GitusService::IsCeilingDirectory(const boost::filesystem::path& dir)
 {
-	std::string t;
-	RawData header;
-	switch (type)
+	using namespace std;
+	using namespace boost;
+
+	auto ceilings = getenv("GITUS_CEILING_DIRECTORIES");
+	if (ceilings == nullptr)
+		return false;
+
+#ifdef _WIN32
+	const char separator = ';';
+#else
+	const char separator = ':';
+#endif
+
+	stringstream ss(ceilings);
+	string ceiling;
+	while (getline(ss, ceiling, separator))
 	{
-	case GitusService::Blob:
-		t = "blob";
-		break;
-	case GitusService::Commit:
-		t = "commit";
-		break;
-	case GitusService::Tree:
-		t = "tree";
-		break;
-	default:
-		break;
-	}
+		if (ceiling.empty())
+			continue;
 
-	// add the type
-	copy(t.begin(), t.end(), std::back_inserter(header));
+		auto ceilingPath = filesystem::path(ceiling).lexically_normal();
+		if (ceilingPath.filename() == ".")
+			ceilingPath = ceilingPath.parent_path();
 
-	// add the size
-	Word2 size; size.n = object.size();
-	copy(&size.c[0], &(size.c[4]), back_inserter(header));
-	return header;
+		if (ceilingPath == dir)
+			return true;
+	}
+
+	return false;
 }
 
+bool GitusService::HashObject(ByteView object, ObjectHashType type, bool write, RawData& sha1)
+{
+	bool existed;
+	return HashObject(object, type, write, sha1, existed);
+}
 
-bool GitusService::WriteIndex(const std::map<std::string, IndexEntry>& entries)
+bool GitusService::HashObject(ByteView object, ObjectHashType type, bool write, RawData& sha1, bool& existed)
 {
 	using namespace std;
 	using namespace boost;
+	namespace ios = iostreams;
+	GITUS_TRACE_SCOPE("GitusService::HashObject");
 
-	RawData entriesData;
+	// The header and the object are streamed to the hash and to the compressor in turn,
+	// the content is never assembled in memory
+	ObjectHeader header(type, object.size());
 
-	// The c++ standard guarantees that a map is iterated over in order of the keys
-	for (auto it = entries.begin(); it != entries.end(); it++)
+	// Hashed once, the hex string used for the object path is derived from the binary sha1
+	// 20 bytes returned as 40 hex characters
+	RawData binarySha1;
+	Sha1Context context;
+	context.Update(header.View());
+	context.Update(object);
+	context.Final(binarySha1);
+	string sha1String;
+	Utils::Sha1ToString(binarySha1, sha1String);
+
+	existed = write && ObjectExists(sha1String);
+	if (write)
 	{
-		auto* entry = &it->second;
+		if (!existed) {
+			DeflateContext deflate;
+			deflate.Update(header.View());
+			deflate.Update(object);
+			auto compressed = deflate.Finish();
+
+			if (!WriteObjectData(sha1String, binarySha1, compressed))
+				return false;
+		}
+		else
+		{
+			Stats::Add(Stats::ObjectsSkipped);
+		}
 
-		for (int i = 0; i < entry->numFields; i++)
+		lock_guard<mutex> lock(_cacheMutex);
+		_knownObjects.insert(sha1String);
+	}
+
+	// populate full sha binary
+	copy(binarySha1.begin(), binarySha1.end(), back_inserter(sha1));
+	return true;
+}
+
+
+bool GitusService::WriteObjectData(const std::string& sha1String, ByteView sha1, std::string& compressed)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::WriteObjectFile");
+
+	{
+		lock_guard<mutex> lock(_packsMutex);
+		if (_bulkCheckin)
 		{
-			for(int j = 0; j < 4; j++)
-			entriesData.push_back(entry->fields[i].c[j]);
+			Stats::Add(Stats::ObjectsWritten);
+			return _bulkCheckin->Add(sha1, compressed);
 		}
+	}
 
-		for (int j = 0; j < Sha1Size; j++)
-		entriesData.push_back(entry->sha1[j]);
+	auto filePath = ObjectsDirectory() / sha1String.substr(0, 2);
+	auto last = sha1String.substr(2);
+	if (!filesystem::exists(filePath)) {
+		filesystem::create_directories(filePath);
+	}
 
-		// add flags
-		for (int j = 0; j < 2; j++)
-			entriesData.push_back(entry->flags.c[j]);
+	// Written aside then renamed, so that concurrent readers and writers of the
+	// same object never see a partial file
+	auto temporaryPath = filePath / filesystem::unique_path(last + "-%%%%%%%%.tmp");
+	bool written;
+	{
+		filesystem::ofstream ofs{ temporaryPath, ios_base::binary };
+		ofs << compressed;
+		ofs.close();
+		written = static_cast<bool>(ofs);
+	}
 
-		// Add path
-		for (int j = 0; j < entry->path.size(); j++)
-			entriesData.push_back(entry->path[j]);
-		entriesData.push_back(0);//null terminate the path
-		
-		// Add padding
-		size_t pathOffset = ((BaseEntryLength + entry->path.size() + 8) / 8) * 8;
-		auto paddingLength = pathOffset - BaseEntryLength - entry->path.size();
-		for (int j = 0; j < paddingLength; j++)
-			entriesData.push_back(0);
+	// A short write (e.g a full disk) must not leave a truncated object in place
+	if (!written)
+	{
+		system::error_code ec;
+		filesystem::remove(temporaryPath, ec);
+		return false;
 	}
+	filesystem::rename(temporaryPath, filePath / last);
 
-	RawData data;
+	Stats::Add(Stats::OpenCalls);
+	Stats::Add(Stats::BytesWritten, compressed.size());
+	Stats::Add(Stats::ObjectsWritten);
+	return true;
+}
 
-	// A 12 byte header
-	// Signature
-	for (int j = 0; j < 4; j++)
-		data.push_back(DirCacheSignature[j]);
+void GitusService::BeginBulkCheckin()
+{
+	std::lock_guard<std::mutex> lock(_packsMutex);
+	if (!_bulkCheckin)
+		_bulkCheckin = std::make_shared<PackWriter>(PacksDirectory());
+}
 
-	// Version number
-	Word2 version; version.n = IndexFormatVersion;
-	for (int j = 0; j < 4; j++)
-		data.push_back(version.c[j]);
+bool GitusService::EndBulkCheckin()
+{
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::EndBulkCheckin");
 
-	// Number of entries
-	Word2 numEntries; numEntries.n = entries.size();
-	for (int j = 0; j < 4; j++)
-		data.push_back(numEntries.c[j]);
+	std::shared_ptr<PackWriter> writer;
+	{
+		std::lock_guard<std::mutex> lock(_packsMutex);
+		writer.swap(_bulkCheckin);
+	}
 
-	// Concat entries
-	copy(entriesData.begin(), entriesData.end(), back_inserter(data));
+	if (!writer)
+		return true;
 
-	RawData digest;
-	Utils::Sha1(data, digest);
+	filesystem::path packPath;
+	if (writer->Finish(packPath))
+	{
+		InvalidatePacks();
+		return true;
+	}
 
-	filesystem::ofstream ofs{ IndexFile() };
+	// The objects of the pack were reported as present, they are not
+	std::lock_guard<std::mutex> lock(_cacheMutex);
+	_knownObjects.clear();
+	return false;
+}
 
-	// Concat digest
-	copy(digest.begin(), digest.end(), back_inserter(data));
+void GitusService::AbortBulkCheckin()
+{
+	std::shared_ptr<PackWriter> writer;
+	{
+		std::lock_guard<std::mutex> lock(_packsMutex);
+		writer.swap(_bulkCheckin);
+	}
 
-	ofs.write(reinterpret_cast<char*>(data.data()), data.size()*sizeof(unsigned char));
+	if (!writer)
+		return;
 
-	return true;
+	// Removes the temporary pack
+	writer.reset();
 
-};
+	std::lock_guard<std::mutex> lock(_cacheMutex);
+	_knownObjects.clear();
+}
 
-bool GitusService::ReadIndex(std::map<std::string, IndexEntry>& entries)
+std::vector<std::shared_ptr<PackIndex>> GitusService::Packs()
 {
 	using namespace std;
 	using namespace boost;
 
-	if (filesystem::exists(IndexFile()))
-	{
-		auto data = Utils::ReadBytes(IndexFile().string());
-		RawData digest(data.end() - Sha1Size, data.end());
-		RawData content(data.begin(), data.end() - Sha1Size);
+	// One stat when nothing changed, a new pack always changes the mtime of the directory
+	Stats::Add(Stats::StatCalls);
+	auto stamp = ModificationStamp(PacksDirectory());
 
-		RawData contentHash;
-		Utils::Sha1(content, contentHash);
-		if (contentHash != digest) {
-			std::exception("fatal: Index file is corrupted.");
-			return false;
-		}
+	lock_guard<mutex> lock(_packsMutex);
+	if (stamp == _packsStamp)
+		return _packs;
 
-		RawData indexEntries(content.begin() + HeaderLength, content.end());
+	_packs.clear();
+	_packsStamp = stamp;
+	if (stamp == 0)
+		return _packs;
 
-		int i = 0;
-		while (i + BaseEntryLength < indexEntries.size())
-		{
-			RawData remainingEntriesContent(indexEntries.begin() + i, indexEntries.end());
-			RawData entryHeader(remainingEntriesContent.begin(), remainingEntriesContent.begin() + EntryHeaderLength);
+	system::error_code ec;
+	Stats::Add(Stats::ReaddirCalls);
+	for (filesystem::directory_iterator it(PacksDirectory(), ec), end; !ec && it != end; it.increment(ec))
+	{
+		auto name = it->path().filename().string();
+		if (it->path().extension() != ".idx" || name.compare(0, 5, "pack-") != 0)
+			continue;
 
-			IndexEntry entry(entryHeader);
-			size_t shaEndPos = EntryHeaderLength + Sha1Size;
-			entry.sha1 = RawData(
-				remainingEntriesContent.begin() + EntryHeaderLength, 
-				remainingEntriesContent.begin() + shaEndPos);
+		auto pack = PackIndex::Open(it->path());
+		if (pack)
+			_packs.push_back(pack);
+	}
 
-			size_t flagsEndPos = shaEndPos + FlagsLength;
-			RawData flags(
-				remainingEntriesContent.begin() + shaEndPos,
-				remainingEntriesContent.begin() + flagsEndPos);
+	return _packs;
+}
 
-			copy(&flags.data()[0], &flags.data()[2], entry.flags.c);
+void GitusService::InvalidatePacks()
+{
+	std::lock_guard<std::mutex> lock(_packsMutex);
+	_packsStamp = -1;
+	_lookupStamp = -1;
+}
 
-			// Find potential range for a path over remaining bits
-			RawData possiblePathRange(
-				remainingEntriesContent.begin() + flagsEndPos,
-				remainingEntriesContent.end());
+bool GitusService::FindPackedObject(ByteView sha1, ScratchData* compressed)
+{
+	using namespace std;
+	using namespace boost;
 
-			// Find null terminated string
+	Stats::Add(Stats::StatCalls);
+	auto stamp = ModificationStamp(PacksDirectory());
 
-			auto pos = std::find(remainingEntriesContent.begin() + flagsEndPos, remainingEntriesContent.end(), '\0');
-			
-			auto path = RawData(remainingEntriesContent.begin() + flagsEndPos, pos);
+	std::shared_ptr<MultiPackIndex> multiPackIndex;
+	vector<std::shared_ptr<PackIndex>> packs;
+	{
+		lock_guard<mutex> lock(_packsMutex);
+		if (stamp != _lookupStamp)
+		{
+			_lookupStamp = stamp;
+			_multiPackIndex = nullptr;
+			_uncoveredPacks.clear();
+
+			set<string> packNames;
+			vector<filesystem::path> indexPaths;
+			system::error_code ec;
+			Stats::Add(Stats::ReaddirCalls);
+			for (filesystem::directory_iterator it(PacksDirectory(), ec), end; stamp != 0 && !ec && it != end; it.increment(ec))
+			{
+				auto name = it->path().filename().string();
+				if (name.compare(0, 5, "pack-") != 0)
+					continue;
+
+				if (it->path().extension() == ".pack")
+					packNames.insert(name);
+				else if (it->path().extension() == ".idx")
+					indexPaths.push_back(it->path());
+			}
 
-			copy(path.begin(), path.end(), back_inserter<string>(entry.path));
+			// Stale once one of its packs was removed, the packs are then looked up one by one
+			auto index = packNames.empty() ? nullptr : MultiPackIndex::Open(MultiPackIndexFile());
+			if (index && all_of(index->PackNames().begin(), index->PackNames().end(), [&](const string& name) { return packNames.count(name) != 0; }))
+				_multiPackIndex = index;
 
-			entries.insert(make_pair(entry.path, entry));
+			for (auto& indexPath : indexPaths)
+			{
+				auto packName = filesystem::path(indexPath).replace_extension(".pack").filename().string();
+				if (_multiPackIndex && find(_multiPackIndex->PackNames().begin(), _multiPackIndex->PackNames().end(), packName) != _multiPackIndex->PackNames().end())
+					continue;
 
-			auto currentEntryLength = ((BaseEntryLength + entry.path.size() + 8) / 8) * 8;
-			i += currentEntryLength;
+				auto pack = PackIndex::Open(indexPath);
+				if (pack)
+					_uncoveredPacks.push_back(pack);
+			}
 		}
+
+		multiPackIndex = _multiPackIndex;
+		packs = _uncoveredPacks;
 	}
 
-	return true;
-};
+	size_t pack;
+	uint64_t offset;
+	uint32_t length;
+	if (multiPackIndex && multiPackIndex->Find(sha1, pack, offset, length))
+		return compressed == nullptr || PackIndex::ReadEntry(multiPackIndex->PackPath(pack), offset, length, *compressed);
 
+	for (auto& index : packs)
+	{
+		if (index->Find(sha1, offset, length))
+			return compressed == nullptr || index->ReadEntry(offset, length, *compressed);
+	}
 
-RawData GitusService::HashCommitTree() {
+	return false;
+}
 
+bool GitusService::WriteMultiPackIndex(size_t& packCount, size_t& objectCount)
+{
 	using namespace std;
 	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::WriteMultiPackIndex");
 
-	auto entries = map<string, IndexEntry>();
-	RawData treeEntries;
+	auto packs = Packs();
+	packCount = packs.size();
+	objectCount = 0;
 
-	if (!GitusService::ReadIndex(entries))
+	system::error_code ec;
+	if (packs.empty())
 	{
-		// Error occured
-		return treeEntries;
+		filesystem::remove(MultiPackIndexFile(), ec);
+		return true;
 	}
-	else if (entries.empty())
+
+	map<const PackIndex*, int64_t> stamps;
+	for (auto& pack : packs)
+		stamps[pack.get()] = ModificationStamp(pack->PackPath());
+
+	auto preferred = max_element(packs.begin(), packs.end(), [](const std::shared_ptr<PackIndex>& a, const std::shared_ptr<PackIndex>& b) {
+		return a->Count() < b->Count();
+	});
+	iter_swap(packs.begin(), preferred);
+	sort(packs.begin() + 1, packs.end(), [&](const std::shared_ptr<PackIndex>& a, const std::shared_ptr<PackIndex>& b) {
+		return stamps[a.get()] > stamps[b.get()];
+	});
+
+	if (!MultiPackIndex::Write(MultiPackIndexFile(), packs))
+		return false;
+
+	InvalidatePacks();
+	auto index = MultiPackIndex::Open(MultiPackIndexFile());
+	objectCount = index ? index->Count() : 0;
+	return index != nullptr;
+}
+
+GitusService::~GitusService()
+{
+	try
 	{
-		std::cout << "Your branch is up to date with 'origin/master'" << std::endl;
-		return treeEntries;
+		FlushHashCache();
+	}
+	catch (const std::exception&)
+	{
+		// Only a cache, the ids are computed again next time
 	}
+}
 
+bool GitusService::ListWorkTreeFiles(const boost::filesystem::path& directory, std::vector<std::string>& files)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::ListWorkTreeFiles");
 
-	// each 'line' in a tree object is in the '<mode><space><path>' format
-	// then a NUL byte, then the binary SHA-1 hash.
-	for (auto it = entries.begin(); it != entries.end(); it++)
-	{
-		auto* entry = &it->second;
-		
-		// mode
-		copy(&entry->fields[6].c[0], &entry->fields[6].c[4], back_inserter(treeEntries));
-		
-		// empty space
-		treeEntries.push_back(' ');
-		
-		// path
-		copy(entry->path.begin(), entry->path.end(), back_inserter(treeEntries));
-		
-		// null byte
-		treeEntries.push_back(0);
+	auto relative = directory.lexically_normal().lexically_relative(RepoDirectory()).generic_string();
+	if (relative.empty() || relative.compare(0, 2, "..") == 0)
+		return false;
 
-		// sha1
-		copy(entry->sha1.begin(), entry->sha1.end(), back_inserter(treeEntries));	
+	// "." for the work tree, and a trailing "/." for "dir/."
+	if (relative == ".")
+		relative.clear();
+	else if (relative.size() > 2 && relative.compare(relative.size() - 2, 2, "/.") == 0)
+		relative.resize(relative.size() - 2);
+
+	if (relative == ".git" || relative.compare(0, 5, ".git/") == 0)
+		return true;
+
+	IgnoreMatcher matcher(RepoDirectory(), _currentGitusDirectory);
+	IgnoreMatcher::FramePtr frame;
+	if (!matcher.EnterParents(relative, frame))
+		return true;
+
+	TreeWalker::Walk(RepoDirectory(), matcher, frame, relative, files);
+	return true;
+}
+
+std::shared_ptr<HashCache> GitusService::FileHashCache()
+{
+	std::lock_guard<std::mutex> lock(_hashCacheMutex);
+	if (!_hashCache)
+		_hashCache = std::make_shared<HashCache>(HashCacheFile(), _chunkThreshold, _largeFileThreshold);
+
+	return _hashCache;
+}
+
+void GitusService::ResetHashCache()
+{
+	FlushHashCache();
+	std::lock_guard<std::mutex> lock(_hashCacheMutex);
+	_hashCache.reset();
+}
+
+void GitusService::SetChunkThreshold(size_t threshold)
+{
+	if (threshold == _chunkThreshold)
+		return;
+
+	// Reopened with the new threshold, the file written under the previous one is discarded
+	ResetHashCache();
+	_chunkThreshold = threshold;
+}
+
+void GitusService::SetLargeFileThreshold(size_t threshold)
+{
+	if (threshold == _largeFileThreshold)
+		return;
+
+	ResetHashCache();
+	_largeFileThreshold = threshold;
+}
+
+bool GitusService::FlushHashCache()
+{
+	std::shared_ptr<HashCache> hashCache;
+	{
+		std::lock_guard<std::mutex> lock(_hashCacheMutex);
+		hashCache = _hashCache;
 	}
 
-	return treeEntries;
+	// Nothing to write before the repository exists (e.g 'init' failed)
+	if (!hashCache || !boost::filesystem::is_directory(_currentGitusDirectory))
+		return true;
+
+	return hashCache->Flush();
 }
 
-bool GitusService::HasParentTree() {
-	auto parentTreePath = MasterFile();
-	auto masterSize = boost::filesystem::file_size(parentTreePath);
-	auto hashParent = masterSize > 0;
-	return hashParent;
+int64_t GitusService::ModificationStamp(const boost::filesystem::path& path)
+{
+	// Nanoseconds where available, several packs may be written within a second
+#ifdef _WIN32
+	boost::system::error_code ec;
+	auto mtime = boost::filesystem::last_write_time(path, ec);
+	return ec ? 0 : static_cast<int64_t>(mtime) * 1000000000;
+#else
+	struct stat status;
+	if (::stat(path.c_str(), &status) != 0)
+		return 0;
+
+	return static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
 }
 
-bool GitusService::LocalMasterHash(RawData& hash) {
-	// Get current commit hash of local master branch
-	hash = Utils::ReadBytes(MasterFile().string());
+bool GitusService::ReadStoredObject(const std::string& sha1String, ScratchData& compressed)
+{
+	RawData sha1;
+	return Utils::ReadBytes(ObjectFile(sha1String).string(), compressed)
+		|| (Utils::StringToSha1(sha1String, sha1) && FindPackedObject(sha1, &compressed));
+}
+
+bool GitusService::ReadObjectData(const std::string& sha1String, ScratchData& compressed)
+{
+	if (!ReadStoredObject(sha1String, compressed))
+		return false;
+
+	// Only packs store deltas
+	static const std::string deltaName = TypeName(Delta);
+	auto prefix = Utils::DecompressPrefix(compressed, deltaName.size());
+	if (!std::equal(deltaName.begin(), deltaName.end(), prefix.begin(), prefix.end()))
+		return true;
+
+	auto content = Utils::Decompress(compressed);
+	if (!ResolveDelta(content, 0))
+		return false;
+
+	DeflateContext deflate;
+	deflate.Update(content);
+	auto deflated = deflate.Finish();
+	compressed.assign(deflated.begin(), deflated.end());
 	return true;
 }
 
-bool GitusService::ObjectExists(std::string sha1String) {
+bool GitusService::ReadObjectContent(const std::string& sha1String, std::string& content)
+{
+	return ReadObjectContent(sha1String, content, 0);
+}
+
+bool GitusService::ReadObjectContent(const std::string& sha1String, std::string& content, size_t depth)
+{
+	ScratchData compressed;
+	if (!ReadStoredObject(sha1String, compressed))
+		return false;
+
+	content = Utils::Decompress(compressed);
+	return ResolveDelta(content, depth);
+}
+
+bool GitusService::ReadPackedContent(const PackIndex& pack, size_t i, std::string& content)
+{
+	uint64_t offset;
+	uint32_t length;
+	ScratchData compressed;
+	pack.Location(i, offset, length);
+	if (!pack.ReadEntry(offset, length, compressed))
+		return false;
+
+	content = Utils::Decompress(compressed);
+	return ResolveDelta(content, 0);
+}
 
+bool GitusService::ResolveDelta(std::string& content, size_t depth)
+{
 	using namespace std;
 
-	std::string first = sha1String.substr(0, 2);
-	std::string last = sha1String.substr(2, std::string::npos);
+	// "delta", the size of what follows, the sha1 of the base and the delta itself (see 'DeltaIndex')
+	static const string deltaName = TypeName(Delta);
+	auto headerLength = deltaName.size() + 4;
+	if (content.compare(0, deltaName.size(), deltaName) != 0)
+		return true;
 
-	auto filePath = ObjectsDirectory() / first;
+	Word2 size;
+	if (content.size() < headerLength + Sha1Size || depth >= MaxDeltaDepth)
+		return false;
 
-	return boost::filesystem::exists(filePath / last);
+	copy(content.begin() + deltaName.size(), content.begin() + headerLength, size.c);
+	if (size.n != content.size() - headerLength)
+		return false;
+
+	string baseString;
+	string base;
+	Utils::Sha1ToString(ByteView(content).Sub(headerLength, Sha1Size), baseString);
+	if (!ReadObjectContent(baseString, base, depth + 1))
+		return false;
+
+	string result;
+	if (!DeltaIndex::Apply(base, ByteView(content).Sub(headerLength + Sha1Size, content.size() - headerLength - Sha1Size), result))
+		return false;
+
+	content.swap(result);
+	return true;
 }
 
+bool GitusService::HashObjects(const std::vector<RawData>& objects, ObjectHashType type, bool write, std::vector<RawData>& sha1s)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::HashObjects");
+
+	sha1s.assign(objects.size(), RawData());
+	vector<string> sha1Strings(objects.size());
+	vector<string> compressed(objects.size());
 
+	{
+		ThreadPool pool(min(objects.size(), ThreadPool::DefaultThreadCount()));
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			pool.Enqueue([&, i]() {
+				ObjectHeader header(type, objects[i].size());
+				Sha1Context context;
+				context.Update(header.View());
+				context.Update(objects[i]);
+				context.Final(sha1s[i]);
+				Utils::Sha1ToString(sha1s[i], sha1Strings[i]);
+				if (write && !ObjectExists(sha1Strings[i]))
+				{
+					DeflateContext deflate;
+					deflate.Update(header.View());
+					deflate.Update(objects[i]);
+					compressed[i] = deflate.Finish();
+				}
+			});
+		}
+		pool.Wait();
+	}
+
+	if (!write)
+		return true;
+
+	bool bulkCheckin;
+	{
+		lock_guard<mutex> lock(_packsMutex);
+		bulkCheckin = static_cast<bool>(_bulkCheckin);
+	}
+
+	// The same content may appear several times in a batch
+	set<string> pending;
+	if (bulkCheckin)
+	{
+		bool success = true;
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			if (compressed[i].empty() || !pending.insert(sha1Strings[i]).second)
+			{
+				Stats::Add(Stats::ObjectsSkipped);
+				continue;
+			}
+
+			success = WriteObjectData(sha1Strings[i], sha1s[i], compressed[i]) && success;
+			lock_guard<mutex> lock(_cacheMutex);
+			_knownObjects.insert(sha1Strings[i]);
+		}
+
+		return success;
+	}
+
+	vector<IoEngine::WriteRequest> requests;
+	vector<string> requestNames;
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		if (compressed[i].empty() || !pending.insert(sha1Strings[i]).second)
+		{
+			Stats::Add(Stats::ObjectsSkipped);
+			continue;
+		}
+
+		auto directory = ObjectsDirectory() / sha1Strings[i].substr(0, 2);
+		if (!filesystem::exists(directory))
+			filesystem::create_directories(directory);
+
+		IoEngine::WriteRequest request;
+		request.path = ObjectFile(sha1Strings[i]);
+		request.data = move(compressed[i]);
+		requests.push_back(move(request));
+		requestNames.push_back(sha1Strings[i]);
+	}
+
+	auto success = IoEngine::WriteFiles(requests);
+
+	lock_guard<mutex> lock(_cacheMutex);
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		if (!requests[i].done)
+			continue;
+
+		_knownObjects.insert(requestNames[i]);
+		Stats::Add(Stats::ObjectsWritten);
+	}
+
+	return success;
+}
+
+
+size_t GitusService::ThresholdFromEnvironment(const char* name)
+{
+	auto threshold = std::getenv(name);
+	if (threshold == nullptr || *threshold == 0)
+		return 0;
+
+	return std::strtoull(threshold, nullptr, 10);
+}
+
+boost::filesystem::path GitusService::PathFromEnvironment(const char* name)
+{
+	auto path = std::getenv(name);
+	if (path == nullptr || *path == 0)
+		return boost::filesystem::path();
+
+	return boost::filesystem::absolute(path);
+}
+
+bool GitusService::HashBlobFile(const boost::filesystem::path& path, bool write, RawData& sha1)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::HashBlobFile");
+
+	HashCache::FileStamp stamp;
+	if (!HashCache::Stat(path, stamp))
+		return false;
+
+	// When writing, the object may have been removed since (e.g an aborted bulk checkin)
+	RawData id;
+	string idString;
+	if (FileHashCache()->Lookup(stamp, id) && (!write || (Utils::Sha1ToString(id, idString) && ObjectExists(idString))))
+	{
+		sha1.insert(sha1.end(), id.begin(), id.end());
+		return true;
+	}
+
+	id.clear();
+	if (!HashBlobContent(path, stamp.size, write, id))
+		return false;
+
+	// The objects of a bulk checkin are only stored once its pack is written
+	bool bulkCheckin;
+	{
+		lock_guard<mutex> lock(_packsMutex);
+		bulkCheckin = write && _bulkCheckin;
+	}
+	if (!bulkCheckin)
+		FileHashCache()->Insert(path, stamp, id);
+	sha1.insert(sha1.end(), id.begin(), id.end());
+	return true;
+}
+
+bool GitusService::HashBlobContent(const boost::filesystem::path& path, uintmax_t size, bool write, RawData& sha1)
+{
+	using namespace std;
+	using namespace boost;
+
+	if (_largeFileThreshold != 0 && size >= _largeFileThreshold)
+		return StoreLargeFile(path, write, sha1);
+
+	if (_chunkThreshold == 0 || size < _chunkThreshold)
+	{
+		ScratchData content;
+		if (!Utils::ReadBytes(path.string(), content))
+			return false;
+
+		return HashObject(content, Blob, write, sha1);
+	}
+
+	filesystem::ifstream ifs(path, ios_base::binary);
+	Stats::Add(Stats::OpenCalls);
+	if (!ifs)
+		return false;
+
+	// The file is streamed through a window holding several chunks, it is never read whole
+	ScratchData window(8 * Chunker::MaxSize);
+	size_t begin = 0;
+	size_t end = 0;
+	bool endOfFile = false;
+
+	RawData chunks;
+	while (true)
+	{
+		if (!endOfFile && end - begin < Chunker::MaxSize)
+		{
+			copy(window.begin() + begin, window.begin() + end, window.begin());
+			end -= begin;
+			begin = 0;
+
+			ifs.read(reinterpret_cast<char*>(window.data() + end), window.size() - end);
+			auto length = static_cast<size_t>(ifs.gcount());
+			Stats::Add(Stats::BytesRead, length);
+			end += length;
+			endOfFile = !ifs;
+			continue;
+		}
+
+		if (begin == end)
+			break;
+
+		auto chunk = ByteView(window.data() + begin, end - begin);
+		chunk = chunk.Sub(0, Chunker::NextChunk(chunk));
+
+		RawData chunkSha1;
+		if (!HashObject(chunk, Blob, write, chunkSha1))
+			return false;
+		chunks.insert(chunks.end(), chunkSha1.begin(), chunkSha1.end());
+
+		Word2 chunkSize; chunkSize.n = chunk.size();
+		chunks.insert(chunks.end(), &chunkSize.c[0], &chunkSize.c[4]);
+
+		begin += chunk.size();
+	}
+
+	return HashObject(chunks, Chunks, write, sha1);
+}
+
+
+bool GitusService::StoreLargeFile(const boost::filesystem::path& path, bool write, RawData& sha1)
+{
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::StoreLargeFile");
+
+	if (!write)
+	{
+		std::string oid;
+		uintmax_t size = 0;
+		if (!CopyFileHashed(path, filesystem::path(), oid, size))
+			return false;
+
+		return HashObject(CreateLargeFilePointer(oid, size), Blob, false, sha1);
+	}
+
+	// Named after its content, which is only known once copied
+	filesystem::create_directories(LargeFilesDirectory());
+	auto temporaryPath = LargeFilesDirectory() / filesystem::unique_path("%%%%%%%%%%%%.tmp");
+	std::string oid;
+	uintmax_t size = 0;
+	if (!CopyFileHashed(path, temporaryPath, oid, size))
+	{
+		filesystem::remove(temporaryPath);
+		return false;
+	}
+
+	auto storedPath = LargeFile(oid);
+	if (filesystem::exists(storedPath))
+	{
+		filesystem::remove(temporaryPath);
+		Stats::Add(Stats::ObjectsSkipped);
+	}
+	else
+	{
+		filesystem::create_directories(storedPath.parent_path());
+		filesystem::rename(temporaryPath, storedPath);
+		Stats::Add(Stats::ObjectsWritten);
+	}
+
+	return HashObject(CreateLargeFilePointer(oid, size), Blob, true, sha1);
+}
+
+bool GitusService::FetchLargeFile(const std::string& oid)
+{
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::FetchLargeFile");
+
+	Stats::Add(Stats::StatCalls);
+	if (filesystem::exists(LargeFile(oid)))
+		return true;
+
+	if (_largeFileRemote.empty())
+		return false;
+
+	auto remotePath = _largeFileRemote / oid.substr(0, 2) / oid.substr(2);
+	Stats::Add(Stats::StatCalls);
+	if (!filesystem::is_regular_file(remotePath))
+		return false;
+
+	// The remote copy is verified, a corrupted remote must not corrupt the local store
+	auto storedPath = LargeFile(oid);
+	filesystem::create_directories(storedPath.parent_path());
+	auto temporaryPath = storedPath.parent_path() / filesystem::unique_path(oid.substr(2) + "-%%%%%%%%.tmp");
+	std::string fetchedOid;
+	uintmax_t size = 0;
+	if (!CopyFileHashed(remotePath, temporaryPath, fetchedOid, size) || fetchedOid != oid)
+	{
+		filesystem::remove(temporaryPath);
+		return false;
+	}
+
+	filesystem::rename(temporaryPath, storedPath);
+	return true;
+}
+
+bool GitusService::CheckoutBlob(const RawData& sha1, const boost::filesystem::path& destination)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::CheckoutBlob");
+
+	// A chunked blob is read as its list, not reassembled
+	string sha1String;
+	ObjectHashType type;
+	RawData object;
+	vector<ChunkEntry> chunks;
+	if (!Utils::Sha1ToString(sha1, sha1String) || !ReadObjectFile(sha1String, type, object)
+		|| (type != Blob && type != Chunks) || (type == Chunks && !ParseChunks(object, chunks)))
+		return false;
+
+	if (!destination.parent_path().empty())
+		filesystem::create_directories(destination.parent_path());
+	auto temporaryPath = destination.parent_path() / filesystem::unique_path(destination.filename().string() + "-%%%%%%%%.tmp");
+
+	string oid;
+	uintmax_t size = 0;
+	if (type == Blob && ParseLargeFilePointer(object, oid, size))
+	{
+		// Only the large files actually checked out are fetched
+		if (!FetchLargeFile(oid))
+			return false;
+
+		filesystem::copy_file(LargeFile(oid), temporaryPath);
+		Stats::Add(Stats::BytesRead, size);
+		Stats::Add(Stats::BytesWritten, size);
+	}
+	else
+	{
+		// The chunks are written one at a time, only one of them is ever held in memory
+		bool written = true;
+		{
+			filesystem::ofstream ofs{ temporaryPath, ios_base::binary };
+			if (type == Blob)
+			{
+				ofs.write(reinterpret_cast<const char*>(object.data()), object.size());
+				Stats::Add(Stats::BytesWritten, object.size());
+			}
+
+			string chunkString;
+			ObjectHashType chunkType;
+			for (auto& chunk : chunks)
+			{
+				Utils::Sha1ToString(chunk.sha1, chunkString);
+				if (!ReadObjectFile(chunkString, chunkType, object) || chunkType != Blob || object.size() != chunk.size)
+				{
+					written = false;
+					break;
+				}
+
+				ofs.write(reinterpret_cast<const char*>(object.data()), object.size());
+				Stats::Add(Stats::BytesWritten, object.size());
+			}
+
+			// A short write must not replace the file of the work tree with a truncated one
+			ofs.close();
+			written = written && static_cast<bool>(ofs);
+		}
+
+		if (!written)
+		{
+			system::error_code ec;
+			filesystem::remove(temporaryPath, ec);
+			return false;
+		}
+	}
+
+	Stats::Add(Stats::OpenCalls);
+	filesystem::rename(temporaryPath, destination);
+	return true;
+}
+
+bool GitusService::CheckoutEntries(const std::vector<const IndexEntry*>& entries, size_t& updated, std::string& failed)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::CheckoutEntries");
+
+	updated = 0;
+	failed.clear();
+	auto workTree = RepoDirectory();
+	vector<const IndexEntry*> files;
+	set<filesystem::path> directories;
+	for (auto* entry : entries)
+	{
+		if (entry->IsSparseDirectory())
+			continue;
+
+		files.push_back(entry);
+		directories.insert((workTree / entry->path).parent_path());
+	}
+
+	if (files.empty())
+		return true;
+
+	// Created up front, the workers only write files
+	for (auto& directory : directories)
+	{
+		system::error_code ec;
+		filesystem::create_directories(directory, ec);
+	}
+
+	// Small files are checked out in batches rather than one task each
+	const size_t batchSize = 32;
+	atomic<size_t> written(0);
+	mutex failedMutex;
+	auto fail = [&](size_t i) {
+		lock_guard<mutex> lock(failedMutex);
+		if (failed.empty())
+			failed = files[i]->path;
+	};
+
+	{
+		ThreadPool pool(min((files.size() + batchSize - 1) / batchSize, ThreadPool::DefaultThreadCount()));
+		for (size_t start = 0; start < files.size(); start += batchSize)
+		{
+			pool.Enqueue([&, start]() {
+				// The plain blobs of the batch are written together by the I/O engine,
+				// chunked blobs and large files are streamed one by one
+				vector<IoEngine::WriteRequest> requests;
+				vector<size_t> requestFiles;
+				for (auto i = start; i < min(start + batchSize, files.size()); i++)
+				{
+					bool success;
+					try
+					{
+						string sha1String;
+						ObjectHashType type;
+						RawData object;
+						string oid;
+						uintmax_t size;
+						if (!Utils::Sha1ToString(files[i]->sha1, sha1String) || !ReadObjectFile(sha1String, type, object))
+							success = false;
+						else if (type == Blob && !ParseLargeFilePointer(object, oid, size))
+						{
+							IoEngine::WriteRequest request;
+							request.path = workTree / files[i]->path;
+							request.data.assign(object.begin(), object.end());
+							requests.push_back(move(request));
+							requestFiles.push_back(i);
+							continue;
+						}
+						else
+							success = CheckoutBlob(files[i]->sha1, workTree / files[i]->path);
+					}
+					catch (const std::exception&)
+					{
+						// e.g a corrupt object failing to inflate, tasks must not throw
+						success = false;
+					}
+
+					if (success)
+						written++;
+					else
+						fail(i);
+				}
+
+				try
+				{
+					IoEngine::WriteFiles(requests);
+				}
+				catch (const std::exception&)
+				{
+					// The requests not done are reported below
+				}
+				for (size_t i = 0; i < requests.size(); i++)
+				{
+					if (requests[i].done)
+						written++;
+					else
+						fail(requestFiles[i]);
+				}
+			});
+		}
+		pool.Wait();
+	}
+
+	updated = written;
+	return failed.empty();
+}
+
+bool GitusService::LinkOrCopyFile(const boost::filesystem::path& source, const boost::filesystem::path& destination)
+{
+	using namespace boost;
+
+	system::error_code ec;
+	filesystem::create_hard_link(source, destination, ec);
+	if (!ec)
+		return true;
+
+	// Written aside then renamed, like the objects themselves
+	auto temporaryPath = destination.parent_path() / filesystem::unique_path(destination.filename().string() + "-%%%%%%%%.tmp");
+	auto copied = false;
+	uintmax_t size = 0;
+
+#ifdef __linux__
+	auto in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat status;
+	if (in >= 0 && ::fstat(in, &status) == 0)
+	{
+		auto out = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, status.st_mode & 0777);
+		if (out >= 0)
+		{
+			size = status.st_size;
+			auto remaining = size;
+			while (remaining > 0)
+			{
+				auto length = ::copy_file_range(in, nullptr, out, nullptr, remaining, 0);
+				if (length <= 0)
+					break;
+				remaining -= length;
+			}
+
+			copied = remaining == 0 && ::close(out) == 0;
+			if (remaining != 0)
+				::close(out);
+		}
+	}
+
+	if (in >= 0)
+		::close(in);
+	Stats::Add(Stats::OpenCalls, 2);
+#endif
+
+	// Older kernels do not copy across file systems
+	if (!copied)
+	{
+		filesystem::remove(temporaryPath, ec);
+		filesystem::copy_file(source, temporaryPath, ec);
+		if (ec)
+			return false;
+		size = filesystem::file_size(temporaryPath, ec);
+	}
+
+	Stats::Add(Stats::BytesRead, size);
+	Stats::Add(Stats::BytesWritten, size);
+	filesystem::rename(temporaryPath, destination, ec);
+	if (ec)
+	{
+		filesystem::remove(temporaryPath, ec);
+		return false;
+	}
+
+	return true;
+}
+
+bool GitusService::LinkObjects(const boost::filesystem::path& sourceGitusDirectory, size_t& linked)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::LinkObjects");
+
+	// One task per directory of the stores: fan-out directories, packs and large files
+	vector<pair<filesystem::path, filesystem::path>> directories;
+	auto stores = {
+		make_pair(sourceGitusDirectory / "objects", ObjectsDirectory()),
+		make_pair(sourceGitusDirectory / "lfs" / "objects", LargeFilesDirectory()),
+	};
+
+	for (auto& store : stores)
+	{
+		system::error_code ec;
+		Stats::Add(Stats::ReaddirCalls);
+		for (filesystem::directory_iterator it(store.first, ec), end; !ec && it != end; it.increment(ec))
+		{
+			if (filesystem::is_directory(it->path()))
+				directories.push_back(make_pair(it->path(), store.second / it->path().filename()));
+		}
+	}
+
+	atomic<size_t> count(0);
+	atomic<bool> success(true);
+	{
+		ThreadPool pool(min(max(directories.size(), size_t(1)), ThreadPool::DefaultThreadCount()));
+		for (auto& directory : directories)
+		{
+			pool.Enqueue([&]() {
+				system::error_code ec;
+				filesystem::create_directories(directory.second, ec);
+				Stats::Add(Stats::ReaddirCalls);
+				for (filesystem::directory_iterator it(directory.first, ec), end; !ec && it != end; it.increment(ec))
+				{
+					// Files still being written by the source
+					auto name = it->path().filename().string();
+					if (name.compare(0, 4, "tmp-") == 0 || it->path().extension() == ".tmp")
+						continue;
+
+					auto destination = directory.second / name;
+					Stats::Add(Stats::StatCalls);
+					if (filesystem::exists(destination))
+						continue;
+
+					if (LinkOrCopyFile(it->path(), destination))
+						count++;
+					else
+						success = false;
+				}
+			});
+		}
+		pool.Wait();
+	}
+
+	linked = count;
+	return success;
+}
+
+bool GitusService::FindRepository(const boost::filesystem::path& repository, boost::filesystem::path& gitusDirectory, bool& bare)
+{
+	using namespace boost;
+
+	gitusDirectory = filesystem::absolute(repository).lexically_normal() / ".git";
+	Stats::Add(Stats::StatCalls, 3);
+	bare = !filesystem::is_directory(gitusDirectory);
+	if (bare)
+		gitusDirectory = gitusDirectory.parent_path();
+
+	return filesystem::is_directory(gitusDirectory / "objects") && filesystem::exists(gitusDirectory / "HEAD");
+}
+
+bool GitusService::ReadReference(const boost::filesystem::path& file, RawData& sha1)
+{
+	sha1.clear();
+	Stats::Add(Stats::StatCalls);
+	// The directory of the references named after it, e.g. 'refs/heads/a' for "a/b"
+	boost::system::error_code ec;
+	if (!boost::filesystem::is_regular_file(file, ec))
+		return true;
+
+	sha1 = Utils::ReadBytes(file.string());
+	if (sha1.empty())
+		return true;
+
+	// Binary, followed by a new line
+	if (sha1.size() < Sha1Size)
+		return false;
+
+	sha1.resize(Sha1Size);
+	return true;
+}
+
+bool GitusService::WriteReference(const boost::filesystem::path& file, const RawData& sha1)
+{
+	using namespace std;
+	using namespace boost;
+
+	auto directory = file.parent_path();
+	filesystem::create_directories(directory);
+	auto temporaryPath = directory / filesystem::unique_path(file.filename().string() + "-%%%%%%%%.tmp");
+	bool written;
+	{
+		filesystem::ofstream ofs(temporaryPath, ios_base::binary);
+		ofs.write(reinterpret_cast<const char*>(sha1.data()), sha1.size());
+		if (!sha1.empty())
+			ofs.put('\n');
+		Stats::Add(Stats::OpenCalls);
+		Stats::Add(Stats::BytesWritten, sha1.size() + 1);
+		written = static_cast<bool>(ofs);
+	}
+
+	if (!written)
+	{
+		system::error_code ec;
+		filesystem::remove(temporaryPath, ec);
+		return false;
+	}
+
+	filesystem::rename(temporaryPath, file);
+	return true;
+}
+
+bool GitusService::HeadBranch(std::string& branch)
+{
+	using namespace std;
+	static const string prefix = "ref: refs/heads/";
+
+	auto content = Utils::ReadBytes(HeadFile().string());
+	string head(content.begin(), content.end());
+
+	// Repositories initialized by older versions read "ref: refs / heads / master"
+	for (size_t position; (position = head.find(" / ")) != string::npos;)
+		head.replace(position, 3, "/");
+
+	while (!head.empty() && isspace(static_cast<unsigned char>(head.back())))
+		head.pop_back();
+
+	if (head.compare(0, prefix.size(), prefix) != 0)
+		return false;
+
+	branch = head.substr(prefix.size());
+	return IsValidBranchName(branch);
+}
+
+bool GitusService::WriteHead(const std::string& branch)
+{
+	using namespace std;
+	using namespace boost;
+
+	auto temporaryPath = _currentGitusDirectory / filesystem::unique_path("HEAD-%%%%%%%%.tmp");
+	auto head = "ref: refs/heads/" + branch + "\n";
+	bool written;
+	{
+		filesystem::ofstream ofs(temporaryPath, ios_base::binary);
+		ofs << head;
+		Stats::Add(Stats::OpenCalls);
+		Stats::Add(Stats::BytesWritten, head.size());
+		written = static_cast<bool>(ofs);
+	}
+
+	system::error_code ec;
+	if (written)
+		filesystem::rename(temporaryPath, HeadFile(), ec);
+
+	if (!written || ec)
+	{
+		filesystem::remove(temporaryPath, ec);
+		return false;
+	}
+
+	return true;
+}
+
+std::shared_ptr<PackedRefs> GitusService::LoadPackedRefs()
+{
+	auto stamp = FileStamp::Of(PackedRefsFile());
+
+	std::lock_guard<std::mutex> lock(_refsMutex);
+	if (!_packedRefs || _packedRefs->Stamp() != stamp)
+		_packedRefs = PackedRefs::Open(PackedRefsFile());
+	return _packedRefs;
+}
+
+bool GitusService::ResolveReference(const std::string& name, RawData& sha1)
+{
+	if (!ReadReference(_currentGitusDirectory / name, sha1))
+		return false;
+
+	if (!sha1.empty())
+		return true;
+
+	auto packedRefs = LoadPackedRefs();
+	if (!packedRefs)
+		return false;
+
+	if (!packedRefs->Find(name, sha1))
+		sha1.clear();
+	return true;
+}
+
+bool GitusService::UpdateReference(const std::string& name, const RawData& sha1)
+{
+	return WriteReference(_currentGitusDirectory / name, sha1);
+}
+
+bool GitusService::DeleteReference(const std::string& name)
+{
+	using namespace std;
+	using namespace boost;
+
+	auto packedRefs = LoadPackedRefs();
+	if (!packedRefs)
+		return false;
+
+	// The packed line first, a reader never finds the older commit once the loose file is gone
+	RawData sha1;
+	if (packedRefs->Find(name, sha1))
+	{
+		map<string, RawData> references;
+		packedRefs->List("", references);
+		references.erase(name);
+		if (!PackedRefs::Write(PackedRefsFile(), references))
+			return false;
+	}
+
+	system::error_code ec;
+	filesystem::remove(_currentGitusDirectory / name, ec);
+	if (ec)
+		return false;
+
+	// So that "a" can be created once "a/b" is deleted, the directories of 'refs/heads' and the like are kept
+	auto parent = filesystem::path(name).parent_path();
+	while (std::distance(parent.begin(), parent.end()) > 2 && filesystem::remove(_currentGitusDirectory / parent, ec))
+		parent = parent.parent_path();
+
+	return true;
+}
+
+bool GitusService::ReadLooseReferences(const std::string& directory, std::map<std::string, RawData>& references)
+{
+	using namespace std;
+	using namespace boost;
+
+	auto base = (_currentGitusDirectory / directory).generic_string();
+	system::error_code ec;
+	Stats::Add(Stats::ReaddirCalls);
+	for (filesystem::recursive_directory_iterator it(base, ec), end; !ec && it != end; it.increment(ec))
+	{
+		// A reference being written (see 'WriteReference')
+		if (!filesystem::is_regular_file(it->path()) || it->path().extension() == ".tmp")
+			continue;
+
+		auto name = it->path().generic_string().substr(base.size());
+		if (!name.empty() && name[0] == '/')
+			name.erase(0, 1);
+
+		RawData sha1;
+		if (!ReadReference(it->path(), sha1))
+			return false;
+
+		if (!sha1.empty())
+			references[directory + name] = sha1;
+	}
+
+	return true;
+}
+
+bool GitusService::ListReferences(const std::string& prefix, std::map<std::string, RawData>& references)
+{
+	using namespace std;
+
+	references.clear();
+	auto packedRefs = LoadPackedRefs();
+	if (!packedRefs)
+		return false;
+
+	packedRefs->List(prefix, references);
+
+	// The loose files take precedence
+	map<string, RawData> looseReferences;
+	if (!ReadLooseReferences(prefix.substr(0, prefix.rfind('/') + 1), looseReferences))
+		return false;
+
+	for (auto& reference : looseReferences)
+	{
+		if (reference.first.compare(0, prefix.size(), prefix) == 0)
+			references[reference.first] = reference.second;
+	}
+
+	return true;
+}
+
+bool GitusService::PackReferences(size_t& packed)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::PackReferences");
+
+	map<string, RawData> looseReferences;
+	map<string, RawData> references;
+	if (!ReadLooseReferences("refs/", looseReferences) || !ListReferences("refs/", references)
+		|| !PackedRefs::Write(PackedRefsFile(), references))
+		return false;
+
+	packed = references.size();
+
+	// A reference updated meanwhile keeps its loose file
+	system::error_code ec;
+	RawData sha1;
+	for (auto& reference : looseReferences)
+	{
+		auto file = _currentGitusDirectory / reference.first;
+		if (ReadReference(file, sha1) && sha1 == reference.second)
+			filesystem::remove(file, ec);
+	}
+
+	return true;
+}
+
+bool GitusService::IsValidBranchName(const std::string& name)
+{
+	using namespace std;
+
+	if (name.empty() || name[0] == '-' || name.back() == '/' || name.back() == '.' || name == "HEAD"
+		|| name.find("..") != string::npos || name.find("//") != string::npos || name.find("@{") != string::npos)
+		return false;
+
+	for (auto c : name)
+	{
+		auto byte = static_cast<unsigned char>(c);
+		if (byte <= ' ' || byte == 0x7f || strchr("~^:?*[\\", byte) != nullptr)
+			return false;
+	}
+
+	for (size_t start = 0, end = 0; end != string::npos; start = end + 1)
+	{
+		end = name.find('/', start);
+		auto component = name.substr(start, end == string::npos ? string::npos : end - start);
+		auto endsWith = [&](const string& suffix) {
+			return component.size() >= suffix.size() && component.compare(component.size() - suffix.size(), suffix.size(), suffix) == 0;
+		};
+
+		if (component.empty() || component[0] == '.' || endsWith(".lock") || endsWith(".tmp"))
+			return false;
+	}
+
+	return true;
+}
+
+bool GitusService::RemoteRepository(const std::string& remote, boost::filesystem::path& repository)
+{
+	using namespace std;
+	static const string urlField = "URL: ";
+
+	// A name without separator is looked up first
+	RawData content;
+	if (remote.find_first_of("/\\") == string::npos && Utils::ReadBytes(RemoteFile(remote).string(), content))
+	{
+		string line(content.begin(), content.end());
+		line = line.substr(0, line.find('\n'));
+		if (line.compare(0, urlField.size(), urlField) != 0)
+			return false;
+
+		repository = line.substr(urlField.size());
+		return true;
+	}
+
+	repository = remote;
+	return true;
+}
+
+bool GitusService::WriteRemote(const std::string& remote, const boost::filesystem::path& repository)
+{
+	using namespace boost;
+
+	filesystem::create_directories(RemoteFile(remote).parent_path());
+	filesystem::ofstream ofs(RemoteFile(remote), std::ios_base::binary);
+	ofs << "URL: " << repository.string() << "\n";
+	Stats::Add(Stats::OpenCalls);
+	return static_cast<bool>(ofs);
+}
+
+bool GitusService::CopyFileHashed(const boost::filesystem::path& source, const boost::filesystem::path& destination, std::string& oid, uintmax_t& size)
+{
+	using namespace std;
+	using namespace boost;
+
+	// Only hashed without a destination
+	filesystem::ifstream ifs(source, ios_base::binary);
+	filesystem::ofstream ofs;
+	if (!destination.empty())
+		ofs.open(destination, ios_base::binary);
+	Stats::Add(Stats::OpenCalls, destination.empty() ? 1 : 2);
+	if (!ifs || !ofs)
+		return false;
+
+	// Streamed, the content is neither compressed nor held in memory
+	ScratchData buffer(1024 * 1024);
+	Sha1Context sha1;
+	size = 0;
+	while (ifs)
+	{
+		ifs.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+		auto length = static_cast<size_t>(ifs.gcount());
+		if (length == 0)
+			break;
+
+		sha1.Update(ByteView(buffer.data(), length));
+		if (!destination.empty())
+			ofs.write(reinterpret_cast<const char*>(buffer.data()), length);
+		size += length;
+	}
+
+	Stats::Add(Stats::BytesRead, size);
+	if (!destination.empty())
+	{
+		Stats::Add(Stats::BytesWritten, size);
+		ofs.close();
+	}
+
+	if (ifs.bad() || !ofs)
+		return false;
+
+	RawData digest;
+	sha1.Final(digest);
+	return Utils::Sha1ToString(digest, oid);
+}
+
+RawData GitusService::CreateLargeFilePointer(const std::string& oid, uintmax_t size)
+{
+	auto pointer = "version gitus-lfs/1\noid sha1:" + oid + "\nsize " + std::to_string(size) + "\n";
+	return RawData(pointer.begin(), pointer.end());
+}
+
+bool GitusService::ParseLargeFilePointer(ByteView object, std::string& oid, uintmax_t& size)
+{
+	using namespace std;
+
+	static const string version = "version gitus-lfs/1\noid sha1:";
+	static const string sizeField = "\nsize ";
+
+	// Pointers are small, a larger blob is never parsed
+	if (object.size() < version.size() + 40 + sizeField.size() + 2 || object.size() > 128
+		|| !equal(version.begin(), version.end(), object.begin())
+		|| object[object.size() - 1] != '\n')
+		return false;
+
+	oid = string(object.begin() + version.size(), object.begin() + version.size() + 40);
+	if (oid.find_first_not_of("0123456789abcdef") != string::npos
+		|| !equal(sizeField.begin(), sizeField.end(), object.begin() + version.size() + 40))
+		return false;
+
+	string sizeString(object.begin() + version.size() + 40 + sizeField.size(), object.end() - 1);
+	if (sizeString.empty() || sizeString.find_first_not_of("0123456789") != string::npos)
+		return false;
+
+	size = stoull(sizeString);
+	return true;
+}
+
+
+RawData GitusService::CreateContentData(ByteView object, ObjectHashType type) {
+	auto header = CreateHeaderData(type, object);
+	RawData content;
+	content.reserve(header.size() + object.size());
+	std::copy(header.begin(), header.end(), std::back_inserter(content));
+	std::copy(object.begin(), object.end(), std::back_inserter(content));
+	return content;
+}
+
+std::string GitusService::TypeName(ObjectHashType type)
+{
+	switch (type)
+	{
+	case GitusService::Blob:
+		return "blob";
+	case GitusService::Commit:
+		return "commit";
+	case GitusService::Tree:
+		return "tree";
+	case GitusService::Chunks:
+		return "chunks";
+	case GitusService::Delta:
+		return "delta";
+	default:
+		return "";
+	}
+}
+
+RawData GitusService::CreateHeaderData(GitusService::ObjectHashType type, ByteView object)
+{
+	std::string t = TypeName(type);
+	RawData header;
+
+	// add the type
+	copy(t.begin(), t.end(), std::back_inserter(header));
+
+	// add the size
+	Word2 size; size.n = object.size();
+	copy(&size.c[0], &(size.c[4]), back_inserter(header));
+	return header;
+}
+
+
+bool GitusService::WriteIndex(const std::map<std::string, IndexEntry>& entries)
+{
+	{
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		if (_deferIndexWrites)
+		{
+			_indexCache = entries;
+			_indexCacheValid = true;
+			_indexDirty = true;
+			return true;
+		}
+	}
+
+	return WriteIndexFile(entries);
+}
+
+bool GitusService::FlushIndex()
+{
+	std::map<std::string, IndexEntry> entries;
+	{
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		if (!_indexDirty)
+			return true;
+
+		entries = _indexCache;
+	}
+
+	if (!WriteIndexFile(entries))
+		return false;
+
+	std::lock_guard<std::mutex> lock(_cacheMutex);
+	_indexDirty = false;
+	return true;
+}
+
+void GitusService::SetDeferIndexWrites(bool defer)
+{
+	{
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		_deferIndexWrites = defer;
+	}
+
+	if (!defer)
+		FlushIndex();
+}
+
+bool GitusService::WriteIndexFile(const std::map<std::string, IndexEntry>& entries)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::WriteIndex");
+
+	// Sized upfront, the header, entries and digest are written in place
+	size_t indexLength = HeaderLength + Sha1Size;
+	for (auto& entry : entries)
+		indexLength += ((BaseEntryLength + entry.second.path.size() + 8) / 8) * 8;
+
+	ScratchData data;
+	data.reserve(indexLength);
+
+	// A 12 byte header
+	// Signature
+	data.insert(data.end(), DirCacheSignature, DirCacheSignature + 4);
+
+	// Version number
+	Word2 version; version.n = IndexFormatVersion;
+	data.insert(data.end(), &version.c[0], &version.c[4]);
+
+	// Number of entries
+	Word2 numEntries; numEntries.n = entries.size();
+	data.insert(data.end(), &numEntries.c[0], &numEntries.c[4]);
+
+	// The c++ standard guarantees that a map is iterated over in order of the keys
+	for (auto it = entries.begin(); it != entries.end(); it++)
+	{
+		auto* entry = &it->second;
+
+		for (int i = 0; i < entry->numFields; i++)
+			data.insert(data.end(), &entry->fields[i].c[0], &entry->fields[i].c[4]);
+
+		data.insert(data.end(), entry->sha1.begin(), entry->sha1.begin() + Sha1Size);
+
+		// add flags
+		data.insert(data.end(), &entry->flags.c[0], &entry->flags.c[2]);
+
+		// Add path
+		data.insert(data.end(), entry->path.begin(), entry->path.end());
+		data.push_back(0);//null terminate the path
+		
+		// Add padding, the null terminator counts as padding (see 'ReadIndex')
+		size_t pathOffset = ((BaseEntryLength + entry->path.size() + 8) / 8) * 8;
+		auto paddingLength = pathOffset - BaseEntryLength - entry->path.size() - 1;
+		data.insert(data.end(), paddingLength, 0);
+	}
+
+	RawData digest;
+	Utils::Sha1(data, digest);
+
+	{
+		filesystem::ofstream ofs{ IndexFile(), ios_base::binary };
+
+		// Concat digest
+		copy(digest.begin(), digest.end(), back_inserter(data));
+
+		ofs.write(reinterpret_cast<char*>(data.data()), data.size()*sizeof(unsigned char));
+
+		Stats::Add(Stats::OpenCalls);
+		Stats::Add(Stats::BytesWritten, data.size());
+	}
+
+	IndexStamp stamp;
+	lock_guard<mutex> lock(_cacheMutex);
+	_indexCacheValid = ReadIndexStamp(stamp) && stamp.digest == digest;
+	if (_indexCacheValid)
+	{
+		_indexStamp = stamp;
+		_indexCache = entries;
+	}
+
+	return true;
+
+};
+
+bool GitusService::ReadIndexStamp(IndexStamp& stamp)
+{
+	using namespace std;
+	using namespace boost;
+
+	// The trailing digest catches rewrites of the same size within the mtime resolution
+	system::error_code ec;
+	stamp.mtime = filesystem::last_write_time(IndexFile(), ec);
+	stamp.size = filesystem::file_size(IndexFile(), ec);
+	Stats::Add(Stats::StatCalls, 2);
+	if (ec || stamp.size < Sha1Size)
+		return false;
+
+	filesystem::ifstream ifs{ IndexFile(), ios_base::binary };
+	Stats::Add(Stats::OpenCalls);
+	Stats::Add(Stats::BytesRead, Sha1Size);
+	ifs.seekg(-static_cast<streamoff>(Sha1Size), ios_base::end);
+	stamp.digest.resize(Sha1Size);
+	ifs.read(reinterpret_cast<char*>(stamp.digest.data()), Sha1Size);
+	return static_cast<bool>(ifs);
+}
+
+bool GitusService::ReadIndex(std::map<std::string, IndexEntry>& entries)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::ReadIndex");
+
+	{
+		// Not written to disk yet, see 'SetDeferIndexWrites'
+		lock_guard<mutex> lock(_cacheMutex);
+		if (_indexDirty)
+		{
+			entries.insert(_indexCache.begin(), _indexCache.end());
+			return true;
+		}
+	}
+
+	IndexStamp stamp;
+	if (ReadIndexStamp(stamp))
+	{
+		{
+			lock_guard<mutex> lock(_cacheMutex);
+			if (_indexCacheValid && _indexStamp == stamp)
+			{
+				entries.insert(_indexCache.begin(), _indexCache.end());
+				return true;
+			}
+		}
+
+		ScratchData data;
+		Utils::ReadBytes(IndexFile().string(), data);
+		if (data.size() < HeaderLength + Sha1Size)
+			return false;
+
+		// The entries are parsed in place, only the parsed entries are allocated
+		auto contentEnd = data.data() + data.size() - Sha1Size;
+		RawData contentHash;
+		Utils::Sha1(ByteView(data.data(), data.size() - Sha1Size), contentHash);
+		if (!equal(contentHash.begin(), contentHash.end(), contentEnd)) {
+			std::exception("fatal: Index file is corrupted.");
+			return false;
+		}
+
+		auto entryBegin = data.data() + HeaderLength;
+		while (contentEnd - entryBegin > static_cast<ptrdiff_t>(BaseEntryLength))
+		{
+			IndexEntry entry(entryBegin);
+			size_t shaEndPos = EntryHeaderLength + Sha1Size;
+			entry.sha1.assign(
+				entryBegin + EntryHeaderLength, 
+				entryBegin + shaEndPos);
+
+			size_t flagsEndPos = shaEndPos + FlagsLength;
+			copy(entryBegin + shaEndPos, entryBegin + flagsEndPos, entry.flags.c);
+
+			// Find null terminated string
+			auto pos = std::find(entryBegin + flagsEndPos, contentEnd, '\0');
+			entry.path.assign(entryBegin + flagsEndPos, pos);
+
+			auto currentEntryLength = ((BaseEntryLength + entry.path.size() + 8) / 8) * 8;
+			auto path = entry.path;
+			entries.emplace(move(path), move(entry));
+			Stats::Add(Stats::IndexEntriesParsed);
+
+			entryBegin += currentEntryLength;
+		}
+
+		lock_guard<mutex> lock(_cacheMutex);
+		_indexStamp = stamp;
+		_indexCache = entries;
+		_indexCacheValid = true;
+	}
+
+	return true;
+};
+
+
+RawData GitusService::HashCommitTree() {
+
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("GitusService::HashCommitTree");
+
+	auto entries = map<string, IndexEntry>();
+	RawData treeEntries;
+
+	if (!GitusService::ReadIndex(entries))
+	{
+		// Error occured
+		return treeEntries;
+	}
+	else if (entries.empty())
+	{
+		return treeEntries;
+	}
+
+
+	// each 'line' in a tree object is in the '<mode><space><path>' format
+	// then a NUL byte, then the binary SHA-1 hash.
+	size_t treeLength = 0;
+	for (auto& entry : entries)
+		treeLength += 4 + 1 + entry.second.path.size() + 1 + Sha1Size;
+	treeEntries.reserve(treeLength);
+
+	for (auto it = entries.begin(); it != entries.end(); it++)
+	{
+		auto* entry = &it->second;
+		
+		// mode
+		copy(&entry->fields[6].c[0], &entry->fields[6].c[4], back_inserter(treeEntries));
+		
+		// empty space
+		treeEntries.push_back(' ');
+		
+		// path, a sparse directory is stored without its trailing '/'
+		auto pathEnd = entry->IsSparseDirectory() ? entry->path.end() - 1 : entry->path.end();
+		copy(entry->path.begin(), pathEnd, back_inserter(treeEntries));
+		
+		// null byte
+		treeEntries.push_back(0);
+
+		// sha1
+		copy(entry->sha1.begin(), entry->sha1.end(), back_inserter(treeEntries));	
+	}
+
+	return treeEntries;
+}
+
+bool GitusService::HasParentTree() {
+	RawData head;
+	return LocalMasterHash(head) && !head.empty();
+}
+
+bool GitusService::LocalMasterHash(RawData& hash) {
+	// Get current commit hash of the branch HEAD points to
+	std::string branch;
+	hash.clear();
+	return HeadBranch(branch) && ResolveReference("refs/heads/" + branch, hash);
+}
+
+bool GitusService::ReadHeadTree(std::map<std::string, RawData>& files)
+{
+	using namespace std;
+	GITUS_TRACE_SCOPE("GitusService::ReadHeadTree");
+
+	files.clear();
+	RawData commit;
+	if (!LocalMasterHash(commit))
+		return false;
+
+	if (commit.empty())
+		return true;
+
+	string sha1String;
+	ObjectHashType type;
+	RawData object;
+	RawData tree;
+	vector<RawData> parents;
+	if (!Utils::Sha1ToString(commit, sha1String) || !ReadObject(sha1String, type, object) || type != Commit
+		|| !ParseCommit(object, tree, parents))
+		return false;
+
+	vector<TreeEntry> entries;
+	if (!Utils::Sha1ToString(tree, sha1String) || !ReadObject(sha1String, type, object) || type != Tree
+		|| !ParseTree(object, entries))
+		return false;
+
+	for (auto& entry : entries)
+	{
+		auto path = entry.mode.n == IndexEntry::SparseDirectoryMode ? entry.path + "/" : entry.path;
+		files[path] = move(entry.sha1);
+	}
+
+	return true;
+}
+
+bool GitusService::ReadTree(const RawData& sha1, const std::string& prefix, std::vector<TreeEntry>& entries)
+{
+	using namespace std;
+
+	string sha1String;
+	ObjectHashType type;
+	RawData object;
+	auto first = entries.size();
+	if (!Utils::Sha1ToString(sha1, sha1String) || !ReadObject(sha1String, type, object) || type != Tree
+		|| !ParseTree(object, entries))
+		return false;
+
+	for (auto i = first; i < entries.size(); i++)
+		entries[i].path.insert(0, prefix);
+
+	return true;
+}
+
+RawData GitusService::CreateTreeData(const std::vector<TreeEntry>& entries)
+{
+	size_t length = 0;
+	for (auto& entry : entries)
+		length += 4 + 1 + entry.path.size() + 1 + Sha1Size;
+
+	// Same layout as 'HashCommitTree'
+	RawData data;
+	data.reserve(length);
+	for (auto& entry : entries)
+	{
+		data.insert(data.end(), &entry.mode.c[0], &entry.mode.c[4]);
+		data.push_back(' ');
+		data.insert(data.end(), entry.path.begin(), entry.path.end());
+		data.push_back(0);
+		data.insert(data.end(), entry.sha1.begin(), entry.sha1.end());
+	}
+
+	return data;
+}
+
+bool GitusService::SparseCone(std::vector<std::string>& directories)
+{
+	using namespace std;
+
+	directories.clear();
+	Stats::Add(Stats::StatCalls);
+	if (!boost::filesystem::exists(SparseCheckoutFile()))
+		return false;
+
+	boost::filesystem::ifstream ifs{ SparseCheckoutFile() };
+	string line;
+	while (getline(ifs, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (!line.empty())
+			directories.push_back(line);
+	}
+
+	return true;
+}
+
+bool GitusService::WriteSparseCone(const std::vector<std::string>& directories)
+{
+	using namespace boost;
+
+	system::error_code ec;
+	if (directories.empty())
+	{
+		filesystem::remove(SparseCheckoutFile(), ec);
+		return !ec;
+	}
+
+	filesystem::create_directories(SparseCheckoutFile().parent_path(), ec);
+	auto temporary = SparseCheckoutFile();
+	temporary += ".lock";
+	{
+		filesystem::ofstream ofs{ temporary, std::ios_base::binary };
+		for (auto& directory : directories)
+			ofs << directory << '\n';
+		if (!ofs)
+			return false;
+	}
+
+	filesystem::rename(temporary, SparseCheckoutFile(), ec);
+	return !ec;
+}
+
+bool GitusService::InSparseCone(const std::vector<std::string>& directories, const std::string& path)
+{
+	auto separator = path.rfind('/');
+	if (separator == std::string::npos)
+		return true;
+
+	// Below a directory of the cone, or directly in one of its parents
+	auto parent = path.substr(0, separator);
+	for (auto& directory : directories)
+	{
+		if (path.size() > directory.size() && path.compare(0, directory.size(), directory) == 0 && path[directory.size()] == '/')
+			return true;
+
+		if (directory.size() > parent.size() && directory.compare(0, parent.size(), parent) == 0 && directory[parent.size()] == '/')
+			return true;
+	}
+
+	return false;
+}
+
+bool GitusService::CollapseIndex(std::map<std::string, IndexEntry>& entries, const std::vector<std::string>& directories)
+{
+	using namespace std;
+	GITUS_TRACE_SCOPE("GitusService::CollapseIndex");
+
+	// The highest directory above a path outside of the cone with no directory of the cone below it
+	auto collapsedDirectory = [&](const string& path) {
+		for (auto separator = path.find('/'); separator != string::npos; separator = path.find('/', separator + 1))
+		{
+			auto contains = any_of(directories.begin(), directories.end(), [&](const string& directory) {
+				return directory.compare(0, separator, path, 0, separator) == 0
+					&& (directory.size() == separator || directory[separator] == '/');
+			});
+			if (!contains)
+				return path.substr(0, separator + 1);
+		}
+		return string();
+	};
+
+	map<string, vector<TreeEntry>> collapsed;
+	for (auto it = entries.begin(); it != entries.end();)
+	{
+		auto& entry = it->second;
+		auto directory = entry.IsSparseDirectory() || InSparseCone(directories, it->first) ? string() : collapsedDirectory(it->first);
+		if (directory.empty())
+		{
+			it++;
+			continue;
+		}
+
+		TreeEntry treeEntry;
+		treeEntry.mode = entry.fields[6];
+		treeEntry.path = it->first.substr(directory.size());
+		treeEntry.sha1 = entry.sha1;
+		collapsed[directory].push_back(move(treeEntry));
+		it = entries.erase(it);
+	}
+
+	for (auto& directory : collapsed)
+	{
+		IndexEntry entry;
+		entry.path = directory.first;
+		entry.fields[6].n = IndexEntry::SparseDirectoryMode;
+		if (!HashObject(CreateTreeData(directory.second), Tree, true, entry.sha1))
+			return false;
+
+		entries[entry.path] = entry;
+	}
+
+	return true;
+}
+
+bool GitusService::ExpandIndex(std::map<std::string, IndexEntry>& entries, const std::string& path, size_t& expanded)
+{
+	using namespace std;
+	GITUS_TRACE_SCOPE("GitusService::ExpandIndex");
+
+	expanded = 0;
+	vector<string> directories;
+	if (path.empty())
+	{
+		for (auto& entry : entries)
+		{
+			if (entry.second.IsSparseDirectory())
+				directories.push_back(entry.first);
+		}
+	}
+	else
+	{
+		// Only one of the directories above the path can be collapsed
+		for (auto separator = path.find('/'); separator != string::npos; separator = path.find('/', separator + 1))
+		{
+			auto entry = entries.find(path.substr(0, separator + 1));
+			if (entry != entries.end() && entry->second.IsSparseDirectory())
+			{
+				directories.push_back(entry->first);
+				break;
+			}
+		}
+	}
+
+	for (auto& directory : directories)
+	{
+		vector<TreeEntry> treeEntries;
+		if (!ReadTree(entries[directory].sha1, directory, treeEntries))
+			return false;
+
+		entries.erase(directory);
+		for (auto& treeEntry : treeEntries)
+		{
+			IndexEntry entry;
+			entry.fields[6] = treeEntry.mode;
+			entry.path = entry.IsSparseDirectory() ? treeEntry.path + "/" : treeEntry.path;
+			entry.sha1 = move(treeEntry.sha1);
+			entries[entry.path] = entry;
+		}
+
+		expanded++;
+	}
+
+	return true;
+}
+
+bool GitusService::WriteCommit(const RawData& tree, const std::string& msg, const std::string& author, const std::string& email, std::time_t time, RawData& commitHash)
+{
+	// Add parent commit object information
+	// If has local master and local master is not empty
+	RawData parent;
+	if (HasParentTree()) {
+		LocalMasterHash(parent);
+		if (parent.size() >= Sha1Size)
+			parent.resize(Sha1Size);
+		else
+			parent.clear();
+	}
+
+	auto commitObject = CreateCommitData(tree, parent, msg, author, email, time);
+
+	// Get hash representation
+	commitHash.clear();
+	if (!HashObject(commitObject, GitusService::Commit, true, commitHash))
+		return false;
+
+	// Write commit representation to the branch HEAD points to
+	std::string branch;
+	return HeadBranch(branch) && UpdateReference("refs/heads/" + branch, commitHash);
+}
+
+RawData GitusService::CreateCommitData(const RawData& tree, const RawData& parent, const std::string& msg, const std::string& author, const std::string& email, std::time_t time)
+{
+	using namespace std;
+
+	stringstream content;
+	// Add tree information
+	content << "tree ";
+	content.write(
+		reinterpret_cast<const char*>(tree.data()),
+		tree.size() * sizeof(unsigned char));
+
+	if (!parent.empty())
+	{
+		content << '\n';
+		content << "parent ";
+		content.write(
+			reinterpret_cast<const char*>(parent.data()),
+			parent.size() * sizeof(unsigned char));
+	}
+
+	// Add author information
+	content << '\n';
+	string timezone = "+0000";
+	content << "author " << author << time << timezone;
+
+	// Add commiter information (Simplified: same as author)
+	content << '\n';
+	content << "author " << author << email << time << timezone;
+
+	// Add linebreak as per the specification
+	content << '\n';
+
+	// Add the message
+	content << '\n';
+	content << msg;
+
+	return RawData(
+		(std::istreambuf_iterator<char>(content)),
+		(std::istreambuf_iterator<char>()));
+}
+
+bool GitusService::ObjectExists(std::string sha1String) {
+
+	using namespace std;
+
+	{
+		lock_guard<mutex> lock(_cacheMutex);
+		if (_knownObjects.count(sha1String) != 0)
+			return true;
+	}
+
+	std::string first = sha1String.substr(0, 2);
+	std::string last = sha1String.substr(2, std::string::npos);
+
+	auto filePath = ObjectsDirectory() / first;
+
+	Stats::Add(Stats::StatCalls);
+	if (!boost::filesystem::exists(filePath / last))
+	{
+		RawData sha1;
+		if (!Utils::StringToSha1(sha1String, sha1))
+			return false;
+
+		if (!FindPackedObject(sha1, nullptr))
+			return false;
+	}
+
+	// Only presence is cached, a missing object may be written by another process
+	lock_guard<mutex> lock(_cacheMutex);
+	_knownObjects.insert(sha1String);
+	return true;
+}
+
+
+
+
+bool GitusService::ReadObject(const std::string& sha1String, ObjectHashType& type, RawData& object)
+{
+	using namespace std;
+	GITUS_TRACE_SCOPE("GitusService::ReadObject");
+
+	{
+		lock_guard<mutex> lock(_cacheMutex);
+		auto cached = _objectCache.find(sha1String);
+		if (cached != _objectCache.end())
+		{
+			_objectCacheOrder.splice(_objectCacheOrder.begin(), _objectCacheOrder, cached->second.position);
+			type = static_cast<ObjectHashType>(cached->second.type);
+			object = cached->second.object;
+			return true;
+		}
+	}
+
+	if (!ReadObjectFile(sha1String, type, object))
+		return false;
+
+	if (type == Chunks)
+	{
+		vector<ChunkEntry> chunks;
+		if (!ParseChunks(object, chunks))
+			return false;
+
+		size_t size = 0;
+		for (auto& chunk : chunks)
+			size += chunk.size;
+
+		// The chunks are not cached, only the reassembled blob when small enough
+		RawData blob;
+		blob.reserve(size);
+		RawData chunkData;
+		for (auto& chunk : chunks)
+		{
+			string chunkString;
+			ObjectHashType chunkType;
+			Utils::Sha1ToString(chunk.sha1, chunkString);
+			if (!ReadObjectFile(chunkString, chunkType, chunkData) || chunkType != Blob || chunkData.size() != chunk.size)
+				return false;
+
+			blob.insert(blob.end(), chunkData.begin(), chunkData.end());
+		}
+
+		type = Blob;
+		object = move(blob);
+	}
+
+	CacheObject(sha1String, type, object);
+	return true;
+}
+
+bool GitusService::ReadObjectFile(const std::string& sha1String, ObjectHashType& type, RawData& object)
+{
+	if (sha1String.size() != 40 || !ObjectExists(sha1String))
+		return false;
+
+	std::string content;
+	return ReadObjectContent(sha1String, content) && ParseContentData(content, type, object);
+}
+
+void GitusService::CacheObject(const std::string& sha1String, int type, const RawData& object)
+{
+	using namespace std;
+
+	// Objects larger than a quarter of the cache would evict everything else
+	if (object.size() > _objectCacheLimit / 4)
+		return;
+
+	lock_guard<mutex> lock(_cacheMutex);
+	if (_objectCache.count(sha1String) != 0)
+		return;
+
+	_objectCacheOrder.push_front(sha1String);
+	_objectCache[sha1String] = CachedObject{ type, object, _objectCacheOrder.begin() };
+	_objectCacheBytes += object.size();
+
+	while (_objectCacheBytes > _objectCacheLimit)
+	{
+		auto evicted = _objectCache.find(_objectCacheOrder.back());
+		_objectCacheBytes -= evicted->second.object.size();
+		_objectCache.erase(evicted);
+		_objectCacheOrder.pop_back();
+	}
+}
+
+void GitusService::ClearCaches()
+{
+	// Pending ids belong to the previous repository
+	ResetHashCache();
+
+	std::lock_guard<std::mutex> lock(_cacheMutex);
+	_indexCacheValid = false;
+	_indexDirty = false;
+	_indexCache.clear();
+	_knownObjects.clear();
+	_objectCache.clear();
+	_objectCacheOrder.clear();
+	_objectCacheBytes = 0;
+
+	std::lock_guard<std::mutex> packsLock(_packsMutex);
+	_packs.clear();
+	_packsStamp = 0;
+	_multiPackIndex = nullptr;
+	_uncoveredPacks.clear();
+	_lookupStamp = 0;
+}
+
+bool GitusService::ReadObjectHeader(const std::string& sha1String, ObjectHashType& type, size_t& size)
+{
+	using namespace std;
+
+	if (sha1String.size() != 40 || !ObjectExists(sha1String) || !ReadStoredHeader(sha1String, type, size, 0))
+		return false;
+
+	// The size of a chunked blob is the sum of its chunks, the list is small enough to be read
+	if (type == Chunks)
+	{
+		RawData object;
+		vector<ChunkEntry> chunks;
+		if (!ReadObjectFile(sha1String, type, object) || !ParseChunks(object, chunks))
+			return false;
+
+		type = Blob;
+		size = 0;
+		for (auto& chunk : chunks)
+			size += chunk.size;
+	}
+
+	return true;
+}
+
+bool GitusService::ReadStoredHeader(const std::string& sha1String, ObjectHashType& type, size_t& size, size_t depth)
+{
+	using namespace std;
+
+	ScratchData data;
+	if (!ReadStoredObject(sha1String, data))
+		return false;
+
+	// Longest header is that of a delta: "delta", the 4 bytes size, the sha1 of the base,
+	// then the sizes of the base and of the result (10 bytes at most each)
+	static const string deltaName = TypeName(Delta);
+	auto headerLength = deltaName.size() + 4;
+	auto prefix = Utils::DecompressPrefix(data, headerLength + Sha1Size + 20);
+
+	if (prefix.size() >= headerLength && equal(deltaName.begin(), deltaName.end(), prefix.begin()))
+	{
+		// The result has the type of its base and a header of its own, which is not counted
+		string baseString;
+		size_t baseSize, resultSize;
+		if (depth >= MaxDeltaDepth || prefix.size() < headerLength + Sha1Size
+			|| !DeltaIndex::ReadSizes(ByteView(prefix).Sub(headerLength + Sha1Size, prefix.size() - headerLength - Sha1Size), baseSize, resultSize)
+			|| !Utils::Sha1ToString(ByteView(prefix).Sub(headerLength, Sha1Size), baseString)
+			|| !ReadStoredHeader(baseString, type, size, depth + 1))
+			return false;
+
+		auto resultHeaderLength = TypeName(type).size() + 4;
+		if (resultSize < resultHeaderLength)
+			return false;
+
+		size = resultSize - resultHeaderLength;
+		return true;
+	}
+
+	for (auto candidate : { Blob, Commit, Tree, Chunks })
+	{
+		auto name = TypeName(candidate);
+		if (prefix.size() < name.size() + 4 || !equal(name.begin(), name.end(), prefix.begin()))
+			continue;
+
+		Word2 objectSize;
+		copy(prefix.begin() + name.size(), prefix.begin() + name.size() + 4, objectSize.c);
+		type = candidate;
+		size = objectSize.n;
+		return true;
+	}
+
+	return false;
+}
+
+bool GitusService::ParseContentData(ByteView content, ObjectHashType& type, RawData& object)
+{
+	using namespace std;
+
+	// The header is the type name directly followed by the 4 bytes size (see 'CreateHeaderData')
+	for (auto candidate : { Blob, Commit, Tree, Chunks })
+	{
+		auto name = TypeName(candidate);
+		auto headerLength = name.size() + 4;
+		if (content.size() < headerLength || !equal(name.begin(), name.end(), content.begin()))
+			continue;
+
+		Word2 size;
+		copy(content.begin() + name.size(), content.begin() + headerLength, size.c);
+		if (size.n != content.size() - headerLength)
+			return false;
+
+		type = candidate;
+		object.assign(content.begin() + headerLength, content.end());
+		return true;
+	}
+
+	return false;
+}
+
+bool GitusService::ParseTree(ByteView object, std::vector<TreeEntry>& entries)
+{
+	using namespace std;
+
+	// Same layout as written by 'HashCommitTree'
+	size_t i = 0;
+	while (i < object.size())
+	{
+		TreeEntry entry;
+		if (i + 5 > object.size() || object[i + 4] != ' ')
+			return false;
+
+		copy(object.begin() + i, object.begin() + i + 4, entry.mode.c);
+		i += 5;
+
+		auto pathEnd = find(object.begin() + i, object.end(), '\0');
+		if (pathEnd == object.end() || size_t(object.end() - pathEnd - 1) < Sha1Size)
+			return false;
+
+		entry.path = string(object.begin() + i, pathEnd);
+		i = (pathEnd - object.begin()) + 1;
+
+		entry.sha1 = SUBSTR(object, i, Sha1Size);
+		i += Sha1Size;
+
+		entries.push_back(entry);
+	}
+
+	return true;
+}
+
+bool GitusService::ParseCommit(ByteView object, RawData& tree, std::vector<RawData>& parents)
+{
+	using namespace std;
+
+	// Same layout as written by 'CommitCommand', hashes are stored as binary
+	static const string treeField = "tree ";
+	static const string parentField = "\nparent ";
+
+	if (object.size() < treeField.size() + Sha1Size
+		|| !equal(treeField.begin(), treeField.end(), object.begin()))
+		return false;
+
+	size_t i = treeField.size();
+	tree = SUBSTR(object, i, Sha1Size);
+	i += Sha1Size;
+
+	while (i + parentField.size() + Sha1Size <= object.size()
+		&& equal(parentField.begin(), parentField.end(), object.begin() + i))
+	{
+		i += parentField.size();
+		parents.push_back(SUBSTR(object, i, Sha1Size));
+		i += Sha1Size;
+	}
+
+	return true;
+}
+
+bool GitusService::ParseChunks(ByteView object, std::vector<ChunkEntry>& chunks)
+{
+	// Same layout as written by 'HashBlobFile'
+	if (object.size() % (Sha1Size + 4) != 0)
+		return false;
+
+	for (size_t i = 0; i < object.size(); i += Sha1Size + 4)
+	{
+		Word2 size;
+		std::copy(object.begin() + i + Sha1Size, object.begin() + i + Sha1Size + 4, size.c);
+		chunks.push_back({ SUBSTR(object, i, Sha1Size), size.n });
+	}
+
+	return true;
+}
@@ -6,6 +6,12 @@
 #include <bitset>
 #include <memory>
 #include <vector>
+#include <array>
+#include <map>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/detail/sha1.hpp>
@@ -18,6 +24,12 @@
 
 #include "utils.h"
 
+class PackIndex;
+class PackWriter;
+class MultiPackIndex;
+class PackedRefs;
+class HashCache;
+
 
 //https://mincong-h.github.io/2018/04/28/git-index/
 struct IndexEntry
@@ -35,7 +47,8 @@ struct IndexEntry
 	//		uid: The user identifier of the current user
 	//		gid: The group identifier of the current user
 	//		size: file size in number of bytes
-	std::vector<Word2> fields;
+	// Fixed size, so that copying the entries of a large index does not allocate
+	std::array<Word2, 10> fields;
 
 	// flags: flags used for validation
 	union Word flags;
@@ -52,37 +65,52 @@ struct IndexEntry
 		return fields[6];
 	}
 
+	// Mode of the entries standing for a whole directory outside of the sparse checkout cone
+	// Their path ends with '/' and their id is a tree of the files below them.
+	static const unsigned int SparseDirectoryMode = 040000;
+
+	bool IsSparseDirectory() const
+	{
+		return fields[6].n == SparseDirectoryMode;
+	}
+
 	IndexEntry()
 	{
-		Word2 buffer;
-		buffer.n = 0;
-		for (int i = 0; i < numFields; i++)
-		{
-			fields.push_back(buffer);
-		}
+		for (auto& field : fields)
+			field.n = 0;
 
 		flags.n = 0;
 
 	};
 
-	IndexEntry(const RawData& header) {
+	IndexEntry(const RawData& header) : IndexEntry(header.data()) {}
+
+	// 'header' points to the 40 bytes of fields of an entry
+	IndexEntry(const unsigned char* header) {
 
-		Word2 buffer;
 		for (int i = 0; i < numFields; i++)
-		{
-			buffer.n = 0;
-			std::copy(header.data()+i, header.data()+i+4, buffer.c);
-			fields.push_back(buffer);
-		}
+			std::copy(header + i * 4, header + i * 4 + 4, fields[i].c);
 
 		flags.n = 0;
 	}
 };
 
-class GitusService {
+// One '<mode><space><path><null><sha1>' line of a tree object
+struct TreeEntry
+{
+	union Word2 mode;
+	std::string path;
+	RawData sha1;
+};
 
-private:
-	boost::filesystem::path _currentGitusDirectory;
+// One chunk of a chunked blob, see 'GitusService::HashBlobFile'
+struct ChunkEntry
+{
+	RawData sha1;
+	size_t size;
+};
+
+class GitusService {
 
 public:
 
@@ -90,35 +118,165 @@ public:
 	{
 		Blob,
 		Commit,
-		Tree
+		Tree,
+		// List of the chunks of a large blob, read back as a 'Blob'
+		Chunks,
+		// Packed object stored as a delta of another one (see 'DeltaIndex'), read back as the object itself
+		Delta
 	};
 
-	static boost::filesystem::path NewGitusDirectory()
-	{
-		return boost::filesystem::current_path() / ".git" / "";
-	}
+private:
+	boost::filesystem::path _currentGitusDirectory;
+	boost::filesystem::path _workTree;
 
-	// Iterate over directories from current to find the '.git' directory
-	bool CacheCurrentGitusDirectory()
+	// Discovery is done once per process (see 'CacheCurrentGitusDirectory')
+	bool _resolved = false;
+
+	static bool IsCeilingDirectory(const boost::filesystem::path& dir);
+
+	// Caches kept warm between commands when the service is long lived (e.g 'gitus daemon')
+	// Objects are immutable so a cached object or presence never needs revalidation,
+	// the parsed index is revalidated against the index file stamp.
+	struct IndexStamp
 	{
-		using namespace boost;
+		std::time_t mtime = 0;
+		uintmax_t size = 0;
+		RawData digest;
 
-		filesystem::path dir = filesystem::current_path();		
-		for (filesystem::recursive_directory_iterator it(dir); it != filesystem::recursive_directory_iterator(); it++)
+		bool operator==(const IndexStamp& other) const
 		{
-			if (it->path().filename().string() == ".git")
-			{
-				_currentGitusDirectory = it->path();
-				return true;
-			}
+			return mtime == other.mtime && size == other.size && digest == other.digest;
 		}
+	};
+
+	struct CachedObject
+	{
+		int type;
+		RawData object;
+		std::list<std::string>::iterator position;
+	};
+
+	std::mutex _cacheMutex;
+
+	bool _indexCacheValid = false;
+	// The cached index has not been written yet
+	bool _indexDirty = false;
+	bool _deferIndexWrites = false;
+	IndexStamp _indexStamp;
+	std::map<std::string, IndexEntry> _indexCache;
+
+	std::unordered_set<std::string> _knownObjects;
+
+	std::unordered_map<std::string, CachedObject> _objectCache;
+	// Most recently used first
+	std::list<std::string> _objectCacheOrder;
+	size_t _objectCacheBytes = 0;
+	size_t _objectCacheLimit = 64 * 1024 * 1024;
+
+	// Files of at least this size are stored as chunks, 0 disables chunking
+	size_t _chunkThreshold = ThresholdFromEnvironment("GITUS_CHUNK_THRESHOLD");
+
+	// Files of at least this size are moved to the large file store, 0 disables the store
+	size_t _largeFileThreshold = ThresholdFromEnvironment("GITUS_LARGE_FILE_THRESHOLD");
+	// Directory with the layout of 'LargeFilesDirectory' the missing large files are fetched from
+	boost::filesystem::path _largeFileRemote = PathFromEnvironment("GITUS_LARGE_FILE_REMOTE");
+
+	// Packs of the repository, rescanned when the pack directory changes
+	std::mutex _packsMutex;
+	std::vector<std::shared_ptr<PackIndex>> _packs;
+	int64_t _packsStamp = 0;
+	// New objects are appended to this pack while a bulk checkin is in progress
+	std::shared_ptr<PackWriter> _bulkCheckin;
+
+	// Lookup of the packed objects: the multi-pack index, then the packs it does not cover
+	std::shared_ptr<MultiPackIndex> _multiPackIndex;
+	std::vector<std::shared_ptr<PackIndex>> _uncoveredPacks;
+	int64_t _lookupStamp = 0;
+
+	// Finds a packed object and reads its deflated content, unless 'compressed' is nullptr
+	bool FindPackedObject(ByteView sha1, ScratchData* compressed);
+
+	// The deflated entry as stored, a packed delta is left as is
+	bool ReadStoredObject(const std::string& sha1String, ScratchData& compressed);
+	bool ReadObjectContent(const std::string& sha1String, std::string& content, size_t depth);
+	// Type and size of the object as stored, a chunk list remains a 'Chunks'
+	// The type and size of a packed delta are those of its result, read without applying it.
+	bool ReadStoredHeader(const std::string& sha1String, ObjectHashType& type, size_t& size, size_t depth);
+	// Replaces an inflated delta entry by the content of its object, other contents are left as is
+	bool ResolveDelta(std::string& content, size_t depth);
+
+	// Writes a new object, loose or to the pack of the bulk checkin
+	bool WriteObjectData(const std::string& sha1String, ByteView sha1, std::string& compressed);
+
+	// 'packed-refs' as last opened, reopened once the file changed
+	std::mutex _refsMutex;
+	std::shared_ptr<PackedRefs> _packedRefs;
+
+	std::shared_ptr<PackedRefs> LoadPackedRefs();
+	// The loose references with a commit below 'directory' (e.g. "refs/heads/"), by name
+	bool ReadLooseReferences(const std::string& directory, std::map<std::string, RawData>& references);
+
+	// Opened on first use, see 'FileHashCache'
+	std::mutex _hashCacheMutex;
+	std::shared_ptr<HashCache> _hashCache;
+
+	// Writes the pending ids and closes the hash cache, the next use opens it again
+	void ResetHashCache();
+
+	static int64_t ModificationStamp(const boost::filesystem::path& path);
+	static size_t ThresholdFromEnvironment(const char* name);
+	static boost::filesystem::path PathFromEnvironment(const char* name);
+
+	bool StoreLargeFile(const boost::filesystem::path& path, bool write, RawData& sha1);
+	bool HashBlobContent(const boost::filesystem::path& path, uintmax_t size, bool write, RawData& sha1);
+	// Copies a file while hashing it, 'oid' is the hex sha1 of the content
+	// Only hashes it when 'destination' is empty.
+	static bool CopyFileHashed(const boost::filesystem::path& source, const boost::filesystem::path& destination, std::string& oid, uintmax_t& size);
+
+	bool ReadIndexStamp(IndexStamp& stamp);
+	bool WriteIndexFile(const std::map<std::string, IndexEntry>& entries);
+	void CacheObject(const std::string& sha1String, int type, const RawData& object);
+
+	void ClearCaches();
+
+public:
 
-		return false;
+	// Environment variables overriding the discovery
+	//		GITUS_DIR: path of the '.git' directory
+	//		GITUS_WORK_TREE: path of the working tree (defaults to the parent of the '.git' directory)
+	//		GITUS_CEILING_DIRECTORIES: list of directories the upward search does not go above
+	static boost::filesystem::path NewGitusDirectory()
+	{
+		auto gitusDir = std::getenv("GITUS_DIR");
+		if (gitusDir != nullptr && *gitusDir != 0)
+			return boost::filesystem::absolute(gitusDir);
+
+		return boost::filesystem::current_path() / ".git" / "";
 	}
 
+	GitusService() = default;
+
+	// Writes the ids left in the hash cache
+	~GitusService();
+
+	GitusService(const GitusService&) = delete;
+	GitusService& operator=(const GitusService&) = delete;
+
+	// Walks up from the current directory to find the '.git' directory
+	// The result is cached, call 'SetGitusDirectory' to change it
+	bool CacheCurrentGitusDirectory();
+
+	// Walks up from 'start' (an absolute path) to find the '.git' directory, ignoring GITUS_DIR
+	bool DiscoverGitusDirectory(const boost::filesystem::path& start);
+
+	// Creates the directories, references and HEAD of an empty repository
+	bool CreateLayout();
+
+	void SetGitusDirectory(const boost::filesystem::path& gitusDirectory);
+
 	boost::filesystem::path RepoDirectory()
 	{
-		return _currentGitusDirectory.parent_path();
+		return _workTree;
 	}
 
 	boost::filesystem::path IndexFile()
@@ -146,26 +304,316 @@ public:
 		return _currentGitusDirectory / "refs" / "heads" / "master" / "";
 	}
 
+	// References moved out of their loose files by 'PackReferences', see 'PackedRefs'
+	boost::filesystem::path PackedRefsFile()
+	{
+		return _currentGitusDirectory / "packed-refs";
+	}
+
+	// Commit of the branch 'branch' of 'remote' at the last fetch
+	boost::filesystem::path RemoteTrackingFile(const std::string& remote, const std::string& branch)
+	{
+		return _currentGitusDirectory / "refs" / "remotes" / remote / branch / "";
+	}
+
+	// Name of the same reference, which may be packed (see 'ResolveReference')
+	static std::string RemoteTrackingReference(const std::string& remote, const std::string& branch)
+	{
+		return "refs/remotes/" + remote + "/" + branch;
+	}
+
+	// Commit of the last fetch from a remote given by its path
+	boost::filesystem::path FetchHeadFile()
+	{
+		return _currentGitusDirectory / "FETCH_HEAD";
+	}
+
+	// "URL: <path>" of the remote 'remote', as in the 'remotes' directory of git
+	boost::filesystem::path RemoteFile(const std::string& remote)
+	{
+		return _currentGitusDirectory / "remotes" / remote / "";
+	}
+
 	boost::filesystem::path ObjectsDirectory()
 	{
 		return _currentGitusDirectory / "objects" / "";
 	} 
 
-	bool HashObject(const RawData& object, ObjectHashType type, bool write, RawData& sha1);
+	bool HashObject(ByteView object, ObjectHashType type, bool write, RawData& sha1);
+
+	// When writing, 'existed' is true if the object was already stored, it is not written again then
+	bool HashObject(ByteView object, ObjectHashType type, bool write, RawData& sha1, bool& existed);
+
+	// Same as 'HashObject' for many objects: hashed and compressed in parallel,
+	// the missing objects are written in one batch
+	bool HashObjects(const std::vector<RawData>& objects, ObjectHashType type, bool write, std::vector<RawData>& sha1s);
+
+	// Files below 'directory' (an absolute path in the work tree), skipping '.git' and the paths
+	// excluded by '.gitignore' files and '.git/info/exclude'. Excluded directories are not entered.
+	// 'files' are relative to the work tree, sorted as in the index (see 'TreeWalker').
+	// False when 'directory' is outside the work tree.
+	bool ListWorkTreeFiles(const boost::filesystem::path& directory, std::vector<std::string>& files);
+
+	// Ids of unchanged files, consulted by 'HashBlobFile' and add
+	// Shared: the cache is replaced when a threshold changes or by 'ClearCaches'.
+	std::shared_ptr<HashCache> FileHashCache();
+
+	// Writes the ids added to the hash cache since the last flush
+	bool FlushHashCache();
+
+	boost::filesystem::path HashCacheFile()
+	{
+		return _currentGitusDirectory / "hashcache";
+	}
+
+	// Stores a file of the working tree as a blob, streamed in chunks when it is larger than the
+	// chunk threshold: the chunks are stored as blobs and 'sha1' is the id of their 'Chunks' list,
+	// so a new version of a large file only writes the chunks which changed
+	// The id of an unchanged file comes from the hash cache, the file is not read then. During a
+	// bulk checkin the new id is not cached: the caller caches it once 'EndBulkCheckin' succeeded.
+	bool HashBlobFile(const boost::filesystem::path& path, bool write, RawData& sha1);
+
+	// Environment variable GITUS_CHUNK_THRESHOLD, in bytes (chunking is disabled by default)
+	// The ids cached under another threshold are dropped.
+	void SetChunkThreshold(size_t threshold);
+
+	size_t ChunkThreshold() const
+	{
+		return _chunkThreshold;
+	}
+
+	// Environment variable GITUS_LARGE_FILE_THRESHOLD, in bytes (disabled by default)
+	// Takes precedence over chunking
+	void SetLargeFileThreshold(size_t threshold);
+
+	// Environment variable GITUS_LARGE_FILE_REMOTE, e.g a mounted network directory
+	void SetLargeFileRemote(const boost::filesystem::path& remote)
+	{
+		_largeFileRemote = remote;
+	}
+
+	// Files of this size are streamed by 'HashBlobFile' rather than read whole
+	bool IsStreamed(uintmax_t size) const
+	{
+		return (_chunkThreshold != 0 && size >= _chunkThreshold)
+			|| (_largeFileThreshold != 0 && size >= _largeFileThreshold);
+	}
+
+	// Makes sure the content of a large file is in the local store, copying it from the remote
+	// store when missing. 'oid' is the hex sha1 of the content.
+	bool FetchLargeFile(const std::string& oid);
+
+	// Writes the content of the blob 'sha1' to 'destination', fetching the content of a pointer blob
+	// A chunked blob is streamed chunk by chunk, it is never reassembled in memory.
+	// Written aside then renamed, so a failed checkout never leaves a truncated file.
+	bool CheckoutBlob(const RawData& sha1, const boost::filesystem::path& destination);
+
+	// Checks out the files of 'entries' in parallel, the sparse directory entries are skipped
+	// The plain blobs are written in batches through 'IoEngine', like the objects of an add.
+	// 'failed' is the path of an entry which could not be written.
+	bool CheckoutEntries(const std::vector<const IndexEntry*>& entries, size_t& updated, std::string& failed);
+
+	// Hard links 'destination' to 'source', or copies it when they are on different file systems
+	// (with copy_file_range on Linux, which lets the file system share or copy the blocks itself)
+	static bool LinkOrCopyFile(const boost::filesystem::path& source, const boost::filesystem::path& destination);
+
+	// Links the loose objects, packs and large files of the repository 'sourceGitusDirectory'
+	// into this one, in parallel. Existing files are kept: objects never change once written.
+	bool LinkObjects(const boost::filesystem::path& sourceGitusDirectory, size_t& linked);
 
 	bool WriteIndex(const std::map<std::string, IndexEntry>& entries);
 
+	// The '.git' directory of the local repository 'repository': its work tree, or the directory
+	// itself for a bare repository
+	static bool FindRepository(const boost::filesystem::path& repository, boost::filesystem::path& gitusDirectory, bool& bare);
+
+	// The commit of a reference file, empty when the branch has no commit yet
+	static bool ReadReference(const boost::filesystem::path& file, RawData& sha1);
+
+	// Replaces a reference file at once, a reader never finds it half written
+	static bool WriteReference(const boost::filesystem::path& file, const RawData& sha1);
+
+	// The branch HEAD points to, "master" for "ref: refs/heads/master"
+	bool HeadBranch(std::string& branch);
+
+	// Points HEAD to 'branch', which may have no commit yet
+	bool WriteHead(const std::string& branch);
+
+	// The commit of the reference 'name' (e.g. "refs/heads/master"), from its loose file, else from
+	// 'packed-refs'. Empty when the reference does not exist or has no commit yet.
+	bool ResolveReference(const std::string& name, RawData& sha1);
+
+	// Writes the loose file of a reference, which takes precedence over its packed line
+	bool UpdateReference(const std::string& name, const RawData& sha1);
+
+	// Removes both the loose file and the packed line of a reference
+	bool DeleteReference(const std::string& name);
+
+	// The references whose name starts with 'prefix' (e.g. "refs/heads/") and which have a commit
+	bool ListReferences(const std::string& prefix, std::map<std::string, RawData>& references);
+
+	// Moves every loose reference with a commit to 'packed-refs', 'packed' counts the references of the file
+	bool PackReferences(size_t& packed);
+
+	// Same rules as git: no "..", "//", "@{", control characters, spaces or any of "~^:?*[\\", no
+	// component starting with a '.' or ending with ".lock", nor with ".tmp" as files being written
+	static bool IsValidBranchName(const std::string& name);
+
+	// The repository of 'remote', a remote name or a path
+	bool RemoteRepository(const std::string& remote, boost::filesystem::path& repository);
+
+	bool WriteRemote(const std::string& remote, const boost::filesystem::path& repository);
+
 	bool ReadIndex(std::map<std::string, IndexEntry>& entries);
 
+	// When deferred, 'WriteIndex' only updates the cached index until 'FlushIndex' is called
+	void SetDeferIndexWrites(bool defer);
+
+	bool FlushIndex();
+
 	RawData HashCommitTree();
 
+	// Whether the branch HEAD points to has a commit
 	bool HasParentTree();
 
+	// The commit of the branch HEAD points to, empty before its first commit
 	bool LocalMasterHash(RawData& hash);
 
+	// Blob ids of the files of the HEAD commit by path, empty before the first commit
+	// A directory collapsed by a sparse index is a tree id, its path ends with '/'.
+	bool ReadHeadTree(std::map<std::string, RawData>& files);
+
+	// Entries of the tree 'sha1', with 'prefix' prepended to their paths
+	bool ReadTree(const RawData& sha1, const std::string& prefix, std::vector<TreeEntry>& entries);
+
+	// Tree object of 'entries', sorted by path
+	static RawData CreateTreeData(const std::vector<TreeEntry>& entries);
+
+	// Sparse checkout (cone mode)
+	//
+	// Only the files below the directories of the cone and the files directly in their parent
+	// directories (the root included) are checked out. The index holds a single entry per directory
+	// outside of the cone ("vendor/", see 'IndexEntry::SparseDirectoryMode'), so reading and writing
+	// the index and hashing the commit tree only cost the cone. These entries are expanded when a
+	// command needs a path below them.
+	boost::filesystem::path SparseCheckoutFile()
+	{
+		return _currentGitusDirectory / "info" / "sparse-checkout";
+	}
+
+	// False when sparse checkout is disabled. One directory per line, relative to the work tree.
+	bool SparseCone(std::vector<std::string>& directories);
+
+	// An empty list of directories disables sparse checkout
+	bool WriteSparseCone(const std::vector<std::string>& directories);
+
+	static bool InSparseCone(const std::vector<std::string>& directories, const std::string& path);
+
+	// Replaces the entries outside of the cone by one sparse directory entry per directory
+	// The sparse directory entries must have been expanded first.
+	bool CollapseIndex(std::map<std::string, IndexEntry>& entries, const std::vector<std::string>& directories);
+
+	// Replaces the sparse directory entry above 'path', or all of them when 'path' is empty, by the
+	// entries of its files. 'expanded' counts the sparse directory entries replaced.
+	bool ExpandIndex(std::map<std::string, IndexEntry>& entries, const std::string& path, size_t& expanded);
+
+	// Writes the commit object of 'tree' on top of the local master and moves master to it
+	bool WriteCommit(const RawData& tree, const std::string& msg, const std::string& author, const std::string& email, std::time_t time, RawData& commitHash);
+
+	// 'parent' is empty for the first commit
+	static RawData CreateCommitData(const RawData& tree, const RawData& parent, const std::string& msg, const std::string& author, const std::string& email, std::time_t time);
+
 	bool ObjectExists(std::string sha1String);
-	static RawData CreateContentData(const RawData& object, ObjectHashType type);
-	static RawData CreateHeaderData(GitusService::ObjectHashType type, const RawData & object);
+
+	boost::filesystem::path DaemonSocketFile()
+	{
+		return _currentGitusDirectory / "gitus.sock";
+	}
+
+	boost::filesystem::path ObjectFile(const std::string& sha1String)
+	{
+		return ObjectsDirectory() / sha1String.substr(0, 2) / sha1String.substr(2);
+	}
+
+	boost::filesystem::path PacksDirectory()
+	{
+		return _currentGitusDirectory / "objects" / "pack" / "";
+	}
+
+	// Below this many new objects an operation writes loose objects rather than a pack
+	static const size_t BulkCheckinMinObjects = 64;
+
+	// Until 'EndBulkCheckin', new objects are appended to a single pack instead of one loose
+	// file each. They can only be read once the pack is finished.
+	void BeginBulkCheckin();
+	bool EndBulkCheckin();
+	// Drops the objects written since 'BeginBulkCheckin' with their unfinished pack
+	void AbortBulkCheckin();
+
+	// The deflated content of an object, from its loose file or from a pack
+	// A packed delta is rebuilt and deflated again, prefer 'ReadObjectContent' to inflate it.
+	bool ReadObjectData(const std::string& sha1String, ScratchData& compressed);
+
+	// The inflated content of an object, header included, packed deltas rebuilt
+	bool ReadObjectContent(const std::string& sha1String, std::string& content);
+
+	// Same for the i-th object of 'pack', even when a loose copy or another pack has the object
+	bool ReadPackedContent(const PackIndex& pack, size_t i, std::string& content);
+
+	// Longest chain of deltas read, a longer one is taken for a cycle
+	static const size_t MaxDeltaDepth = 64;
+
+	// The packs of the repository, rescanned when the pack directory changed
+	std::vector<std::shared_ptr<PackIndex>> Packs();
+
+	// Rescans the pack directory on the next 'Packs', a pack was added within the resolution of its mtime
+	void InvalidatePacks();
+
+	// Index of the objects of all the packs, see 'MultiPackIndex'
+	boost::filesystem::path MultiPackIndexFile()
+	{
+		return _currentGitusDirectory / "objects" / "pack" / "multi-pack-index";
+	}
+
+	// Writes the multi-pack index of the current packs, preferring the largest pack for the objects
+	// stored several times, then the newest ones. 'packs' and 'objects' are the counts indexed.
+	bool WriteMultiPackIndex(size_t& packs, size_t& objects);
+
+	// Content of the files too large for the object store, uncompressed and named by the sha1 of
+	// their content, the trees only reference a pointer blob (see 'CreateLargeFilePointer')
+	boost::filesystem::path LargeFilesDirectory()
+	{
+		return _currentGitusDirectory / "lfs" / "objects" / "";
+	}
+
+	boost::filesystem::path LargeFile(const std::string& oid)
+	{
+		return LargeFilesDirectory() / oid.substr(0, 2) / oid.substr(2);
+	}
+
+	// Inflates an object and strips its header, chunked blobs are reassembled and read as a 'Blob'
+	bool ReadObject(const std::string& sha1String, ObjectHashType& type, RawData& object);
+
+	// Reads a single object file, chunk lists are read as such and not reassembled
+	bool ReadObjectFile(const std::string& sha1String, ObjectHashType& type, RawData& object);
+
+	// Only inflates the header of an object
+	bool ReadObjectHeader(const std::string& sha1String, ObjectHashType& type, size_t& size);
+
+	static RawData CreateContentData(ByteView object, ObjectHashType type);
+	static RawData CreateHeaderData(GitusService::ObjectHashType type, ByteView object);
+	static std::string TypeName(ObjectHashType type);
+
+	// Splits inflated object content into its type and payload, validating the stored size
+	static bool ParseContentData(ByteView content, ObjectHashType& type, RawData& object);
+	static bool ParseTree(ByteView object, std::vector<TreeEntry>& entries);
+	static bool ParseCommit(ByteView object, RawData& tree, std::vector<RawData>& parents);
+	// Each chunk is its binary sha1 followed by its 4 bytes size
+	static bool ParseChunks(ByteView object, std::vector<ChunkEntry>& chunks);
+
+	// Pointer blob of a large file: "version gitus-lfs/1\noid sha1:<hex>\nsize <bytes>\n"
+	static RawData CreateLargeFilePointer(const std::string& oid, uintmax_t size);
+	static bool ParseLargeFilePointer(ByteView object, std::string& oid, uintmax_t& size);
 
 };
 
@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "hash_cache.h"
+#include "trace.h"
+
+
+static const char* CacheSignature = "HCCH";
+static const size_t HeaderLength = 32;
+static const size_t Sha1Size = 20;
+// stamp, sha1, path offset and length, padding
+static const size_t RecordLength = 5 * 8 + Sha1Size + 4 + 4 + 4;
+// Below this size the cache is never compacted
+static const size_t MinCompactionCount = 1024;
+
+
+bool HashCache::Stat(const boost::filesystem::path& path, FileStamp& stamp)
+{
+	Stats::Add(Stats::StatCalls);
+
+#ifdef _WIN32
+	boost::system::error_code ec;
+	auto size = boost::filesystem::file_size(path, ec);
+	auto mtime = boost::filesystem::last_write_time(path, ec);
+	if (ec)
+		return false;
+
+	// No inode, the path stands for it
+	stamp.device = 0;
+	stamp.inode = std::hash<std::string>()(boost::filesystem::absolute(path).string());
+	stamp.size = size;
+	stamp.mtime = static_cast<int64_t>(mtime) * 1000000000;
+	stamp.ctime = stamp.mtime;
+#else
+	struct stat status;
+	if (::stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+		return false;
+
+	stamp.device = status.st_dev;
+	stamp.inode = status.st_ino;
+	stamp.size = status.st_size;
+	stamp.mtime = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+	stamp.ctime = static_cast<int64_t>(status.st_ctim.tv_sec) * 1000000000 + status.st_ctim.tv_nsec;
+#endif
+
+	return true;
+}
+
+HashCache::HashCache(const boost::filesystem::path& cacheFile, uint64_t chunkThreshold, uint64_t largeFileThreshold)
+{
+	_cacheFile = cacheFile;
+	_chunkThreshold = chunkThreshold;
+	_largeFileThreshold = largeFileThreshold;
+}
+
+HashCache::~HashCache()
+{
+	Unmap();
+}
+
+void HashCache::Load()
+{
+	_loaded = true;
+
+#ifdef _WIN32
+	if (!Utils::ReadBytes(_cacheFile.string(), _buffer))
+		return;
+
+	_mapped = _buffer.data();
+	_mappedSize = _buffer.size();
+#else
+	auto fd = ::open(_cacheFile.c_str(), O_RDONLY);
+	Stats::Add(Stats::OpenCalls);
+	if (fd < 0)
+		return;
+
+	struct stat status;
+	if (::fstat(fd, &status) == 0 && status.st_size > 0)
+	{
+		auto mapped = ::mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED)
+		{
+			_mapped = static_cast<const unsigned char*>(mapped);
+			_mappedSize = status.st_size;
+		}
+	}
+	::close(fd);
+#endif
+
+	// A cache which does not look right is ignored, it is rewritten by the next flush
+	Word2 version, count, compactedCount;
+	if (_mappedSize < HeaderLength || memcmp(_mapped, CacheSignature, 4) != 0)
+	{
+		Unmap();
+		return;
+	}
+
+	uint64_t chunkThreshold, largeFileThreshold;
+	memcpy(version.c, _mapped + 4, 4);
+	memcpy(count.c, _mapped + 8, 4);
+	memcpy(compactedCount.c, _mapped + 12, 4);
+	memcpy(&chunkThreshold, _mapped + 16, 8);
+	memcpy(&largeFileThreshold, _mapped + 24, 8);
+	if (version.n != Version || _mappedSize < HeaderLength + size_t(count.n) * RecordLength
+		|| !HasThresholds(chunkThreshold, largeFileThreshold))
+	{
+		Unmap();
+		return;
+	}
+
+	_count = count.n;
+	_compactedCount = compactedCount.n;
+}
+
+void HashCache::Unmap()
+{
+#ifdef _WIN32
+	_buffer.clear();
+#else
+	if (_mapped != nullptr)
+		::munmap(const_cast<unsigned char*>(_mapped), _mappedSize);
+#endif
+
+	_mapped = nullptr;
+	_mappedSize = 0;
+	_count = 0;
+	_compactedCount = 0;
+}
+
+HashCache::Entry HashCache::MappedEntry(size_t i) const
+{
+	auto record = _mapped + HeaderLength + i * RecordLength;
+
+	Entry entry;
+	memcpy(&entry.stamp.device, record, 8);
+	memcpy(&entry.stamp.inode, record + 8, 8);
+	memcpy(&entry.stamp.size, record + 16, 8);
+	memcpy(&entry.stamp.mtime, record + 24, 8);
+	memcpy(&entry.stamp.ctime, record + 32, 8);
+	entry.sha1.assign(record + 40, record + 40 + Sha1Size);
+
+	Word2 offset, length;
+	memcpy(offset.c, record + 40 + Sha1Size, 4);
+	memcpy(length.c, record + 44 + Sha1Size, 4);
+	if (size_t(offset.n) + length.n <= _mappedSize)
+		entry.path.assign(reinterpret_cast<const char*>(_mapped) + offset.n, length.n);
+
+	return entry;
+}
+
+bool HashCache::FindMapped(const Key& key, Entry& entry) const
+{
+	// Binary search on the records in place, only the record found is decoded
+	size_t low = 0;
+	size_t high = _count;
+	while (low < high)
+	{
+		auto middle = low + (high - low) / 2;
+		auto record = _mapped + HeaderLength + middle * RecordLength;
+
+		Key recordKey;
+		memcpy(&recordKey.first, record, 8);
+		memcpy(&recordKey.second, record + 8, 8);
+		if (recordKey == key)
+		{
+			entry = MappedEntry(middle);
+			return true;
+		}
+
+		if (recordKey < key)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return false;
+}
+
+bool HashCache::Lookup(const FileStamp& stamp, RawData& sha1)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_loaded)
+		Load();
+
+	Key key(stamp.device, stamp.inode);
+	auto pending = _pending.find(key);
+
+	Entry entry;
+	bool found = pending != _pending.end();
+	if (found)
+		entry = pending->second;
+	else
+		found = FindMapped(key, entry);
+
+	if (!found || !(entry.stamp == stamp))
+	{
+		Stats::Add(Stats::HashCacheMisses);
+		return false;
+	}
+
+	Stats::Add(Stats::HashCacheHits);
+	sha1 = entry.sha1;
+	return true;
+}
+
+void HashCache::Insert(const boost::filesystem::path& path, const FileStamp& stamp, const RawData& sha1)
+{
+	using namespace std::chrono;
+
+	if (stamp.inode == 0 || sha1.size() != Sha1Size)
+		return;
+
+	auto now = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+	if (now - stamp.mtime < duration_cast<nanoseconds>(seconds(1)).count())
+		return;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	Entry entry;
+	entry.stamp = stamp;
+	entry.sha1 = sha1;
+	entry.path = boost::filesystem::absolute(path).string();
+	_pending[Key(stamp.device, stamp.inode)] = entry;
+}
+
+bool HashCache::Flush()
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("HashCache::Flush");
+
+	lock_guard<mutex> lock(_mutex);
+	if (_pending.empty())
+		return true;
+
+	if (!_loaded)
+		Load();
+
+	// Both are sorted by key, the pending entry replaces the record of the same file
+	vector<Entry> entries;
+	entries.reserve(_count + _pending.size());
+	auto pending = _pending.begin();
+	for (size_t i = 0; i < _count; i++)
+	{
+		auto entry = MappedEntry(i);
+		Key key(entry.stamp.device, entry.stamp.inode);
+		while (pending != _pending.end() && pending->first < key)
+			entries.push_back((pending++)->second);
+
+		if (pending != _pending.end() && pending->first == key)
+			continue;
+
+		entries.push_back(move(entry));
+	}
+
+	while (pending != _pending.end())
+		entries.push_back((pending++)->second);
+
+	auto compactedCount = _compactedCount;
+	if (entries.size() >= 2 * max(compactedCount, MinCompactionCount))
+	{
+		GITUS_TRACE_SCOPE("HashCache::Compact");
+		entries.erase(remove_if(entries.begin(), entries.end(), [](const Entry& entry) {
+			FileStamp stamp;
+			return !Stat(entry.path, stamp) || !(stamp == entry.stamp);
+		}), entries.end());
+		compactedCount = entries.size();
+	}
+
+	ScratchData data;
+	size_t pathsLength = 0;
+	for (auto& entry : entries)
+		pathsLength += entry.path.size();
+	data.reserve(HeaderLength + entries.size() * RecordLength + pathsLength);
+
+	Word2 version, count, compacted;
+	version.n = Version;
+	count.n = entries.size();
+	compacted.n = compactedCount;
+	data.insert(data.end(), CacheSignature, CacheSignature + 4);
+	data.insert(data.end(), &version.c[0], &version.c[4]);
+	data.insert(data.end(), &count.c[0], &count.c[4]);
+	data.insert(data.end(), &compacted.c[0], &compacted.c[4]);
+	auto chunkThreshold = reinterpret_cast<const unsigned char*>(&_chunkThreshold);
+	auto largeFileThreshold = reinterpret_cast<const unsigned char*>(&_largeFileThreshold);
+	data.insert(data.end(), chunkThreshold, chunkThreshold + 8);
+	data.insert(data.end(), largeFileThreshold, largeFileThreshold + 8);
+
+	Word2 offset, length;
+	offset.n = HeaderLength + entries.size() * RecordLength;
+	for (auto& entry : entries)
+	{
+		auto stamp = reinterpret_cast<const unsigned char*>(&entry.stamp);
+		data.insert(data.end(), stamp, stamp + 5 * 8);
+		data.insert(data.end(), entry.sha1.begin(), entry.sha1.begin() + Sha1Size);
+
+		length.n = entry.path.size();
+		data.insert(data.end(), &offset.c[0], &offset.c[4]);
+		data.insert(data.end(), &length.c[0], &length.c[4]);
+		data.insert(data.end(), 4, 0);
+		offset.n += length.n;
+	}
+
+	for (auto& entry : entries)
+		data.insert(data.end(), entry.path.begin(), entry.path.end());
+
+	auto temporaryPath = _cacheFile.parent_path() / filesystem::unique_path(_cacheFile.filename().string() + "-%%%%%%%%.tmp");
+	bool written;
+	{
+		filesystem::ofstream ofs(temporaryPath, ios_base::binary);
+		ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+		Stats::Add(Stats::OpenCalls);
+		Stats::Add(Stats::BytesWritten, data.size());
+		written = static_cast<bool>(ofs);
+	}
+
+	if (!written)
+	{
+		system::error_code ec;
+		filesystem::remove(temporaryPath, ec);
+		return false;
+	}
+
+	Unmap();
+	_loaded = false;
+	_pending.clear();
+	filesystem::rename(temporaryPath, _cacheFile);
+	return true;
+}
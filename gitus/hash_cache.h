@@ -0,0 +1,112 @@
+#ifndef GITUS_HASH_CACHE_H
+#define GITUS_HASH_CACHE_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "utils.h"
+
+
+// Persistent cache of the blob id of files, so that an unchanged file is neither read nor hashed
+//
+// A file is identified by its device and inode, and its id is only trusted while its size,
+// mtime and ctime (in nanoseconds) are unchanged. The cache file is memory mapped and searched
+// in place, new ids are kept in memory and merged into a new cache file by 'Flush'.
+// Whether a file is stored as a blob, a chunk list or a large file pointer depends on the chunk
+// and large file thresholds, a cache written under other thresholds is discarded.
+//
+// '.git/hashcache'
+//		"HCCH", version (4 bytes), record count (4 bytes), count after the last compaction (4 bytes)
+//		chunk threshold, large file threshold (8 bytes each)
+//		records sorted by device and inode: device, inode, size, mtime, ctime (8 bytes each),
+//		binary sha1, path offset and length (4 bytes each) in the path table, 4 bytes of padding
+//		path table: the absolute path of every record, not terminated
+//
+// The records of deleted files are only dropped by compaction: once the cache doubled since the
+// last compaction, the file of every record is checked again while flushing.
+class HashCache {
+
+public:
+	struct FileStamp
+	{
+		uint64_t device = 0;
+		uint64_t inode = 0;
+		uint64_t size = 0;
+		int64_t mtime = 0;
+		int64_t ctime = 0;
+
+		bool operator==(const FileStamp& other) const
+		{
+			return device == other.device && inode == other.inode && size == other.size
+				&& mtime == other.mtime && ctime == other.ctime;
+		}
+	};
+
+	static const size_t Version = 2;
+
+	// Returns false when the file cannot be stat'ed
+	static bool Stat(const boost::filesystem::path& path, FileStamp& stamp);
+
+private:
+	struct Entry
+	{
+		FileStamp stamp;
+		RawData sha1;
+		std::string path;
+	};
+
+	typedef std::pair<uint64_t, uint64_t> Key;
+
+	boost::filesystem::path _cacheFile;
+	uint64_t _chunkThreshold;
+	uint64_t _largeFileThreshold;
+	std::mutex _mutex;
+
+	// Mapped cache file, read only
+	bool _loaded = false;
+	const unsigned char* _mapped = nullptr;
+	size_t _mappedSize = 0;
+	size_t _count = 0;
+	size_t _compactedCount = 0;
+#ifdef _WIN32
+	RawData _buffer;
+#endif
+
+	std::map<Key, Entry> _pending;
+
+	void Load();
+	void Unmap();
+	bool FindMapped(const Key& key, Entry& entry) const;
+	Entry MappedEntry(size_t i) const;
+
+public:
+	HashCache(const boost::filesystem::path& cacheFile, uint64_t chunkThreshold, uint64_t largeFileThreshold);
+	~HashCache();
+
+	HashCache(const HashCache&) = delete;
+	HashCache& operator=(const HashCache&) = delete;
+
+	// 'sha1' is the id stored for 'stamp', false when the file changed or is not cached
+	bool Lookup(const FileStamp& stamp, RawData& sha1);
+
+	// Ignored when the file was modified too recently: a change within the resolution of
+	// its mtime would go unnoticed
+	void Insert(const boost::filesystem::path& path, const FileStamp& stamp, const RawData& sha1);
+
+	// Writes the pending ids, returns true when there is nothing to write
+	bool Flush();
+
+	// The ids were computed under these thresholds
+	bool HasThresholds(uint64_t chunkThreshold, uint64_t largeFileThreshold) const
+	{
+		return chunkThreshold == _chunkThreshold && largeFileThreshold == _largeFileThreshold;
+	}
+};
+
+
+#endif
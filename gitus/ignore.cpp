@@ -0,0 +1,415 @@
+#include <algorithm>
+
+#include "ignore.h"
+#include "stats.h"
+
+
+//--- IgnoreRules
+
+void IgnoreRules::Parse(ByteView content)
+{
+	size_t start = 0;
+	while (start < content.size())
+	{
+		auto end = start;
+		while (end < content.size() && content[end] != '\n')
+			end++;
+
+		auto length = end - start;
+		if (length > 0 && content[end - 1] == '\r')
+			length--;
+
+		AddRule(std::string(reinterpret_cast<const char*>(content.data()) + start, length));
+		start = end + 1;
+	}
+}
+
+void IgnoreRules::AddRule(const std::string& line)
+{
+	if (line.empty() || line[0] == '#')
+		return;
+
+	// Trailing spaces are dropped unless escaped
+	auto pattern = line;
+	while (!pattern.empty() && pattern.back() == ' ' && (pattern.size() < 2 || pattern[pattern.size() - 2] != '\\'))
+		pattern.pop_back();
+
+	Rule rule;
+	if (!pattern.empty() && pattern[0] == '!')
+	{
+		rule.negated = true;
+		pattern.erase(0, 1);
+	}
+
+	if (!pattern.empty() && pattern.back() == '/')
+	{
+		rule.directoryOnly = true;
+		pattern.pop_back();
+	}
+
+	// A slash anywhere but at the end matches from the directory of the rules
+	if (pattern.find('/') != std::string::npos)
+	{
+		rule.anchored = true;
+		if (pattern[0] == '/')
+			pattern.erase(0, 1);
+	}
+
+	if (pattern.empty() || !Compile(pattern, rule))
+		return;
+
+	auto index = _rules.size();
+	auto& tokens = rule.tokens;
+	auto literals = [&](size_t begin, size_t end) {
+		std::string literal;
+		for (auto i = begin; i < end; i++)
+		{
+			if (tokens[i].kind != Token::Literal)
+				return false;
+			literal.push_back(static_cast<char>(tokens[i].value));
+		}
+		rule.literal = literal;
+		return true;
+	};
+
+	if (literals(0, tokens.size()))
+	{
+		(rule.anchored ? _paths : _names)[rule.literal].push_back(index);
+	}
+	else if (!rule.anchored && tokens.size() > 1 && tokens[0].kind == Token::Star && literals(1, tokens.size()))
+	{
+		auto extension = rule.literal.rfind('.');
+		if (extension != std::string::npos)
+			_extensions[rule.literal.substr(extension)].push_back(index);
+		else
+			_suffixes.push_back(index);
+	}
+	else if (!rule.anchored && tokens.size() > 1 && tokens.back().kind == Token::Star && literals(0, tokens.size() - 1))
+	{
+		_prefixes.push_back(index);
+	}
+	else
+	{
+		rule.literal.clear();
+		_globs.push_back(index);
+	}
+
+	_rules.push_back(std::move(rule));
+}
+
+bool IgnoreRules::Compile(const std::string& pattern, Rule& rule)
+{
+	auto& tokens = rule.tokens;
+	auto literal = [&](char c) {
+		tokens.push_back(Token{ Token::Literal, static_cast<unsigned char>(c) });
+	};
+
+	for (size_t i = 0; i < pattern.size(); i++)
+	{
+		auto c = pattern[i];
+		if (c == '\\')
+		{
+			// A trailing backslash makes the pattern invalid, as with git
+			if (++i == pattern.size())
+				return false;
+			literal(pattern[i]);
+		}
+		else if (c == '?')
+		{
+			tokens.push_back(Token{ Token::AnyChar, 0 });
+		}
+		else if (c == '*')
+		{
+			auto stars = i;
+			while (i + 1 < pattern.size() && pattern[i + 1] == '*')
+				i++;
+
+			// '**' only spans directories as a whole component, otherwise it is a '*'
+			auto componentStart = stars == 0 || pattern[stars - 1] == '/';
+			if (i > stars && componentStart && i + 1 < pattern.size() && pattern[i + 1] == '/')
+			{
+				tokens.push_back(Token{ Token::Directories, 0 });
+				i++;
+			}
+			else if (i > stars && componentStart && i + 1 == pattern.size())
+			{
+				tokens.push_back(Token{ Token::DoubleStar, 0 });
+			}
+			else
+			{
+				tokens.push_back(Token{ Token::Star, 0 });
+			}
+		}
+		else if (c == '[')
+		{
+			std::bitset<256> members;
+			auto j = i + 1;
+			auto negated = j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^');
+			if (negated)
+				j++;
+
+			// A ']' right after the opening bracket is a member
+			auto first = j;
+			while (j < pattern.size() && (pattern[j] != ']' || j == first))
+			{
+				auto low = static_cast<unsigned char>(pattern[j]);
+				if (pattern[j] == '\\' && j + 1 < pattern.size())
+					low = static_cast<unsigned char>(pattern[++j]);
+
+				auto high = low;
+				if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']')
+				{
+					j += 2;
+					high = static_cast<unsigned char>(pattern[j]);
+					if (pattern[j] == '\\' && j + 1 < pattern.size())
+						high = static_cast<unsigned char>(pattern[++j]);
+				}
+
+				for (unsigned member = low; member <= high; member++)
+					members.set(member);
+				j++;
+			}
+
+			// Without a closing bracket, '[' is an ordinary character
+			if (j == pattern.size() || _classes.size() > 255)
+			{
+				literal(c);
+				continue;
+			}
+
+			if (negated)
+				members.flip();
+
+			tokens.push_back(Token{ Token::Class, static_cast<unsigned char>(_classes.size()) });
+			_classes.push_back(members);
+			i = j;
+		}
+		else
+		{
+			literal(c);
+		}
+	}
+
+	return tokens.size() <= MaxTokens;
+}
+
+bool IgnoreRules::MatchTokens(const Rule& rule, const std::string& subject) const
+{
+	// The states are the number of tokens matched so far, all the possible states are tracked at once
+	typedef std::bitset<MaxTokens + 1> States;
+	auto& tokens = rule.tokens;
+	auto count = tokens.size();
+
+	// The stars may also match nothing
+	auto enter = [&](States& states, size_t state) {
+		states.set(state);
+		while (state < count && tokens[state].kind >= Token::Star)
+			states.set(++state);
+	};
+
+	States current;
+	enter(current, 0);
+	for (auto c : subject)
+	{
+		auto byte = static_cast<unsigned char>(c);
+		States next;
+		for (size_t state = 0; state < count; state++)
+		{
+			if (!current.test(state))
+				continue;
+
+			auto& token = tokens[state];
+			switch (token.kind)
+			{
+			case Token::Literal:
+				if (byte == token.value)
+					enter(next, state + 1);
+				break;
+			case Token::AnyChar:
+				if (c != '/')
+					enter(next, state + 1);
+				break;
+			case Token::Class:
+				if (c != '/' && _classes[token.value].test(byte))
+					enter(next, state + 1);
+				break;
+			case Token::Star:
+				if (c != '/')
+					enter(next, state);
+				break;
+			case Token::DoubleStar:
+				enter(next, state);
+				break;
+			case Token::Directories:
+				// Stays within the directories until a '/' ends one of them
+				next.set(state);
+				if (c == '/')
+					enter(next, state + 1);
+				break;
+			}
+		}
+
+		if (next.none())
+			return false;
+		current = next;
+	}
+
+	return current.test(count);
+}
+
+void IgnoreRules::Consider(const RuleTable& table, const std::string& key, bool isDirectory, long& best) const
+{
+	auto rules = table.find(key);
+	if (rules == table.end())
+		return;
+
+	for (auto index = rules->second.rbegin(); index != rules->second.rend(); index++)
+	{
+		if (static_cast<long>(*index) <= best)
+			return;
+
+		if (Applies(*index, isDirectory))
+		{
+			best = *index;
+			return;
+		}
+	}
+}
+
+IgnoreRules::Result IgnoreRules::Match(const std::string& path, const std::string& name, bool isDirectory) const
+{
+	if (_rules.empty())
+		return None;
+
+	long best = -1;
+	Consider(_names, name, isDirectory, best);
+	Consider(_paths, path, isDirectory, best);
+
+	auto extension = name.rfind('.');
+	if (extension != std::string::npos && !_extensions.empty())
+	{
+		auto rules = _extensions.find(name.substr(extension));
+		if (rules != _extensions.end())
+		{
+			for (auto index = rules->second.rbegin(); index != rules->second.rend() && static_cast<long>(*index) > best; index++)
+			{
+				auto& suffix = _rules[*index].literal;
+				if (Applies(*index, isDirectory) && name.size() >= suffix.size()
+					&& name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+				{
+					best = *index;
+					break;
+				}
+			}
+		}
+	}
+
+	for (auto index = _suffixes.rbegin(); index != _suffixes.rend() && static_cast<long>(*index) > best; index++)
+	{
+		auto& suffix = _rules[*index].literal;
+		if (Applies(*index, isDirectory) && name.size() >= suffix.size()
+			&& name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+		{
+			best = *index;
+			break;
+		}
+	}
+
+	for (auto index = _prefixes.rbegin(); index != _prefixes.rend() && static_cast<long>(*index) > best; index++)
+	{
+		auto& prefix = _rules[*index].literal;
+		if (Applies(*index, isDirectory) && name.compare(0, prefix.size(), prefix) == 0)
+		{
+			best = *index;
+			break;
+		}
+	}
+
+	for (auto index = _globs.rbegin(); index != _globs.rend() && static_cast<long>(*index) > best; index++)
+	{
+		auto& rule = _rules[*index];
+		if (Applies(*index, isDirectory) && MatchTokens(rule, rule.anchored ? path : name))
+		{
+			best = *index;
+			break;
+		}
+	}
+
+	if (best < 0)
+		return None;
+
+	return _rules[best].negated ? Included : Excluded;
+}
+
+
+//--- IgnoreMatcher
+
+IgnoreMatcher::IgnoreMatcher(const boost::filesystem::path& workTree, const boost::filesystem::path& gitusDirectory)
+{
+	_workTree = workTree;
+
+	RawData exclude;
+	auto excludeFile = gitusDirectory / "info" / "exclude";
+	if (boost::filesystem::exists(excludeFile) && Utils::ReadBytes(excludeFile.string(), exclude))
+		_exclude.Parse(exclude);
+}
+
+bool IgnoreMatcher::HasIgnoreFile(const std::string& directory) const
+{
+	Stats::Add(Stats::StatCalls);
+	return boost::filesystem::is_regular_file(_workTree / directory / ".gitignore");
+}
+
+IgnoreMatcher::FramePtr IgnoreMatcher::Enter(const FramePtr& parent, const std::string& directory, bool hasIgnoreFile) const
+{
+	RawData content;
+	if (!hasIgnoreFile || !Utils::ReadBytes((_workTree / directory / ".gitignore").string(), content))
+		return parent;
+
+	auto frame = std::make_shared<Frame>();
+	if (!directory.empty())
+		frame->directory = directory + "/";
+	frame->rules = std::make_shared<IgnoreRules>();
+	frame->rules->Parse(content);
+	frame->parent = parent;
+	return frame;
+}
+
+bool IgnoreMatcher::EnterParents(const std::string& path, FramePtr& frame) const
+{
+	frame = nullptr;
+	if (path.empty())
+		return true;
+
+	frame = Enter(frame, "", HasIgnoreFile(""));
+	size_t start = 0;
+	while (true)
+	{
+		auto end = path.find('/', start);
+		auto directory = path.substr(0, end);
+		if (IsIgnored(frame, directory, true))
+			return false;
+
+		if (end == std::string::npos)
+			return true;
+
+		frame = Enter(frame, directory, HasIgnoreFile(directory));
+		start = end + 1;
+	}
+}
+
+bool IgnoreMatcher::IsIgnored(const FramePtr& frame, const std::string& path, bool isDirectory) const
+{
+	auto separator = path.rfind('/');
+	auto name = separator == std::string::npos ? path : path.substr(separator + 1);
+
+	// The rules closest to the path take precedence
+	for (auto current = frame.get(); current != nullptr; current = current->parent.get())
+	{
+		auto result = current->rules->Match(path.substr(current->directory.size()), name, isDirectory);
+		if (result != IgnoreRules::None)
+			return result == IgnoreRules::Excluded;
+	}
+
+	return _exclude.Match(path, name, isDirectory) == IgnoreRules::Excluded;
+}
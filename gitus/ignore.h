@@ -0,0 +1,142 @@
+#ifndef GITUS_IGNORE_H
+#define GITUS_IGNORE_H
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "utils.h"
+
+
+// The rules of one '.gitignore' file (or '.git/info/exclude'), compiled for matching
+//
+// Most rules are a file name ("Thumbs.db", "build/"), an extension ("*.o") or a name prefix
+// ("cmake-build-*"): they are looked up in hash tables or short lists rather than matched one by one.
+// The other rules are compiled to a small automaton over the path, matched in one pass without
+// backtracking. When several rules match a path, the last one wins, as with git.
+class IgnoreRules {
+
+public:
+	enum Result { None, Excluded, Included };
+
+	// Longer patterns are ignored
+	static const size_t MaxTokens = 255;
+
+	// Adds the rules of a '.gitignore' file, after the current ones
+	void Parse(ByteView content);
+
+	// 'path' is relative to the directory of the rules, with '/' separators, 'name' is its last component
+	Result Match(const std::string& path, const std::string& name, bool isDirectory) const;
+
+	size_t Count() const
+	{
+		return _rules.size();
+	}
+
+private:
+	struct Token
+	{
+		enum Kind : uint8_t {
+			Literal,
+			// '?', any character but '/'
+			AnyChar,
+			// '[...]', a character of 'classes[value]'
+			Class,
+			// '*', any characters but '/'
+			Star,
+			// '**' at the end or in the middle of a component, any characters
+			DoubleStar,
+			// '**/', any number of directories, possibly none
+			Directories,
+		};
+
+		Kind kind;
+		unsigned char value;
+	};
+
+	struct Rule
+	{
+		bool negated = false;
+		bool directoryOnly = false;
+		// Matched against the whole path rather than the name
+		bool anchored = false;
+		std::vector<Token> tokens;
+		// The name, path, suffix or prefix of the rules looked up in tables
+		std::string literal;
+	};
+
+	typedef std::unordered_map<std::string, std::vector<size_t>> RuleTable;
+
+	std::vector<Rule> _rules;
+	std::vector<std::bitset<256>> _classes;
+
+	// Rule indices, in increasing order
+	RuleTable _names;
+	RuleTable _paths;
+	// By the last extension of the suffix, ".gz" for "*.tar.gz"
+	RuleTable _extensions;
+	std::vector<size_t> _suffixes;
+	std::vector<size_t> _prefixes;
+	std::vector<size_t> _globs;
+
+	void AddRule(const std::string& line);
+	bool Compile(const std::string& pattern, Rule& rule);
+	bool MatchTokens(const Rule& rule, const std::string& subject) const;
+
+	bool Applies(size_t index, bool isDirectory) const
+	{
+		return !_rules[index].directoryOnly || isDirectory;
+	}
+
+	// Highest index of 'table[key]' which applies, or 'best'
+	void Consider(const RuleTable& table, const std::string& key, bool isDirectory, long& best) const;
+};
+
+// Ignore rules of a directory walk: '.git/info/exclude', then the '.gitignore' of every directory
+// from the work tree down to the current one, the deepest ones taking precedence
+//
+// A walk enters a directory before matching its entries, an excluded directory is not entered at all.
+// The frames of the directories are immutable and shared with their subdirectories, so the parallel
+// walks of several directories need no locking.
+class IgnoreMatcher {
+
+public:
+	struct Frame
+	{
+		// Relative to the work tree with a trailing '/', empty for the work tree
+		std::string directory;
+		std::shared_ptr<IgnoreRules> rules;
+		std::shared_ptr<const Frame> parent;
+	};
+
+	// nullptr until a directory with a '.gitignore' is entered
+	typedef std::shared_ptr<const Frame> FramePtr;
+
+private:
+	boost::filesystem::path _workTree;
+	IgnoreRules _exclude;
+
+	bool HasIgnoreFile(const std::string& directory) const;
+
+public:
+	IgnoreMatcher(const boost::filesystem::path& workTree, const boost::filesystem::path& gitusDirectory);
+
+	// Frame of 'directory' (relative to the work tree, "" for the work tree) below the frame of its parent
+	// 'hasIgnoreFile' tells whether its '.gitignore' should be read, the parent frame is kept otherwise.
+	FramePtr Enter(const FramePtr& parent, const std::string& directory, bool hasIgnoreFile) const;
+
+	// Enters the work tree and every directory above 'path' (relative to the work tree), false when
+	// 'path' or one of these directories is ignored
+	bool EnterParents(const std::string& path, FramePtr& frame) const;
+
+	// 'path' is relative to the work tree, in the directory of 'frame'
+	bool IsIgnored(const FramePtr& frame, const std::string& path, bool isDirectory) const;
+};
+
+
+#endif
@@ -0,0 +1,526 @@
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#if defined(__linux__) && !defined(GITUS_NO_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+// IORING_OP_RENAMEAT is an enumerator, IORING_FEAT_EXT_ARG comes with the same kernel headers (5.11)
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_EXT_ARG)
+#define GITUS_IO_URING
+#endif
+#endif
+
+#include "io_engine.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+
+namespace {
+
+	// Below this, a batch is not worth a ring or a thread pool
+	const size_t MinBatchSize = 4;
+	const unsigned MaxRingEntries = 256;
+
+	bool WriteFile(IoEngine::WriteRequest& request)
+	{
+		using namespace boost;
+
+		system::error_code ec;
+		auto temporaryPath = request.path;
+		temporaryPath += filesystem::unique_path("-%%%%%%%%.tmp");
+		{
+			filesystem::ofstream ofs{ temporaryPath, std::ios_base::binary };
+			ofs.write(request.data.data(), request.data.size());
+			if (!ofs)
+			{
+				ofs.close();
+				filesystem::remove(temporaryPath, ec);
+				return false;
+			}
+		}
+
+		filesystem::rename(temporaryPath, request.path, ec);
+		if (ec)
+			filesystem::remove(temporaryPath, ec);
+
+		Stats::Add(Stats::OpenCalls);
+		Stats::Add(Stats::BytesWritten, request.data.size());
+		request.done = !ec;
+		return request.done;
+	}
+
+	bool ReadFile(IoEngine::ReadRequest& request)
+	{
+		boost::filesystem::ifstream ifs{ request.path, std::ios_base::binary };
+		if (!ifs)
+			return false;
+
+		request.data.assign(
+			(std::istreambuf_iterator<char>(ifs)),
+			(std::istreambuf_iterator<char>()));
+
+		Stats::Add(Stats::OpenCalls);
+		Stats::Add(Stats::BytesRead, request.data.size());
+		request.done = !ifs.bad();
+		return request.done;
+	}
+
+	// The requests already done (e.g by the windows of the ring before it gave up) are skipped
+	template <typename Request>
+	bool RunOnThreads(std::vector<Request>& requests, bool (*run)(Request&))
+	{
+		std::atomic<bool> success(true);
+		if (requests.size() < MinBatchSize)
+		{
+			for (auto& request : requests)
+				success = (request.done || run(request)) && success;
+			return success;
+		}
+
+		ThreadPool pool(std::min(requests.size(), ThreadPool::DefaultThreadCount() * 2));
+		for (auto& request : requests)
+		{
+			if (request.done)
+				continue;
+
+			auto* current = &request;
+			pool.Enqueue([&success, current, run]() {
+				if (!run(*current))
+					success = false;
+			});
+		}
+
+		pool.Wait();
+		return success;
+	}
+
+#ifdef GITUS_IO_URING
+	// Minimal io_uring on the raw system calls, to avoid a dependency on liburing
+	class Ring {
+
+	private:
+		int _fd = -1;
+		unsigned _entries = 0;
+
+		void* _sqRing = MAP_FAILED;
+		size_t _sqRingSize = 0;
+		void* _cqRing = MAP_FAILED;
+		size_t _cqRingSize = 0;
+		io_uring_sqe* _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+		size_t _sqesSize = 0;
+
+		unsigned* _sqHead = nullptr;
+		unsigned* _sqTail = nullptr;
+		unsigned* _sqMask = nullptr;
+		unsigned* _sqArray = nullptr;
+		unsigned* _cqHead = nullptr;
+		unsigned* _cqTail = nullptr;
+		unsigned* _cqMask = nullptr;
+		io_uring_cqe* _cqes = nullptr;
+
+		bool Supports(const std::vector<int>& operations)
+		{
+			// The probe is followed by one entry per operation
+			std::vector<char> buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+			auto probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+			if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+				return false;
+
+			for (auto operation : operations)
+			{
+				if (operation > probe->last_op || !(probe->ops[operation].flags & IO_URING_OP_SUPPORTED))
+					return false;
+			}
+
+			return true;
+		}
+
+	public:
+
+		~Ring()
+		{
+			if (_sqes != MAP_FAILED)
+				munmap(_sqes, _sqesSize);
+			if (_cqRing != MAP_FAILED && _cqRing != _sqRing)
+				munmap(_cqRing, _cqRingSize);
+			if (_sqRing != MAP_FAILED)
+				munmap(_sqRing, _sqRingSize);
+			if (_fd >= 0)
+				close(_fd);
+		}
+
+		bool Open(unsigned entries)
+		{
+			io_uring_params params;
+			std::memset(&params, 0, sizeof(params));
+			_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+			if (_fd < 0)
+				return false;
+
+			_entries = params.sq_entries;
+			_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			auto singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+			if (singleMap)
+				_sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+			_sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+			if (_sqRing == MAP_FAILED)
+				return false;
+
+			_cqRing = singleMap ? _sqRing
+				: mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+			if (_cqRing == MAP_FAILED)
+				return false;
+
+			_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+			_sqes = static_cast<io_uring_sqe*>(mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES));
+			if (_sqes == MAP_FAILED)
+				return false;
+
+			auto sq = static_cast<char*>(_sqRing);
+			_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+			_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+			_sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+			_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+			auto cq = static_cast<char*>(_cqRing);
+			_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+			_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+			_cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+			_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+			return Supports({ IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_RENAMEAT });
+		}
+
+		// Submits 'count' operations with at most the size of the ring in flight
+		// 'prepare' fills the entry of an operation, 'complete' receives its result (-errno on failure)
+		bool Run(size_t count, const std::function<void(size_t, io_uring_sqe&)>& prepare, const std::function<void(size_t, int)>& complete)
+		{
+			size_t prepared = 0;
+			size_t completed = 0;
+			while (completed < count)
+			{
+				// Only this thread produces entries, the kernel consumes them
+				unsigned tail = *_sqTail;
+				while (prepared < count && prepared - completed < _entries)
+				{
+					auto index = tail & *_sqMask;
+					auto& sqe = _sqes[index];
+					std::memset(&sqe, 0, sizeof(sqe));
+					prepare(prepared, sqe);
+					sqe.user_data = prepared;
+					_sqArray[index] = index;
+					tail++;
+					prepared++;
+				}
+				__atomic_store_n(_sqTail, tail, __ATOMIC_RELEASE);
+
+				auto toSubmit = tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+				if (syscall(__NR_io_uring_enter, _fd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+					return false;
+
+				unsigned head = *_cqHead;
+				while (head != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE))
+				{
+					auto& cqe = _cqes[head & *_cqMask];
+					complete(static_cast<size_t>(cqe.user_data), cqe.res);
+					head++;
+					completed++;
+				}
+				__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+			}
+
+			return true;
+		}
+	};
+
+	bool OpenRing(Ring& ring, size_t batchSize)
+	{
+		return ring.Open(static_cast<unsigned>(std::min<size_t>(batchSize, MaxRingEntries)));
+	}
+
+	// Opens every path, 'fds' is -1 for the paths which could not be opened
+	// 'exhausted' is set when the process or the system ran out of file descriptors.
+	bool OpenAll(Ring& ring, const std::vector<std::string>& paths, int flags, std::vector<int>& fds, bool& exhausted)
+	{
+		fds.assign(paths.size(), -1);
+		exhausted = false;
+		Stats::Add(Stats::OpenCalls, paths.size());
+		return ring.Run(paths.size(),
+			[&](size_t i, io_uring_sqe& sqe) {
+				sqe.opcode = IORING_OP_OPENAT;
+				sqe.fd = AT_FDCWD;
+				sqe.addr = reinterpret_cast<uintptr_t>(paths[i].c_str());
+				sqe.len = 0644;
+				sqe.open_flags = flags | O_CLOEXEC;
+			},
+			[&](size_t i, int result) {
+				fds[i] = result;
+				if (result == -EMFILE || result == -ENFILE)
+					exhausted = true;
+			});
+	}
+
+	bool CloseAll(Ring& ring, std::vector<int>& fds)
+	{
+		std::vector<size_t> opened;
+		for (size_t i = 0; i < fds.size(); i++)
+		{
+			if (fds[i] >= 0)
+				opened.push_back(i);
+		}
+
+		return ring.Run(opened.size(),
+			[&](size_t i, io_uring_sqe& sqe) {
+				sqe.opcode = IORING_OP_CLOSE;
+				sqe.fd = fds[opened[i]];
+			},
+			[&](size_t i, int) { fds[opened[i]] = -1; });
+	}
+
+	// Transfers 'sizes' bytes for every open file, resubmitting the remainder of short transfers
+	// 'offsets' is the progress of every file, a file failing has its offset set to -1
+	bool TransferAll(Ring& ring, int opcode, const std::vector<int>& fds, const std::vector<char*>& buffers,
+		const std::vector<size_t>& sizes, std::vector<int64_t>& offsets)
+	{
+		offsets.assign(fds.size(), 0);
+		while (true)
+		{
+			std::vector<size_t> remaining;
+			for (size_t i = 0; i < fds.size(); i++)
+			{
+				if (fds[i] >= 0 && offsets[i] >= 0 && static_cast<size_t>(offsets[i]) < sizes[i])
+					remaining.push_back(i);
+			}
+
+			if (remaining.empty())
+				return true;
+
+			auto success = ring.Run(remaining.size(),
+				[&](size_t i, io_uring_sqe& sqe) {
+					auto file = remaining[i];
+					// A single operation transfers at most 2GiB
+					auto length = std::min<size_t>(sizes[file] - offsets[file], 1u << 30);
+					sqe.opcode = static_cast<__u8>(opcode);
+					sqe.fd = fds[file];
+					sqe.addr = reinterpret_cast<uintptr_t>(buffers[file] + offsets[file]);
+					sqe.len = static_cast<__u32>(length);
+					sqe.off = offsets[file];
+				},
+				[&](size_t i, int result) {
+					auto file = remaining[i];
+					// 0 is the end of a file which shrank since its size was read
+					offsets[file] = result > 0 ? offsets[file] + result : -1;
+				});
+
+			if (!success)
+				return false;
+		}
+	}
+
+	// Writes the requests from 'begin' to 'end', their files are all closed on return
+	bool WriteWindow(Ring& ring, std::vector<IoEngine::WriteRequest>& requests, size_t begin, size_t end)
+	{
+		using namespace boost;
+
+		std::vector<std::string> temporaryPaths;
+		std::vector<std::string> paths;
+		std::vector<char*> buffers;
+		std::vector<size_t> sizes;
+		for (auto i = begin; i < end; i++)
+		{
+			paths.push_back(requests[i].path.string());
+			temporaryPaths.push_back(paths.back() + filesystem::unique_path("-%%%%%%%%.tmp").string());
+			buffers.push_back(&requests[i].data[0]);
+			sizes.push_back(requests[i].data.size());
+		}
+
+		std::vector<int> fds;
+		std::vector<int64_t> offsets;
+		bool exhausted;
+		if (!OpenAll(ring, temporaryPaths, O_WRONLY | O_CREAT | O_TRUNC, fds, exhausted) || exhausted
+			|| !TransferAll(ring, IORING_OP_WRITE, fds, buffers, sizes, offsets))
+		{
+			for (size_t i = 0; i < fds.size(); i++)
+			{
+				if (fds[i] >= 0)
+					close(fds[i]);
+				unlink(temporaryPaths[i].c_str());
+			}
+			return false;
+		}
+
+		std::vector<size_t> written;
+		for (size_t i = 0; i < fds.size(); i++)
+		{
+			if (fds[i] >= 0 && offsets[i] >= 0)
+			{
+				written.push_back(i);
+				Stats::Add(Stats::BytesWritten, sizes[i]);
+			}
+		}
+
+		CloseAll(ring, fds);
+
+		ring.Run(written.size(),
+			[&](size_t i, io_uring_sqe& sqe) {
+				sqe.opcode = IORING_OP_RENAMEAT;
+				sqe.fd = AT_FDCWD;
+				sqe.addr = reinterpret_cast<uintptr_t>(temporaryPaths[written[i]].c_str());
+				sqe.len = static_cast<__u32>(AT_FDCWD);
+				sqe.addr2 = reinterpret_cast<uintptr_t>(paths[written[i]].c_str());
+			},
+			[&](size_t i, int result) { requests[begin + written[i]].done = result == 0; });
+
+		// Files not written or not renamed
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			if (!requests[begin + i].done)
+				unlink(temporaryPaths[i].c_str());
+		}
+
+		return true;
+	}
+
+	// Reads the requests from 'begin' to 'end', their files are all closed on return
+	bool ReadWindow(Ring& ring, std::vector<IoEngine::ReadRequest>& requests, size_t begin, size_t end)
+	{
+		std::vector<std::string> paths;
+		for (auto i = begin; i < end; i++)
+			paths.push_back(requests[i].path.string());
+
+		std::vector<int> fds;
+		bool exhausted;
+		if (!OpenAll(ring, paths, O_RDONLY, fds, exhausted) || exhausted)
+		{
+			for (auto fd : fds)
+			{
+				if (fd >= 0)
+					close(fd);
+			}
+			return false;
+		}
+
+		std::vector<char*> buffers(paths.size(), nullptr);
+		std::vector<size_t> sizes(paths.size(), 0);
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			struct stat status;
+			if (fds[i] < 0 || fstat(fds[i], &status) != 0)
+				continue;
+
+			requests[begin + i].data.resize(status.st_size);
+			buffers[i] = reinterpret_cast<char*>(requests[begin + i].data.data());
+			sizes[i] = status.st_size;
+		}
+
+		std::vector<int64_t> offsets;
+		auto success = TransferAll(ring, IORING_OP_READ, fds, buffers, sizes, offsets);
+		for (size_t i = 0; success && i < paths.size(); i++)
+		{
+			requests[begin + i].done = fds[i] >= 0 && offsets[i] >= 0;
+			if (requests[begin + i].done)
+				Stats::Add(Stats::BytesRead, sizes[i]);
+		}
+
+		if (!CloseAll(ring, fds))
+		{
+			for (auto fd : fds)
+			{
+				if (fd >= 0)
+					close(fd);
+			}
+		}
+
+		return success;
+	}
+
+	// The files are opened, transferred and closed one window of at most 'MaxRingEntries' at a
+	// time, a batch never holds more descriptors than that whatever its size
+	// Returns false when the ring failed or ran out of descriptors, the requests not done are
+	// then left to the threads.
+	template <typename Request>
+	bool RunWithRing(std::vector<Request>& requests, bool (*runWindow)(Ring&, std::vector<Request>&, size_t, size_t))
+	{
+		Ring ring;
+		if (!OpenRing(ring, requests.size()))
+			return false;
+
+		for (size_t begin = 0; begin < requests.size(); begin += MaxRingEntries)
+		{
+			if (!runWindow(ring, requests, begin, std::min<size_t>(begin + MaxRingEntries, requests.size())))
+				return false;
+		}
+
+		return true;
+	}
+#endif
+
+	bool UseRing()
+	{
+#ifdef GITUS_IO_URING
+		// Kernels without io_uring, or sandboxes forbidding it, are only probed once
+		static const bool available = []() {
+			auto engine = std::getenv("GITUS_IO_ENGINE");
+			if (engine != nullptr && std::string(engine) == "threads")
+				return false;
+
+			Ring ring;
+			return ring.Open(1);
+		}();
+
+		return available;
+#else
+		return false;
+#endif
+	}
+}
+
+bool IoEngine::WriteFiles(std::vector<WriteRequest>& requests)
+{
+	GITUS_TRACE_SCOPE("IoEngine::WriteFiles");
+
+	for (auto& request : requests)
+		request.done = false;
+
+#ifdef GITUS_IO_URING
+	if (requests.size() >= MinBatchSize && UseRing() && RunWithRing(requests, &WriteWindow))
+		return std::all_of(requests.begin(), requests.end(), [](const WriteRequest& request) { return request.done; });
+#endif
+
+	return RunOnThreads(requests, &WriteFile);
+}
+
+bool IoEngine::ReadFiles(std::vector<ReadRequest>& requests)
+{
+	GITUS_TRACE_SCOPE("IoEngine::ReadFiles");
+
+	for (auto& request : requests)
+		request.done = false;
+
+#ifdef GITUS_IO_URING
+	if (requests.size() >= MinBatchSize && UseRing() && RunWithRing(requests, &ReadWindow))
+		return std::all_of(requests.begin(), requests.end(), [](const ReadRequest& request) { return request.done; });
+#endif
+
+	return RunOnThreads(requests, &ReadFile);
+}
+
+std::string IoEngine::Backend()
+{
+	return UseRing() ? "io_uring" : "threads";
+}
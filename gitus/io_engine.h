@@ -0,0 +1,51 @@
+#ifndef GITUS_IO_ENGINE_H
+#define GITUS_IO_ENGINE_H
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "utils.h"
+
+
+// Batched file I/O for many objects at once (bulk add, object writes, checkout)
+//
+// On Linux the requests of a batch are submitted together through io_uring, one phase at a
+// time (open, read or write, close, rename), so a batch costs a few system calls instead of
+// several per file. A large batch goes through the phases in windows of a few hundred files, so
+// that it never holds more file descriptors than that. Elsewhere, when the kernel refuses
+// io_uring or the process runs out of descriptors, or with GITUS_IO_ENGINE=threads, the requests
+// are spread over a thread pool doing blocking I/O.
+// Built without io_uring when GITUS_NO_IO_URING is defined (CMake option GITUS_IO_URING).
+class IoEngine {
+
+public:
+	struct WriteRequest
+	{
+		boost::filesystem::path path;
+		std::string data;
+		bool done = false;
+	};
+
+	struct ReadRequest
+	{
+		boost::filesystem::path path;
+		RawData data;
+		bool done = false;
+	};
+
+	// Writes every file to a temporary name then renames it, so that readers never see a
+	// partial file. The parent directories must exist.
+	// Returns false when at least one request failed, see 'done'.
+	static bool WriteFiles(std::vector<WriteRequest>& requests);
+
+	// Returns false when at least one request failed, see 'done'
+	static bool ReadFiles(std::vector<ReadRequest>& requests);
+
+	// "io_uring" or "threads", the backend used for the next batch
+	static std::string Backend();
+};
+
+
+#endif
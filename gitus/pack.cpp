@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "pack.h"
+#include "trace.h"
+
+
+static const char* PackSignature = "PACK";
+static const char* IndexSignature = "PIDX";
+static const size_t PackHeaderLength = 8;
+static const size_t IndexHeaderLength = 12;
+static const size_t FanoutLength = 256 * 4;
+static const size_t Sha1Size = 20;
+// offset and length
+static const size_t LocationLength = 8 + 4;
+
+static const char* MultiIndexSignature = "MIDX";
+static const size_t MultiIndexHeaderLength = 20;
+// pack id, offset and length
+static const size_t MultiLocationLength = 4 + 8 + 4;
+
+
+//--- PackIndex
+
+std::shared_ptr<PackIndex> PackIndex::Open(const boost::filesystem::path& indexPath)
+{
+	using namespace std;
+
+	auto index = make_shared<PackIndex>();
+	index->_packPath = indexPath;
+	index->_packPath.replace_extension(".pack");
+
+	if (!Utils::ReadBytes(indexPath.string(), index->_data))
+		return nullptr;
+
+	auto& data = index->_data;
+	if (data.size() < IndexHeaderLength + FanoutLength + Sha1Size
+		|| !equal(IndexSignature, IndexSignature + 4, data.begin()))
+		return nullptr;
+
+	Word2 version, count;
+	copy(data.begin() + 4, data.begin() + 8, version.c);
+	copy(data.begin() + 8, data.begin() + 12, count.c);
+	index->_count = count.n;
+	if (version.n != Version
+		|| data.size() != IndexHeaderLength + FanoutLength + index->_count * (Sha1Size + LocationLength) + Sha1Size)
+		return nullptr;
+
+	return index;
+}
+
+const unsigned char* PackIndex::Fanout() const
+{
+	return _data.data() + IndexHeaderLength;
+}
+
+const unsigned char* PackIndex::Sha1s() const
+{
+	return Fanout() + FanoutLength;
+}
+
+const unsigned char* PackIndex::Locations() const
+{
+	return Sha1s() + _count * Sha1Size;
+}
+
+ByteView PackIndex::Sha1(size_t i) const
+{
+	return ByteView(Sha1s() + i * Sha1Size, Sha1Size);
+}
+
+bool PackIndex::Find(ByteView sha1, uint64_t& offset, uint32_t& length) const
+{
+	using namespace std;
+
+	if (sha1.size() < Sha1Size)
+		return false;
+
+	// The fanout narrows the search to the objects sharing the first byte
+	Word2 begin, end;
+	begin.n = 0;
+	if (sha1[0] > 0)
+		copy(Fanout() + (sha1[0] - 1) * 4, Fanout() + sha1[0] * 4, begin.c);
+	copy(Fanout() + sha1[0] * 4, Fanout() + sha1[0] * 4 + 4, end.c);
+
+	size_t low = begin.n;
+	size_t high = end.n;
+	while (low < high)
+	{
+		auto middle = low + (high - low) / 2;
+		auto comparison = memcmp(Sha1s() + middle * Sha1Size, sha1.data(), Sha1Size);
+		if (comparison == 0)
+		{
+			auto location = Locations() + middle * LocationLength;
+			memcpy(&offset, location, 8);
+			memcpy(&length, location + 8, 4);
+			return true;
+		}
+
+		if (comparison < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return false;
+}
+
+void PackIndex::Location(size_t i, uint64_t& offset, uint32_t& length) const
+{
+	auto location = Locations() + i * LocationLength;
+	memcpy(&offset, location, 8);
+	memcpy(&length, location + 8, 4);
+}
+
+bool PackIndex::ReadEntry(uint64_t offset, uint32_t length, ScratchData& compressed) const
+{
+	return ReadEntry(_packPath, offset, length, compressed);
+}
+
+bool PackIndex::ReadEntry(const boost::filesystem::path& packPath, uint64_t offset, uint32_t length, ScratchData& compressed)
+{
+	boost::filesystem::ifstream ifs(packPath, std::ios_base::binary);
+	Stats::Add(Stats::OpenCalls);
+	if (!ifs)
+		return false;
+
+	compressed.resize(length);
+	ifs.seekg(static_cast<std::streamoff>(offset));
+	ifs.read(reinterpret_cast<char*>(compressed.data()), length);
+	Stats::Add(Stats::BytesRead, static_cast<size_t>(ifs.gcount()));
+	return static_cast<size_t>(ifs.gcount()) == length;
+}
+
+
+//--- MultiPackIndex
+
+MultiPackIndex::~MultiPackIndex()
+{
+#ifndef _WIN32
+	if (_data != nullptr)
+		::munmap(const_cast<unsigned char*>(_data), _size);
+#endif
+}
+
+std::shared_ptr<MultiPackIndex> MultiPackIndex::Open(const boost::filesystem::path& indexPath)
+{
+	using namespace std;
+
+	auto index = make_shared<MultiPackIndex>();
+	index->_directory = indexPath.parent_path();
+
+#ifdef _WIN32
+	if (!Utils::ReadBytes(indexPath.string(), index->_buffer))
+		return nullptr;
+
+	index->_data = index->_buffer.data();
+	index->_size = index->_buffer.size();
+#else
+	auto fd = ::open(indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+	Stats::Add(Stats::OpenCalls);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat status;
+	if (::fstat(fd, &status) == 0 && status.st_size > 0)
+	{
+		auto mapped = ::mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED)
+		{
+			index->_data = static_cast<const unsigned char*>(mapped);
+			index->_size = status.st_size;
+		}
+	}
+	::close(fd);
+#endif
+
+	auto data = index->_data;
+	if (index->_size < MultiIndexHeaderLength || memcmp(data, MultiIndexSignature, 4) != 0)
+		return nullptr;
+
+	Word2 version, packCount, count, namesLength;
+	memcpy(version.c, data + 4, 4);
+	memcpy(packCount.c, data + 8, 4);
+	memcpy(count.c, data + 12, 4);
+	memcpy(namesLength.c, data + 16, 4);
+	index->_count = count.n;
+	if (version.n != Version || namesLength.n % 4 != 0
+		|| index->_size != MultiIndexHeaderLength + namesLength.n + FanoutLength + size_t(count.n) * (Sha1Size + MultiLocationLength) + Sha1Size)
+		return nullptr;
+
+	// The names are NUL terminated and the last one is followed by the padding
+	auto names = reinterpret_cast<const char*>(data + MultiIndexHeaderLength);
+	size_t position = 0;
+	for (size_t i = 0; i < packCount.n; i++)
+	{
+		auto end = static_cast<const char*>(memchr(names + position, 0, namesLength.n - position));
+		if (end == nullptr)
+			return nullptr;
+
+		index->_packNames.emplace_back(names + position, end);
+		position = end - names + 1;
+	}
+
+	index->_fanout = data + MultiIndexHeaderLength + namesLength.n;
+	return index;
+}
+
+const unsigned char* MultiPackIndex::Sha1s() const
+{
+	return _fanout + FanoutLength;
+}
+
+const unsigned char* MultiPackIndex::Locations() const
+{
+	return Sha1s() + _count * Sha1Size;
+}
+
+bool MultiPackIndex::Find(ByteView sha1, size_t& pack, uint64_t& offset, uint32_t& length) const
+{
+	using namespace std;
+
+	if (sha1.size() < Sha1Size)
+		return false;
+
+	// Same search as 'PackIndex::Find', over the objects of all the packs
+	Word2 begin, end;
+	begin.n = 0;
+	if (sha1[0] > 0)
+		memcpy(begin.c, _fanout + (sha1[0] - 1) * 4, 4);
+	memcpy(end.c, _fanout + sha1[0] * 4, 4);
+
+	size_t low = begin.n;
+	size_t high = min<size_t>(end.n, _count);
+	while (low < high)
+	{
+		auto middle = low + (high - low) / 2;
+		auto comparison = memcmp(Sha1s() + middle * Sha1Size, sha1.data(), Sha1Size);
+		if (comparison == 0)
+		{
+			auto location = Locations() + middle * MultiLocationLength;
+			Word2 packId;
+			memcpy(packId.c, location, 4);
+			memcpy(&offset, location + 4, 8);
+			memcpy(&length, location + 12, 4);
+			pack = packId.n;
+			return pack < _packNames.size();
+		}
+
+		if (comparison < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return false;
+}
+
+bool MultiPackIndex::Write(const boost::filesystem::path& indexPath, const std::vector<std::shared_ptr<PackIndex>>& packs)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("MultiPackIndex::Write");
+
+	struct Entry
+	{
+		const unsigned char* sha1;
+		uint32_t pack;
+		uint64_t offset;
+		uint32_t length;
+	};
+
+	vector<Entry> entries;
+	size_t total = 0;
+	for (auto& pack : packs)
+		total += pack->Count();
+	entries.reserve(total);
+
+	for (uint32_t id = 0; id < packs.size(); id++)
+	{
+		auto& pack = *packs[id];
+		for (size_t i = 0; i < pack.Count(); i++)
+		{
+			Entry entry;
+			entry.sha1 = pack.Sha1(i).data();
+			entry.pack = id;
+			pack.Location(i, entry.offset, entry.length);
+			entries.push_back(entry);
+		}
+	}
+
+	// Stable, so that the copy of the first pack listed is kept
+	stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return memcmp(a.sha1, b.sha1, Sha1Size) < 0; });
+	entries.erase(unique(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return memcmp(a.sha1, b.sha1, Sha1Size) == 0; }), entries.end());
+
+	string names;
+	for (auto& pack : packs)
+		names += pack->PackPath().filename().string() + '\0';
+	names.resize((names.size() + 3) / 4 * 4, '\0');
+
+	ScratchData index;
+	index.reserve(MultiIndexHeaderLength + names.size() + FanoutLength + entries.size() * (Sha1Size + MultiLocationLength) + Sha1Size);
+
+	Word2 version, packCount, count, namesLength;
+	version.n = Version;
+	packCount.n = packs.size();
+	count.n = entries.size();
+	namesLength.n = names.size();
+	index.insert(index.end(), MultiIndexSignature, MultiIndexSignature + 4);
+	index.insert(index.end(), &version.c[0], &version.c[4]);
+	index.insert(index.end(), &packCount.c[0], &packCount.c[4]);
+	index.insert(index.end(), &count.c[0], &count.c[4]);
+	index.insert(index.end(), &namesLength.c[0], &namesLength.c[4]);
+	index.insert(index.end(), names.begin(), names.end());
+
+	size_t entry = 0;
+	for (size_t i = 0; i < 256; i++)
+	{
+		while (entry < entries.size() && entries[entry].sha1[0] <= i)
+			entry++;
+
+		Word2 fanout; fanout.n = entry;
+		index.insert(index.end(), &fanout.c[0], &fanout.c[4]);
+	}
+
+	for (auto& entry : entries)
+		index.insert(index.end(), entry.sha1, entry.sha1 + Sha1Size);
+
+	for (auto& entry : entries)
+	{
+		Word2 pack; pack.n = entry.pack;
+		auto offset = reinterpret_cast<const unsigned char*>(&entry.offset);
+		auto length = reinterpret_cast<const unsigned char*>(&entry.length);
+		index.insert(index.end(), &pack.c[0], &pack.c[4]);
+		index.insert(index.end(), offset, offset + 8);
+		index.insert(index.end(), length, length + 4);
+	}
+
+	Sha1Context context;
+	RawData checksum;
+	context.Update(ByteView(index.data(), index.size()));
+	context.Final(checksum);
+	index.insert(index.end(), checksum.begin(), checksum.end());
+
+	auto temporaryPath = indexPath.parent_path() / filesystem::unique_path("tmp-%%%%%%%%%%%%.midx");
+	{
+		filesystem::ofstream ofs(temporaryPath, ios_base::binary);
+		ofs.write(reinterpret_cast<const char*>(index.data()), index.size());
+		Stats::Add(Stats::OpenCalls);
+		Stats::Add(Stats::BytesWritten, index.size());
+		if (!ofs)
+		{
+			ofs.close();
+			system::error_code ec;
+			filesystem::remove(temporaryPath, ec);
+			return false;
+		}
+	}
+
+	filesystem::rename(temporaryPath, indexPath);
+	return true;
+}
+
+
+//--- PackWriter
+
+PackWriter::PackWriter(const boost::filesystem::path& packDirectory)
+{
+	using namespace boost;
+
+	_directory = packDirectory;
+	filesystem::create_directories(_directory);
+	_temporaryPath = _directory / filesystem::unique_path("tmp-%%%%%%%%%%%%.pack");
+	_pack.open(_temporaryPath, std::ios_base::binary);
+	Stats::Add(Stats::OpenCalls);
+
+	Word2 version; version.n = PackIndex::Version;
+	Write(ByteView(PackSignature, 4));
+	Write(ByteView(version.c, 4));
+}
+
+PackWriter::~PackWriter()
+{
+	// Not finished, the objects are dropped
+	if (_pack.is_open())
+	{
+		_pack.close();
+		boost::system::error_code ec;
+		boost::filesystem::remove(_temporaryPath, ec);
+	}
+}
+
+void PackWriter::Write(ByteView data)
+{
+	_checksum.Update(data);
+	_pack.write(reinterpret_cast<const char*>(data.data()), data.size());
+	_offset += data.size();
+	Stats::Add(Stats::BytesWritten, data.size());
+}
+
+bool PackWriter::Add(ByteView sha1, ByteView compressed)
+{
+	// The index stores the length in 4 bytes, a longer entry could not be read back
+	if (compressed.size() > MaxEntryLength)
+		return false;
+
+	Entry entry;
+	entry.sha1.assign(sha1.begin(), sha1.begin() + Sha1Size);
+	entry.offset = _offset;
+	entry.length = static_cast<uint32_t>(compressed.size());
+	_entries.push_back(entry);
+
+	Write(compressed);
+	return static_cast<bool>(_pack);
+}
+
+bool PackWriter::Finish(boost::filesystem::path& packPath)
+{
+	using namespace std;
+	using namespace boost;
+
+	packPath.clear();
+	if (_entries.empty())
+	{
+		_pack.close();
+		filesystem::remove(_temporaryPath);
+		return true;
+	}
+
+	RawData checksum;
+	_checksum.Final(checksum);
+	_pack.write(reinterpret_cast<const char*>(checksum.data()), checksum.size());
+	_pack.close();
+	if (!_pack)
+	{
+		filesystem::remove(_temporaryPath);
+		return false;
+	}
+
+	string checksumString;
+	Utils::Sha1ToString(checksum, checksumString);
+	packPath = _directory / ("pack-" + checksumString + ".pack");
+	filesystem::rename(_temporaryPath, packPath);
+
+	// The same object may have been added twice, the first copy is kept
+	stable_sort(_entries.begin(), _entries.end(), [](const Entry& a, const Entry& b) { return a.sha1 < b.sha1; });
+	_entries.erase(unique(_entries.begin(), _entries.end(), [](const Entry& a, const Entry& b) { return a.sha1 == b.sha1; }), _entries.end());
+
+	ScratchData index;
+	index.reserve(IndexHeaderLength + FanoutLength + _entries.size() * (Sha1Size + LocationLength) + Sha1Size);
+
+	Word2 version, count;
+	version.n = PackIndex::Version;
+	count.n = _entries.size();
+	index.insert(index.end(), IndexSignature, IndexSignature + 4);
+	index.insert(index.end(), &version.c[0], &version.c[4]);
+	index.insert(index.end(), &count.c[0], &count.c[4]);
+
+	size_t entry = 0;
+	for (size_t i = 0; i < 256; i++)
+	{
+		while (entry < _entries.size() && _entries[entry].sha1[0] <= i)
+			entry++;
+
+		Word2 fanout; fanout.n = entry;
+		index.insert(index.end(), &fanout.c[0], &fanout.c[4]);
+	}
+
+	for (auto& entry : _entries)
+		index.insert(index.end(), entry.sha1.begin(), entry.sha1.end());
+
+	for (auto& entry : _entries)
+	{
+		auto offset = reinterpret_cast<const unsigned char*>(&entry.offset);
+		auto length = reinterpret_cast<const unsigned char*>(&entry.length);
+		index.insert(index.end(), offset, offset + 8);
+		index.insert(index.end(), length, length + 4);
+	}
+
+	index.insert(index.end(), checksum.begin(), checksum.end());
+
+	auto indexPath = packPath;
+	indexPath.replace_extension(".idx");
+	auto temporaryIndexPath = _directory / filesystem::unique_path("tmp-%%%%%%%%%%%%.idx");
+	{
+		filesystem::ofstream ofs(temporaryIndexPath, ios_base::binary);
+		ofs.write(reinterpret_cast<const char*>(index.data()), index.size());
+		Stats::Add(Stats::OpenCalls);
+		Stats::Add(Stats::BytesWritten, index.size());
+		if (!ofs)
+			return false;
+	}
+	filesystem::rename(temporaryIndexPath, indexPath);
+	return true;
+}
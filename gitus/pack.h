@@ -0,0 +1,180 @@
+#ifndef GITUS_PACK_H
+#define GITUS_PACK_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "utils.h"
+
+
+// Packs store many objects in one file, instead of one loose file per object
+//
+// 'pack-<checksum>.pack'
+//		"PACK", version (4 bytes)
+//		the deflated content of every object, the same bytes as its loose file, or a deflated delta
+//		of another object of the repository (see 'DeltaIndex'), written by 'Repacker'
+//		sha1 of everything above, the checksum naming the pack
+// 'pack-<checksum>.idx'
+//		"PIDX", version (4 bytes), object count (4 bytes)
+//		fanout table: 256 counts, the number of objects whose first sha1 byte is <= i
+//		the binary sha1 of every object, sorted
+//		the offset (8 bytes) and deflated length (4 bytes) of every object, in the same order
+//		checksum of the pack
+// Numbers are native endian, as in the index and the objects.
+// The index is written after its pack, a reader never finds an index without its pack.
+class PackIndex {
+
+private:
+	boost::filesystem::path _packPath;
+	RawData _data;
+	size_t _count = 0;
+
+	const unsigned char* Fanout() const;
+	const unsigned char* Sha1s() const;
+	const unsigned char* Locations() const;
+
+public:
+	static const size_t Version = 1;
+
+	// Reads 'pack-<checksum>.idx', nullptr when it is not a valid index
+	static std::shared_ptr<PackIndex> Open(const boost::filesystem::path& indexPath);
+
+	// Returns false when the pack does not contain the object
+	bool Find(ByteView sha1, uint64_t& offset, uint32_t& length) const;
+
+	// Reads the deflated content of an object found with 'Find'
+	bool ReadEntry(uint64_t offset, uint32_t length, ScratchData& compressed) const;
+
+	// Same for an object of the pack 'packPath', e.g found with 'MultiPackIndex::Find'
+	static bool ReadEntry(const boost::filesystem::path& packPath, uint64_t offset, uint32_t length, ScratchData& compressed);
+
+	size_t Count() const
+	{
+		return _count;
+	}
+
+	// Binary sha1 of the i-th object, in sha1 order
+	ByteView Sha1(size_t i) const;
+
+	// Location in the pack of the i-th object
+	void Location(size_t i, uint64_t& offset, uint32_t& length) const;
+
+	const boost::filesystem::path& PackPath() const
+	{
+		return _packPath;
+	}
+};
+
+// One index over the objects of many packs, so that a lookup is a single binary search whatever
+// the number of packs
+//
+// 'multi-pack-index'
+//		"MIDX", version (4 bytes), pack count (4 bytes), object count (4 bytes), length of the names (4 bytes)
+//		the file names of the packs, each followed by a NUL, padded with NULs to 4 bytes
+//		fanout table: 256 counts, the number of objects whose first sha1 byte is <= i
+//		the binary sha1 of every object, sorted
+//		the pack id (4 bytes), offset (8 bytes) and deflated length (4 bytes) of every object
+//		sha1 of everything above
+// An object stored in several packs is only listed once, in the first pack listed: the preferred pack.
+// The file is mapped rather than read, opening it costs the same whatever its size.
+class MultiPackIndex {
+
+private:
+	boost::filesystem::path _directory;
+	std::vector<std::string> _packNames;
+	const unsigned char* _data = nullptr;
+	size_t _size = 0;
+	size_t _count = 0;
+	const unsigned char* _fanout = nullptr;
+#ifdef _WIN32
+	RawData _buffer;
+#endif
+
+	const unsigned char* Sha1s() const;
+	const unsigned char* Locations() const;
+
+public:
+	static const size_t Version = 1;
+
+	MultiPackIndex() = default;
+	~MultiPackIndex();
+
+	MultiPackIndex(const MultiPackIndex&) = delete;
+	MultiPackIndex& operator=(const MultiPackIndex&) = delete;
+
+	// nullptr when 'indexPath' is missing or not a valid index
+	static std::shared_ptr<MultiPackIndex> Open(const boost::filesystem::path& indexPath);
+
+	// Merges the objects of 'packs', the first one being preferred for the objects stored several times
+	static bool Write(const boost::filesystem::path& indexPath, const std::vector<std::shared_ptr<PackIndex>>& packs);
+
+	// Returns false when none of the packs contains the object
+	bool Find(ByteView sha1, size_t& pack, uint64_t& offset, uint32_t& length) const;
+
+	// File names of the packs, by pack id
+	const std::vector<std::string>& PackNames() const
+	{
+		return _packNames;
+	}
+
+	boost::filesystem::path PackPath(size_t pack) const
+	{
+		return _directory / _packNames[pack];
+	}
+
+	size_t Count() const
+	{
+		return _count;
+	}
+};
+
+// Appends objects to a new pack, which is only visible once 'Finish' wrote its index
+class PackWriter {
+
+private:
+	struct Entry
+	{
+		RawData sha1;
+		uint64_t offset;
+		uint32_t length;
+	};
+
+	boost::filesystem::path _directory;
+	boost::filesystem::path _temporaryPath;
+	boost::filesystem::ofstream _pack;
+	Sha1Context _checksum;
+	std::vector<Entry> _entries;
+	uint64_t _offset = 0;
+
+	void Write(ByteView data);
+
+public:
+	PackWriter(const boost::filesystem::path& packDirectory);
+	~PackWriter();
+
+	PackWriter(const PackWriter&) = delete;
+	PackWriter& operator=(const PackWriter&) = delete;
+
+	// Longest deflated content of an object, see the length in 'PackIndex'
+	static const uint64_t MaxEntryLength = UINT32_MAX;
+
+	// 'compressed' is the deflated content of the object, as written to a loose object
+	// Returns false when it is longer than 'MaxEntryLength' or the write failed.
+	bool Add(ByteView sha1, ByteView compressed);
+
+	size_t Count() const
+	{
+		return _entries.size();
+	}
+
+	// Writes the checksum and the index, then moves the pack in place
+	// 'packPath' is empty when no object was added, nothing is written then.
+	bool Finish(boost::filesystem::path& packPath);
+};
+
+
+#endif
@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "refs.h"
+#include "trace.h"
+
+
+// hex sha1 and space
+static const size_t NameOffset = 41;
+
+const char* PackedRefs::Header = "# pack-refs with: sorted\n";
+
+
+//--- FileStamp
+
+FileStamp FileStamp::Of(const boost::filesystem::path& path)
+{
+	FileStamp stamp;
+	Stats::Add(Stats::StatCalls);
+#ifdef _WIN32
+	boost::system::error_code ec;
+	auto mtime = boost::filesystem::last_write_time(path, ec);
+	if (ec)
+		return stamp;
+
+	stamp.mtime = static_cast<int64_t>(mtime);
+	stamp.size = static_cast<int64_t>(boost::filesystem::file_size(path, ec));
+#else
+	struct stat status;
+	if (::stat(path.c_str(), &status) != 0)
+		return stamp;
+
+	stamp.mtime = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+	stamp.size = status.st_size;
+	stamp.inode = status.st_ino;
+#endif
+	return stamp;
+}
+
+
+//--- PackedRefs
+
+PackedRefs::~PackedRefs()
+{
+#ifndef _WIN32
+	if (_data != nullptr)
+		::munmap(const_cast<char*>(_data), _size);
+#endif
+}
+
+std::shared_ptr<PackedRefs> PackedRefs::Open(const boost::filesystem::path& path)
+{
+	using namespace std;
+
+	auto refs = make_shared<PackedRefs>();
+
+#ifdef _WIN32
+	refs->_stamp = FileStamp::Of(path);
+	if (refs->_stamp.mtime == 0)
+		return refs;
+
+	if (!Utils::ReadBytes(path.string(), refs->_buffer))
+		return nullptr;
+
+	refs->_data = reinterpret_cast<const char*>(refs->_buffer.data());
+	refs->_size = refs->_buffer.size();
+#else
+	auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	Stats::Add(Stats::OpenCalls);
+	if (fd < 0)
+		return errno == ENOENT ? refs : nullptr;
+
+	struct stat status;
+	if (::fstat(fd, &status) == 0)
+	{
+		refs->_stamp.mtime = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+		refs->_stamp.size = status.st_size;
+		refs->_stamp.inode = status.st_ino;
+	}
+
+	if (status.st_size > 0)
+	{
+		auto mapped = ::mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED)
+		{
+			refs->_data = static_cast<const char*>(mapped);
+			refs->_size = status.st_size;
+		}
+	}
+	::close(fd);
+
+	if (status.st_size > 0 && refs->_data == nullptr)
+		return nullptr;
+#endif
+
+	if (refs->_size == 0)
+		return refs;
+
+	auto headerLength = strlen(Header);
+	if (refs->_size < headerLength || memcmp(refs->_data, Header, headerLength) != 0 || refs->_data[refs->_size - 1] != '\n')
+		return nullptr;
+
+	refs->_begin = headerLength;
+	return refs;
+}
+
+bool PackedRefs::Write(const boost::filesystem::path& path, const std::map<std::string, RawData>& references)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("PackedRefs::Write");
+
+	auto temporaryPath = path.parent_path() / filesystem::unique_path(path.filename().string() + "-%%%%%%%%.tmp");
+	bool written;
+	{
+		filesystem::ofstream ofs(temporaryPath, ios_base::binary);
+		Stats::Add(Stats::OpenCalls);
+		ofs << Header;
+
+		// 'std::map' sorts the names as the binary search compares them
+		string sha1String;
+		for (auto& reference : references)
+		{
+			if (!Utils::Sha1ToString(reference.second, sha1String))
+				continue;
+			ofs << sha1String << ' ' << reference.first << '\n';
+			Stats::Add(Stats::BytesWritten, NameOffset + reference.first.size() + 1);
+		}
+
+		written = static_cast<bool>(ofs);
+	}
+
+	system::error_code ec;
+	if (!written)
+	{
+		filesystem::remove(temporaryPath, ec);
+		return false;
+	}
+
+	filesystem::rename(temporaryPath, path, ec);
+	if (ec)
+		filesystem::remove(temporaryPath, ec);
+	return !ec;
+}
+
+size_t PackedRefs::LineStart(size_t position) const
+{
+	while (position > _begin && _data[position - 1] != '\n')
+		position--;
+	return position;
+}
+
+size_t PackedRefs::LowerBound(const std::string& name) const
+{
+	// Every line before 'low' is below 'name', every line from 'high' is not
+	auto low = _begin;
+	auto high = _size;
+	while (low < high)
+	{
+		auto middle = LineStart(low + (high - low) / 2);
+		auto lineEnd = static_cast<const char*>(memchr(_data + middle, '\n', _size - middle)) - _data;
+		auto nameStart = std::min<size_t>(middle + NameOffset, lineEnd);
+
+		if (name.compare(0, std::string::npos, _data + nameStart, lineEnd - nameStart) > 0)
+			low = lineEnd + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+bool PackedRefs::Find(const std::string& name, RawData& sha1) const
+{
+	auto line = LowerBound(name);
+	if (line + NameOffset + name.size() + 1 > _size || _data[line + NameOffset - 1] != ' '
+		|| name.compare(0, std::string::npos, _data + line + NameOffset, name.size()) != 0
+		|| _data[line + NameOffset + name.size()] != '\n')
+		return false;
+
+	sha1.clear();
+	return Utils::StringToSha1(std::string(_data + line, NameOffset - 1), sha1);
+}
+
+void PackedRefs::List(const std::string& prefix, std::map<std::string, RawData>& references) const
+{
+	RawData sha1;
+	for (auto line = LowerBound(prefix); line < _size;)
+	{
+		auto lineEnd = static_cast<const char*>(memchr(_data + line, '\n', _size - line)) - _data;
+		if (static_cast<size_t>(lineEnd) < line + NameOffset || prefix.compare(0, prefix.size(), _data + line + NameOffset,
+			std::min<size_t>(prefix.size(), lineEnd - line - NameOffset)) != 0)
+			break;
+
+		sha1.clear();
+		if (Utils::StringToSha1(std::string(_data + line, NameOffset - 1), sha1))
+			references[std::string(_data + line + NameOffset, lineEnd - line - NameOffset)] = sha1;
+
+		line = lineEnd + 1;
+	}
+}
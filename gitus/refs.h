@@ -0,0 +1,89 @@
+#ifndef GITUS_REFS_H
+#define GITUS_REFS_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "utils.h"
+
+
+// Identity of a version of a file: rewriting it through a rename changes the inode, even within
+// the resolution of its mtime
+struct FileStamp
+{
+	int64_t mtime = 0;
+	int64_t size = 0;
+	int64_t inode = 0;
+
+	// Zeros for a missing file
+	static FileStamp Of(const boost::filesystem::path& path);
+
+	bool operator==(const FileStamp& other) const
+	{
+		return mtime == other.mtime && size == other.size && inode == other.inode;
+	}
+
+	bool operator!=(const FileStamp& other) const
+	{
+		return !(*this == other);
+	}
+};
+
+// The references moved out of their loose files (see 'GitusService::PackReferences'), in one file
+//
+// 'packed-refs'
+//		"# pack-refs with: sorted\n"
+//		"<hex sha1> <name>\n" for every reference, sorted by name
+// A loose reference file takes precedence over its line. The file is mapped rather than read and
+// a reference is found by a binary search over the lines, whatever the number of references.
+class PackedRefs {
+
+private:
+	const char* _data = nullptr;
+	size_t _size = 0;
+	// Offset of the first reference, past the header
+	size_t _begin = 0;
+	FileStamp _stamp;
+#ifdef _WIN32
+	RawData _buffer;
+#endif
+
+	// Start of the line containing 'position'
+	size_t LineStart(size_t position) const;
+	// Start of the first line whose name is not below 'name', the end of the file when there is none
+	size_t LowerBound(const std::string& name) const;
+
+public:
+	static const char* Header;
+
+	PackedRefs() = default;
+	~PackedRefs();
+
+	PackedRefs(const PackedRefs&) = delete;
+	PackedRefs& operator=(const PackedRefs&) = delete;
+
+	// An empty list when 'path' is missing, nullptr when it is not a valid file
+	static std::shared_ptr<PackedRefs> Open(const boost::filesystem::path& path);
+
+	// Replaces the file at once with 'references', which have a commit each
+	static bool Write(const boost::filesystem::path& path, const std::map<std::string, RawData>& references);
+
+	// Returns false when the file has no line for 'name'
+	bool Find(const std::string& name, RawData& sha1) const;
+
+	// Adds the references whose name starts with 'prefix' to 'references', by name
+	void List(const std::string& prefix, std::map<std::string, RawData>& references) const;
+
+	// The version of the file that was opened
+	const FileStamp& Stamp() const
+	{
+		return _stamp;
+	}
+};
+
+
+#endif
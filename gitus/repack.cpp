@@ -0,0 +1,426 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+
+#include "repack.h"
+#include "delta.h"
+#include "pack.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+
+namespace {
+
+	const size_t Sha1Size = 20;
+
+	struct PackObject
+	{
+		std::string sha1String;
+		GitusService::ObjectHashType type = GitusService::Blob;
+		size_t size = 0;
+		uint32_t nameHash = 0;
+		// Index of the base in the sorted objects, -1 for an object stored whole
+		int64_t base = -1;
+		size_t depth = 0;
+		// Deflated delta entry
+		std::string compressed;
+	};
+
+	// The stored type and size of an object, a chunk list remains a 'Chunks'
+	bool ReadStoredHeader(GitusService& gitus, PackObject& object)
+	{
+		using namespace std;
+
+		ScratchData compressed;
+		if (!gitus.ReadObjectData(object.sha1String, compressed))
+			return false;
+
+		auto prefix = Utils::DecompressPrefix(compressed, 10);
+		for (auto candidate : { GitusService::Blob, GitusService::Commit, GitusService::Tree, GitusService::Chunks })
+		{
+			auto name = GitusService::TypeName(candidate);
+			if (prefix.size() < name.size() + 4 || !equal(name.begin(), name.end(), prefix.begin()))
+				continue;
+
+			Word2 size;
+			copy(prefix.begin() + name.size(), prefix.begin() + name.size() + 4, size.c);
+			object.type = candidate;
+			object.size = size.n;
+			return true;
+		}
+
+		return false;
+	}
+
+	// Hashes the paths of the blobs and trees of the history of the references and of the index,
+	// an object keeps the first path found
+	void CollectNameHashes(GitusService& gitus, std::map<std::string, uint32_t>& nameHashes)
+	{
+		using namespace std;
+		GITUS_TRACE_SCOPE("Repacker::CollectNameHashes");
+
+		map<string, RawData> references;
+		gitus.ListReferences("refs/", references);
+
+		deque<RawData> queue;
+		for (auto& reference : references)
+			queue.push_back(reference.second);
+
+		RawData commit;
+
+		set<RawData> visited;
+		string sha1String;
+		while (!queue.empty())
+		{
+			commit = queue.front();
+			queue.pop_front();
+			if (!visited.insert(commit).second)
+				continue;
+
+			GitusService::ObjectHashType type;
+			RawData object;
+			RawData tree;
+			vector<RawData> parents;
+			if (!Utils::Sha1ToString(commit, sha1String) || !gitus.ReadObject(sha1String, type, object)
+				|| type != GitusService::Commit || !GitusService::ParseCommit(object, tree, parents))
+				continue;
+
+			queue.insert(queue.end(), parents.begin(), parents.end());
+
+			// Trees shared by several commits are only listed once
+			vector<pair<RawData, string>> trees{ { tree, "" } };
+			while (!trees.empty())
+			{
+				auto current = trees.back();
+				trees.pop_back();
+				Utils::Sha1ToString(current.first, sha1String);
+				if (!nameHashes.emplace(sha1String, Repacker::NameHash(current.second)).second)
+					continue;
+
+				vector<TreeEntry> entries;
+				if (!gitus.ReadTree(current.first, current.second.empty() ? "" : current.second + "/", entries))
+					continue;
+
+				for (auto& entry : entries)
+				{
+					// The directories collapsed by a sparse index are trees
+					if (entry.mode.n == IndexEntry::SparseDirectoryMode)
+					{
+						trees.emplace_back(entry.sha1, entry.path);
+						continue;
+					}
+
+					Utils::Sha1ToString(entry.sha1, sha1String);
+					nameHashes.emplace(sha1String, Repacker::NameHash(entry.path));
+				}
+			}
+		}
+
+		map<string, IndexEntry> entries;
+		gitus.ReadIndex(entries);
+		for (auto& entry : entries)
+		{
+			Utils::Sha1ToString(entry.second.sha1, sha1String);
+			nameHashes.emplace(sha1String, Repacker::NameHash(entry.first));
+		}
+	}
+
+	// An object of the window, compared with the objects which follow it
+	struct WindowEntry
+	{
+		size_t index;
+		std::string content;
+		// Built on the first comparison
+		std::unique_ptr<DeltaIndex> deltaIndex;
+	};
+
+	// Searches the bases of the objects from 'begin' to 'end', in order: the window never crosses a partition
+	bool SearchDeltas(GitusService& gitus, const Repacker::Options& options, std::vector<PackObject>& objects, size_t begin, size_t end)
+	{
+		using namespace std;
+		GITUS_TRACE_SCOPE("Repacker::SearchDeltas");
+
+		static const string deltaName = GitusService::TypeName(GitusService::Delta);
+		const size_t entryOverhead = deltaName.size() + 4 + Sha1Size;
+
+		deque<WindowEntry> window;
+		size_t windowMemory = 0;
+		string delta;
+		string best;
+		for (auto i = begin; i < end; i++)
+		{
+			auto& object = objects[i];
+			if (object.size < Repacker::MinDeltaSize)
+				continue;
+
+			window.emplace_back();
+			auto& target = window.back();
+			target.index = i;
+			if (!gitus.ReadObjectContent(object.sha1String, target.content))
+				return false;
+			windowMemory += target.content.size();
+
+			// Newest first, the closest in the sort order are the most similar
+			auto maxSize = target.content.size() / 2 > entryOverhead ? target.content.size() / 2 - entryOverhead : 0;
+			for (auto candidate = window.rbegin() + 1; maxSize != 0 && candidate != window.rend(); candidate++)
+			{
+				auto& base = objects[candidate->index];
+				auto& baseContent = candidate->content;
+				if (base.type != object.type || base.depth >= options.depth
+					|| target.content.size() < baseContent.size() / 32
+					|| (target.content.size() > baseContent.size() && target.content.size() - baseContent.size() > maxSize))
+					continue;
+
+				if (!candidate->deltaIndex)
+				{
+					candidate->deltaIndex.reset(new DeltaIndex(baseContent));
+					windowMemory += candidate->deltaIndex->MemoryUsage();
+				}
+
+				if (!candidate->deltaIndex->Create(target.content, maxSize, delta))
+					continue;
+
+				best.swap(delta);
+				object.base = candidate->index;
+				object.depth = base.depth + 1;
+				maxSize = best.size() - 1;
+			}
+
+			if (object.base >= 0)
+			{
+				// Same header as an object: the type name and the size of what follows
+				RawData header(deltaName.begin(), deltaName.end());
+				Word2 size;
+				size.n = static_cast<unsigned int>(Sha1Size + best.size());
+				header.insert(header.end(), size.c, size.c + 4);
+				RawData baseSha1;
+				Utils::StringToSha1(objects[object.base].sha1String, baseSha1);
+
+				DeflateContext deflate;
+				deflate.Update(header);
+				deflate.Update(baseSha1);
+				deflate.Update(best);
+				object.compressed = deflate.Finish();
+			}
+
+			// The oldest objects leave the window, the newest one stays whatever its size
+			while (window.size() > options.window || (windowMemory > options.windowMemory && window.size() > 1))
+			{
+				windowMemory -= window.front().content.size();
+				if (window.front().deltaIndex)
+					windowMemory -= window.front().deltaIndex->MemoryUsage();
+				window.pop_front();
+			}
+		}
+
+		return true;
+	}
+}
+
+
+//--- Repacker
+
+uint32_t Repacker::NameHash(const std::string& path)
+{
+	// Every character shifts the previous ones out by 2 bits, the last 16 characters count most
+	uint32_t hash = 0;
+	for (auto c : path)
+	{
+		if (isspace(static_cast<unsigned char>(c)))
+			continue;
+		hash = (hash >> 2) + (static_cast<uint32_t>(static_cast<unsigned char>(c)) << 24);
+	}
+	return hash;
+}
+
+bool Repacker::Repack(GitusService& gitus, const Options& options, size_t& objectCount, size_t& deltaCount,
+	boost::filesystem::path& packPath)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("Repacker::Repack");
+
+	objectCount = 0;
+	deltaCount = 0;
+	packPath.clear();
+
+	// Loose objects, then those of the packs
+	vector<PackObject> objects;
+	vector<filesystem::path> looseFiles;
+	set<string> listed;
+	system::error_code ec;
+	Stats::Add(Stats::ReaddirCalls);
+	for (filesystem::directory_iterator it(gitus.ObjectsDirectory(), ec), end; !ec && it != end; it.increment(ec))
+	{
+		auto prefix = it->path().filename().string();
+		if (prefix.size() != 2 || prefix.find_first_not_of("0123456789abcdef") != string::npos)
+			continue;
+
+		Stats::Add(Stats::ReaddirCalls);
+		system::error_code fileEc;
+		for (filesystem::directory_iterator file(it->path(), fileEc); !fileEc && file != end; file.increment(fileEc))
+		{
+			auto sha1String = prefix + file->path().filename().string();
+			if (sha1String.size() != 40 || sha1String.find_first_not_of("0123456789abcdef") != string::npos)
+				continue;
+
+			looseFiles.push_back(file->path());
+			if (listed.insert(sha1String).second)
+			{
+				objects.emplace_back();
+				objects.back().sha1String = sha1String;
+			}
+		}
+	}
+
+	auto packs = gitus.Packs();
+	string sha1String;
+	for (auto& pack : packs)
+	{
+		for (size_t i = 0; i < pack->Count(); i++)
+		{
+			Utils::Sha1ToString(pack->Sha1(i), sha1String);
+			if (listed.insert(sha1String).second)
+			{
+				objects.emplace_back();
+				objects.back().sha1String = sha1String;
+			}
+		}
+	}
+
+	if (objects.empty())
+		return true;
+
+	map<string, uint32_t> nameHashes;
+	CollectNameHashes(gitus, nameHashes);
+
+	ThreadPool pool(options.threads);
+	atomic<bool> failed(false);
+	{
+		GITUS_TRACE_SCOPE("Repacker::ReadHeaders");
+		const size_t batchSize = 256;
+		for (size_t begin = 0; begin < objects.size(); begin += batchSize)
+		{
+			pool.Enqueue([&, begin]() {
+				try
+				{
+					for (auto i = begin; i < objects.size() && i < begin + batchSize; i++)
+					{
+						if (!ReadStoredHeader(gitus, objects[i]))
+							failed = true;
+					}
+				}
+				catch (const std::exception&)
+				{
+					failed = true;
+				}
+			});
+		}
+		pool.Wait();
+	}
+
+	if (failed)
+		return false;
+
+	for (auto& object : objects)
+	{
+		auto nameHash = nameHashes.find(object.sha1String);
+		if (nameHash != nameHashes.end())
+			object.nameHash = nameHash->second;
+	}
+
+	sort(objects.begin(), objects.end(), [](const PackObject& a, const PackObject& b) {
+		if (a.type != b.type)
+			return a.type < b.type;
+		if (a.nameHash != b.nameHash)
+			return a.nameHash < b.nameHash;
+		if (a.size != b.size)
+			return a.size > b.size;
+		return a.sha1String < b.sha1String;
+	});
+
+	// The boundaries only depend on the objects, not on the number of threads
+	{
+		GITUS_TRACE_SCOPE("Repacker::Partitions");
+		for (size_t begin = 0, end; begin < objects.size(); begin = end)
+		{
+			end = min(objects.size(), begin + PartitionObjects);
+			while (end < objects.size() && end < begin + 2 * PartitionObjects
+				&& objects[end].type == objects[end - 1].type && objects[end].nameHash == objects[end - 1].nameHash)
+				end++;
+
+			pool.Enqueue([&, begin, end]() {
+				try
+				{
+					if (!failed && !SearchDeltas(gitus, options, objects, begin, end))
+						failed = true;
+				}
+				catch (const std::exception&)
+				{
+					failed = true;
+				}
+			});
+		}
+		pool.Wait();
+	}
+
+	if (failed)
+		return false;
+
+	// Objects stored whole keep their deflated bytes
+	PackWriter writer(gitus.PacksDirectory());
+	RawData sha1;
+	for (auto& object : objects)
+	{
+		Utils::StringToSha1(object.sha1String, sha1);
+		if (object.base >= 0)
+		{
+			if (!writer.Add(sha1, object.compressed))
+				return false;
+			deltaCount++;
+			continue;
+		}
+
+		ScratchData compressed;
+		if (!gitus.ReadObjectData(object.sha1String, compressed) || !writer.Add(sha1, compressed))
+			return false;
+	}
+
+	objectCount = writer.Count();
+	if (!writer.Finish(packPath))
+		return false;
+
+	// Everything is in the new pack, the multi-pack index of the old ones is stale
+	auto hadMultiPackIndex = filesystem::exists(gitus.MultiPackIndexFile());
+	filesystem::remove(gitus.MultiPackIndexFile(), ec);
+
+	// The index first, a reader never finds an index without its pack
+	for (auto& pack : packs)
+	{
+		if (pack->PackPath().filename() == packPath.filename())
+			continue;
+
+		filesystem::remove(filesystem::path(pack->PackPath()).replace_extension(".idx"), ec);
+		filesystem::remove(pack->PackPath(), ec);
+	}
+
+	set<filesystem::path> fanoutDirectories;
+	for (auto& looseFile : looseFiles)
+	{
+		filesystem::remove(looseFile, ec);
+		fanoutDirectories.insert(looseFile.parent_path());
+	}
+
+	// Only removed once empty, an object may have been written meanwhile
+	for (auto& directory : fanoutDirectories)
+		filesystem::remove(directory, ec);
+
+	gitus.InvalidatePacks();
+
+	size_t indexedPacks, indexedObjects;
+	return !hadMultiPackIndex || gitus.WriteMultiPackIndex(indexedPacks, indexedObjects);
+}
@@ -0,0 +1,49 @@
+#ifndef GITUS_REPACK_H
+#define GITUS_REPACK_H
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "gitus_service.h"
+
+
+// Rewrites all the objects of a repository, loose and packed, into a single pack where similar
+// objects are stored as deltas of one another (see 'DeltaIndex')
+//
+// The objects are sorted by type, hash of their path, then size, largest first: the versions of a
+// file end up next to each other. Each object is compared with the previous ones within a window,
+// the smallest delta is kept when it saves at least half of the object. The sorted list is split in
+// partitions of fixed size whose boundaries fall between two paths, and idle workers take the next
+// partition, so the pack is the same whatever the number of threads.
+class Repacker {
+
+public:
+	struct Options
+	{
+		// Number of previous objects an object is compared with
+		size_t window = 10;
+		// Longest chain of deltas, 'GitusService::MaxDeltaDepth' at most
+		size_t depth = 16;
+		// Memory of the objects and indexes of one window, its oldest objects are dropped beyond it
+		size_t windowMemory = 256 * 1024 * 1024;
+		// Uses every core when 0
+		size_t threads = 0;
+	};
+
+	// Objects of a partition, more when the path at the boundary continues
+	static const size_t PartitionObjects = 1024;
+	// Smaller objects are stored whole, a delta would hardly save anything
+	static const size_t MinDeltaSize = 64;
+
+	// 'objects' counts the objects of the new pack, 'deltas' those stored as a delta, 'packPath' is
+	// empty when the repository has no object. The old packs and the loose objects are deleted.
+	static bool Repack(GitusService& gitus, const Options& options, size_t& objects, size_t& deltas,
+		boost::filesystem::path& packPath);
+
+	// Hash of a path, ordered by its last characters so that files of the same name are close
+	static uint32_t NameHash(const std::string& path);
+};
+
+
+#endif
@@ -0,0 +1,221 @@
+#include <memory>
+#include <iostream>
+#include <exception>
+
+#include <boost/filesystem.hpp>
+
+#include "repository.h"
+#include "utils.h"
+
+
+// Every entry point goes through this, exceptions must not cross the library boundary
+template <typename F>
+static GitusStatus Guarded(F function)
+{
+	try
+	{
+		return function();
+	}
+	catch (const boost::filesystem::filesystem_error&)
+	{
+		return GitusStatus::IoError;
+	}
+	catch (const std::ios_base::failure&)
+	{
+		return GitusStatus::IoError;
+	}
+	catch (const std::exception&)
+	{
+		// e.g a truncated object failing to inflate
+		return GitusStatus::Corrupted;
+	}
+	catch (...)
+	{
+		return GitusStatus::Corrupted;
+	}
+}
+
+const char* Repository::StatusMessage(GitusStatus status)
+{
+	switch (status)
+	{
+	case GitusStatus::Ok: return "ok";
+	case GitusStatus::NotARepository: return "not a git repository (or any of the parent directories): .git";
+	case GitusStatus::NotFound: return "not found";
+	case GitusStatus::InvalidArgument: return "invalid argument";
+	case GitusStatus::NothingToCommit: return "nothing to commit, working tree clean";
+	case GitusStatus::Unchanged: return "already inside the index";
+	case GitusStatus::Corrupted: return "corrupted repository";
+	case GitusStatus::IoError: return "input/output error";
+	}
+
+	return "unknown error";
+}
+
+GitusStatus Repository::Open(const boost::filesystem::path& directory, std::shared_ptr<Repository>& repository)
+{
+	using namespace boost;
+
+	return Guarded([&]() {
+		auto gitus = std::make_shared<GitusService>();
+		if (!gitus->DiscoverGitusDirectory(filesystem::absolute(directory).lexically_normal()))
+			return GitusStatus::NotARepository;
+
+		repository = std::shared_ptr<Repository>(new Repository(gitus));
+		return GitusStatus::Ok;
+	});
+}
+
+GitusStatus Repository::Init(const boost::filesystem::path& directory, std::shared_ptr<Repository>& repository)
+{
+	using namespace boost;
+
+	return Guarded([&]() {
+		auto gitusDirectory = filesystem::absolute(directory).lexically_normal() / ".git";
+		auto gitus = std::make_shared<GitusService>();
+		if (!filesystem::exists(gitusDirectory))
+		{
+			filesystem::create_directories(gitusDirectory);
+			gitus->SetGitusDirectory(gitusDirectory);
+			gitus->CreateLayout();
+		}
+		else
+		{
+			gitus->SetGitusDirectory(gitusDirectory);
+		}
+
+		repository = std::shared_ptr<Repository>(new Repository(gitus));
+		return GitusStatus::Ok;
+	});
+}
+
+GitusStatus Repository::WriteObject(GitusService::ObjectHashType type, const RawData& object, RawData& id)
+{
+	return Guarded([&]() {
+		id.clear();
+		_gitus->HashObject(object, type, true, id);
+		return GitusStatus::Ok;
+	});
+}
+
+GitusStatus Repository::ReadObject(const RawData& id, GitusService::ObjectHashType& type, RawData& object)
+{
+	return Guarded([&]() {
+		std::string sha1String;
+		if (!Utils::Sha1ToString(id, sha1String))
+			return GitusStatus::InvalidArgument;
+
+		if (!_gitus->ObjectExists(sha1String))
+			return GitusStatus::NotFound;
+
+		return _gitus->ReadObject(sha1String, type, object) ? GitusStatus::Ok : GitusStatus::Corrupted;
+	});
+}
+
+GitusStatus Repository::HasObject(const RawData& id, bool& exists)
+{
+	return Guarded([&]() {
+		std::string sha1String;
+		if (!Utils::Sha1ToString(id, sha1String))
+			return GitusStatus::InvalidArgument;
+
+		exists = _gitus->ObjectExists(sha1String);
+		return GitusStatus::Ok;
+	});
+}
+
+GitusStatus Repository::ReadIndex(std::map<std::string, IndexEntry>& entries)
+{
+	return Guarded([&]() {
+		entries.clear();
+		if (!boost::filesystem::exists(_gitus->IndexFile()))
+			return GitusStatus::Ok;
+
+		return _gitus->ReadIndex(entries) ? GitusStatus::Ok : GitusStatus::Corrupted;
+	});
+}
+
+GitusStatus Repository::UpdateIndex(const std::function<bool(std::map<std::string, IndexEntry>&)>& update)
+{
+	std::lock_guard<std::mutex> lock(_indexMutex);
+
+	std::map<std::string, IndexEntry> entries;
+	auto status = ReadIndex(entries);
+	if (status != GitusStatus::Ok)
+		return status;
+
+	return Guarded([&]() {
+		if (!update(entries))
+			return GitusStatus::Unchanged;
+
+		return _gitus->WriteIndex(entries) ? GitusStatus::Ok : GitusStatus::IoError;
+	});
+}
+
+GitusStatus Repository::Add(const std::string& path)
+{
+	using namespace boost;
+
+	IndexEntry entry;
+	auto status = Guarded([&]() {
+		auto relativePath = filesystem::path(path).lexically_normal();
+		if (relativePath.empty() || relativePath.is_absolute() || *relativePath.begin() == "..")
+			return GitusStatus::InvalidArgument;
+
+		auto fullPath = _gitus->RepoDirectory() / relativePath;
+		if (!filesystem::is_regular_file(fullPath))
+			return GitusStatus::NotFound;
+
+		entry.path = relativePath.generic_string();
+		if (!_gitus->HashBlobFile(fullPath, true, entry.sha1))
+			return GitusStatus::IoError;
+		return GitusStatus::Ok;
+	});
+
+	if (status != GitusStatus::Ok)
+		return status;
+
+	return UpdateIndex([&](std::map<std::string, IndexEntry>& entries) {
+		// Below a directory collapsed by sparse checkout
+		size_t expanded = 0;
+		_gitus->ExpandIndex(entries, entry.path, expanded);
+
+		auto indexed = entries.find(entry.path);
+		if (indexed != entries.end() && indexed->second.sha1 == entry.sha1)
+			return expanded != 0;
+
+		entries[entry.path] = entry;
+		return true;
+	});
+}
+
+GitusStatus Repository::Commit(const std::string& msg, const std::string& author, const std::string& email, std::time_t time, RawData& id)
+{
+	std::lock_guard<std::mutex> lock(_indexMutex);
+
+	return Guarded([&]() {
+		auto tree = _gitus->HashCommitTree();
+		if (tree.empty())
+			return GitusStatus::NothingToCommit;
+
+		// Same check as the commit command: the tree of the index is already stored
+		RawData treeId;
+		bool treeExisted = false;
+		_gitus->HashObject(tree, GitusService::Tree, true, treeId, treeExisted);
+		if (treeExisted)
+			return GitusStatus::NothingToCommit;
+
+		id.clear();
+		return _gitus->WriteCommit(treeId, msg, author, email, time, id) ? GitusStatus::Ok : GitusStatus::IoError;
+	});
+}
+
+GitusStatus Repository::Head(RawData& id)
+{
+	std::lock_guard<std::mutex> lock(_indexMutex);
+
+	return Guarded([&]() {
+		id.clear();
+		return _gitus->LocalMasterHash(id) ? GitusStatus::Ok : GitusStatus::Corrupted;
+	});
+}
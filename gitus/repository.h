@@ -0,0 +1,91 @@
+#ifndef GITUS_REPOSITORY_H
+#define GITUS_REPOSITORY_H
+
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <map>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "gitus_service.h"
+
+
+enum class GitusStatus
+{
+	Ok,
+	NotARepository,
+	NotFound,
+	InvalidArgument,
+	NothingToCommit,
+	Unchanged,
+	Corrupted,
+	IoError
+};
+
+// Embedding API of libgitus, for services which would otherwise run one gitus process per operation
+//
+// A 'Repository' is bound to its '.git' directory when opened and never depends on the current
+// directory, so several repositories can be used from the same process.
+// Every method is thread-safe and reports failures as a status instead of throwing.
+// Index transactions and commits are serialized within the process only, another process
+// writing the same repository at the same time is not detected.
+class Repository {
+
+private:
+	std::shared_ptr<GitusService> _gitus;
+
+	// Serializes the read-modify-write of the index and of the master reference
+	std::mutex _indexMutex;
+
+	Repository(const std::shared_ptr<GitusService>& gitus)
+	{
+		_gitus = gitus;
+	}
+
+public:
+
+	static const char* StatusMessage(GitusStatus status);
+
+	// Opens the repository containing 'directory', searching upward for the '.git' directory
+	static GitusStatus Open(const boost::filesystem::path& directory, std::shared_ptr<Repository>& repository);
+
+	// Creates an empty repository in 'directory', or opens it when it already exists
+	static GitusStatus Init(const boost::filesystem::path& directory, std::shared_ptr<Repository>& repository);
+
+	boost::filesystem::path WorkTree() const
+	{
+		return _gitus->RepoDirectory();
+	}
+
+	// The service is shared with the repository, e.g to run commands
+	std::shared_ptr<GitusService> Service() const
+	{
+		return _gitus;
+	}
+
+	// 'id' is the binary SHA1 of the object
+	GitusStatus WriteObject(GitusService::ObjectHashType type, const RawData& object, RawData& id);
+	GitusStatus ReadObject(const RawData& id, GitusService::ObjectHashType& type, RawData& object);
+	GitusStatus HasObject(const RawData& id, bool& exists);
+
+	GitusStatus ReadIndex(std::map<std::string, IndexEntry>& entries);
+
+	// Reads the index, applies 'update' and writes the index back when 'update' returns true,
+	// without other transactions of the process interleaving
+	GitusStatus UpdateIndex(const std::function<bool(std::map<std::string, IndexEntry>&)>& update);
+
+	// Stores the content of a file of the working tree and adds it to the index
+	// 'path' is relative to the working tree
+	GitusStatus Add(const std::string& path);
+
+	// Commits the index on top of master, 'time' is in seconds since the epoch (UTC)
+	GitusStatus Commit(const std::string& msg, const std::string& author, const std::string& email, std::time_t time, RawData& id);
+
+	// 'id' is empty before the first commit
+	GitusStatus Head(RawData& id);
+};
+
+
+#endif
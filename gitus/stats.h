@@ -0,0 +1,203 @@
+#ifndef GITUS_STATS_H
+#define GITUS_STATS_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+
+// Process wide counters of the work done on the hot paths
+//
+// Always on: every thread increments its own block of relaxed atomics, so counting
+// never contends between threads, and blocks are only summed when the counters are read.
+// Printed as JSON by 'gitus stats', at exit with '--stats' or the GITUS_STATS environment
+// variable (a file name, or '1' for the standard error).
+class Stats {
+
+public:
+	enum Counter
+	{
+		BytesRead,
+		BytesWritten,
+		BytesHashed,
+		BytesDeflated,
+		BytesInflated,
+		ObjectsWritten,
+		ObjectsSkipped,
+		StatCalls,
+		OpenCalls,
+		ReaddirCalls,
+		IndexEntriesParsed,
+		HashCacheHits,
+		HashCacheMisses,
+		CounterCount
+	};
+
+private:
+	struct Block
+	{
+		std::atomic<uint64_t> values[CounterCount];
+
+		Block()
+		{
+			for (auto& value : values)
+				value.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	// Registers the block of the thread and folds it into the totals when the thread exits
+	class ThreadBlock {
+
+	public:
+		Block block;
+
+		ThreadBlock()
+		{
+			auto& stats = Instance();
+			std::lock_guard<std::mutex> lock(stats._mutex);
+			stats._blocks.push_back(&block);
+		}
+
+		~ThreadBlock()
+		{
+			auto& stats = Instance();
+			std::lock_guard<std::mutex> lock(stats._mutex);
+			for (int i = 0; i < CounterCount; i++)
+				stats._retired.values[i].fetch_add(block.values[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+			stats._blocks.erase(std::find(stats._blocks.begin(), stats._blocks.end(), &block));
+		}
+	};
+
+	std::mutex _mutex;
+	std::vector<Block*> _blocks;
+	Block _retired;
+	std::string _output;
+
+	static Stats& Instance()
+	{
+		static Stats stats;
+		return stats;
+	}
+
+	static Block& Local()
+	{
+		thread_local ThreadBlock local;
+		return local.block;
+	}
+
+public:
+
+	static const char* Name(Counter counter)
+	{
+		static const char* names[] = {
+			"bytes_read", "bytes_written", "bytes_hashed", "bytes_deflated", "bytes_inflated",
+			"objects_written", "objects_skipped", "stat_calls", "open_calls", "readdir_calls",
+			"index_entries_parsed", "hash_cache_hits", "hash_cache_misses"
+		};
+		return names[counter];
+	}
+
+	static void Add(Counter counter, uint64_t value = 1)
+	{
+		Local().values[counter].fetch_add(value, std::memory_order_relaxed);
+	}
+
+	static uint64_t Get(Counter counter)
+	{
+		auto& stats = Instance();
+		std::lock_guard<std::mutex> lock(stats._mutex);
+		auto total = stats._retired.values[counter].load(std::memory_order_relaxed);
+		for (auto block : stats._blocks)
+			total += block->values[counter].load(std::memory_order_relaxed);
+		return total;
+	}
+
+	static void Reset()
+	{
+		auto& stats = Instance();
+		std::lock_guard<std::mutex> lock(stats._mutex);
+		for (int i = 0; i < CounterCount; i++)
+		{
+			stats._retired.values[i].store(0, std::memory_order_relaxed);
+			for (auto block : stats._blocks)
+				block->values[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// In bytes, 0 when the platform does not report it
+	static uint64_t PeakResidentSize()
+	{
+#ifndef _WIN32
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+#ifdef __APPLE__
+		return usage.ru_maxrss;
+#else
+		return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+		return 0;
+#endif
+	}
+
+	static void WriteJson(std::ostream& out)
+	{
+		out << "{";
+		for (int i = 0; i < CounterCount; i++)
+			out << "\n\t\"" << Name(static_cast<Counter>(i)) << "\": " << Get(static_cast<Counter>(i)) << ",";
+		out << "\n\t\"peak_rss\": " << PeakResidentSize() << "\n}" << std::endl;
+	}
+
+	// An empty output or "1" prints the counters on the standard error
+	static void Enable(const std::string& output)
+	{
+		auto& stats = Instance();
+		std::lock_guard<std::mutex> lock(stats._mutex);
+		stats._output = output.empty() ? "1" : output;
+	}
+
+	static void EnableFromEnvironment()
+	{
+		auto output = std::getenv("GITUS_STATS");
+		if (output != nullptr && *output != 0 && std::string(output) != "0")
+			Enable(output);
+	}
+
+	// Writes the counters to the configured output, if any
+	static void Flush()
+	{
+		std::string output;
+		{
+			auto& stats = Instance();
+			std::lock_guard<std::mutex> lock(stats._mutex);
+			output = stats._output;
+		}
+
+		if (output.empty())
+			return;
+
+		if (output == "1")
+		{
+			WriteJson(std::cerr);
+		}
+		else
+		{
+			std::ofstream ofs(output);
+			WriteJson(ofs);
+		}
+	}
+};
+
+
+#endif
@@ -3,10 +3,18 @@
 
 #include <boost/test/unit_test.hpp>
 #include <boost/filesystem.hpp>
+#include <thread>
+#include <atomic>
 
 #include "../gitus_service.h"
 #include "../commands.h"
+#include "../repository.h"
 #include "../utils.h"
+#include "../arena.h"
+#include "../pack.h"
+#include "../repack.h"
+#include "../ignore.h"
+#include "../hash_cache.h"
 
 void CleanUp();
 void DeleteFile(std::string fileName);
@@ -48,7 +56,7 @@ BOOST_AUTO_TEST_CASE(InitNormal)
 	BOOST_CHECK(headDirExist);
 	BOOST_CHECK(headFileExist);
 	BOOST_CHECK(masterFileExist);
-	BOOST_CHECK_EQUAL(headFileSize, 26);
+	BOOST_CHECK_EQUAL(headFileSize, 23);
 	BOOST_CHECK_EQUAL(masterFileSize, 0);
 
 	CleanUp();
@@ -291,6 +299,1417 @@ BOOST_AUTO_TEST_CASE(CommitSameIndexAfterCommit)
 	DeleteFile(fileName);
 }
 
+BOOST_AUTO_TEST_CASE(FsckAfterCommit)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+
+	auto fileName = "testFile1.txt";
+	CreateFile(fileName, "random text");
+
+	AddCommand* add = new AddCommand(gitus, fileName);
+	InitCommand* init = new InitCommand(gitus);
+	CommitCommand* commit = new CommitCommand(gitus, "First Commit", "Me", "Me@yahoo.ca");
+	FsckCommand* fsck = new FsckCommand(gitus);
+
+	init->Execute();
+	add->Execute();
+	commit->Execute();
+	//Act
+	auto res = fsck->Execute();
+
+	//Assert
+	BOOST_CHECK(res);
+
+	CleanUp();
+	DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(FsckCorruptedObject)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+
+	auto fileName = "testFile1.txt";
+	CreateFile(fileName, "random text");
+	auto filePath1 = GetFileObjPath(fileName);
+
+	AddCommand* add = new AddCommand(gitus, fileName);
+	InitCommand* init = new InitCommand(gitus);
+	FsckCommand* fsck = new FsckCommand(gitus);
+
+	init->Execute();
+	add->Execute();
+	boost::filesystem::ofstream{ filePath1 } << "corrupted";
+	//Act
+	auto res = fsck->Execute();
+
+	//Assert
+	BOOST_CHECK(!res);
+
+	CleanUp();
+	DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(FsckCorruptedPackEntryOfLooseObject)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+
+	auto fileName = "testFile1.txt";
+	CreateFile(fileName, "random text");
+
+	InitCommand* init = new InitCommand(gitus);
+	AddCommand* add = new AddCommand(gitus, fileName);
+	init->Execute();
+	add->Execute();
+
+	auto entries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(entries);
+
+	// The loose copy is intact, the packed copy of the same object is not
+	DeflateContext deflate;
+	deflate.Update(GitusService::CreateContentData(RawData{ 'b', 'a', 'd' }, GitusService::Blob));
+	auto compressed = deflate.Finish();
+	boost::filesystem::path packPath;
+	{
+		PackWriter writer(gitus->PacksDirectory());
+		writer.Add(entries[fileName].sha1, compressed);
+		writer.Finish(packPath);
+	}
+	gitus->InvalidatePacks();
+
+	//Act
+	auto res = FsckCommand(gitus).Execute();
+
+	//Assert
+	BOOST_CHECK(!packPath.empty());
+	BOOST_CHECK(!res);
+
+	CleanUp();
+	DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(CatFileBatch)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+
+	auto fileName = "testFile1.txt";
+	CreateFile(fileName, "random text");
+	auto filePath1 = GetFileObjPath(fileName);
+	auto sha1String = filePath1.parent_path().filename().string() + filePath1.filename().string();
+
+	AddCommand* add = new AddCommand(gitus, fileName);
+	InitCommand* init = new InitCommand(gitus);
+
+	std::stringstream in(sha1String + "\n" + std::string(40, '0') + "\n");
+	std::stringstream out;
+	CatFileCommand* catFile = new CatFileCommand(gitus, false, true, in, out);
+
+	init->Execute();
+	add->Execute();
+	//Act
+	auto res = catFile->Execute();
+
+	//Assert
+	BOOST_CHECK(res);
+	BOOST_CHECK_EQUAL(out.str(), sha1String + " blob 11\nrandom text\n" + std::string(40, '0') + " missing\n");
+
+	CleanUp();
+	DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(AddFromSubdirectory)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	auto root = boost::filesystem::current_path();
+	boost::filesystem::create_directory("testDir");
+	CreateFile("testDir/testFile1.txt", "random text");
+
+	//Act
+	boost::filesystem::current_path(root / "testDir");
+	auto subGitus = std::shared_ptr<GitusService>(new GitusService);
+	AddCommand* add = new AddCommand(subGitus, "testFile1.txt");
+	auto res = add->Execute();
+	boost::filesystem::current_path(root);
+
+	//Assert
+	auto entries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(entries);
+
+	BOOST_CHECK(res);
+	BOOST_CHECK_EQUAL(subGitus->RepoDirectory(), gitus->RepoDirectory());
+	BOOST_CHECK_EQUAL(entries.count("testDir/testFile1.txt"), 1);
+
+	CleanUp();
+	boost::filesystem::remove_all("testDir");
+}
+
+BOOST_AUTO_TEST_CASE(IndexCacheRevalidated)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	auto otherGitus = std::shared_ptr<GitusService>(new GitusService);
+
+	auto fileName = "testFile1.txt";
+	auto fileName2 = "testFile21.txt";
+	CreateFile(fileName, "random text");
+	CreateFile(fileName2, "randodasddsadasdsdsam text");
+
+	InitCommand* init = new InitCommand(gitus);
+	AddCommand* add = new AddCommand(gitus, fileName);
+	AddCommand* add2 = new AddCommand(otherGitus, fileName2);
+
+	init->Execute();
+	add->Execute();
+	auto cachedEntries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(cachedEntries);
+
+	//Act
+	add2->Execute();
+	auto entries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(entries);
+
+	//Assert
+	BOOST_CHECK_EQUAL(cachedEntries.size(), 1);
+	BOOST_CHECK_EQUAL(entries.size(), 2);
+
+	CleanUp();
+	DeleteFile(fileName);
+	DeleteFile(fileName2);
+}
+
+BOOST_AUTO_TEST_CASE(BatchAddCommit)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	auto gitusDir = GitusService::NewGitusDirectory();
+	auto masterFile = gitusDir / "refs/heads/master";
+
+	auto fileName = "testFile1.txt";
+	auto fileName2 = "testFile21.txt";
+	CreateFile(fileName, "random text");
+	CreateFile(fileName2, "randodasddsadasdsdsam text");
+
+	CommandFactory createCommand = [gitus](const std::vector<std::string>& args) -> std::shared_ptr<BaseCommand> {
+		if (args[0] == "add")
+			return std::make_shared<AddCommand>(gitus, args[1]);
+		return std::make_shared<CommitCommand>(gitus, args[1], args[2], args[3]);
+	};
+
+	std::stringstream in("add testFile1.txt\n\n# comment\nadd testFile21.txt\ncommit \"First Commit\" Me Me@yahoo.ca\n");
+	InitCommand* init = new InitCommand(gitus);
+	BatchCommand* batch = new BatchCommand(gitus, createCommand, in);
+
+	init->Execute();
+	//Act
+	auto res = batch->Execute();
+
+	//Assert
+	auto entries = std::map<std::string, IndexEntry>();
+	GitusService otherGitus;
+	otherGitus.CacheCurrentGitusDirectory();
+	otherGitus.ReadIndex(entries);
+
+	BOOST_CHECK(res);
+	BOOST_CHECK_EQUAL(entries.size(), 2);
+	BOOST_CHECK(boost::filesystem::file_size(masterFile) > 0);
+	BOOST_CHECK_EQUAL(BatchCommand::SplitCommandLine("commit 'a b' c\\ d").size(), 3);
+
+	CleanUp();
+	DeleteFile(fileName);
+	DeleteFile(fileName2);
+}
+
+BOOST_AUTO_TEST_CASE(StatsCountObjects)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+
+	auto fileName = "testFile1.txt";
+	CreateFile(fileName, "random text");
+
+	InitCommand* init = new InitCommand(gitus);
+	AddCommand* add = new AddCommand(gitus, fileName);
+
+	init->Execute();
+	Stats::Reset();
+
+	//Act
+	add->Execute();
+	add->Execute();
+	std::stringstream out;
+	StatsCommand(gitus, false, out).Execute();
+
+	//Assert
+	BOOST_CHECK_EQUAL(Stats::Get(Stats::ObjectsWritten), 1);
+	BOOST_CHECK_EQUAL(Stats::Get(Stats::ObjectsSkipped), 1);
+	BOOST_CHECK(Stats::Get(Stats::BytesHashed) > 0);
+	BOOST_CHECK(out.str().find("\"objects_written\": 1,") != std::string::npos);
+
+	CleanUp();
+	DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(RepositoryEmbedded)
+{
+	//Arrange
+	auto directory = boost::filesystem::current_path() / "embedded";
+	boost::filesystem::create_directories(directory);
+	CreateFile((directory / "testFile1.txt").string(), "random text");
+
+	std::shared_ptr<Repository> repository;
+	auto initStatus = Repository::Init(directory, repository);
+
+	//Act
+	std::vector<std::thread> writers;
+	std::atomic<int> written(0);
+	for (int i = 0; i < 4; i++)
+	{
+		writers.emplace_back([&]() {
+			RawData id;
+			if (repository->WriteObject(GitusService::Blob, RawData{ 'a', 'b' }, id) == GitusStatus::Ok)
+				written++;
+		});
+	}
+	for (auto& writer : writers)
+		writer.join();
+
+	auto addStatus = repository->Add("testFile1.txt");
+	auto addAgainStatus = repository->Add("testFile1.txt");
+	RawData commitId;
+	auto commitStatus = repository->Commit("First Commit", "Me", "Me@yahoo.ca", 1500000000, commitId);
+	auto commitAgainStatus = repository->Commit("Second Commit", "Me", "Me@yahoo.ca", 1500000000, commitId);
+
+	std::shared_ptr<Repository> reopened;
+	auto openStatus = Repository::Open(directory / "subdirectory", reopened);
+	RawData head;
+	reopened->Head(head);
+	GitusService::ObjectHashType type;
+	RawData object;
+	auto readStatus = reopened->ReadObject(head, type, object);
+
+	//Assert
+	BOOST_CHECK(initStatus == GitusStatus::Ok);
+	BOOST_CHECK_EQUAL(written.load(), 4);
+	BOOST_CHECK(addStatus == GitusStatus::Ok);
+	BOOST_CHECK(addAgainStatus == GitusStatus::Unchanged);
+	BOOST_CHECK(commitStatus == GitusStatus::Ok);
+	BOOST_CHECK(commitAgainStatus == GitusStatus::NothingToCommit);
+	BOOST_CHECK(openStatus == GitusStatus::Ok);
+	BOOST_CHECK(head == commitId);
+	BOOST_CHECK(readStatus == GitusStatus::Ok);
+	BOOST_CHECK(type == GitusService::Commit);
+	BOOST_CHECK(reopened->Add("../outside.txt") == GitusStatus::InvalidArgument);
+
+	boost::filesystem::remove_all(directory);
+}
+
+BOOST_AUTO_TEST_CASE(AddManyFilesBatched)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+
+	std::vector<std::string> fileNames;
+	for (int i = 0; i < 8; i++)
+	{
+		fileNames.push_back("batchFile" + std::to_string(i) + ".txt");
+		// Two files share their content
+		CreateFile(fileNames.back(), "batched text " + std::to_string(i % 7));
+	}
+
+	InitCommand* init = new InitCommand(gitus);
+	AddCommand* add = new AddCommand(gitus, fileNames);
+
+	init->Execute();
+
+	//Act
+	auto res = add->Execute();
+
+	//Assert
+	auto entries = std::map<std::string, IndexEntry>();
+	GitusService otherGitus;
+	otherGitus.CacheCurrentGitusDirectory();
+	otherGitus.ReadIndex(entries);
+
+	std::string sha1String;
+	Utils::Sha1ToString(entries["batchFile3.txt"].sha1, sha1String);
+	GitusService::ObjectHashType type;
+	RawData object;
+	otherGitus.ReadObject(sha1String, type, object);
+
+	BOOST_CHECK(res);
+	BOOST_CHECK_EQUAL(entries.size(), 8);
+	BOOST_CHECK(entries["batchFile0.txt"].sha1 == entries["batchFile7.txt"].sha1);
+	BOOST_CHECK_EQUAL(std::string(object.begin(), object.end()), "batched text 3");
+
+	CleanUp();
+	for (auto& fileName : fileNames)
+		DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(ArenaScopeIndexRoundTrip)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	std::map<std::string, IndexEntry> entries;
+	for (int i = 0; i < 50; i++)
+	{
+		IndexEntry entry;
+		entry.path = "dir/arenaFile" + std::to_string(i) + ".txt";
+		gitus->HashObject(RawData(entry.path.begin(), entry.path.end()), GitusService::Blob, false, entry.sha1);
+		entries[entry.path] = entry;
+	}
+
+	//Act
+	std::map<std::string, IndexEntry> readEntries;
+	const void* first = nullptr;
+	const void* second = nullptr;
+	{
+		ArenaScope scope;
+		gitus->WriteIndex(entries);
+		gitus->ReadIndex(readEntries);
+	}
+	{
+		ArenaScope scope;
+		first = ScratchData(16).data();
+	}
+	{
+		ArenaScope scope;
+		second = ScratchData(16).data();
+	}
+
+	//Assert
+	BOOST_CHECK_EQUAL(readEntries.size(), entries.size());
+	BOOST_CHECK(readEntries["dir/arenaFile7.txt"].sha1 == entries["dir/arenaFile7.txt"].sha1);
+	BOOST_CHECK(Arena::Current() == nullptr);
+	// The memory of a closed scope is reused by the next one
+	BOOST_CHECK(first == second);
+
+	CleanUp();
+}
+
+BOOST_AUTO_TEST_CASE(IncrementalHashAndDeflate)
+{
+	//Arrange
+	RawData object;
+	for (int i = 0; i < 100000; i++)
+		object.push_back(static_cast<unsigned char>(i * 7 % 251));
+	auto content = GitusService::CreateContentData(object, GitusService::Blob);
+	auto header = GitusService::CreateHeaderData(GitusService::Blob, object);
+
+	//Act
+	RawData expected;
+	Utils::Sha1(content, expected);
+
+	RawData streamed;
+	Sha1Context sha1;
+	sha1.Update(header);
+	sha1.Update(ByteView(object).Sub(0, 1000));
+	sha1.Update(ByteView(object).Sub(1000, object.size() - 1000));
+	sha1.Final(streamed);
+
+	DeflateContext deflate;
+	deflate.Update(header);
+	deflate.Update(object);
+	auto inflated = Utils::Decompress(deflate.Finish());
+
+	GitusService gitus;
+	RawData hashed;
+	gitus.HashObject(object, GitusService::Blob, false, hashed);
+
+	//Assert
+	BOOST_CHECK(streamed == expected);
+	BOOST_CHECK(hashed == expected);
+	BOOST_CHECK(RawData(inflated.begin(), inflated.end()) == content);
+}
+
+BOOST_AUTO_TEST_CASE(AddLargeFileChunked)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+	gitus->SetChunkThreshold(64 * 1024);
+
+	std::string content;
+	unsigned state = 12345;
+	for (int i = 0; i < 2 * 1024 * 1024; i++)
+	{
+		state = state * 1103515245 + 12345;
+		content.push_back(static_cast<char>(state >> 16));
+	}
+	CreateFile("largeFile.bin", content);
+
+	auto countObjects = [&]() {
+		size_t count = 0;
+		for (boost::filesystem::recursive_directory_iterator it(gitus->ObjectsDirectory()), end; it != end; it++)
+			count += boost::filesystem::is_regular_file(it->path()) ? 1 : 0;
+		return count;
+	};
+
+	//Act
+	RawData first;
+	gitus->HashBlobFile("largeFile.bin", true, first);
+	auto firstCount = countObjects();
+
+	content[content.size() / 2] ^= 0x5a;
+	CreateFile("largeFile.bin", content);
+	AddCommand* add = new AddCommand(gitus, "largeFile.bin");
+	auto res = add->Execute();
+	auto secondCount = countObjects();
+
+	//Assert
+	auto entries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(entries);
+
+	std::string sha1String;
+	Utils::Sha1ToString(entries["largeFile.bin"].sha1, sha1String);
+	GitusService::ObjectHashType type;
+	RawData object;
+	GitusService otherGitus;
+	otherGitus.CacheCurrentGitusDirectory();
+	otherGitus.ReadObject(sha1String, type, object);
+
+	size_t size = 0;
+	otherGitus.ReadObjectHeader(sha1String, type, size);
+
+	auto checkedOut = otherGitus.CheckoutBlob(entries["largeFile.bin"].sha1, "largeFileCopy.bin");
+	RawData copy;
+	Utils::ReadBytes("largeFileCopy.bin", copy);
+
+	BOOST_CHECK(res);
+	BOOST_CHECK(checkedOut);
+	BOOST_CHECK(std::string(copy.begin(), copy.end()) == content);
+	BOOST_CHECK(entries["largeFile.bin"].sha1 != first);
+	BOOST_CHECK(type == GitusService::Blob);
+	BOOST_CHECK_EQUAL(size, content.size());
+	BOOST_CHECK(std::string(object.begin(), object.end()) == content);
+	// The edited chunk (or two when the edit moved a boundary) and the new list
+	BOOST_CHECK_GT(firstCount, 10u);
+	BOOST_CHECK_LE(secondCount - firstCount, 3u);
+
+	CleanUp();
+	DeleteFile("largeFile.bin");
+	DeleteFile("largeFileCopy.bin");
+}
+
+BOOST_AUTO_TEST_CASE(LargeFileStoreCheckout)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+	gitus->SetLargeFileThreshold(64 * 1024);
+
+	std::string content(300 * 1024, 'x');
+	content[1234] = 'y';
+	CreateFile("largeStored.bin", content);
+	CreateFile("smallFile.txt", "small content");
+
+	AddCommand* add = new AddCommand(gitus, std::vector<std::string>{ "largeStored.bin", "smallFile.txt" });
+	add->Execute();
+
+	auto entries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(entries);
+	std::string sha1String;
+	Utils::Sha1ToString(entries["largeStored.bin"].sha1, sha1String);
+	GitusService::ObjectHashType type;
+	RawData pointer;
+	gitus->ReadObject(sha1String, type, pointer);
+
+	std::string oid;
+	uintmax_t size = 0;
+	auto isPointer = GitusService::ParseLargeFilePointer(pointer, oid, size);
+
+	// Only the remote store has the content, as after a clone
+	auto remote = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("gitus-lfs-%%%%");
+	boost::filesystem::rename(gitus->LargeFilesDirectory(), remote);
+	gitus->SetLargeFileRemote(remote);
+	DeleteFile("largeStored.bin");
+	DeleteFile("smallFile.txt");
+
+	//Act
+	CheckoutCommand* checkout = new CheckoutCommand(gitus, std::vector<std::string>());
+	auto res = checkout->Execute();
+
+	//Assert
+	BOOST_CHECK(isPointer);
+	BOOST_CHECK_EQUAL(size, content.size());
+	BOOST_CHECK(res);
+	BOOST_CHECK(Utils::ReadBytes("largeStored.bin") == RawData(content.begin(), content.end()));
+	auto small = Utils::ReadBytes("smallFile.txt");
+	BOOST_CHECK_EQUAL(std::string(small.begin(), small.end()), "small content");
+	BOOST_CHECK(boost::filesystem::exists(gitus->LargeFile(oid)));
+
+	CleanUp();
+	boost::filesystem::remove_all(remote);
+	DeleteFile("largeStored.bin");
+	DeleteFile("smallFile.txt");
+}
+
+BOOST_AUTO_TEST_CASE(AddBulkCheckinPack)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	std::vector<std::string> fileNames;
+	for (size_t i = 0; i < GitusService::BulkCheckinMinObjects + 8; i++)
+	{
+		fileNames.push_back("bulkFile" + std::to_string(i) + ".txt");
+		CreateFile(fileNames.back(), "bulk text " + std::to_string(i));
+	}
+
+	//Act
+	AddCommand* add = new AddCommand(gitus, fileNames);
+	auto res = add->Execute();
+
+	CommitCommand* commit = new CommitCommand(gitus, "bulk", "author", "author@gitus");
+	commit->Execute();
+	FsckCommand* fsck = new FsckCommand(gitus);
+	auto fsckRes = fsck->Execute();
+
+	//Assert
+	size_t looseObjects = 0;
+	for (boost::filesystem::directory_iterator it(gitus->ObjectsDirectory()), end; it != end; it++)
+	{
+		if (it->path().filename() != "pack")
+			looseObjects += std::distance(boost::filesystem::directory_iterator(it->path()), boost::filesystem::directory_iterator());
+	}
+
+	GitusService otherGitus;
+	otherGitus.CacheCurrentGitusDirectory();
+	auto packs = otherGitus.Packs();
+
+	auto entries = std::map<std::string, IndexEntry>();
+	otherGitus.ReadIndex(entries);
+	std::string sha1String;
+	Utils::Sha1ToString(entries["bulkFile42.txt"].sha1, sha1String);
+	GitusService::ObjectHashType type;
+	RawData object;
+	otherGitus.ReadObject(sha1String, type, object);
+
+	BOOST_CHECK(res);
+	BOOST_CHECK(fsckRes);
+	BOOST_REQUIRE_EQUAL(packs.size(), 1u);
+	BOOST_CHECK_EQUAL(packs[0]->Count(), fileNames.size());
+	// Only the tree and the commit
+	BOOST_CHECK_EQUAL(looseObjects, 2u);
+	BOOST_CHECK_EQUAL(std::string(object.begin(), object.end()), "bulk text 42");
+
+	CleanUp();
+	for (auto& fileName : fileNames)
+		DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(AbortBulkCheckinDropsPack)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	//Act
+	gitus->BeginBulkCheckin();
+	RawData sha1;
+	auto hashRes = gitus->HashObject(std::string("aborted text"), GitusService::Blob, true, sha1);
+	gitus->AbortBulkCheckin();
+
+	std::string sha1String;
+	Utils::Sha1ToString(sha1, sha1String);
+
+	//Assert
+	// Neither the pack nor its index is published
+	BOOST_CHECK(hashRes);
+	BOOST_CHECK(boost::filesystem::is_empty(gitus->PacksDirectory()));
+	BOOST_CHECK(!gitus->ObjectExists(sha1String));
+	BOOST_CHECK(gitus->EndBulkCheckin());
+
+	CleanUp();
+}
+
+BOOST_AUTO_TEST_CASE(MultiPackIndexFindsObjectsOfAllPacks)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	// Three packs of 2, 4 and 3 objects, "object 0" is in every pack
+	std::vector<size_t> packSizes = { 2, 4, 3 };
+	std::vector<boost::filesystem::path> packPaths;
+	std::vector<RawData> sha1s;
+	for (size_t p = 0, next = 1; p < packSizes.size(); p++)
+	{
+		PackWriter writer(gitus->PacksDirectory());
+		for (size_t i = 0; i < packSizes[p]; i++)
+		{
+			auto text = "object " + std::to_string(i == 0 ? 0 : next++);
+			auto content = GitusService::CreateContentData(RawData(text.begin(), text.end()), GitusService::Blob);
+			std::string sha1String;
+			RawData sha1;
+			Utils::Sha1String(content, sha1String);
+			Utils::StringToSha1(sha1String, sha1);
+			DeflateContext deflate;
+			deflate.Update(content);
+			writer.Add(sha1, deflate.Finish());
+			if (p == 0 || i != 0)
+				sha1s.push_back(sha1);
+		}
+
+		boost::filesystem::path packPath;
+		writer.Finish(packPath);
+		packPaths.push_back(packPath);
+	}
+
+	//Act
+	auto res = MultiPackIndexCommand(gitus, "write").Execute();
+	auto index = MultiPackIndex::Open(gitus->MultiPackIndexFile());
+
+	size_t found = 0;
+	GitusService reader;
+	reader.CacheCurrentGitusDirectory();
+	for (auto& sha1 : sha1s)
+	{
+		std::string sha1String;
+		Utils::Sha1ToString(sha1, sha1String);
+		GitusService::ObjectHashType type;
+		RawData object;
+		if (reader.ReadObject(sha1String, type, object) && std::string(object.begin(), object.end()).compare(0, 7, "object ") == 0)
+			found++;
+	}
+
+	size_t pack = 0;
+	uint64_t offset;
+	uint32_t length;
+	auto duplicateFound = index && index->Find(sha1s[0], pack, offset, length);
+
+	// Once one of its packs is gone the index is stale, the other packs are still searched
+	boost::filesystem::remove(boost::filesystem::path(packPaths[2]).replace_extension(".idx"));
+	boost::filesystem::remove(packPaths[2]);
+	GitusService staleReader;
+	staleReader.CacheCurrentGitusDirectory();
+	std::string lastSha1String, firstSha1String;
+	Utils::Sha1ToString(sha1s[4], firstSha1String);
+	Utils::Sha1ToString(sha1s.back(), lastSha1String);
+
+	//Assert
+	BOOST_CHECK(res);
+	BOOST_REQUIRE(index);
+	BOOST_CHECK_EQUAL(index->Count(), sha1s.size());
+	BOOST_CHECK_EQUAL(index->PackNames().size(), packSizes.size());
+	BOOST_CHECK_EQUAL(found, sha1s.size());
+	// The largest pack is preferred
+	BOOST_CHECK(duplicateFound);
+	BOOST_CHECK(index->PackPath(pack) == packPaths[1]);
+	BOOST_CHECK(staleReader.ObjectExists(firstSha1String));
+	BOOST_CHECK(!staleReader.ObjectExists(lastSha1String));
+
+	CleanUp();
+}
+
+BOOST_AUTO_TEST_CASE(HashCacheSkipsUnchangedFiles)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	// Files modified within the last second are not cached
+	auto fileName = "cachedFile.txt";
+	CreateFile(fileName, "cached text");
+	auto past = boost::filesystem::last_write_time(fileName) - 60;
+	boost::filesystem::last_write_time(fileName, past);
+
+	RawData sha1;
+	gitus->HashBlobFile(boost::filesystem::absolute(fileName), true, sha1);
+	auto flushRes = gitus->FlushHashCache();
+
+	//Act
+	GitusService otherGitus;
+	otherGitus.CacheCurrentGitusDirectory();
+	Stats::Reset();
+	RawData cachedSha1;
+	auto res = otherGitus.HashBlobFile(boost::filesystem::absolute(fileName), true, cachedSha1);
+	auto bytesHashed = Stats::Get(Stats::BytesHashed);
+	auto hits = Stats::Get(Stats::HashCacheHits);
+
+	CreateFile(fileName, "modified text");
+	boost::filesystem::last_write_time(fileName, past);
+	RawData modifiedSha1;
+	otherGitus.HashBlobFile(boost::filesystem::absolute(fileName), true, modifiedSha1);
+
+	//Assert
+	BOOST_CHECK(flushRes);
+	BOOST_CHECK(boost::filesystem::exists(gitus->HashCacheFile()));
+	BOOST_CHECK(res);
+	BOOST_CHECK(cachedSha1 == sha1);
+	BOOST_CHECK_EQUAL(bytesHashed, 0);
+	BOOST_CHECK_EQUAL(hits, 1);
+	BOOST_CHECK(modifiedSha1 != sha1);
+
+	CleanUp();
+	DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(HashCacheWaitsForBulkCheckin)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	auto fileName = "cachedFile.txt";
+	CreateFile(fileName, "cached text");
+	auto past = boost::filesystem::last_write_time(fileName) - 60;
+	boost::filesystem::last_write_time(fileName, past);
+	HashCache::FileStamp stamp;
+	HashCache::Stat(fileName, stamp);
+
+	//Act
+	gitus->BeginBulkCheckin();
+	RawData sha1;
+	gitus->HashBlobFile(boost::filesystem::absolute(fileName), true, sha1);
+	RawData pendingSha1;
+	auto cachedDuringCheckin = gitus->FileHashCache()->Lookup(stamp, pendingSha1);
+	gitus->EndBulkCheckin();
+
+	//Assert
+	// Until the pack is written, the object the id names is not stored
+	BOOST_CHECK(!sha1.empty());
+	BOOST_CHECK(!cachedDuringCheckin);
+
+	CleanUp();
+	DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(HashCacheDiscardedWithThresholds)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	auto fileName = "cachedFile.txt";
+	CreateFile(fileName, "cached text");
+	auto past = boost::filesystem::last_write_time(fileName) - 60;
+	boost::filesystem::last_write_time(fileName, past);
+
+	RawData sha1;
+	gitus->HashBlobFile(boost::filesystem::absolute(fileName), true, sha1);
+	gitus->FlushHashCache();
+
+	//Act
+	// The file is now stored as a chunk list, the plain blob id no longer applies
+	GitusService otherGitus;
+	otherGitus.CacheCurrentGitusDirectory();
+	otherGitus.SetChunkThreshold(4);
+	Stats::Reset();
+	RawData chunkedSha1;
+	auto res = otherGitus.HashBlobFile(boost::filesystem::absolute(fileName), true, chunkedSha1);
+	auto hits = Stats::Get(Stats::HashCacheHits);
+
+	//Assert
+	BOOST_CHECK(res);
+	BOOST_CHECK_EQUAL(hits, 0);
+	BOOST_CHECK(chunkedSha1 != sha1);
+
+	CleanUp();
+	DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(HashCacheResetBySetThreshold)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	auto fileName = "cachedFile.txt";
+	CreateFile(fileName, "cached text");
+	auto past = boost::filesystem::last_write_time(fileName) - 60;
+	boost::filesystem::last_write_time(fileName, past);
+	HashCache::FileStamp stamp;
+	HashCache::Stat(fileName, stamp);
+
+	RawData sha1;
+	gitus->HashBlobFile(boost::filesystem::absolute(fileName), true, sha1);
+	auto previousCache = gitus->FileHashCache();
+
+	//Act
+	gitus->SetChunkThreshold(4);
+	Stats::Reset();
+	RawData chunkedSha1;
+	auto res = gitus->HashBlobFile(boost::filesystem::absolute(fileName), true, chunkedSha1);
+	auto hits = Stats::Get(Stats::HashCacheHits);
+
+	// The cache handed out before the change stays valid
+	RawData previousSha1;
+	auto previousHit = previousCache->Lookup(stamp, previousSha1);
+
+	//Assert
+	BOOST_CHECK(res);
+	BOOST_CHECK_EQUAL(hits, 0);
+	BOOST_CHECK(chunkedSha1 != sha1);
+	BOOST_CHECK(gitus->FileHashCache() != previousCache);
+	BOOST_CHECK(previousHit);
+	BOOST_CHECK(previousSha1 == sha1);
+
+	CleanUp();
+	DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(IgnoreRulesMatch)
+{
+	//Arrange
+	std::string content = "# build outputs\n*.o\n*.tar.gz\nbuild/\n/TODO\ncmake-build-*\ndoc/**/*.html\n!keep.o\nlib[0-9].a\n";
+	IgnoreRules rules;
+
+	//Act
+	rules.Parse(content);
+
+	//Assert
+	BOOST_CHECK_EQUAL(rules.Count(), 8u);
+	BOOST_CHECK_EQUAL(rules.Match("src/main.o", "main.o", false), IgnoreRules::Excluded);
+	BOOST_CHECK_EQUAL(rules.Match("keep.o", "keep.o", false), IgnoreRules::Included);
+	BOOST_CHECK_EQUAL(rules.Match("dist/a.tar.gz", "a.tar.gz", false), IgnoreRules::Excluded);
+	BOOST_CHECK_EQUAL(rules.Match("a.gz", "a.gz", false), IgnoreRules::None);
+	BOOST_CHECK_EQUAL(rules.Match("src/build", "build", true), IgnoreRules::Excluded);
+	BOOST_CHECK_EQUAL(rules.Match("src/build", "build", false), IgnoreRules::None);
+	BOOST_CHECK_EQUAL(rules.Match("TODO", "TODO", false), IgnoreRules::Excluded);
+	BOOST_CHECK_EQUAL(rules.Match("src/TODO", "TODO", false), IgnoreRules::None);
+	BOOST_CHECK_EQUAL(rules.Match("cmake-build-debug", "cmake-build-debug", true), IgnoreRules::Excluded);
+	BOOST_CHECK_EQUAL(rules.Match("doc/index.html", "index.html", false), IgnoreRules::Excluded);
+	BOOST_CHECK_EQUAL(rules.Match("doc/api/v1/index.html", "index.html", false), IgnoreRules::Excluded);
+	BOOST_CHECK_EQUAL(rules.Match("src/doc/index.html", "index.html", false), IgnoreRules::None);
+	BOOST_CHECK_EQUAL(rules.Match("lib1.a", "lib1.a", false), IgnoreRules::Excluded);
+	BOOST_CHECK_EQUAL(rules.Match("libx.a", "libx.a", false), IgnoreRules::None);
+}
+
+BOOST_AUTO_TEST_CASE(AddDirectoryHonorsGitignore)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	boost::filesystem::create_directories("addDir/src/out");
+	boost::filesystem::create_directories("addDir/build/obj");
+	CreateFile("addDir/.gitignore", "build/\n*.log\n");
+	CreateFile("addDir/src/.gitignore", "out/\n!debug.log\n");
+	CreateFile("addDir/src/main.cpp", "int main() {}");
+	CreateFile("addDir/src/debug.log", "kept by the nested rules");
+	CreateFile("addDir/src/run.log", "ignored");
+	CreateFile("addDir/src/out/main.o", "ignored");
+	CreateFile("addDir/build/obj/main.o", "ignored");
+
+	//Act
+	Stats::Reset();
+	AddCommand* add = new AddCommand(gitus, "addDir");
+	auto res = add->Execute();
+	auto readdirs = Stats::Get(Stats::ReaddirCalls);
+
+	//Assert
+	auto entries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(entries);
+	std::vector<std::string> paths;
+	for (auto& entry : entries)
+		paths.push_back(entry.first);
+
+	std::vector<std::string> expected = { "addDir/.gitignore", "addDir/src/.gitignore", "addDir/src/debug.log", "addDir/src/main.cpp" };
+	BOOST_CHECK(res);
+	BOOST_CHECK(paths == expected);
+	// The excluded directories are not listed
+	BOOST_CHECK_EQUAL(readdirs, 2);
+
+	CleanUp();
+	boost::filesystem::remove_all("addDir");
+}
+
+BOOST_AUTO_TEST_CASE(StatusReportsChanges)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	CreateFile("statusA.txt", "a");
+	CreateFile("statusB.txt", "b");
+	std::vector<std::string> committed = { "statusA.txt", "statusB.txt" };
+	AddCommand* add = new AddCommand(gitus, committed);
+	add->Execute();
+	CommitCommand* commit = new CommitCommand(gitus, "status", "author", "author@gitus");
+	commit->Execute();
+
+	DeleteFile("statusA.txt");
+	CreateFile("statusB.txt", "b changed");
+	CreateFile("statusC.txt", "untracked");
+	CreateFile("statusD.txt", "d");
+	AddCommand* addNew = new AddCommand(gitus, "statusD.txt");
+	addNew->Execute();
+
+	//Act
+	std::stringstream out;
+	auto res = StatusCommand(gitus, out).Execute();
+	auto output = out.str();
+
+	//Assert
+	BOOST_CHECK(res);
+	BOOST_CHECK(output.find("Changes to be committed:\n\tnew file:   statusD.txt\n\n") != std::string::npos);
+	BOOST_CHECK(output.find("Changes not staged for commit:\n\tdeleted:    statusA.txt\n\tmodified:   statusB.txt\n\n") != std::string::npos);
+	BOOST_CHECK(output.find("\tstatusC.txt\n") != std::string::npos);
+	BOOST_CHECK(output.find("\tstatusD.txt\n") == std::string::npos);
+
+	CleanUp();
+	for (auto fileName : { "statusB.txt", "statusC.txt", "statusD.txt" })
+		DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(SparseCheckoutCollapsesIndex)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	boost::filesystem::create_directories("sparse/app/src");
+	boost::filesystem::create_directories("sparse/vendor/lib");
+	boost::filesystem::create_directories("sparse/docs");
+	std::vector<std::string> fileNames = { "sparse/top.txt", "sparse/app/src/main.cpp", "sparse/app/README", "sparse/vendor/lib/lib.cpp", "sparse/docs/guide.md" };
+	for (auto& fileName : fileNames)
+		CreateFile(fileName, "content of " + fileName);
+
+	AddCommand* add = new AddCommand(gitus, fileNames);
+	add->Execute();
+	CommitCommand* commit = new CommitCommand(gitus, "full", "author", "author@gitus");
+	commit->Execute();
+
+	//Act
+	auto res = SparseCheckoutCommand(gitus, "set", { "sparse/app/src" }).Execute();
+
+	auto sparseEntries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(sparseEntries);
+	std::vector<std::string> sparsePaths;
+	for (auto& entry : sparseEntries)
+		sparsePaths.push_back(entry.first);
+
+	std::stringstream status;
+	StatusCommand(gitus, status).Execute();
+	auto vendorRemoved = !boost::filesystem::exists("sparse/vendor");
+
+	// A file added below a collapsed directory expands it
+	boost::filesystem::create_directories("sparse/docs");
+	CreateFile("sparse/docs/new.md", "new");
+	AddCommand* addSparse = new AddCommand(gitus, "sparse/docs/new.md");
+	addSparse->Execute();
+	auto expandedEntries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(expandedEntries);
+
+	auto disableRes = SparseCheckoutCommand(gitus, "disable", {}).Execute();
+	auto fullEntries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(fullEntries);
+
+	//Assert
+	std::vector<std::string> expected = { "sparse/app/README", "sparse/app/src/main.cpp", "sparse/docs/", "sparse/top.txt", "sparse/vendor/" };
+	BOOST_CHECK(res);
+	BOOST_CHECK(sparsePaths == expected);
+	BOOST_CHECK(sparseEntries["sparse/vendor/"].IsSparseDirectory());
+	BOOST_CHECK(vendorRemoved);
+	BOOST_CHECK(status.str().find("nothing to commit, working tree clean") != std::string::npos);
+	BOOST_CHECK_EQUAL(expandedEntries.count("sparse/docs/"), 0u);
+	BOOST_CHECK_EQUAL(expandedEntries.count("sparse/docs/guide.md"), 1u);
+	BOOST_CHECK_EQUAL(expandedEntries.count("sparse/vendor/"), 1u);
+	BOOST_CHECK(disableRes);
+	BOOST_CHECK_EQUAL(fullEntries.size(), fileNames.size() + 1);
+	BOOST_CHECK(boost::filesystem::exists("sparse/vendor/lib/lib.cpp"));
+	BOOST_CHECK(!boost::filesystem::exists(gitus->SparseCheckoutFile()));
+
+	CleanUp();
+	boost::filesystem::remove_all("sparse");
+}
+
+BOOST_AUTO_TEST_CASE(CloneLinksObjectsAndChecksOut)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	boost::filesystem::create_directories("origin/src");
+	std::vector<std::string> fileNames = { "origin/README", "origin/src/main.cpp", "origin/src/util.cpp" };
+	for (auto& fileName : fileNames)
+		CreateFile(fileName, "content of " + fileName);
+
+	AddCommand* add = new AddCommand(gitus, fileNames);
+	add->Execute();
+	CommitCommand* commit = new CommitCommand(gitus, "origin", "author", "author@gitus");
+	commit->Execute();
+
+	auto gitusDirectory = gitus->ObjectsDirectory().parent_path();
+
+	//Act
+	// The service of the command stays on its repository, the clone is opened apart
+	auto res = CloneCommand(gitus, ".", "cloneDest").Execute();
+	auto existingRes = CloneCommand(std::shared_ptr<GitusService>(new GitusService), ".", "cloneDest").Execute();
+	auto clone = std::shared_ptr<GitusService>(new GitusService);
+	clone->SetGitusDirectory(boost::filesystem::absolute("cloneDest/.git"));
+
+	auto entries = std::map<std::string, IndexEntry>();
+	clone->ReadIndex(entries);
+
+	std::string content;
+	std::ifstream ifs("cloneDest/origin/src/main.cpp");
+	std::getline(ifs, content);
+
+	RawData sourceMaster, cloneMaster;
+	gitus->ResolveReference("refs/heads/master", sourceMaster);
+	clone->ResolveReference("refs/heads/master", cloneMaster);
+	auto objectPath = GetFileObjPath("origin/README");
+
+	//Assert
+	BOOST_CHECK(res);
+	BOOST_CHECK(!existingRes);
+	BOOST_CHECK(gitus->ObjectsDirectory().parent_path() == gitusDirectory);
+	BOOST_CHECK_EQUAL(entries.size(), fileNames.size());
+	BOOST_CHECK_EQUAL(content, "content of origin/src/main.cpp");
+	BOOST_CHECK(!cloneMaster.empty() && cloneMaster == sourceMaster);
+	BOOST_CHECK(boost::filesystem::exists(clone->ObjectsDirectory() / objectPath.parent_path().filename() / objectPath.filename()));
+	BOOST_CHECK(boost::filesystem::hard_link_count(objectPath) >= 2);
+
+	ifs.close();
+	CleanUp();
+	boost::filesystem::remove_all("origin");
+	boost::filesystem::remove_all("cloneDest");
+}
+
+BOOST_AUTO_TEST_CASE(CheckoutReportsCorruptObject)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	auto fileName = "corruptFile.txt";
+	CreateFile(fileName, "corrupt text");
+	auto objectPath = GetFileObjPath(fileName);
+	AddCommand* add = new AddCommand(gitus, fileName);
+	add->Execute();
+	boost::filesystem::ofstream{ objectPath } << "corrupted";
+
+	auto entries = std::map<std::string, IndexEntry>();
+	gitus->ReadIndex(entries);
+	std::vector<const IndexEntry*> selected{ &entries[fileName] };
+
+	//Act
+	// The object fails to inflate, the checkout fails rather than the process
+	size_t updated = 0;
+	std::string failed;
+	auto res = gitus->CheckoutEntries(selected, updated, failed);
+
+	//Assert
+	BOOST_CHECK(!res);
+	BOOST_CHECK_EQUAL(updated, 0u);
+	BOOST_CHECK_EQUAL(failed, fileName);
+
+	CleanUp();
+	DeleteFile(fileName);
+}
+
+BOOST_AUTO_TEST_CASE(FetchAndPushTransferOnlyNewObjects)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	boost::filesystem::create_directories("transfer");
+	std::vector<std::string> fileNames = { "transfer/a.txt", "transfer/b.txt" };
+	for (auto& fileName : fileNames)
+		CreateFile(fileName, "content of " + fileName);
+
+	AddCommand* add = new AddCommand(gitus, fileNames);
+	add->Execute();
+	CommitCommand* commit = new CommitCommand(gitus, "first", "author", "author@gitus");
+	commit->Execute();
+
+	auto mirror = std::shared_ptr<GitusService>(new GitusService);
+	CloneCommand(mirror, ".", "mirror.git", true).Execute();
+	mirror->SetGitusDirectory(boost::filesystem::absolute("mirror.git"));
+	auto downstream = std::shared_ptr<GitusService>(new GitusService);
+	CloneCommand(downstream, "mirror.git", "downstream").Execute();
+	downstream->SetGitusDirectory(boost::filesystem::absolute("downstream/.git"));
+
+	auto packedObjects = [](GitusService& service) {
+		size_t count = 0;
+		for (auto& pack : service.Packs())
+			count += pack->Count();
+		return count;
+	};
+
+	CreateFile("transfer/a.txt", "new content");
+	AddCommand* addChange = new AddCommand(gitus, "transfer/a.txt");
+	addChange->Execute();
+	CommitCommand* commitChange = new CommitCommand(gitus, "second", "author", "author@gitus");
+	commitChange->Execute();
+
+	//Act
+	auto pushRes = PushCommand(gitus, "mirror.git").Execute();
+	auto pushAgainRes = PushCommand(gitus, "mirror.git").Execute();
+	auto pushWorkTreeRes = PushCommand(gitus, "downstream").Execute();
+	auto fetchRes = FetchCommand(downstream, "origin").Execute();
+
+	RawData master, mirrorMaster, tracking;
+	GitusService::ReadReference(gitus->MasterFile(), master);
+	GitusService::ReadReference(mirror->MasterFile(), mirrorMaster);
+	GitusService::ReadReference(downstream->RemoteTrackingFile("origin", "master"), tracking);
+
+	//Assert
+	BOOST_CHECK(pushRes);
+	BOOST_CHECK(pushAgainRes);
+	BOOST_CHECK(!pushWorkTreeRes);
+	BOOST_CHECK(fetchRes);
+	BOOST_CHECK(!master.empty() && mirrorMaster == master);
+	BOOST_CHECK(tracking == master);
+	// The new commit, its tree and the changed file
+	BOOST_CHECK_EQUAL(packedObjects(*mirror), 3u);
+	BOOST_CHECK_EQUAL(packedObjects(*downstream), 3u);
+
+	CleanUp();
+	boost::filesystem::remove_all("transfer");
+	boost::filesystem::remove_all("mirror.git");
+	boost::filesystem::remove_all("downstream");
+}
+
+BOOST_AUTO_TEST_CASE(FetchAndPushFollowHeadBranch)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+	gitus->WriteHead("topic");
+
+	auto fileName = "topicFile.txt";
+	CreateFile(fileName, "topic text");
+	AddCommand* add = new AddCommand(gitus, fileName);
+	add->Execute();
+	CommitCommand* commit = new CommitCommand(gitus, "first", "author", "author@gitus");
+	commit->Execute();
+
+	auto mirror = std::shared_ptr<GitusService>(new GitusService);
+	CloneCommand(mirror, ".", "mirror.git", true).Execute();
+	mirror->SetGitusDirectory(boost::filesystem::absolute("mirror.git"));
+	auto downstream = std::shared_ptr<GitusService>(new GitusService);
+	CloneCommand(downstream, "mirror.git", "downstream").Execute();
+	downstream->SetGitusDirectory(boost::filesystem::absolute("downstream/.git"));
+
+	CreateFile(fileName, "new topic text");
+	AddCommand* addChange = new AddCommand(gitus, fileName);
+	addChange->Execute();
+	CommitCommand* commitChange = new CommitCommand(gitus, "second", "author", "author@gitus");
+	commitChange->Execute();
+
+	//Act
+	auto pushRes = PushCommand(gitus, "mirror.git").Execute();
+	auto fetchRes = FetchCommand(downstream, "origin").Execute();
+
+	RawData topic, mirrorTopic, mirrorMaster, tracking;
+	gitus->ResolveReference("refs/heads/topic", topic);
+	mirror->ResolveReference("refs/heads/topic", mirrorTopic);
+	mirror->ResolveReference("refs/heads/master", mirrorMaster);
+	downstream->ResolveReference(GitusService::RemoteTrackingReference("origin", "topic"), tracking);
+
+	//Assert
+	BOOST_CHECK(pushRes);
+	BOOST_CHECK(fetchRes);
+	BOOST_CHECK(!topic.empty() && mirrorTopic == topic);
+	BOOST_CHECK(mirrorMaster.empty());
+	BOOST_CHECK(tracking == topic);
+
+	CleanUp();
+	DeleteFile(fileName);
+	boost::filesystem::remove_all("mirror.git");
+	boost::filesystem::remove_all("downstream");
+}
+
+BOOST_AUTO_TEST_CASE(RepackStoresVersionsAsDeltas)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	// Three versions of a file, each one a line longer
+	boost::filesystem::create_directories("repack");
+	std::string text;
+	for (int i = 0; i < 200; i++)
+		text += "line " + std::to_string(i) + " of the notes\n";
+
+	std::vector<std::string> versions;
+	for (int version = 0; version < 3; version++)
+	{
+		text += "change " + std::to_string(version) + "\n";
+		versions.push_back(text);
+		CreateFile("repack/notes.txt", text);
+		AddCommand(gitus, "repack/notes.txt").Execute();
+		CommitCommand(gitus, "version " + std::to_string(version), "author", "author@gitus").Execute();
+	}
+
+	uintmax_t looseBytes = 0;
+	for (boost::filesystem::recursive_directory_iterator it(gitus->ObjectsDirectory()), end; it != end; it++)
+	{
+		if (boost::filesystem::is_regular_file(it->path()))
+			looseBytes += boost::filesystem::file_size(it->path());
+	}
+
+	Repacker::Options options;
+	options.threads = 1;
+
+	//Act
+	auto res = RepackCommand(gitus, options).Execute();
+	auto packs = gitus->Packs();
+	auto firstPack = packs.empty() ? boost::filesystem::path() : packs[0]->PackPath();
+
+	// The same objects give the same pack, whatever the number of threads
+	options.threads = 4;
+	size_t objects = 0, deltas = 0;
+	boost::filesystem::path packPath;
+	auto againRes = Repacker::Repack(*gitus, options, objects, deltas, packPath);
+
+	GitusService reader;
+	reader.CacheCurrentGitusDirectory();
+	std::vector<std::string> readBack;
+	bool headersMatch = true;
+	RawData master;
+	GitusService::ReadReference(reader.MasterFile(), master);
+	for (size_t i = 0; i < versions.size(); i++)
+	{
+		std::string sha1String;
+		GitusService::ObjectHashType type;
+		RawData commit, tree, object;
+		std::vector<RawData> parents;
+		std::vector<TreeEntry> entries;
+		Utils::Sha1ToString(master, sha1String);
+		if (!reader.ReadObject(sha1String, type, commit) || !GitusService::ParseCommit(commit, tree, parents)
+			|| !reader.ReadTree(tree, "", entries) || entries.size() != 1)
+			break;
+
+		Utils::Sha1ToString(entries[0].sha1, sha1String);
+		reader.ReadObject(sha1String, type, object);
+		// The header of a delta comes from its base and the delta sizes
+		GitusService::ObjectHashType headerType;
+		size_t headerSize = 0;
+		headersMatch = headersMatch && reader.ReadObjectHeader(sha1String, headerType, headerSize)
+			&& headerType == GitusService::Blob && headerSize == object.size();
+		readBack.insert(readBack.begin(), std::string(object.begin(), object.end()));
+		master = parents.empty() ? RawData() : parents[0];
+	}
+
+	auto fsckRes = FsckCommand(gitus).Execute();
+
+	//Assert
+	BOOST_CHECK(res);
+	BOOST_CHECK(againRes);
+	BOOST_REQUIRE_EQUAL(packs.size(), 1u);
+	BOOST_CHECK(packPath.filename() == firstPack.filename());
+	BOOST_CHECK_EQUAL(gitus->Packs().size(), 1u);
+	// 3 commits, 3 trees and 3 blobs, the older versions of the file are deltas
+	BOOST_CHECK_EQUAL(objects, 9u);
+	BOOST_CHECK_EQUAL(deltas, 2u);
+	BOOST_CHECK_LT(boost::filesystem::file_size(packPath), looseBytes);
+	BOOST_CHECK(readBack == versions);
+	BOOST_CHECK(headersMatch);
+	BOOST_CHECK(fsckRes);
+
+	CleanUp();
+	boost::filesystem::remove_all("repack");
+}
+
+BOOST_AUTO_TEST_CASE(BranchesResolveFromPackedRefs)
+{
+	//Arrange
+	auto gitus = std::shared_ptr<GitusService>(new GitusService);
+	InitCommand* init = new InitCommand(gitus);
+	init->Execute();
+
+	CreateFile("branch.txt", "first");
+	AddCommand(gitus, "branch.txt").Execute();
+	CommitCommand(gitus, "first", "author", "author@gitus").Execute();
+	RawData first;
+	gitus->LocalMasterHash(first);
+
+	//Act
+	auto topicRes = BranchCommand(gitus, "topic").Execute();
+	auto nestedRes = BranchCommand(gitus, "feature/a", "topic").Execute();
+	auto existingRes = BranchCommand(gitus, "topic").Execute();
+	auto conflictRes = BranchCommand(gitus, "feature").Execute();
+	auto invalidRes = BranchCommand(gitus, "bad..name").Execute();
+
+	// Many short-lived branches, all packed
+	for (int i = 0; i < 300; i++)
+		gitus->UpdateReference("refs/heads/tmp/" + std::to_string(i), first);
+	auto packRes = PackRefsCommand(gitus).Execute();
+	auto topicLoose = boost::filesystem::exists(gitus->HeadsDirectory() / "topic");
+
+	size_t resolved = 0;
+	for (int i = 0; i < 300; i++)
+	{
+		RawData sha1;
+		if (gitus->ResolveReference("refs/heads/tmp/" + std::to_string(i), sha1) && sha1 == first)
+			resolved++;
+	}
+	RawData missing;
+	gitus->ResolveReference("refs/heads/tmp/300", missing);
+
+	// A commit updates the loose file of the branch, which hides its packed line
+	CreateFile("branch.txt", "second");
+	AddCommand(gitus, "branch.txt").Execute();
+	CommitCommand(gitus, "second", "author", "author@gitus").Execute();
+	RawData second, master;
+	gitus->LocalMasterHash(second);
+	gitus->ResolveReference("refs/heads/master", master);
+
+	auto deleteRes = BranchCommand(gitus, "topic", "", true).Execute();
+	auto deleteCurrentRes = BranchCommand(gitus, "master", "", true).Execute();
+	RawData topic;
+	gitus->ResolveReference("refs/heads/topic", topic);
+	std::map<std::string, RawData> branches;
+	gitus->ListReferences("refs/heads/", branches);
+
+	auto headContent = Utils::ReadBytes(gitus->HeadFile().string());
+
+	//Assert
+	BOOST_CHECK(topicRes);
+	BOOST_CHECK(nestedRes);
+	BOOST_CHECK(!existingRes);
+	BOOST_CHECK(!conflictRes);
+	BOOST_CHECK(!invalidRes);
+	BOOST_CHECK(packRes);
+	BOOST_CHECK(!topicLoose);
+	BOOST_CHECK_EQUAL(resolved, 300u);
+	BOOST_CHECK(missing.empty());
+	BOOST_CHECK(!second.empty() && second != first);
+	BOOST_CHECK(master == second);
+	BOOST_CHECK(deleteRes);
+	BOOST_CHECK(!deleteCurrentRes);
+	BOOST_CHECK(topic.empty());
+	BOOST_CHECK_EQUAL(branches.size(), 302u);
+	BOOST_CHECK(branches["refs/heads/feature/a"] == first);
+	BOOST_CHECK(std::string(headContent.begin(), headContent.end()) == "ref: refs/heads/master\n");
+
+	CleanUp();
+	DeleteFile("branch.txt");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 void CleanUp() {
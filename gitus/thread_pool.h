@@ -0,0 +1,126 @@
+#ifndef GITUS_THREAD_POOL_H
+#define GITUS_THREAD_POOL_H
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+#include "arena.h"
+
+
+// Fixed size pool of worker threads consuming a shared queue of tasks
+class ThreadPool {
+
+private:
+	std::vector<std::thread> _workers;
+	std::queue<std::function<void()>> _tasks;
+
+	std::mutex _mutex;
+	std::condition_variable _taskAvailable;
+	std::condition_variable _tasksDone;
+
+	// Number of tasks queued or currently running
+	size_t _pending = 0;
+	bool _stopping = false;
+
+	void Work()
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_taskAvailable.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+				if (_tasks.empty())
+					return;
+
+				task = std::move(_tasks.front());
+				_tasks.pop();
+			}
+
+			{
+				// Scratch buffers of the task are released in bulk when it ends
+				ArenaScope arena;
+				task();
+			}
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (--_pending == 0)
+				_tasksDone.notify_all();
+		}
+	}
+
+public:
+
+	// Use as many threads as there are cores when 'numThreads' is 0
+	ThreadPool(size_t numThreads = 0)
+	{
+		if (numThreads == 0)
+			numThreads = DefaultThreadCount();
+
+		for (size_t i = 0; i < numThreads; i++)
+		{
+			_workers.emplace_back([this] { Work(); });
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+
+		_taskAvailable.notify_all();
+		for (auto& worker : _workers)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	static size_t DefaultThreadCount()
+	{
+		auto count = std::thread::hardware_concurrency();
+		return count == 0 ? 1 : count;
+	}
+
+	size_t Size() const
+	{
+		return _workers.size();
+	}
+
+	// Tasks must not throw, catch inside the task if needed
+	void Enqueue(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_tasks.push(std::move(task));
+			_pending++;
+		}
+
+		_taskAvailable.notify_one();
+	}
+
+	// Blocks until every queued task has completed
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_tasksDone.wait(lock, [this] { return _pending == 0; });
+	}
+
+	// Returns true if every queued task completed before the timeout
+	template<class Rep, class Period>
+	bool WaitFor(const std::chrono::duration<Rep, Period>& timeout)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		return _tasksDone.wait_for(lock, timeout, [this] { return _pending == 0; });
+	}
+};
+
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef GITUS_TRACE_H
+#define GITUS_TRACE_H
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstdint>
+
+
+// Timing spans around the phases of a command
+//
+// Enabled with '--timings', '--trace-output <file>' or the GITUS_TRACE environment variable.
+// When the output is a '.json' file, spans are written in the Chrome trace event format
+// (load it in chrome://tracing or https://ui.perfetto.dev), otherwise a summary table
+// is printed on the standard error.
+// When disabled, a span only costs a relaxed atomic load.
+class Trace {
+
+private:
+	struct Event
+	{
+		const char* name;
+		int64_t start;
+		int64_t duration;
+		size_t thread;
+	};
+
+	std::atomic<bool> _enabled{ false };
+	std::string _output;
+
+	std::mutex _mutex;
+	std::vector<Event> _events;
+	std::map<std::thread::id, size_t> _threads;
+	std::chrono::steady_clock::time_point _origin = std::chrono::steady_clock::now();
+
+	static Trace& Instance()
+	{
+		static Trace trace;
+		return trace;
+	}
+
+	void WriteChromeTrace(std::ostream& out)
+	{
+		out << "{\"traceEvents\":[";
+		for (size_t i = 0; i < _events.size(); i++)
+		{
+			auto& event = _events[i];
+			out << (i == 0 ? "" : ",") << "\n"
+				<< "{\"name\":\"" << event.name << "\",\"cat\":\"gitus\",\"ph\":\"X\""
+				<< ",\"ts\":" << event.start << ",\"dur\":" << event.duration
+				<< ",\"pid\":1,\"tid\":" << event.thread << "}";
+		}
+		out << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+	}
+
+	void WriteSummary(std::ostream& out)
+	{
+		struct Summary
+		{
+			const char* name;
+			size_t count = 0;
+			int64_t total = 0;
+			int64_t max = 0;
+		};
+
+		std::map<std::string, Summary> summaries;
+		for (auto& event : _events)
+		{
+			auto& summary = summaries[event.name];
+			summary.name = event.name;
+			summary.count++;
+			summary.total += event.duration;
+			summary.max = std::max(summary.max, event.duration);
+		}
+
+		std::vector<Summary> sorted;
+		for (auto& summary : summaries)
+			sorted.push_back(summary.second);
+		std::sort(sorted.begin(), sorted.end(), [](const Summary& a, const Summary& b) { return a.total > b.total; });
+
+		out << std::left << std::setw(44) << "span" << std::right
+			<< std::setw(10) << "count" << std::setw(14) << "total (ms)"
+			<< std::setw(14) << "mean (ms)" << std::setw(14) << "max (ms)" << std::endl;
+		out << std::fixed << std::setprecision(3);
+		for (auto& summary : sorted)
+		{
+			out << std::left << std::setw(44) << summary.name << std::right
+				<< std::setw(10) << summary.count
+				<< std::setw(14) << summary.total / 1000.0
+				<< std::setw(14) << summary.total / 1000.0 / summary.count
+				<< std::setw(14) << summary.max / 1000.0 << std::endl;
+		}
+	}
+
+public:
+
+	static bool Enabled()
+	{
+		return Instance()._enabled.load(std::memory_order_relaxed);
+	}
+
+	// An empty output or one not ending with '.json' prints a summary table
+	static void Enable(const std::string& output)
+	{
+		auto& trace = Instance();
+		std::lock_guard<std::mutex> lock(trace._mutex);
+		trace._output = output;
+		trace._enabled.store(true, std::memory_order_relaxed);
+	}
+
+	static void EnableFromEnvironment()
+	{
+		auto output = std::getenv("GITUS_TRACE");
+		if (output != nullptr && *output != 0 && std::string(output) != "0")
+			Enable(output);
+	}
+
+	static int64_t Now()
+	{
+		using namespace std::chrono;
+		return duration_cast<microseconds>(steady_clock::now() - Instance()._origin).count();
+	}
+
+	static void Record(const char* name, int64_t start, int64_t end)
+	{
+		auto& trace = Instance();
+		std::lock_guard<std::mutex> lock(trace._mutex);
+		auto thread = trace._threads.emplace(std::this_thread::get_id(), trace._threads.size()).first->second;
+		trace._events.push_back({ name, start, end - start, thread });
+	}
+
+	// Writes the recorded spans to the configured output
+	static void Flush()
+	{
+		auto& trace = Instance();
+		if (!Enabled())
+			return;
+
+		std::lock_guard<std::mutex> lock(trace._mutex);
+		auto& output = trace._output;
+		auto isJson = output.size() > 5 && output.compare(output.size() - 5, 5, ".json") == 0;
+		if (isJson)
+		{
+			std::ofstream ofs(output);
+			trace.WriteChromeTrace(ofs);
+		}
+		else
+		{
+			trace.WriteSummary(std::cerr);
+		}
+
+		trace._events.clear();
+	}
+};
+
+// Records the lifetime of the scope as a span
+class TraceScope {
+
+private:
+	const char* _name;
+	int64_t _start;
+	bool _active;
+
+public:
+	// 'name' must outlive the trace, use string literals
+	TraceScope(const char* name)
+	{
+		_name = name;
+		_active = Trace::Enabled();
+		_start = _active ? Trace::Now() : 0;
+	}
+
+	~TraceScope()
+	{
+		if (_active)
+			Trace::Record(_name, _start, Trace::Now());
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#define GITUS_TRACE_CONCAT_(a, b) a##b
+#define GITUS_TRACE_CONCAT(a, b) GITUS_TRACE_CONCAT_(a, b)
+#define GITUS_TRACE_SCOPE(name) TraceScope GITUS_TRACE_CONCAT(gitusTraceScope, __LINE__)(name)
+
+
+#endif
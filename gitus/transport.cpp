@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <unordered_set>
+
+#include "transport.h"
+#include "pack.h"
+#include "trace.h"
+
+
+namespace {
+
+	const size_t Sha1Size = 20;
+
+	bool ReadCommit(GitusService& gitus, const RawData& sha1, RawData& tree, std::vector<RawData>& parents)
+	{
+		std::string sha1String;
+		GitusService::ObjectHashType type;
+		RawData object;
+		return Utils::Sha1ToString(sha1, sha1String) && gitus.ReadObject(sha1String, type, object)
+			&& type == GitusService::Commit && GitusService::ParseCommit(object, tree, parents);
+	}
+
+	// Adds 'tree' and the objects below it to 'seen', and to 'objects' unless already seen
+	// 'files' maps the paths of the blobs to their ids: all of them without 'objects', the new ones otherwise.
+	bool CollectTree(GitusService& gitus, const RawData& tree, const std::string& prefix, std::set<std::string>& seen,
+		std::vector<std::string>* objects, std::map<std::string, std::string>& files)
+	{
+		using namespace std;
+
+		string sha1String;
+		Utils::Sha1ToString(tree, sha1String);
+		if (!seen.insert(sha1String).second)
+			return true;
+
+		if (objects != nullptr)
+			objects->push_back(sha1String);
+
+		vector<TreeEntry> entries;
+		if (!gitus.ReadTree(tree, prefix, entries))
+			return false;
+
+		for (auto& entry : entries)
+		{
+			// The directories collapsed by a sparse index are trees
+			if (entry.mode.n == IndexEntry::SparseDirectoryMode)
+			{
+				if (!CollectTree(gitus, entry.sha1, entry.path + "/", seen, objects, files))
+					return false;
+				continue;
+			}
+
+			Utils::Sha1ToString(entry.sha1, sha1String);
+			if (objects == nullptr)
+				files[entry.path] = sha1String;
+
+			if (!seen.insert(sha1String).second || objects == nullptr)
+				continue;
+
+			objects->push_back(sha1String);
+			files[entry.path] = sha1String;
+		}
+
+		return true;
+	}
+
+	// The chunks of a chunk list, nothing for another object
+	bool ReadChunks(ByteView compressed, std::vector<ChunkEntry>& chunks)
+	{
+		static const std::string chunksName = GitusService::TypeName(GitusService::Chunks);
+
+		auto prefix = Utils::DecompressPrefix(compressed, chunksName.size());
+		if (!std::equal(chunksName.begin(), chunksName.end(), prefix.begin(), prefix.end()))
+			return true;
+
+		GitusService::ObjectHashType type;
+		RawData object;
+		auto content = Utils::Decompress(compressed);
+		return GitusService::ParseContentData(content, type, object) && GitusService::ParseChunks(object, chunks);
+	}
+}
+
+
+//--- UploadPack
+
+bool UploadPack::Advertise(std::map<std::string, RawData>& references)
+{
+	references.clear();
+	return _gitus.ListReferences("refs/heads/", references);
+}
+
+void UploadPack::Acknowledge(const std::vector<RawData>& haves, std::vector<RawData>& acknowledged)
+{
+	std::string sha1String;
+	for (auto& have : haves)
+	{
+		if (Utils::Sha1ToString(have, sha1String) && _gitus.ObjectExists(sha1String))
+			acknowledged.push_back(have);
+	}
+}
+
+bool UploadPack::SendPack(const std::vector<RawData>& wants, const std::vector<RawData>& common, GitusService& receiver,
+	size_t& sent, size_t& reused)
+{
+	using namespace std;
+	using namespace boost;
+	GITUS_TRACE_SCOPE("UploadPack::SendPack");
+
+	sent = 0;
+	reused = 0;
+
+	// The receiver has the common commits, and the trees and files of the common commits themselves
+	set<string> seen;
+	map<string, string> commonFiles;
+	string sha1String;
+	RawData tree;
+	vector<RawData> parents;
+	for (auto& commit : common)
+	{
+		parents.clear();
+		if (!ReadCommit(_gitus, commit, tree, parents) || !CollectTree(_gitus, tree, "", seen, nullptr, commonFiles))
+			return false;
+
+		Utils::Sha1ToString(commit, sha1String);
+		seen.insert(sha1String);
+	}
+
+	// The history of the wanted commits down to the common ones, then their trees
+	vector<string> objects;
+	vector<RawData> trees;
+	deque<RawData> queue(wants.begin(), wants.end());
+	while (!queue.empty())
+	{
+		auto commit = queue.front();
+		queue.pop_front();
+		Utils::Sha1ToString(commit, sha1String);
+		if (!seen.insert(sha1String).second)
+			continue;
+
+		parents.clear();
+		if (!ReadCommit(_gitus, commit, tree, parents))
+			return false;
+
+		objects.push_back(sha1String);
+		trees.push_back(tree);
+		queue.insert(queue.end(), parents.begin(), parents.end());
+	}
+
+	map<string, string> files;
+	for (auto& wantedTree : trees)
+	{
+		if (!CollectTree(_gitus, wantedTree, "", seen, &objects, files))
+			return false;
+	}
+
+	map<string, string> paths;
+	for (auto& file : files)
+		paths[file.second] = file.first;
+
+	// A pack whose objects are all sent is linked as is
+	unordered_set<string> linked;
+	{
+		unordered_set<string> wanted(objects.begin(), objects.end());
+		for (auto& pack : _gitus.Packs())
+		{
+			bool complete = pack->Count() != 0;
+			for (size_t i = 0; complete && i < pack->Count(); i++)
+				complete = Utils::Sha1ToString(pack->Sha1(i), sha1String) && wanted.count(sha1String) != 0;
+
+			if (!complete)
+				continue;
+
+			auto packPath = pack->PackPath();
+			auto indexPath = filesystem::path(packPath).replace_extension(".idx");
+			auto destination = receiver.PacksDirectory() / packPath.filename();
+			filesystem::create_directories(receiver.PacksDirectory());
+
+			// The index last, a reader never finds an index without its pack
+			Stats::Add(Stats::StatCalls);
+			if (!filesystem::exists(destination)
+				&& (!GitusService::LinkOrCopyFile(packPath, destination)
+					|| !GitusService::LinkOrCopyFile(indexPath, receiver.PacksDirectory() / indexPath.filename())))
+				continue;
+
+			for (size_t i = 0; i < pack->Count(); i++)
+			{
+				Utils::Sha1ToString(pack->Sha1(i), sha1String);
+				linked.insert(sha1String);
+			}
+			reused += pack->Count();
+		}
+	}
+
+	// The other objects are copied deflated, as stored by the sender
+	PackWriter writer(receiver.PacksDirectory());
+	RawData sha1;
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		auto isLinked = linked.count(objects[i]) != 0;
+		auto path = paths.find(objects[i]);
+		if (isLinked && path == paths.end())
+			continue;
+
+		ScratchData compressed;
+		if (!_gitus.ReadObjectData(objects[i], compressed))
+			return false;
+
+		// The chunks of a new version of a large file, but those of the common version
+		vector<ChunkEntry> chunks;
+		if (path != paths.end() && !ReadChunks(compressed, chunks))
+			return false;
+
+		if (!chunks.empty())
+		{
+			auto commonFile = commonFiles.find(path->second);
+			if (commonFile != commonFiles.end())
+			{
+				GitusService::ObjectHashType type;
+				RawData object;
+				vector<ChunkEntry> commonChunks;
+				if (_gitus.ReadObjectFile(commonFile->second, type, object) && type == GitusService::Chunks
+					&& GitusService::ParseChunks(object, commonChunks))
+				{
+					for (auto& chunk : commonChunks)
+					{
+						Utils::Sha1ToString(chunk.sha1, sha1String);
+						seen.insert(sha1String);
+					}
+				}
+			}
+
+			for (auto& chunk : chunks)
+			{
+				Utils::Sha1ToString(chunk.sha1, sha1String);
+				if (seen.insert(sha1String).second)
+					objects.push_back(sha1String);
+			}
+		}
+
+		if (isLinked)
+			continue;
+
+		if (!Utils::StringToSha1(objects[i], sha1) || !writer.Add(sha1, compressed))
+			return false;
+		sent++;
+	}
+
+	filesystem::path packPath;
+	if (!writer.Finish(packPath))
+		return false;
+
+	receiver.InvalidatePacks();
+	return true;
+}
+
+
+//--- Transport
+
+bool Transport::Negotiate(GitusService& local, const std::vector<RawData>& tips, UploadPack& upload,
+	std::vector<RawData>& common, size_t& rounds)
+{
+	using namespace std;
+	GITUS_TRACE_SCOPE("Transport::Negotiate");
+
+	common.clear();
+	rounds = 0;
+
+	// The commits to list, newest first, and the ancestors of the acknowledged ones
+	deque<RawData> queue;
+	set<RawData> queued;
+	set<RawData> known;
+	for (auto& tip : tips)
+	{
+		if (tip.size() == Sha1Size && queued.insert(tip).second)
+			queue.push_back(tip);
+	}
+
+	auto roundSize = FirstRoundHaves;
+	size_t inVain = 0;
+	RawData tree;
+	vector<RawData> parents;
+	while (!queue.empty() && (common.empty() || inVain < MaxHavesInVain))
+	{
+		vector<RawData> haves;
+		while (!queue.empty() && haves.size() < roundSize)
+		{
+			auto commit = queue.front();
+			queue.pop_front();
+
+			// The history of the local repository may end there
+			parents.clear();
+			if (!ReadCommit(local, commit, tree, parents))
+				continue;
+
+			auto isKnown = known.count(commit) != 0;
+			for (auto& parent : parents)
+			{
+				if (isKnown)
+					known.insert(parent);
+				if (queued.insert(parent).second)
+					queue.push_back(parent);
+			}
+
+			if (!isKnown)
+				haves.push_back(commit);
+		}
+
+		if (haves.empty())
+			continue;
+
+		rounds++;
+		vector<RawData> acknowledged;
+		upload.Acknowledge(haves, acknowledged);
+		inVain = acknowledged.empty() ? inVain + haves.size() : 0;
+		for (auto& commit : acknowledged)
+		{
+			common.push_back(commit);
+			parents.clear();
+			ReadCommit(local, commit, tree, parents);
+			known.insert(parents.begin(), parents.end());
+		}
+
+		if (roundSize < MaxRoundHaves)
+			roundSize *= 2;
+	}
+
+	return true;
+}
+
+bool Transport::IsAncestor(GitusService& gitus, const RawData& ancestor, const RawData& commit)
+{
+	using namespace std;
+
+	deque<RawData> queue{ commit };
+	set<RawData> visited;
+	RawData tree;
+	vector<RawData> parents;
+	while (!queue.empty())
+	{
+		auto current = queue.front();
+		queue.pop_front();
+		if (current == ancestor)
+			return true;
+
+		parents.clear();
+		if (!visited.insert(current).second || !ReadCommit(gitus, current, tree, parents))
+			continue;
+
+		queue.insert(queue.end(), parents.begin(), parents.end());
+	}
+
+	return false;
+}
@@ -0,0 +1,57 @@
+#ifndef GITUS_TRANSPORT_H
+#define GITUS_TRANSPORT_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gitus_service.h"
+
+
+// The sending side of a transfer between two repositories of the local file system, which stands for
+// the remote process of a network transport: the receiving side only learns its references and
+// negotiates with it in have/want rounds (see 'Transport::Negotiate').
+//
+// The objects reachable from the wanted commits and not from the common ones are written to a single
+// pack, straight into the pack directory of the receiver. Objects are copied deflated, as the sender
+// stores them, and a pack of the sender whose objects are all needed is linked rather than rewritten.
+class UploadPack {
+
+private:
+	GitusService& _gitus;
+
+public:
+	explicit UploadPack(GitusService& gitus) : _gitus(gitus) {}
+
+	// The branches and their commits ("refs/heads/<name>"), nothing for a repository without commits
+	bool Advertise(std::map<std::string, RawData>& references);
+
+	// One round of the negotiation: the commits of 'haves' the repository has
+	void Acknowledge(const std::vector<RawData>& haves, std::vector<RawData>& acknowledged);
+
+	// Sends the objects of the commits 'wants' which are not in the commits 'common' to 'receiver'
+	// 'sent' counts the objects written to the new pack, 'reused' those of the linked packs.
+	bool SendPack(const std::vector<RawData>& wants, const std::vector<RawData>& common, GitusService& receiver,
+		size_t& sent, size_t& reused);
+};
+
+class Transport {
+
+public:
+	// The first round lists this many commits, every round doubles it up to 'MaxRoundHaves'
+	static const size_t FirstRoundHaves = 16;
+	static const size_t MaxRoundHaves = 256;
+	// Once a commit is acknowledged, the negotiation ends after this many commits without acknowledgement
+	static const size_t MaxHavesInVain = 256;
+
+	// Finds the commits 'local' has in common with 'upload', walking the history of 'tips' newest
+	// first. The ancestors of an acknowledged commit are common as well, they are not listed.
+	static bool Negotiate(GitusService& local, const std::vector<RawData>& tips, UploadPack& upload,
+		std::vector<RawData>& common, size_t& rounds);
+
+	// Whether 'commit' is 'ancestor' or one of its descendants, 'gitus' having the history of 'commit'
+	static bool IsAncestor(GitusService& gitus, const RawData& ancestor, const RawData& commit);
+};
+
+
+#endif
@@ -15,6 +15,13 @@
 #include <boost/iostreams/filter/zlib.hpp>
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include "arena.h"
+#include "stats.h"
+#include "trace.h"
 
 
 // 16, and 32 bit
@@ -37,94 +44,228 @@ typedef std::vector<unsigned char> RawData;
 
 #define SUBSTR(data, pos, len) RawData(data.begin()+pos, data.begin()+pos+len)
 
-
-class Utils {
+// Non-owning view of contiguous bytes ('RawData', 'ScratchData', 'std::string', ...)
+// The viewed buffer must outlive the view, the view never copies it.
+class ByteView {
 
 private:
+	const unsigned char* _data = nullptr;
+	size_t _size = 0;
+
 public:
+	ByteView() = default;
 
-	// Returns SHA1 as binrary
-	static bool Sha1(RawData object, RawData& shaHash)
+	ByteView(const void* data, size_t size) : _data(static_cast<const unsigned char*>(data)), _size(size) {}
+
+	template <typename Data>
+	ByteView(const Data& data) : _data(reinterpret_cast<const unsigned char*>(data.data())), _size(data.size()) {}
+
+	const unsigned char* data() const { return _data; }
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	unsigned char operator[](size_t pos) const { return _data[pos]; }
+
+	const unsigned char* begin() const { return _data; }
+	const unsigned char* end() const { return _data + _size; }
+
+	ByteView Sub(size_t pos, size_t length) const
+	{
+		return ByteView(_data + pos, length);
+	}
+};
+
+// Incremental SHA1, so that the header and the content of an object are hashed without
+// being concatenated first
+class Sha1Context {
+
+private:
+	boost::uuids::detail::sha1 _sha1;
+
+public:
+	void Update(ByteView data)
 	{
-		using namespace std;
+		Stats::Add(Stats::BytesHashed, data.size());
+		_sha1.process_bytes(data.data(), data.size());
+	}
 
-		boost::uuids::detail::sha1 sha1;
-		sha1.process_bytes(object.data(), sizeof(char)*object.size());
+	// Appends the 20 bytes of the digest to 'shaHash', the context cannot be updated afterwards
+	void Final(RawData& shaHash)
+	{
 		unsigned int hash[5];
-		sha1.get_digest(hash);
-		
+		_sha1.get_digest(hash);
+
 		for (int i = 0; i < 5; i++)
 		{
 			Word2 val; val.n = hash[i];
-			copy(&val.c[0], &val.c[4], back_inserter(shaHash));
+			std::copy(&val.c[0], &val.c[4], std::back_inserter(shaHash));
 		}
+	}
+};
+
+// Incremental zlib deflate, same output as 'Utils::Compress' of the concatenated buffers
+class DeflateContext {
+
+private:
+	std::string _compressed;
+	boost::iostreams::filtering_ostream _out;
+
+public:
+	DeflateContext()
+	{
+		_out.push(boost::iostreams::zlib_compressor());
+		_out.push(boost::iostreams::back_inserter(_compressed));
+	}
+
+	DeflateContext(const DeflateContext&) = delete;
+	DeflateContext& operator=(const DeflateContext&) = delete;
+
+	void Update(ByteView data)
+	{
+		Stats::Add(Stats::BytesDeflated, data.size());
+		_out.write(reinterpret_cast<const char*>(data.data()), data.size());
+	}
+
+	// Flushes the stream, the context cannot be updated afterwards
+	std::string Finish()
+	{
+		_out.reset();
+		return std::move(_compressed);
+	}
+};
+
+
+class Utils {
 
+private:
+public:
+
+	// Returns SHA1 as binrary
+	static bool Sha1(ByteView object, RawData& shaHash)
+	{
+		GITUS_TRACE_SCOPE("Utils::Sha1");
+
+		Sha1Context sha1;
+		sha1.Update(object);
+		sha1.Final(shaHash);
 		return true;
 	};
 
-
 	// Returns SHA1 as Hex string
-	static bool Sha1String(RawData object, std::string& sha)
+	static bool Sha1String(ByteView object, std::string& sha)
 	{
-		using namespace std;
-
-		boost::uuids::detail::sha1 sha1;
+		GITUS_TRACE_SCOPE("Utils::Sha1String");
 
-		// I use data() to disregard the null terminated char
-		sha1.process_bytes(object.data(), sizeof(char)*object.size());
+		RawData shaHash;
+		Sha1(object, shaHash);
+		return Sha1ToString(shaHash, sha);
+	};
 
-		unsigned int hash[5];
-		sha1.get_digest(hash);
+	// Converts a binary SHA1 (as returned by 'Sha1') to the hex string returned by 'Sha1String'
+	static bool Sha1ToString(ByteView shaHash, std::string& sha)
+	{
+		if (shaHash.size() < 20)
+			return false;
 
 		std::stringstream ss;
 		for (int i = 0; i < 5; i++)
-		{	
-			ss << std::hex << hash[i];
+		{
+			Word2 val;
+			std::copy(shaHash.begin() + i * 4, shaHash.begin() + i * 4 + 4, val.c);
+			ss << std::hex << std::setw(8) << std::setfill('0') << val.n;
 		}
 
 		sha = ss.str();
 		return true;
-	};
+	}
+
+	// Converts a hex string (as returned by 'Sha1String') to a binary SHA1
+	static bool StringToSha1(const std::string& sha, RawData& shaHash)
+	{
+		if (sha.size() != 40 || sha.find_first_not_of("0123456789abcdef") != std::string::npos)
+			return false;
+
+		shaHash.clear();
+		for (int i = 0; i < 5; i++)
+		{
+			Word2 val; val.n = std::stoul(sha.substr(i * 8, 8), nullptr, 16);
+			std::copy(&val.c[0], &val.c[4], std::back_inserter(shaHash));
+		}
+
+		return true;
+	}
 
 	// Compression code from
 // https://stackoverflow.com/questions/27529570/simple-zlib-c-string-compression-and-decompression
-	static std::string Compress(const RawData& data)
+	static std::string Compress(ByteView data)
 	{
-		using namespace boost::iostreams;
+		GITUS_TRACE_SCOPE("Utils::Compress");
 
-		std::stringstream compressed;
-		std::stringstream decompressed;
-		decompressed << data.data();
-		filtering_streambuf<input> out;
-		out.push(zlib_compressor());
-		out.push(decompressed);
-		copy(out, compressed);
-		return compressed.str();
+		DeflateContext deflate;
+		deflate.Update(data);
+		return deflate.Finish();
 	}
 
-	static std::string Decompress(const RawData& data)
+	// Read in place rather than copied to a stream, the data may also contain null chars
+	static std::string Decompress(ByteView data)
 	{
 		using namespace boost::iostreams;
+		GITUS_TRACE_SCOPE("Utils::Decompress");
 
-		std::stringstream compressed;
 		std::stringstream decompressed;
-		compressed << data.data();
 		filtering_streambuf<input> in;
 		in.push(zlib_decompressor());
-		in.push(compressed);
+		in.push(array_source(reinterpret_cast<const char*>(data.data()), data.size()));
 		copy(in, decompressed);
-		return decompressed.str();
+
+		auto inflated = decompressed.str();
+		Stats::Add(Stats::BytesInflated, inflated.size());
+		return inflated;
+	}
+
+	// Inflates at most 'maxLength' bytes, used to peek at headers without inflating everything
+	static RawData DecompressPrefix(ByteView data, size_t maxLength)
+	{
+		using namespace boost::iostreams;
+
+		filtering_streambuf<input> in;
+		in.push(zlib_decompressor());
+		in.push(array_source(reinterpret_cast<const char*>(data.data()), data.size()));
+
+		RawData prefix(maxLength);
+		auto length = in.sgetn(reinterpret_cast<char*>(prefix.data()), maxLength);
+		prefix.resize(length < 0 ? 0 : length);
+		Stats::Add(Stats::BytesInflated, prefix.size());
+		return prefix;
 	}
 
 	static RawData ReadBytes(std::string filename)
 	{
-		std::ifstream ifs(filename, std::ios::binary);
-		RawData content(
-			(std::istreambuf_iterator<char>(ifs)),
-			(std::istreambuf_iterator<char>()));
+		RawData content;
+		ReadBytes(filename, content);
 		return content;
 	}
 
+	// Sized once from the length of the file instead of growing while reading
+	template <typename Data>
+	static bool ReadBytes(const std::string& filename, Data& content)
+	{
+		GITUS_TRACE_SCOPE("Utils::ReadBytes");
+		std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+		Stats::Add(Stats::OpenCalls);
+		content.clear();
+		if (!ifs)
+			return false;
+
+		auto size = static_cast<std::streamoff>(ifs.tellg());
+		ifs.seekg(0);
+		content.resize(size > 0 ? static_cast<size_t>(size) : 0);
+		ifs.read(reinterpret_cast<char*>(content.data()), content.size());
+		content.resize(static_cast<size_t>(ifs.gcount()));
+
+		Stats::Add(Stats::BytesRead, content.size());
+		return true;
+	}
+
 	//static std::string ReadFile(std::string filename)
 	//{
 	//	std::ifstream ifs(filename);
@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "walker.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+
+namespace {
+
+#ifdef __linux__
+	// Layout of the records returned by getdents64, not declared by glibc
+	struct LinuxDirent64
+	{
+		uint64_t d_ino;
+		int64_t d_off;
+		unsigned short d_reclen;
+		unsigned char d_type;
+		char d_name[1];
+	};
+
+	// An open directory, closed once its subdirectories have been opened
+	struct DirectoryHandle
+	{
+		int fd;
+
+		DirectoryHandle(int descriptor) : fd(descriptor) {}
+
+		~DirectoryHandle()
+		{
+			::close(fd);
+		}
+	};
+#else
+	struct DirectoryHandle
+	{
+	};
+#endif
+
+	struct Task
+	{
+		// Relative to the work tree
+		std::string path;
+		// Name in the parent directory
+		std::string name;
+		std::shared_ptr<DirectoryHandle> parent;
+		IgnoreMatcher::FramePtr frame;
+	};
+
+	struct Entry
+	{
+		std::string name;
+		bool isDirectory;
+	};
+
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		std::vector<std::string> files;
+	};
+
+	class WalkState {
+
+	private:
+		const boost::filesystem::path& _workTree;
+		const IgnoreMatcher& _matcher;
+		std::vector<std::unique_ptr<Worker>> _workers;
+
+		// Tasks queued or running, the walk is over when it drops to 0
+		std::atomic<size_t> _pending;
+
+		// The entries of the directory, and its descriptor for the subdirectories
+		std::shared_ptr<DirectoryHandle> ReadDirectory(Task& task, std::vector<Entry>& entries)
+		{
+			using namespace std;
+			Stats::Add(Stats::ReaddirCalls);
+
+#ifdef __linux__
+			auto fd = -1;
+			if (task.parent)
+				fd = ::openat(task.parent->fd, task.name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+
+			// Out of descriptors: the parent is kept open for its other subdirectories
+			if (fd < 0)
+				fd = ::open((_workTree / task.path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+			task.parent.reset();
+			Stats::Add(Stats::OpenCalls);
+			if (fd < 0)
+				return nullptr;
+
+			auto handle = make_shared<DirectoryHandle>(fd);
+			char buffer[32 * 1024];
+			while (true)
+			{
+				auto length = ::syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+				if (length <= 0)
+					break;
+
+				for (long offset = 0; offset < length;)
+				{
+					auto record = reinterpret_cast<LinuxDirent64*>(buffer + offset);
+					offset += record->d_reclen;
+
+					auto name = record->d_name;
+					if ((name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) || strcmp(name, ".git") == 0)
+						continue;
+
+					auto type = record->d_type;
+					struct stat status;
+					if (type == DT_UNKNOWN)
+					{
+						Stats::Add(Stats::StatCalls);
+						if (::fstatat(fd, name, &status, AT_SYMLINK_NOFOLLOW) != 0)
+							continue;
+						type = S_ISDIR(status.st_mode) ? DT_DIR : S_ISREG(status.st_mode) ? DT_REG : S_ISLNK(status.st_mode) ? DT_LNK : DT_UNKNOWN;
+					}
+
+					// Symbolic links to files are added, links to directories are not followed
+					if (type == DT_LNK)
+					{
+						Stats::Add(Stats::StatCalls);
+						if (::fstatat(fd, name, &status, 0) != 0 || !S_ISREG(status.st_mode))
+							continue;
+						type = DT_REG;
+					}
+
+					if (type == DT_DIR || type == DT_REG)
+						entries.push_back(Entry{ name, type == DT_DIR });
+				}
+			}
+
+			return handle;
+#else
+			boost::system::error_code ec;
+			for (boost::filesystem::directory_iterator it(_workTree / task.path, ec), end; !ec && it != end; it.increment(ec))
+			{
+				auto name = it->path().filename().string();
+				if (name == ".git")
+					continue;
+
+				boost::system::error_code statusError;
+				auto isDirectory = boost::filesystem::is_directory(it->symlink_status(statusError));
+				if (isDirectory || boost::filesystem::is_regular_file(it->status(statusError)))
+					entries.push_back(Entry{ name, isDirectory });
+			}
+
+			return make_shared<DirectoryHandle>();
+#endif
+		}
+
+		void Process(Task& task, Worker& worker)
+		{
+			using namespace std;
+
+			vector<Entry> entries;
+			auto handle = ReadDirectory(task, entries);
+			if (!handle)
+				return;
+
+			// The '.gitignore' of the directory applies to all of its entries
+			auto hasIgnoreFile = any_of(entries.begin(), entries.end(), [](const Entry& entry) {
+				return !entry.isDirectory && entry.name == ".gitignore";
+			});
+			auto frame = _matcher.Enter(task.frame, task.path, hasIgnoreFile);
+
+			vector<Task> subdirectories;
+			for (auto& entry : entries)
+			{
+				auto path = task.path.empty() ? entry.name : task.path + "/" + entry.name;
+				if (_matcher.IsIgnored(frame, path, entry.isDirectory))
+					continue;
+
+				if (entry.isDirectory)
+					subdirectories.push_back(Task{ move(path), move(entry.name), handle, frame });
+				else
+					worker.files.push_back(move(path));
+			}
+
+			if (subdirectories.empty())
+				return;
+
+			_pending += subdirectories.size();
+			lock_guard<mutex> lock(worker.mutex);
+			for (auto& subdirectory : subdirectories)
+				worker.tasks.push_back(move(subdirectory));
+		}
+
+		bool Take(size_t self, Task& task)
+		{
+			{
+				auto& worker = *_workers[self];
+				std::lock_guard<std::mutex> lock(worker.mutex);
+				if (!worker.tasks.empty())
+				{
+					task = std::move(worker.tasks.back());
+					worker.tasks.pop_back();
+					return true;
+				}
+			}
+
+			for (size_t i = 1; i < _workers.size(); i++)
+			{
+				auto& victim = *_workers[(self + i) % _workers.size()];
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (!victim.tasks.empty())
+				{
+					task = std::move(victim.tasks.front());
+					victim.tasks.pop_front();
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		void Work(size_t self)
+		{
+			ArenaScope arena;
+			size_t idle = 0;
+			while (_pending != 0)
+			{
+				Task task;
+				if (!Take(self, task))
+				{
+					// Another worker is listing a directory, its subdirectories may come soon
+					if (++idle < 64)
+						std::this_thread::yield();
+					else
+						std::this_thread::sleep_for(std::chrono::microseconds(50));
+					continue;
+				}
+
+				idle = 0;
+				Process(task, *_workers[self]);
+				_pending--;
+			}
+		}
+
+	public:
+		WalkState(const boost::filesystem::path& workTree, const IgnoreMatcher& matcher, size_t threadCount)
+			: _workTree(workTree), _matcher(matcher), _pending(0)
+		{
+			for (size_t i = 0; i < threadCount; i++)
+				_workers.emplace_back(new Worker);
+		}
+
+		void Run(const IgnoreMatcher::FramePtr& frame, const std::string& directory, std::vector<std::string>& files)
+		{
+			_pending = 1;
+			_workers[0]->tasks.push_back(Task{ directory, std::string(), nullptr, frame });
+
+			// The calling thread is the first worker
+			std::vector<std::thread> threads;
+			for (size_t i = 1; i < _workers.size(); i++)
+				threads.emplace_back([this, i] { Work(i); });
+
+			Work(0);
+			for (auto& thread : threads)
+				thread.join();
+
+			for (auto& worker : _workers)
+				files.insert(files.end(), std::make_move_iterator(worker->files.begin()), std::make_move_iterator(worker->files.end()));
+			std::sort(files.begin(), files.end());
+		}
+	};
+}
+
+void TreeWalker::Walk(const boost::filesystem::path& workTree, const IgnoreMatcher& matcher, const IgnoreMatcher::FramePtr& frame,
+	const std::string& directory, std::vector<std::string>& files, size_t threadCount)
+{
+	GITUS_TRACE_SCOPE("TreeWalker::Walk");
+
+	if (threadCount == 0)
+		threadCount = ThreadPool::DefaultThreadCount();
+
+	WalkState walk(workTree, matcher, threadCount);
+	walk.Run(frame, directory, files);
+}
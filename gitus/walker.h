@@ -0,0 +1,31 @@
+#ifndef GITUS_WALKER_H
+#define GITUS_WALKER_H
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "ignore.h"
+
+
+// Parallel walk of the files of a work tree
+//
+// Every directory is a task. On Linux its entries are read in large batches with getdents64 from
+// a descriptor opened relative to its parent (openat), and their type comes from the listing, so
+// entries are only stat'ed when the file system does not report it. The subdirectories found are
+// pushed on the deque of the worker: it takes its newest tasks first, depth first while its
+// descriptors are warm, and idle workers steal the oldest tasks of the others, the largest subtrees.
+class TreeWalker {
+
+public:
+	// Files below 'directory' (relative to 'workTree' with '/' separators, "" for the work tree),
+	// skipping '.git' and the paths excluded by 'matcher'. 'frame' holds the rules of the directories
+	// above 'directory', see 'IgnoreMatcher::EnterParents'.
+	// 'files' are relative to the work tree and sorted. Uses every core when 'threadCount' is 0.
+	static void Walk(const boost::filesystem::path& workTree, const IgnoreMatcher& matcher, const IgnoreMatcher::FramePtr& frame,
+		const std::string& directory, std::vector<std::string>& files, size_t threadCount = 0);
+};
+
+
+#endif